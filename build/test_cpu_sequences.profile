@@ -0,0 +1,5 @@
+# Opcode/mode sequence profile (software-cpu profile-seq)
+instructions 21
+pair 1 11 29  # MOV.IMM ADD.IMM
+pair 10 29 6a  # ADD.IMM JMP.DIR
+triple 1 11 29 6a  # MOV.IMM ADD.IMM JMP.DIR
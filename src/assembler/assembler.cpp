@@ -1,5 +1,6 @@
 #include "assembler.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
@@ -537,10 +538,137 @@ std::string error_at_line(int line_num, const std::string &message) {
   return message;
 }
 
+// Reads the source map JSON the assemble command writes: an array of flat
+// objects with number, string and number-array values
+class SourceMapReader {
+public:
+  explicit SourceMapReader(const std::string &text) : text_(text) {}
+
+  bool read(std::vector<SourceMapEntry> &map) {
+    if (!accept('[')) {
+      return false;
+    }
+    if (accept(']')) {
+      return at_end();
+    }
+    do {
+      SourceMapEntry entry{0, 0, "", {}};
+      if (!read_entry(entry)) {
+        return false;
+      }
+      map.push_back(std::move(entry));
+    } while (accept(','));
+    return accept(']') && at_end();
+  }
+
+private:
+  bool read_entry(SourceMapEntry &entry) {
+    if (!accept('{')) {
+      return false;
+    }
+    do {
+      std::string key;
+      if (!read_string(key) || !accept(':')) {
+        return false;
+      }
+      long value = 0;
+      bool ok;
+      if (key == "address") {
+        ok = read_number(value) && value >= 0 && value <= 0xFFFF;
+        entry.address = static_cast<uint16_t>(value);
+      } else if (key == "line") {
+        ok = read_number(value);
+        entry.line_number = static_cast<int>(value);
+      } else if (key == "source") {
+        ok = read_string(entry.source_line);
+      } else if (key == "bytes") {
+        ok = accept('[');
+        if (ok && !accept(']')) {
+          do {
+            ok = read_number(value) && value >= 0 && value <= 0xFF;
+            entry.bytes.push_back(static_cast<uint8_t>(value));
+          } while (ok && accept(','));
+          ok = ok && accept(']');
+        }
+      } else {
+        ok = false;
+      }
+      if (!ok) {
+        return false;
+      }
+    } while (accept(','));
+    return accept('}');
+  }
+
+  bool read_string(std::string &value) {
+    if (!accept('"')) {
+      return false;
+    }
+    value.clear();
+    while (pos_ < text_.size() && text_[pos_] != '"') {
+      char c = text_[pos_++];
+      if (c == '\\') {
+        if (pos_ == text_.size()) {
+          return false;
+        }
+        char escaped = text_[pos_++];
+        c = escaped == 'n' ? '\n' : escaped == 'r' ? '\r'
+            : escaped == 't' ? '\t' : escaped;
+      }
+      value.push_back(c);
+    }
+    return pos_++ < text_.size();
+  }
+
+  bool read_number(long &value) {
+    skip_space();
+    size_t start = pos_;
+    if (pos_ < text_.size() && text_[pos_] == '-') {
+      ++pos_;
+    }
+    while (pos_ < text_.size() &&
+           std::isdigit(static_cast<unsigned char>(text_[pos_]))) {
+      ++pos_;
+    }
+    if (pos_ == start || (text_[start] == '-' && pos_ == start + 1)) {
+      return false;
+    }
+    try {
+      value = std::stol(text_.substr(start, pos_ - start));
+    } catch (const std::exception &) {
+      return false;
+    }
+    return true;
+  }
+
+  void skip_space() {
+    while (pos_ < text_.size() &&
+           std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+      ++pos_;
+    }
+  }
+  bool accept(char c) {
+    skip_space();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+  bool at_end() {
+    skip_space();
+    return pos_ == text_.size();
+  }
+
+  const std::string &text_;
+  size_t pos_ = 0;
+};
+
 } // namespace
 
 std::vector<std::uint8_t> assemble(const std::string &source,
-                                   std::vector<SourceMapEntry> *out_map) {
+                                   std::vector<SourceMapEntry> *out_map,
+                                   std::vector<SymbolEntry> *out_symbols) {
   std::istringstream iss(source);
   std::string raw_line;
 
@@ -817,5 +945,22 @@ std::vector<std::uint8_t> assemble(const std::string &source,
     }
   }
 
+  if (out_symbols) {
+    for (const auto &symbol : symbols) {
+      out_symbols->push_back({symbol.first, symbol.second});
+    }
+    std::sort(out_symbols->begin(), out_symbols->end(),
+              [](const SymbolEntry &a, const SymbolEntry &b) {
+                return a.address != b.address ? a.address < b.address
+                                              : a.name < b.name;
+              });
+  }
+
   return bytes;
 }
+
+bool parse_source_map(const std::string &text,
+                      std::vector<SourceMapEntry> &map) {
+  map.clear();
+  return SourceMapReader(text).read(map);
+}
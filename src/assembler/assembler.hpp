@@ -12,9 +12,23 @@ struct SourceMapEntry {
   std::vector<std::uint8_t> bytes;
 };
 
+// A label and the address it names
+struct SymbolEntry {
+  std::string name;
+  std::uint16_t address;
+};
+
 // Assemble a small subset of the Phase 1 ISA.
 // Returns little-endian bytes of the resulting machine code.
 // If out_map is provided, it will be populated with source mapping info.
+// If out_symbols is provided, it receives every label, ordered by address.
 std::vector<std::uint8_t>
 assemble(const std::string &source,
-         std::vector<SourceMapEntry> *out_map = nullptr);
+         std::vector<SourceMapEntry> *out_map = nullptr,
+         std::vector<SymbolEntry> *out_symbols = nullptr);
+
+// Parse the source map JSON the assemble command writes back into
+// entries. Returns false if the text is malformed or a value does not fit
+// its field.
+bool parse_source_map(const std::string &text,
+                      std::vector<SourceMapEntry> &map);
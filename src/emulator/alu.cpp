@@ -1,47 +1,88 @@
 #include "alu.hpp"
 #include "registers.hpp"
 
-ALU::ALU() {
-  // Constructor - no initialization needed
-}
+ALU::ALU() : lazy_flags_(true) {}
 
 uint16_t ALU::execute(Operation op, uint16_t operand_a, uint16_t operand_b,
                       Registers &registers) {
-  uint16_t result = 0;
-
   switch (op) {
   case Operation::ADD:
+    return execute<Operation::ADD>(operand_a, operand_b, registers);
+  case Operation::SUB:
+    return execute<Operation::SUB>(operand_a, operand_b, registers);
+  case Operation::CMP:
+    return execute<Operation::CMP>(operand_a, operand_b, registers);
+  case Operation::AND:
+    return execute<Operation::AND>(operand_a, operand_b, registers);
+  case Operation::OR:
+    return execute<Operation::OR>(operand_a, operand_b, registers);
+  case Operation::XOR:
+    return execute<Operation::XOR>(operand_a, operand_b, registers);
+  case Operation::SHL:
+    return execute<Operation::SHL>(operand_a, operand_b, registers);
+  case Operation::SHR:
+    return execute<Operation::SHR>(operand_a, operand_b, registers);
+  }
+
+  return 0;
+}
+
+template <ALU::Operation Op>
+uint16_t ALU::execute(uint16_t operand_a, uint16_t operand_b,
+                      Registers &registers) {
+  uint16_t result = 0;
+
+  if (lazy_flags_) {
+    using Source = Registers::FlagSource;
+    if constexpr (Op == Operation::ADD) {
+      result = add(operand_a, operand_b);
+      registers.set_lazy_flags(Source::ADD, operand_a, operand_b, result);
+    } else if constexpr (Op == Operation::SUB || Op == Operation::CMP) {
+      result = subtract(operand_a, operand_b);
+      registers.set_lazy_flags(Source::SUB, operand_a, operand_b, result);
+      if constexpr (Op == Operation::CMP) {
+        return operand_a;
+      }
+    } else if constexpr (Op == Operation::AND) {
+      result = bitwise_and(operand_a, operand_b);
+      registers.set_lazy_flags(Source::LOGIC, operand_a, operand_b, result);
+    } else if constexpr (Op == Operation::OR) {
+      result = bitwise_or(operand_a, operand_b);
+      registers.set_lazy_flags(Source::LOGIC, operand_a, operand_b, result);
+    } else if constexpr (Op == Operation::XOR) {
+      result = bitwise_xor(operand_a, operand_b);
+      registers.set_lazy_flags(Source::LOGIC, operand_a, operand_b, result);
+    } else if constexpr (Op == Operation::SHL) {
+      result = shift_left(operand_a, operand_b);
+      registers.set_lazy_flags(Source::SHL, operand_a, operand_b, result);
+    } else {
+      result = shift_right(operand_a, operand_b);
+      registers.set_lazy_flags(Source::SHR, operand_a, operand_b, result);
+    }
+    return result;
+  }
+
+  if constexpr (Op == Operation::ADD) {
     result = add(operand_a, operand_b);
     update_flags_arithmetic(result, operand_a, operand_b, false, registers);
-    break;
-
-  case Operation::SUB:
+  } else if constexpr (Op == Operation::SUB) {
     result = subtract(operand_a, operand_b);
     update_flags_arithmetic(result, operand_a, operand_b, true, registers);
-    break;
-
-  case Operation::CMP:
+  } else if constexpr (Op == Operation::CMP) {
     result = subtract(operand_a, operand_b);
     update_flags_arithmetic(result, operand_a, operand_b, true, registers);
     // For CMP, we return the original operand_a (result is discarded)
     return operand_a;
-
-  case Operation::AND:
+  } else if constexpr (Op == Operation::AND) {
     result = bitwise_and(operand_a, operand_b);
     update_flags_logical(result, registers);
-    break;
-
-  case Operation::OR:
+  } else if constexpr (Op == Operation::OR) {
     result = bitwise_or(operand_a, operand_b);
     update_flags_logical(result, registers);
-    break;
-
-  case Operation::XOR:
+  } else if constexpr (Op == Operation::XOR) {
     result = bitwise_xor(operand_a, operand_b);
     update_flags_logical(result, registers);
-    break;
-
-  case Operation::SHL: {
+  } else if constexpr (Op == Operation::SHL) {
     // For shifts, operand_b is the shift amount
     bool carry_out = false;
     if (operand_b > 0 && operand_b <= 16) {
@@ -49,23 +90,35 @@ uint16_t ALU::execute(Operation op, uint16_t operand_a, uint16_t operand_b,
     }
     result = shift_left(operand_a, operand_b);
     update_flags_shift(result, carry_out, registers);
-    break;
-  }
-
-  case Operation::SHR: {
+  } else if constexpr (Op == Operation::SHR) {
     bool carry_out = false;
     if (operand_b > 0 && operand_b <= 16) {
       carry_out = (operand_a & (1 << (operand_b - 1))) != 0;
     }
     result = shift_right(operand_a, operand_b);
     update_flags_shift(result, carry_out, registers);
-    break;
-  }
   }
 
   return result;
 }
 
+template uint16_t ALU::execute<ALU::Operation::ADD>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::SUB>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::AND>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::OR>(uint16_t, uint16_t,
+                                                   Registers &);
+template uint16_t ALU::execute<ALU::Operation::XOR>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::SHL>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::SHR>(uint16_t, uint16_t,
+                                                    Registers &);
+template uint16_t ALU::execute<ALU::Operation::CMP>(uint16_t, uint16_t,
+                                                    Registers &);
+
 uint16_t ALU::add(uint16_t a, uint16_t b) {
   return static_cast<uint16_t>(
       (static_cast<uint32_t>(a) + static_cast<uint32_t>(b)) & 0xFFFF);
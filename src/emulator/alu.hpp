@@ -20,9 +20,21 @@ public:
     };
     
     ALU();
+
+    // Lazy-flags mode (default on): execute() records the operation in
+    // Registers and flags are computed only when they are read. Both modes
+    // produce identical flags.
+    void set_lazy_flags(bool enabled) { lazy_flags_ = enabled; }
+    bool is_lazy_flags() const { return lazy_flags_; }
     
     // Main ALU operation - performs operation and updates flags
     uint16_t execute(Operation op, uint16_t operand_a, uint16_t operand_b, Registers& registers);
+
+    // Same as execute(), with the operation fixed at compile time so callers
+    // that already know the opcode (threaded dispatch) skip the switch.
+    // Instantiated for every Operation in alu.cpp.
+    template <Operation Op>
+    uint16_t execute(uint16_t operand_a, uint16_t operand_b, Registers& registers);
     
     // Individual operations (without flag updates)
     uint16_t add(uint16_t a, uint16_t b);
@@ -47,4 +59,6 @@ private:
     bool calculate_carry_sub(uint16_t a, uint16_t b);
     bool calculate_overflow_add(uint16_t a, uint16_t b, uint16_t result);
     bool calculate_overflow_sub(uint16_t a, uint16_t b, uint16_t result);
+
+    bool lazy_flags_;
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include "block_cache.hpp"
+#include "memory.hpp"
+#include <algorithm>
+
+namespace {
+constexpr uint32_t REGION_SIZE =
+    Memory::PROGRAM_END - Memory::PROGRAM_START + 1;
+constexpr uint32_t PAGE_SHIFT = 8;
+} // namespace
+
+BlockCache::BlockCache()
+    : by_pc_(REGION_SIZE, nullptr), covered_(REGION_SIZE, 0),
+      self_modifying_pages_(REGION_SIZE >> PAGE_SHIFT, 0) {}
+
+Block *BlockCache::find(uint16_t pc) const {
+  if (pc < Memory::PROGRAM_START || pc > Memory::PROGRAM_END) {
+    return nullptr;
+  }
+  return by_pc_[pc - Memory::PROGRAM_START];
+}
+
+Block *BlockCache::insert(std::unique_ptr<Block> block) {
+  Block *raw = block.get();
+  by_pc_[raw->start_pc - Memory::PROGRAM_START] = raw;
+  for (uint32_t a = raw->start_pc; a < raw->end_pc; ++a) {
+    covered_[a - Memory::PROGRAM_START] = 1;
+  }
+  blocks_.push_back(std::move(block));
+  return raw;
+}
+
+void BlockCache::flush() {
+  std::fill(by_pc_.begin(), by_pc_.end(), nullptr);
+  std::fill(covered_.begin(), covered_.end(), 0);
+  blocks_.clear();
+  ++generation_;
+}
+
+bool BlockCache::covers(uint16_t address, uint16_t length) const {
+  uint32_t end = static_cast<uint32_t>(address) + length;
+  for (uint32_t a = address; a < end; ++a) {
+    if (a >= Memory::PROGRAM_START && a <= Memory::PROGRAM_END &&
+        covered_[a - Memory::PROGRAM_START]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlockCache::mark_self_modifying(uint16_t address, uint16_t length) {
+  uint32_t end = static_cast<uint32_t>(address) + length;
+  for (uint32_t a = address; a < end; ++a) {
+    if (a >= Memory::PROGRAM_START && a <= Memory::PROGRAM_END) {
+      self_modifying_pages_[(a - Memory::PROGRAM_START) >> PAGE_SHIFT] = 1;
+    }
+  }
+}
+
+bool BlockCache::is_self_modifying(uint16_t pc) const {
+  if (pc < Memory::PROGRAM_START || pc > Memory::PROGRAM_END) {
+    return false;
+  }
+  return self_modifying_pages_[(pc - Memory::PROGRAM_START) >> PAGE_SHIFT] !=
+         0;
+}
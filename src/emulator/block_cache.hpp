@@ -0,0 +1,198 @@
+#pragma once
+
+#include "cpu_handlers.hpp"
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+struct GuestState;
+struct MicroOp;
+
+// Register-cached form of a handler used by the compiled engine. Returns
+// false, without side effects, if the instruction must run on the
+// interpreter instead (I/O access, HALT).
+using CompiledHandler = bool (*)(CPU &, GuestState &, const MicroOp &);
+
+// Handler for a fused CMP/SUB + Jcc pair in the block engine
+using FusedHandler = void (*)(CPU &, const MicroOp &);
+
+// Generated superinstruction (superinstructions.cpp): runs the ops
+// starting at ops[0] and returns how many of them ran
+using SuperHandler = uint32_t (*)(CPU &, const MicroOp *ops,
+                                  uint32_t &pending_ticks);
+
+// Programmer-visible state held in locals while compiled blocks run
+struct GuestState {
+  uint16_t gpr[4];
+  uint16_t sp;
+  uint16_t pc;
+  uint8_t flags;
+};
+
+// One translated instruction of a basic block
+struct MicroOp {
+  InstructionHandler handler;
+  CompiledHandler compiled; // nullptr if it always needs the interpreter
+  CPU::DecodedInstruction instr;
+  uint16_t instruction_word; // IR value for this instruction
+  uint16_t next_pc;          // PC after fetching this instruction
+  bool sync_timer;           // may observe the timer, flush pending ticks first
+
+  // Macro-op fusion: set when this CMP/SUB is fused with the conditional
+  // jump that follows it, so the pair retires in one dispatch. handler and
+  // compiled above still run the first instruction alone, for budgets that
+  // end between the two.
+  FusedHandler fused = nullptr;
+  CompiledHandler fused_compiled = nullptr;
+  CPU::DecodedInstruction branch;
+  uint16_t branch_word;    // IR value for the jump
+  uint16_t branch_next_pc; // PC after fetching the jump (not taken)
+  uint16_t branch_target;  // PC if the jump is taken
+
+  // Set on the first op of a superinstruction (block engine only).
+  // super_length counts the instructions it retires, including the jump
+  // of a fused last op.
+  SuperHandler super = nullptr;
+  uint8_t super_length = 0;
+};
+
+// Compiled handler for an instruction, or nullptr (cpu_compiled.cpp)
+CompiledHandler compiled_handler_for(const CPU::DecodedInstruction &instr);
+
+// Fused handlers for a CMP/SUB + Jcc pair, or nullptr if the pair is not
+// fusable (cpu_blocks.cpp, cpu_compiled.cpp)
+FusedHandler fused_handler_for(const CPU::DecodedInstruction &first,
+                               const CPU::DecodedInstruction &branch);
+CompiledHandler
+compiled_fused_handler_for(const CPU::DecodedInstruction &first,
+                           const CPU::DecodedInstruction &branch);
+
+// Calls Handlers::template fused<Op, Mode, Branch> for a CMP/SUB with a
+// register or immediate operand followed by JZ/JNZ/JC/JNC/JN with an
+// address known at translation time; returns nullptr for anything else
+template <typename Handlers>
+typename Handlers::Fused select_fused(const CPU::DecodedInstruction &first,
+                                      const CPU::DecodedInstruction &branch) {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+  if (first.fault != CPU::FaultCode::NONE ||
+      branch.fault != CPU::FaultCode::NONE ||
+      (branch.mode != AddressingMode::DIRECT &&
+       branch.mode != AddressingMode::PC_RELATIVE)) {
+    return nullptr;
+  }
+
+  constexpr uint8_t REG = static_cast<uint8_t>(AddressingMode::REGISTER);
+  constexpr uint8_t IMM = static_cast<uint8_t>(AddressingMode::IMMEDIATE);
+  constexpr uint8_t CMP = static_cast<uint8_t>(Opcode::CMP);
+  constexpr uint8_t SUB = static_cast<uint8_t>(Opcode::SUB);
+  auto pick = [&](auto op, auto mode) -> typename Handlers::Fused {
+    constexpr uint8_t Op = decltype(op)::value;
+    constexpr uint8_t Mode = decltype(mode)::value;
+    switch (branch.opcode) {
+    case Opcode::JZ:
+      return &Handlers::template fused<Op, Mode, uint8_t(Opcode::JZ)>;
+    case Opcode::JNZ:
+      return &Handlers::template fused<Op, Mode, uint8_t(Opcode::JNZ)>;
+    case Opcode::JC:
+      return &Handlers::template fused<Op, Mode, uint8_t(Opcode::JC)>;
+    case Opcode::JNC:
+      return &Handlers::template fused<Op, Mode, uint8_t(Opcode::JNC)>;
+    case Opcode::JN:
+      return &Handlers::template fused<Op, Mode, uint8_t(Opcode::JN)>;
+    default:
+      return nullptr;
+    }
+  };
+
+  bool reg = first.mode == AddressingMode::REGISTER;
+  if (!reg && first.mode != AddressingMode::IMMEDIATE) {
+    return nullptr;
+  }
+  if (first.opcode == Opcode::CMP) {
+    return reg ? pick(std::integral_constant<uint8_t, CMP>(),
+                      std::integral_constant<uint8_t, REG>())
+               : pick(std::integral_constant<uint8_t, CMP>(),
+                      std::integral_constant<uint8_t, IMM>());
+  }
+  if (first.opcode == Opcode::SUB) {
+    return reg ? pick(std::integral_constant<uint8_t, SUB>(),
+                      std::integral_constant<uint8_t, REG>())
+               : pick(std::integral_constant<uint8_t, SUB>(),
+                      std::integral_constant<uint8_t, IMM>());
+  }
+  return nullptr;
+}
+
+// Taken/not-taken for a Jcc right after SUB/CMP a, b with the given
+// result, without materialising FLAGS
+template <uint8_t Branch>
+inline bool fused_condition(uint16_t a, uint16_t b, uint16_t result) {
+  constexpr CPU::Opcode o = static_cast<CPU::Opcode>(Branch);
+  if constexpr (o == CPU::Opcode::JZ) {
+    return result == 0;
+  } else if constexpr (o == CPU::Opcode::JNZ) {
+    return result != 0;
+  } else if constexpr (o == CPU::Opcode::JC) {
+    return a < b;
+  } else if constexpr (o == CPU::Opcode::JNC) {
+    return a >= b;
+  } else {
+    return (result & 0x8000) != 0;
+  }
+}
+
+// True if a word access at address touches the I/O page
+inline bool is_io_word(uint16_t address) {
+  uint16_t high = static_cast<uint16_t>(address + 1);
+  return (address >= Memory::IO_START && address <= Memory::IO_END) ||
+         (high >= Memory::IO_START && high <= Memory::IO_END);
+}
+
+// Straight-line run of instructions ending at JMP/Jcc/CALL/RET/HALT
+struct Block {
+  uint16_t start_pc = 0;
+  uint16_t end_pc = 0; // first byte after the last instruction
+  std::vector<MicroOp> ops;
+
+  // Exits linked directly to the blocks they lead to
+  Block *successor[2] = {nullptr, nullptr};
+  uint16_t successor_pc[2] = {0, 0};
+
+  // Host code for the block (jit_x86_64.cpp), nullptr until translated
+  const uint8_t *native = nullptr;
+};
+
+// Owns the translated blocks of one CPU, indexed by start PC over the
+// program region. Also remembers which code bytes are covered by a block
+// so stores into translated code can be detected.
+class BlockCache {
+public:
+  BlockCache();
+
+  Block *find(uint16_t pc) const;
+  Block *insert(std::unique_ptr<Block> block);
+  void flush();
+
+  // True if any byte of [address, address + length) was translated
+  bool covers(uint16_t address, uint16_t length) const;
+
+  // Pages of code that were overwritten after translation. They survive
+  // flush() so the compiled engine keeps interpreting them.
+  void mark_self_modifying(uint16_t address, uint16_t length);
+  bool is_self_modifying(uint16_t pc) const;
+
+  size_t size() const { return blocks_.size(); }
+
+  // Incremented by flush(); native code built for an older generation is
+  // unreachable
+  uint64_t generation() const { return generation_; }
+
+private:
+  std::vector<Block *> by_pc_;
+  std::vector<uint8_t> covered_;
+  std::vector<uint8_t> self_modifying_pages_;
+  std::vector<std::unique_ptr<Block>> blocks_;
+  uint64_t generation_ = 0;
+};
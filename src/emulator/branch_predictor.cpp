@@ -0,0 +1,244 @@
+#include "branch_predictor.hpp"
+#include <algorithm>
+
+namespace {
+
+class StaticPredictor : public BranchPredictor {
+public:
+  enum class Rule { BACKWARD_TAKEN, TAKEN, NOT_TAKEN };
+
+  explicit StaticPredictor(Rule rule) : rule_(rule) {}
+
+  std::string name() const override {
+    switch (rule_) {
+    case Rule::TAKEN:
+      return "static-taken";
+    case Rule::NOT_TAKEN:
+      return "static-not-taken";
+    default:
+      return "static";
+    }
+  }
+  bool predicts(BranchKind kind) const override {
+    return kind == BranchKind::CONDITIONAL;
+  }
+  bool resolve(const BranchEvent &event) override {
+    bool predict_taken =
+        rule_ == Rule::TAKEN ||
+        (rule_ == Rule::BACKWARD_TAKEN && event.target <= event.pc);
+    return predict_taken == event.taken;
+  }
+
+private:
+  Rule rule_;
+};
+
+// Two-bit saturating counters; 2 and 3 predict taken
+class CounterTable {
+public:
+  explicit CounterTable(uint32_t bits)
+      : counters_(size_t(1) << bits, 1), mask_((1u << bits) - 1) {}
+
+  bool predict(uint32_t index) const { return counters_[index & mask_] >= 2; }
+  void update(uint32_t index, bool taken) {
+    uint8_t &counter = counters_[index & mask_];
+    if (taken) {
+      counter = static_cast<uint8_t>(std::min(counter + 1, 3));
+    } else if (counter > 0) {
+      --counter;
+    }
+  }
+
+private:
+  std::vector<uint8_t> counters_;
+  uint32_t mask_;
+};
+
+class BimodalPredictor : public BranchPredictor {
+public:
+  explicit BimodalPredictor(uint32_t bits) : bits_(bits), table_(bits) {}
+
+  std::string name() const override {
+    return "bimodal:" + std::to_string(bits_);
+  }
+  bool predicts(BranchKind kind) const override {
+    return kind == BranchKind::CONDITIONAL;
+  }
+  bool resolve(const BranchEvent &event) override {
+    if (event.kind != BranchKind::CONDITIONAL) {
+      return true;
+    }
+    // Instructions are word aligned, so PC bit 0 carries no information
+    uint32_t index = event.pc >> 1;
+    bool correct = table_.predict(index) == event.taken;
+    table_.update(index, event.taken);
+    return correct;
+  }
+
+private:
+  uint32_t bits_;
+  CounterTable table_;
+};
+
+class GsharePredictor : public BranchPredictor {
+public:
+  explicit GsharePredictor(uint32_t bits)
+      : bits_(bits), table_(bits), history_(0) {}
+
+  std::string name() const override {
+    return "gshare:" + std::to_string(bits_);
+  }
+  bool predicts(BranchKind kind) const override {
+    return kind == BranchKind::CONDITIONAL;
+  }
+  bool resolve(const BranchEvent &event) override {
+    if (event.kind != BranchKind::CONDITIONAL) {
+      return true;
+    }
+    uint32_t index = (event.pc >> 1) ^ history_;
+    bool correct = table_.predict(index) == event.taken;
+    table_.update(index, event.taken);
+    history_ = ((history_ << 1) | (event.taken ? 1u : 0u)) &
+               ((1u << bits_) - 1);
+    return correct;
+  }
+
+private:
+  uint32_t bits_;
+  CounterTable table_;
+  uint32_t history_; // outcomes of the last bits_ conditional branches
+};
+
+// Circular return address stack: a CALL past the depth overwrites the
+// oldest entry, a RET on an empty stack mispredicts
+class ReturnStackPredictor : public BranchPredictor {
+public:
+  explicit ReturnStackPredictor(uint32_t depth)
+      : entries_(depth), top_(0), count_(0) {}
+
+  std::string name() const override {
+    return "ras:" + std::to_string(entries_.size());
+  }
+  bool predicts(BranchKind kind) const override {
+    return kind == BranchKind::RETURN;
+  }
+  bool resolve(const BranchEvent &event) override {
+    if (event.kind == BranchKind::CALL) {
+      top_ = (top_ + 1) % entries_.size();
+      entries_[top_] = event.fall_through;
+      count_ = std::min<size_t>(count_ + 1, entries_.size());
+      return true;
+    }
+    if (event.kind != BranchKind::RETURN) {
+      return true;
+    }
+    if (count_ == 0) {
+      return false;
+    }
+    uint16_t predicted = entries_[top_];
+    top_ = (top_ + entries_.size() - 1) % entries_.size();
+    --count_;
+    return predicted == event.target;
+  }
+
+private:
+  std::vector<uint16_t> entries_;
+  size_t top_;
+  size_t count_;
+};
+
+// "name" or "name:N" with N in [min, max]
+bool parse_spec(const std::string &spec, const std::string &name,
+                uint32_t fallback, uint32_t min, uint32_t max,
+                uint32_t &value) {
+  if (spec == name) {
+    value = fallback;
+    return true;
+  }
+  if (spec.compare(0, name.size() + 1, name + ":") != 0) {
+    return false;
+  }
+  const std::string digits = spec.substr(name.size() + 1);
+  if (digits.empty() || digits.size() > 4 ||
+      digits.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  value = static_cast<uint32_t>(std::stoul(digits));
+  return value >= min && value <= max;
+}
+
+} // namespace
+
+std::unique_ptr<BranchPredictor>
+make_branch_predictor(const std::string &spec) {
+  uint32_t value = 0;
+  if (spec == "static") {
+    return std::make_unique<StaticPredictor>(
+        StaticPredictor::Rule::BACKWARD_TAKEN);
+  }
+  if (spec == "static-taken") {
+    return std::make_unique<StaticPredictor>(StaticPredictor::Rule::TAKEN);
+  }
+  if (spec == "static-not-taken") {
+    return std::make_unique<StaticPredictor>(StaticPredictor::Rule::NOT_TAKEN);
+  }
+  if (parse_spec(spec, "bimodal", 10, 1, 20, value)) {
+    return std::make_unique<BimodalPredictor>(value);
+  }
+  if (parse_spec(spec, "gshare", 12, 1, 20, value)) {
+    return std::make_unique<GsharePredictor>(value);
+  }
+  if (parse_spec(spec, "ras", 16, 1, 1024, value)) {
+    return std::make_unique<ReturnStackPredictor>(value);
+  }
+  return nullptr;
+}
+
+BranchProfile::BranchProfile() : site_at_(ADDRESS_COUNT, -1) {}
+
+void BranchProfile::add_predictor(std::unique_ptr<BranchPredictor> predictor) {
+  predictors_.push_back(std::move(predictor));
+  predicted_.push_back(0);
+  mispredicted_.push_back(0);
+  for (Site &site : sites_) {
+    site.mispredictions.push_back(0);
+  }
+}
+
+void BranchProfile::record(const BranchEvent &event) {
+  int32_t &index = site_at_[event.pc];
+  if (index < 0) {
+    index = static_cast<int32_t>(sites_.size());
+    sites_.push_back(Site{event.pc, event.kind, 0, 0,
+                          std::vector<uint64_t>(predictors_.size(), 0)});
+  }
+  Site &site = sites_[index];
+  ++site.executions;
+  site.taken += event.taken ? 1 : 0;
+
+  for (size_t i = 0; i < predictors_.size(); ++i) {
+    BranchPredictor &predictor = *predictors_[i];
+    bool correct = predictor.resolve(event);
+    if (predictor.predicts(event.kind)) {
+      ++predicted_[i];
+      if (!correct) {
+        ++mispredicted_[i];
+        ++site.mispredictions[i];
+      }
+    }
+  }
+}
+
+std::vector<BranchProfile::Site> BranchProfile::sites() const {
+  std::vector<Site> sorted = sites_;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Site &a, const Site &b) { return a.pc < b.pc; });
+  return sorted;
+}
+
+void BranchProfile::clear() {
+  std::fill(site_at_.begin(), site_at_.end(), -1);
+  sites_.clear();
+  std::fill(predicted_.begin(), predicted_.end(), 0);
+  std::fill(mispredicted_.begin(), mispredicted_.end(), 0);
+}
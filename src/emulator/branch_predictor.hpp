@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Branch prediction simulation.
+//
+// Every control transfer the CPU retires (Jcc, JMP, CALL, RET) is handed
+// to each predictor of a BranchProfile, which predicts it, learns the
+// outcome and reports whether it was right. Directional predictors
+// (static, bimodal, gshare) predict conditional branches; the return
+// address stack predicts RET targets from the CALLs it has seen.
+// Direct JMP and CALL targets are always known and not predicted. Several
+// predictors see the same stream in one run, so their accuracy can be
+// compared branch by branch.
+
+enum class BranchKind : uint8_t { CONDITIONAL, JUMP, CALL, RETURN };
+
+struct BranchEvent {
+  uint16_t pc;
+  BranchKind kind;
+  bool taken;            // always true for JUMP, CALL and RETURN
+  uint16_t target;       // destination, also of a Jcc that is not taken
+  uint16_t fall_through; // address after the instruction's words
+};
+
+class BranchPredictor {
+public:
+  virtual ~BranchPredictor() = default;
+
+  virtual std::string name() const = 0;
+  virtual bool predicts(BranchKind kind) const = 0;
+  // Predict event, learn its outcome and return whether the prediction
+  // was right. Called for every transfer; the result is ignored for kinds
+  // the predictor does not predict.
+  virtual bool resolve(const BranchEvent &event) = 0;
+};
+
+// Predictor from a spec: "static" (backward taken, forward not taken),
+// "static-taken", "static-not-taken", "bimodal[:BITS]" (2^BITS two-bit
+// counters, default 10), "gshare[:BITS]" (2^BITS counters indexed by PC
+// xor BITS bits of global history, default 12) or "ras[:DEPTH]" (return
+// address stack, default 16). nullptr for an unknown or malformed spec.
+std::unique_ptr<BranchPredictor> make_branch_predictor(const std::string &spec);
+
+// Outcomes of the branches at each PC under each predictor
+class BranchProfile {
+public:
+  static constexpr uint32_t ADDRESS_COUNT = 0x10000;
+
+  BranchProfile();
+
+  void add_predictor(std::unique_ptr<BranchPredictor> predictor);
+  size_t predictor_count() const { return predictors_.size(); }
+  const BranchPredictor &predictor(size_t index) const {
+    return *predictors_[index];
+  }
+
+  void record(const BranchEvent &event);
+
+  // A branch instruction and what each predictor made of it
+  struct Site {
+    uint16_t pc;
+    BranchKind kind;
+    uint64_t executions;
+    uint64_t taken;
+    std::vector<uint64_t> mispredictions; // by predictor, 0 if not predicted
+  };
+  // Sites in address order
+  std::vector<Site> sites() const;
+
+  // Branches predictor index predicted, and how many it got wrong
+  uint64_t predicted(size_t index) const { return predicted_[index]; }
+  uint64_t mispredicted(size_t index) const { return mispredicted_[index]; }
+
+  // Forget the counts; predictor state is kept
+  void clear();
+
+private:
+  std::vector<std::unique_ptr<BranchPredictor>> predictors_;
+  std::vector<int32_t> site_at_; // index into sites_ by PC, -1 if none
+  std::vector<Site> sites_;
+  std::vector<uint64_t> predicted_;
+  std::vector<uint64_t> mispredicted_;
+};
@@ -0,0 +1,360 @@
+#include "cache_model.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+bool power_of_two(uint32_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+uint32_t log2(uint32_t value) {
+  uint32_t bits = 0;
+  while ((1u << bits) < value) {
+    ++bits;
+  }
+  return bits;
+}
+
+constexpr uint32_t RANDOM_SEED = 0x2545F491;
+
+// Decimal number of at most 5 digits
+bool parse_size(const std::string &digits, uint32_t &value) {
+  if (digits.empty() || digits.size() > 5 ||
+      digits.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  value = static_cast<uint32_t>(std::stoul(digits));
+  return true;
+}
+
+} // namespace
+
+Cache::Cache() : Cache(Config()) {}
+
+Cache::Cache(const Config &config)
+    : config_(config), line_shift_(log2(config.line_size)),
+      set_mask_(config.size / (config.ways * config.line_size) - 1),
+      lines_(config.size / config.line_size, 0),
+      flags_(config.size / config.line_size, 0),
+      stamps_(config.size / config.line_size, 0) {
+  clear();
+}
+
+bool Cache::valid(const Config &config) {
+  return power_of_two(config.size) && power_of_two(config.ways) &&
+         power_of_two(config.line_size) && config.line_size >= 2 &&
+         config.size <= Memory::MEMORY_SIZE &&
+         config.ways <= config.size / config.line_size;
+}
+
+Cache::Result Cache::access(uint16_t address, bool write) {
+  const uint32_t line = static_cast<uint32_t>(address) >> line_shift_;
+  const uint32_t first = (line & set_mask_) * config_.ways;
+  const uint32_t last = first + config_.ways;
+  if (write) {
+    ++stats_.writes;
+  } else {
+    ++stats_.reads;
+  }
+
+  for (uint32_t way = first; way < last; ++way) {
+    if ((flags_[way] & VALID) && lines_[way] == line) {
+      if (config_.replacement == Replacement::LRU) {
+        stamps_[way] = ++tick_;
+      }
+      if (write && config_.write_policy == WritePolicy::WRITE_BACK) {
+        flags_[way] |= DIRTY;
+      }
+      return Result{true, false, false, 0};
+    }
+  }
+
+  if (write) {
+    ++stats_.write_misses;
+    if (config_.write_policy == WritePolicy::WRITE_THROUGH) {
+      return Result{false, false, false, 0};
+    }
+  } else {
+    ++stats_.read_misses;
+  }
+
+  // An empty way if there is one, otherwise the policy's victim
+  uint32_t victim = first;
+  while (victim < last && (flags_[victim] & VALID)) {
+    ++victim;
+  }
+  if (victim == last) {
+    if (config_.replacement == Replacement::RANDOM) {
+      random_state_ ^= random_state_ << 13;
+      random_state_ ^= random_state_ >> 17;
+      random_state_ ^= random_state_ << 5;
+      victim = first + random_state_ % config_.ways;
+    } else {
+      victim = first;
+      for (uint32_t way = first + 1; way < last; ++way) {
+        if (stamps_[way] < stamps_[victim]) {
+          victim = way;
+        }
+      }
+    }
+  }
+
+  Result result = {false, true, false, 0};
+  if ((flags_[victim] & (VALID | DIRTY)) == (VALID | DIRTY)) {
+    ++stats_.writebacks;
+    result.writeback = true;
+    result.victim = static_cast<uint16_t>(lines_[victim] << line_shift_);
+  }
+  lines_[victim] = line;
+  flags_[victim] = write ? (VALID | DIRTY) : VALID;
+  stamps_[victim] = ++tick_;
+  return result;
+}
+
+void Cache::clear() {
+  stats_ = Statistics();
+  std::fill(flags_.begin(), flags_.end(), 0);
+  std::fill(stamps_.begin(), stamps_.end(), 0);
+  tick_ = 0;
+  random_state_ = RANDOM_SEED;
+}
+
+std::string Cache::describe() const {
+  std::ostringstream out;
+  out << config_.size << "B " << config_.ways << "-way " << config_.line_size
+      << "B lines, ";
+  switch (config_.replacement) {
+  case Replacement::LRU:
+    out << "LRU";
+    break;
+  case Replacement::FIFO:
+    out << "FIFO";
+    break;
+  case Replacement::RANDOM:
+    out << "random";
+    break;
+  }
+  out << (config_.write_policy == WritePolicy::WRITE_BACK ? ", write-back"
+                                                          : ", write-through");
+  return out.str();
+}
+
+bool parse_cache_config(const std::string &spec, Cache::Config &config) {
+  std::vector<std::string> fields;
+  std::istringstream in(spec);
+  std::string field;
+  while (std::getline(in, field, ':')) {
+    fields.push_back(field);
+  }
+  if (fields.size() < 3 || fields.size() > 5) {
+    return false;
+  }
+
+  Cache::Config parsed;
+  if (!parse_size(fields[0], parsed.size) ||
+      !parse_size(fields[1], parsed.ways) ||
+      !parse_size(fields[2], parsed.line_size)) {
+    return false;
+  }
+  bool replacement = false;
+  bool write_policy = false;
+  for (size_t i = 3; i < fields.size(); ++i) {
+    if (!replacement && fields[i] == "lru") {
+      parsed.replacement = Cache::Replacement::LRU;
+      replacement = true;
+    } else if (!replacement && fields[i] == "fifo") {
+      parsed.replacement = Cache::Replacement::FIFO;
+      replacement = true;
+    } else if (!replacement && fields[i] == "random") {
+      parsed.replacement = Cache::Replacement::RANDOM;
+      replacement = true;
+    } else if (!write_policy && fields[i] == "wb") {
+      parsed.write_policy = Cache::WritePolicy::WRITE_BACK;
+      write_policy = true;
+    } else if (!write_policy && fields[i] == "wt") {
+      parsed.write_policy = Cache::WritePolicy::WRITE_THROUGH;
+      write_policy = true;
+    } else {
+      return false;
+    }
+  }
+  if (!Cache::valid(parsed)) {
+    return false;
+  }
+  config = parsed;
+  return true;
+}
+
+CacheHierarchy::CacheHierarchy(const Cache::Config &l1i,
+                               const Cache::Config &l1d)
+    : l1i_(l1i), l1d_(l1d), site_at_(ADDRESS_COUNT, -1) {
+  clear();
+}
+
+CacheHierarchy::CacheHierarchy(const Cache::Config &l1i,
+                               const Cache::Config &l1d,
+                               const Cache::Config &l2)
+    : CacheHierarchy(l1i, l1d) {
+  l2_ = std::make_unique<Cache>(l2);
+}
+
+void CacheHierarchy::fetch(uint16_t pc, uint16_t address) {
+  access(l1i_, pc, address, false, true);
+}
+
+void CacheHierarchy::read(uint16_t pc, uint16_t address) {
+  access(l1d_, pc, address, false, false);
+}
+
+void CacheHierarchy::write(uint16_t pc, uint16_t address) {
+  access(l1d_, pc, address, true, false);
+}
+
+void CacheHierarchy::access(Cache &l1, uint16_t pc, uint16_t address,
+                            bool write, bool instruction) {
+  const Region region = region_of(address);
+  RegionStatistics &counts = regions_[region];
+  ++counts.accesses;
+  if (region == REGION_IO) {
+    return;
+  }
+
+  bool l1_miss = false;
+  bool l2_miss = false;
+  probe(l1, address, write, l1_miss, l2_miss);
+  const uint16_t next = static_cast<uint16_t>(address + 1);
+  if (l1.line_base(next) != l1.line_base(address)) {
+    probe(l1, next, write, l1_miss, l2_miss);
+  }
+
+  Site &counted = site(pc);
+  if (instruction) {
+    ++counted.fetches;
+    counted.fetch_misses += l1_miss ? 1 : 0;
+  } else {
+    ++counted.data_accesses;
+    counted.data_misses += l1_miss ? 1 : 0;
+  }
+  counts.l1_misses += l1_miss ? 1 : 0;
+  counts.l2_misses += l2_ && l2_miss ? 1 : 0;
+}
+
+// Look address up in l1 and pass what it misses, fills and evicts down
+void CacheHierarchy::probe(Cache &l1, uint16_t address, bool write,
+                           bool &l1_miss, bool &l2_miss) {
+  const uint32_t line_size = l1.config().line_size;
+  const Cache::Result result = l1.access(address, write);
+  if (result.writeback) {
+    transfer(result.victim, line_size, true);
+  }
+  const bool through =
+      l1.config().write_policy == Cache::WritePolicy::WRITE_THROUGH;
+  if (result.hit) {
+    if (write && through) {
+      lower(address, true);
+    }
+    return;
+  }
+  l1_miss = true;
+  if (result.fill) {
+    l2_miss |= !transfer(l1.line_base(address), line_size, false);
+  } else {
+    // Write-through write miss, not allocated
+    l2_miss |= !lower(address, true);
+  }
+}
+
+// Move an L1 line to or from the level below; true if L2 had all of it
+bool CacheHierarchy::transfer(uint16_t base, uint32_t size, bool write) {
+  const uint32_t step = l2_ ? std::min(size, l2_->config().line_size) : size;
+  bool hit = true;
+  for (uint32_t offset = 0; offset < size; offset += step) {
+    hit &= lower(static_cast<uint16_t>(base + offset), write);
+  }
+  return hit;
+}
+
+// One access to L2, or to memory without one; true if L2 hit
+bool CacheHierarchy::lower(uint16_t address, bool write) {
+  if (!l2_) {
+    ++(write ? memory_writes_ : memory_reads_);
+    return false;
+  }
+  const Cache::Result result = l2_->access(address, write);
+  if (result.writeback) {
+    ++memory_writes_;
+  }
+  if (result.fill) {
+    ++memory_reads_;
+  }
+  if (write && !result.fill &&
+      l2_->config().write_policy == Cache::WritePolicy::WRITE_THROUGH) {
+    ++memory_writes_;
+  }
+  return result.hit;
+}
+
+CacheHierarchy::Site &CacheHierarchy::site(uint16_t pc) {
+  int32_t &index = site_at_[pc];
+  if (index < 0) {
+    index = static_cast<int32_t>(sites_.size());
+    sites_.push_back(Site{pc, 0, 0, 0, 0});
+  }
+  return sites_[index];
+}
+
+std::vector<CacheHierarchy::Site> CacheHierarchy::sites() const {
+  std::vector<Site> sorted = sites_;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Site &a, const Site &b) { return a.pc < b.pc; });
+  return sorted;
+}
+
+void CacheHierarchy::clear() {
+  l1i_.clear();
+  l1d_.clear();
+  if (l2_) {
+    l2_->clear();
+  }
+  memory_reads_ = 0;
+  memory_writes_ = 0;
+  std::fill(std::begin(regions_), std::end(regions_), RegionStatistics());
+  std::fill(site_at_.begin(), site_at_.end(), -1);
+  sites_.clear();
+}
+
+CacheHierarchy::Region CacheHierarchy::region_of(uint16_t address) {
+  if (address < 0x1000) {
+    return REGION_DATA;
+  }
+  if (address < Memory::PROGRAM_START) {
+    return REGION_STACK;
+  }
+  if (address < Memory::IO_START) {
+    return REGION_PROGRAM;
+  }
+  if (address <= Memory::IO_END) {
+    return REGION_IO;
+  }
+  return REGION_RESERVED;
+}
+
+const char *CacheHierarchy::region_name(Region region) {
+  switch (region) {
+  case REGION_DATA:
+    return "data";
+  case REGION_STACK:
+    return "stack";
+  case REGION_PROGRAM:
+    return "program";
+  case REGION_IO:
+    return "I/O";
+  case REGION_RESERVED:
+    return "reserved";
+  default:
+    return "?";
+  }
+}
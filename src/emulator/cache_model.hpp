@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Set-associative cache simulation, for CPU::set_cache_hierarchy().
+//
+// A CacheHierarchy sits between the instructions the CPU retires and
+// memory: instruction fetches go to an L1 instruction cache, operand and
+// stack accesses to an L1 data cache, and both miss into an optional
+// unified L2 and then memory. Only tags are modelled, so the simulation
+// does not change what the program reads or how the CPU counts cycles.
+// The I/O page is not cacheable: its accesses are counted but bypass the
+// caches.
+
+class Cache {
+public:
+  enum class Replacement : uint8_t { LRU, FIFO, RANDOM };
+  // Write-back caches allocate on a write miss; write-through caches pass
+  // every write down and do not allocate
+  enum class WritePolicy : uint8_t { WRITE_BACK, WRITE_THROUGH };
+
+  // Sizes in bytes, all powers of two (see valid())
+  struct Config {
+    uint32_t size = 1024;
+    uint32_t ways = 2;
+    uint32_t line_size = 16;
+    Replacement replacement = Replacement::LRU;
+    WritePolicy write_policy = WritePolicy::WRITE_BACK;
+  };
+
+  struct Statistics {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t read_misses = 0;
+    uint64_t write_misses = 0;
+    uint64_t writebacks = 0; // dirty lines evicted
+    uint64_t accesses() const { return reads + writes; }
+    uint64_t misses() const { return read_misses + write_misses; }
+  };
+
+  // Outcome of one access
+  struct Result {
+    bool hit;
+    bool fill;      // missing line was allocated and must be read from below
+    bool writeback; // a dirty line was evicted and must be written below
+    uint16_t victim; // first address of the evicted dirty line
+  };
+
+  Cache();
+  // config must be valid()
+  explicit Cache(const Config &config);
+
+  // Power-of-two sizes, lines of at least a word and at least one set
+  static bool valid(const Config &config);
+
+  const Config &config() const { return config_; }
+  const Statistics &statistics() const { return stats_; }
+  uint16_t line_base(uint16_t address) const {
+    return static_cast<uint16_t>(address & ~(config_.line_size - 1));
+  }
+
+  Result access(uint16_t address, bool write);
+
+  // Invalidate every line and forget the counts
+  void clear();
+
+  // e.g. "1024B 2-way 16B lines, LRU, write-back"
+  std::string describe() const;
+
+private:
+  static constexpr uint8_t VALID = 1;
+  static constexpr uint8_t DIRTY = 2;
+
+  Config config_;
+  Statistics stats_;
+  uint32_t line_shift_;
+  uint32_t set_mask_;
+  // Per way, set by set: line number (address >> line_shift_), VALID/DIRTY
+  // bits and the tick of the last use (LRU) or fill (FIFO)
+  std::vector<uint32_t> lines_;
+  std::vector<uint8_t> flags_;
+  std::vector<uint64_t> stamps_;
+  uint64_t tick_;
+  uint32_t random_state_; // xorshift, seeded the same on every clear()
+};
+
+// Cache from "SIZE:WAYS:LINE" optionally followed by ":lru", ":fifo" or
+// ":random" and ":wb" or ":wt" (defaults LRU, write-back), e.g.
+// "4096:4:32:fifo:wt". False if the spec is malformed or not valid().
+bool parse_cache_config(const std::string &spec, Cache::Config &config);
+
+// Split L1 caches over an optional unified L2, with hits and misses
+// counted per instruction address and per address region
+class CacheHierarchy {
+public:
+  static constexpr uint32_t ADDRESS_COUNT = 0x10000;
+
+  // Regions of the memory map (docs/architecture/memory_map.md)
+  enum Region : uint8_t {
+    REGION_DATA = 0,     // 0x0000-0x0FFF
+    REGION_STACK = 1,    // 0x1000-0x7FFF
+    REGION_PROGRAM = 2,  // 0x8000-0xEFFF
+    REGION_IO = 3,       // 0xF000-0xF0FF, uncached
+    REGION_RESERVED = 4, // 0xF100-0xFFFF
+    REGION_COUNT = 5
+  };
+
+  struct RegionStatistics {
+    uint64_t accesses = 0;
+    uint64_t l1_misses = 0;
+    uint64_t l2_misses = 0; // missed in L1 and L2; 0 without an L2
+  };
+
+  // Accesses made by the instruction at pc; I/O accesses are not included
+  struct Site {
+    uint16_t pc;
+    uint64_t fetches;
+    uint64_t fetch_misses; // L1I
+    uint64_t data_accesses;
+    uint64_t data_misses; // L1D
+  };
+
+  // l1i and l1d (and l2) must be valid(). The L2 line should be no
+  // smaller than the L1 lines; a larger L1 line is filled from every L2
+  // line it covers.
+  CacheHierarchy(const Cache::Config &l1i, const Cache::Config &l1d);
+  CacheHierarchy(const Cache::Config &l1i, const Cache::Config &l1d,
+                 const Cache::Config &l2);
+
+  // Word accesses on behalf of the instruction at pc. A word that
+  // straddles two lines looks up both and misses if either does.
+  void fetch(uint16_t pc, uint16_t address);
+  void read(uint16_t pc, uint16_t address);
+  void write(uint16_t pc, uint16_t address);
+
+  const Cache &l1i() const { return l1i_; }
+  const Cache &l1d() const { return l1d_; }
+  const Cache *l2() const { return l2_.get(); }
+
+  // Transfers past the last cache level
+  uint64_t memory_reads() const { return memory_reads_; }
+  uint64_t memory_writes() const { return memory_writes_; }
+
+  const RegionStatistics &region(Region region) const {
+    return regions_[region];
+  }
+  // Instructions that accessed memory, in address order
+  std::vector<Site> sites() const;
+
+  // Empty the caches and forget the counts
+  void clear();
+
+  static Region region_of(uint16_t address);
+  static const char *region_name(Region region);
+
+private:
+  void access(Cache &l1, uint16_t pc, uint16_t address, bool write,
+              bool instruction);
+  void probe(Cache &l1, uint16_t address, bool write, bool &l1_miss,
+             bool &l2_miss);
+  bool transfer(uint16_t base, uint32_t size, bool write);
+  bool lower(uint16_t address, bool write);
+  Site &site(uint16_t pc);
+
+  Cache l1i_;
+  Cache l1d_;
+  std::unique_ptr<Cache> l2_;
+  uint64_t memory_reads_;
+  uint64_t memory_writes_;
+  RegionStatistics regions_[REGION_COUNT];
+  std::vector<int32_t> site_at_; // index into sites_ by PC, -1 if none
+  std::vector<Site> sites_;
+};
@@ -0,0 +1,147 @@
+#include "call_graph_profile.hpp"
+#include <algorithm>
+#include <map>
+#include <ostream>
+
+void CallGraphProfile::start(uint16_t entry) {
+  if (!nodes_.empty()) {
+    return;
+  }
+  nodes_.push_back(Node{entry, 0, 1, 0, {}});
+  stack_.assign(1, 0);
+}
+
+void CallGraphProfile::enter(uint16_t function) {
+  uint32_t parent = stack_.back();
+  uint32_t child = 0;
+  bool found = false;
+  for (uint32_t index : nodes_[parent].children) {
+    if (nodes_[index].function == function) {
+      child = index;
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    child = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node{function, parent, 0, 0, {}});
+    nodes_[parent].children.push_back(child);
+  }
+  ++nodes_[child].calls;
+  stack_.push_back(child);
+}
+
+void CallGraphProfile::leave() {
+  if (stack_.size() > 1) {
+    stack_.pop_back();
+  }
+}
+
+std::vector<uint64_t> CallGraphProfile::inclusive_cycles() const {
+  // Children are always created after their parent
+  std::vector<uint64_t> inclusive(nodes_.size());
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    inclusive[i] = nodes_[i].exclusive_cycles;
+  }
+  for (size_t i = nodes_.size(); i-- > 1;) {
+    inclusive[nodes_[i].parent] += inclusive[i];
+  }
+  return inclusive;
+}
+
+void CallGraphProfile::walk(
+    const std::function<void(uint32_t, bool)> &visit) const {
+  if (nodes_.empty()) {
+    return;
+  }
+  // (node, next child) pairs; iterative, as recursion can be deep
+  std::vector<std::pair<uint32_t, size_t>> path;
+  path.emplace_back(0, 0);
+  visit(0, true);
+  while (!path.empty()) {
+    auto &top = path.back();
+    const Node &node = nodes_[top.first];
+    if (top.second < node.children.size()) {
+      uint32_t child = node.children[top.second++];
+      visit(child, true);
+      path.emplace_back(child, 0);
+    } else {
+      visit(top.first, false);
+      path.pop_back();
+    }
+  }
+}
+
+std::vector<CallGraphProfile::FunctionSummary>
+CallGraphProfile::functions() const {
+  const std::vector<uint64_t> inclusive = inclusive_cycles();
+  std::map<uint16_t, FunctionSummary> by_function;
+  // Frames of each function on the current path: the inclusive cycles of
+  // a recursive call are already in its outermost frame
+  std::map<uint16_t, uint32_t> active;
+  walk([&](uint32_t index, bool entering) {
+    const Node &node = nodes_[index];
+    uint32_t &frames = active[node.function];
+    if (!entering) {
+      --frames;
+      return;
+    }
+    FunctionSummary &summary =
+        by_function.emplace(node.function,
+                            FunctionSummary{node.function, 0, 0, 0})
+            .first->second;
+    summary.calls += node.calls;
+    summary.exclusive_cycles += node.exclusive_cycles;
+    if (frames++ == 0) {
+      summary.inclusive_cycles += inclusive[index];
+    }
+  });
+
+  std::vector<FunctionSummary> summaries;
+  for (const auto &entry : by_function) {
+    summaries.push_back(entry.second);
+  }
+  std::stable_sort(summaries.begin(), summaries.end(),
+                   [](const FunctionSummary &a, const FunctionSummary &b) {
+                     return a.inclusive_cycles > b.inclusive_cycles;
+                   });
+  return summaries;
+}
+
+void CallGraphProfile::write_collapsed(std::ostream &out,
+                                       const SymbolLookup &name,
+                                       bool merge_recursion) const {
+  // Merged paths can coincide, so lines are summed by path
+  std::map<std::vector<uint16_t>, uint64_t> lines;
+  std::vector<uint16_t> path;
+  std::vector<bool> pushed(nodes_.size());
+  walk([&](uint32_t index, bool entering) {
+    const Node &node = nodes_[index];
+    if (!entering) {
+      if (pushed[index]) {
+        path.pop_back();
+      }
+      return;
+    }
+    pushed[index] = !merge_recursion || std::find(path.begin(), path.end(),
+                                                  node.function) == path.end();
+    if (pushed[index]) {
+      path.push_back(node.function);
+    }
+    if (node.exclusive_cycles) {
+      lines[path] += node.exclusive_cycles;
+    }
+  });
+
+  for (const auto &line : lines) {
+    for (size_t k = 0; k < line.first.size(); ++k) {
+      out << (k ? ";" : "") << name(line.first[k]);
+    }
+    out << " " << line.second << "\n";
+  }
+}
+
+void CallGraphProfile::clear() {
+  nodes_.clear();
+  stack_.clear();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Cycles per call path, from a shadow call stack kept alongside the guest
+// stack. Every retired instruction is charged to the function on top of
+// the shadow stack; CALL pushes its target and RET pops. Paths form a
+// calling-context tree whose root is the function the run started in, so
+// each node is one distinct call path and holds its exclusive cycles and
+// call count; inclusive cycles are summed over subtrees on demand.
+//
+// The shadow stack follows CALL/RET only. Code that returns by other
+// means (JMP through a popped address, stack switching) leaves it out of
+// step, and a RET with an empty shadow stack is charged to the root.
+class CallGraphProfile {
+public:
+  struct Node {
+    uint16_t function; // entry address
+    uint32_t parent;   // index into nodes(); the root is its own parent
+    uint64_t calls;
+    uint64_t exclusive_cycles;
+    std::vector<uint32_t> children;
+  };
+
+  // Cycles of one function over all paths. Inclusive cycles count each
+  // cycle once, even with the function on the path several times.
+  struct FunctionSummary {
+    uint16_t function;
+    uint64_t calls;
+    uint64_t inclusive_cycles;
+    uint64_t exclusive_cycles;
+  };
+
+  using SymbolLookup = std::function<std::string(uint16_t)>;
+
+  // Root at entry; does nothing if the profile already has a root
+  void start(uint16_t entry);
+  void record(uint64_t cycles) {
+    nodes_[stack_.back()].exclusive_cycles += cycles;
+  }
+  void enter(uint16_t function);
+  void leave();
+
+  bool empty() const { return nodes_.empty(); }
+  const std::vector<Node> &nodes() const { return nodes_; }
+  size_t depth() const { return stack_.size(); }
+  // Inclusive cycles of every node, by index
+  std::vector<uint64_t> inclusive_cycles() const;
+  // Most inclusive cycles first
+  std::vector<FunctionSummary> functions() const;
+
+  // One "root;caller;callee <exclusive cycles>" line per call path, the
+  // input format of flame-graph tools. With merge_recursion, frames that
+  // repeat a function already on the path are dropped, so every depth of
+  // a recursion is folded into its outermost frame.
+  void write_collapsed(std::ostream &out, const SymbolLookup &name,
+                       bool merge_recursion) const;
+
+  void clear();
+
+private:
+  // Depth-first over the tree: visit(node, true) before its children,
+  // visit(node, false) after
+  void walk(const std::function<void(uint32_t, bool)> &visit) const;
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> stack_;
+};
@@ -1,14 +1,36 @@
 #include "cpu.hpp"
+#include "block_cache.hpp"
+#include "cpu_instrumentation.hpp"
+#include "jit_x86_64.hpp"
 #include "memory.hpp"
+#include "timing_model.hpp"
 #include <iomanip>
 #include <iostream>
-#include <stdexcept>
 
-CPU::CPU() : halted_(false), debug_mode_(false) { reset(); }
+CPU::CPU()
+    : halted_(false), faulted_(false), waiting_for_input_(false),
+      debug_mode_(false), engine_(Engine::INTERPRETER), cycle_count_(0),
+      leave_engine_(false), decode_cache_enabled_(true),
+      blocks_invalidated_(false),
+      macro_fusion_(true), superinstructions_(true), native_code_(true),
+      code_modified_(false),
+      load_address_(Memory::PROGRAM_START) {
+  reset();
+}
+
+CPU::~CPU() = default;
 
 void CPU::reset() {
   registers_.reset();
   halted_ = false;
+  faulted_ = false;
+  fault_ = Fault();
+  waiting_for_input_ = false;
+  cycle_count_ = 0;
+  stats_ = Statistics();
+  if (history_) {
+    history_->clear();
+  }
 
   if (debug_mode_) {
     std::cout << "CPU Reset" << std::endl;
@@ -18,7 +40,17 @@ void CPU::reset() {
 void CPU::load_program(const std::vector<uint8_t> &program,
                        uint16_t start_address) {
   memory_.load_program(program, start_address);
+  loaded_image_ = memory_.capture();
+  load_address_ = start_address;
   registers_.set_pc(start_address);
+  code_modified_ = false;
+  flush_decode_cache();
+  if (blocks_) {
+    blocks_->flush();
+  }
+  if (history_) {
+    history_->clear();
+  }
 
   if (debug_mode_) {
     std::cout << "Program loaded at 0x" << std::hex << start_address
@@ -27,85 +59,443 @@ void CPU::load_program(const std::vector<uint8_t> &program,
   }
 }
 
-void CPU::run() {
-  if (debug_mode_) {
-    std::cout << "Starting CPU execution..." << std::endl;
+void CPU::reset_for_reuse() {
+  memory_.revert_to(loaded_image_);
+  memory_.reset_io();
+  reset();
+  registers_.set_pc(load_address_);
+  if (code_modified_) {
+    flush_decode_cache();
+    if (blocks_) {
+      blocks_->flush();
+    }
+    code_modified_ = false;
   }
+}
 
-  const uint32_t MAX_CYCLES = 100000; // Prevent infinite loops
-  uint32_t cycle_count = 0;
+void CPU::load_image(const MemoryImage &image, uint16_t start_address) {
+  memory_.map(image);
+  loaded_image_ = image;
+  load_address_ = start_address;
+  registers_.set_pc(start_address);
+  code_modified_ = false;
+  flush_decode_cache();
+  if (blocks_) {
+    blocks_->flush();
+  }
+  if (history_) {
+    history_->clear();
+  }
+}
 
-  while (!halted_ && step() && cycle_count < MAX_CYCLES) {
-    cycle_count++;
-    if (cycle_count % 10000 == 0 && debug_mode_) {
-      std::cout << "Executed " << cycle_count << " cycles..." << std::endl;
-    }
+std::unique_ptr<CPU> CPU::fork() {
+  auto child = std::make_unique<CPU>();
+  child->memory_.fork_from(memory_);
+  child->registers_ = registers_;
+  child->alu_ = alu_;
+  child->halted_ = halted_;
+  child->faulted_ = faulted_;
+  child->fault_ = fault_;
+  child->waiting_for_input_ = waiting_for_input_;
+  child->debug_mode_ = debug_mode_;
+  child->engine_ = engine_;
+  child->cycle_count_ = cycle_count_;
+  child->stats_ = stats_;
+  child->breakpoints_ = breakpoints_;
+  child->decode_cache_enabled_ = decode_cache_enabled_;
+  child->macro_fusion_ = macro_fusion_;
+  child->superinstructions_ = superinstructions_;
+  child->native_code_ = native_code_;
+  child->timing_model_ = timing_model_;
+  child->code_modified_ = code_modified_;
+  child->loaded_image_ = loaded_image_;
+  child->load_address_ = load_address_;
+  // Decode caches and translated blocks are rebuilt on demand
+  return child;
+}
+
+CPU::Snapshot CPU::snapshot() {
+  Snapshot snapshot;
+  snapshot.registers = registers_;
+  snapshot.halted = halted_;
+  snapshot.faulted = faulted_;
+  snapshot.waiting_for_input = waiting_for_input_;
+  snapshot.code_modified = code_modified_;
+  snapshot.fault = fault_;
+  snapshot.cycle_count = cycle_count_;
+  snapshot.statistics = stats_;
+  snapshot.timer_counter = memory_.get_timer_counter();
+  snapshot.timer_running = memory_.is_timer_running();
+  snapshot.perf_counters = memory_.perf_counters();
+  snapshot.memory = memory_.capture();
+  return snapshot;
+}
+
+void CPU::restore(const Snapshot &snapshot) {
+  restore_state(snapshot);
+  if (history_) {
+    history_->clear();
+  }
+}
+
+void CPU::restore_state(const Snapshot &snapshot) {
+  memory_.map(snapshot.memory);
+  memory_.set_timer_state(snapshot.timer_counter, snapshot.timer_running);
+  memory_.set_perf_counters(snapshot.perf_counters);
+  registers_ = snapshot.registers;
+  halted_ = snapshot.halted;
+  faulted_ = snapshot.faulted;
+  waiting_for_input_ = snapshot.waiting_for_input;
+  code_modified_ = snapshot.code_modified;
+  fault_ = snapshot.fault;
+  cycle_count_ = snapshot.cycle_count;
+  stats_ = snapshot.statistics;
+  // Cached decodes and blocks describe the old memory
+  flush_decode_cache();
+  if (blocks_) {
+    blocks_->flush();
   }
+}
+
+CPU::RunResult CPU::run() { return run_loop(RunBudget(), nullptr); }
+
+CPU::RunResult CPU::run_for(const RunBudget &budget) {
+  return run_loop(budget, nullptr);
+}
 
+CPU::RunResult
+CPU::run_until(const std::function<bool(const CPU &)> &predicate) {
+  return run_loop(RunBudget(), &predicate);
+}
+
+CPU::RunResult
+CPU::run_until(const std::function<bool(const CPU &)> &predicate,
+               const RunBudget &budget) {
+  return run_loop(budget, &predicate);
+}
+
+template <typename Fn> auto CPU::with_policy(Fn &&fn) {
+  const bool observed = tracer_ || history_ || hotspot_profile_ ||
+                        call_graph_profile_ || pipeline_model_ ||
+                        branch_profile_ || cache_hierarchy_ ||
+                        sequence_profile_;
+  // Debug output is per instruction, so on its own it only applies to the
+  // interpreter
+  if (!observed && !(debug_mode_ && engine_ == Engine::INTERPRETER)) {
+    NullPolicy policy;
+    return fn(policy);
+  }
+
+  ObserverPolicy policy;
+  if (tracer_) {
+    observer<TracePolicy>(policy).emplace(*tracer_);
+  }
+  if (history_) {
+    observer<HistoryPolicy>(policy).emplace(*history_);
+  }
+  if (hotspot_profile_) {
+    observer<HotspotPolicy>(policy).emplace(*hotspot_profile_);
+  }
+  if (call_graph_profile_) {
+    observer<CallGraphPolicy>(policy).emplace(*call_graph_profile_);
+  }
+  if (pipeline_model_) {
+    observer<PipelinePolicy>(policy).emplace(*pipeline_model_);
+  }
+  if (branch_profile_) {
+    observer<BranchPolicy>(policy).emplace(*branch_profile_);
+  }
+  if (cache_hierarchy_) {
+    observer<CachePolicy>(policy).emplace(*cache_hierarchy_);
+  }
+  if (sequence_profile_) {
+    observer<ProfilePolicy>(policy).emplace(*sequence_profile_);
+  }
   if (debug_mode_) {
-    std::cout << "CPU execution stopped after " << cycle_count
+    observer<DebugPolicy>(policy).emplace();
+  }
+  return fn(policy);
+}
+
+CPU::RunResult
+CPU::run_loop(const RunBudget &budget,
+              const std::function<bool(const CPU &)> *predicate) {
+  if (debug_mode_) {
+    std::cout << "Starting CPU execution..." << std::endl;
+  }
+
+  RunResult result = with_policy([&](auto &policy) {
+    policy.begin_run(*this);
+    RunResult r = run_with(policy, budget, predicate);
+    policy.end_run(*this);
+    return r;
+  });
+
+  if (debug_mode_) {
+    std::cout << "CPU execution stopped after " << result.instructions
               << " cycles. Halted: " << (halted_ ? "Yes" : "No") << std::endl;
-    if (cycle_count >= MAX_CYCLES) {
-      std::cout << "Warning: Execution stopped due to cycle limit (possible "
+    if (result.reason == StopReason::BUDGET_EXHAUSTED) {
+      std::cout << "Warning: Execution stopped due to run budget (possible "
                    "infinite loop)"
                 << std::endl;
+    } else if (result.reason == StopReason::FAULT) {
+      std::cout << "Fault: " << fault_code_to_string(fault_.code)
+                << " at PC 0x" << std::hex << std::setw(4)
+                << std::setfill('0') << fault_.pc << " (instruction 0x"
+                << std::setw(4) << fault_.instruction_word << ")" << std::dec
+                << std::setfill(' ') << std::endl;
+    } else if (result.reason != StopReason::HALTED) {
+      std::cout << "Stop reason: " << stop_reason_to_string(result.reason)
+                << std::endl;
     }
   }
+
+  return result;
 }
 
-bool CPU::step() {
-  if (halted_)
-    return false;
+template <typename Policy>
+CPU::RunResult
+CPU::run_with(Policy &policy, const RunBudget &budget,
+              const std::function<bool(const CPU &)> *predicate) {
+  const uint64_t start_cycle = cycle_count_;
+  const bool has_deadline =
+      budget.deadline != std::chrono::steady_clock::time_point::max();
+  waiting_for_input_ = false;
 
-  try {
-    // Fetch-Decode-Execute cycle
-    static uint32_t cycle_count = 0;
-    uint16_t current_pc = registers_.get_pc();
-    fetch();
-    DecodedInstruction instr = decode();
-
-    // Start trace cycle
-    if (tracer_) {
-      tracer_->start_cycle(cycle_count, current_pc);
-      tracer_->record_registers(registers_);
-      DecodedInstrView dv;
-      dv.opcode = static_cast<uint8_t>(instr.opcode);
-      dv.mode = static_cast<uint8_t>(instr.mode);
-      dv.rd = instr.rd;
-      dv.rs = instr.rs;
-      dv.extra_word = instr.extra_word;
-      dv.has_extra_word = instr.has_extra_word;
-      tracer_->record_decoded(dv);
-
-      // attach memory trace callback for this cycle
-      memory_.set_trace_callback(
-          [this](uint16_t addr, uint8_t oldv, uint8_t newv) {
-            MemWriteEvent ev{addr, oldv, newv};
-            if (tracer_)
-              tracer_->record_mem_write(ev);
-          });
+  // The threaded, block and compiled cores have no per-instruction hooks,
+  // so instrumented runs, breakpoints and predicates use the interpreter,
+  // as does a timing model and any slice that starts with the performance
+  // counters enabled
+  const bool per_instruction = engine_ == Engine::INTERPRETER ||
+                               Policy::per_instruction || predicate ||
+                               !breakpoints_.empty() || timing_model_;
+  bool first_instruction = true;
+  StopReason reason = StopReason::HALTED;
+
+  while (true) {
+    if (faulted_) {
+      reason = StopReason::FAULT;
+      break;
+    }
+    if (halted_) {
+      reason = StopReason::HALTED;
+      break;
+    }
+    if (waiting_for_input_) {
+      reason = StopReason::WAITING_IO;
+      break;
     }
 
-    if (debug_mode_) {
-      print_instruction(instr);
+    uint64_t retired = cycle_count_ - start_cycle;
+    if ((budget.max_instructions != 0 &&
+         retired >= budget.max_instructions) ||
+        (has_deadline &&
+         std::chrono::steady_clock::now() >= budget.deadline)) {
+      reason = StopReason::BUDGET_EXHAUSTED;
+      break;
     }
 
-    execute(instr);
+    uint32_t slice = RUN_SLICE;
+    if (budget.max_instructions != 0 &&
+        budget.max_instructions - retired < slice) {
+      slice = static_cast<uint32_t>(budget.max_instructions - retired);
+    }
 
-    // Update timer
-    memory_.tick();
+    if (!per_instruction && !memory_.is_perf_counting()) {
+      leave_engine_ = false;
+      switch (engine_) {
+      case Engine::THREADED:
+        run_threaded(slice);
+        break;
+      case Engine::BLOCK:
+        run_blocks(slice);
+        break;
+      default:
+        run_compiled(slice);
+        break;
+      }
+      continue;
+    }
 
-    // finalize trace entry
-    if (tracer_) {
-      tracer_->end_cycle();
+    bool stop = false;
+    for (uint32_t i = 0; i < slice; ++i) {
+      if (!first_instruction && !breakpoints_.empty() &&
+          breakpoints_.count(registers_.get_pc())) {
+        stop = true;
+        break;
+      }
+      first_instruction = false;
+
+      if (!step_with(policy)) {
+        break; // halted, faulted or waiting; reported above
+      }
+      if (predicate && (*predicate)(*this)) {
+        stop = true;
+        break;
+      }
+    }
+    if (stop) {
+      reason = StopReason::BREAKPOINT;
+      break;
     }
+  }
+
+  return RunResult{reason, cycle_count_ - start_cycle, cycle_count_};
+}
+
+const char *CPU::stop_reason_to_string(StopReason reason) {
+  switch (reason) {
+  case StopReason::HALTED:
+    return "halted";
+  case StopReason::BUDGET_EXHAUSTED:
+    return "budget exhausted";
+  case StopReason::BREAKPOINT:
+    return "breakpoint";
+  case StopReason::FAULT:
+    return "fault";
+  case StopReason::WAITING_IO:
+    return "waiting on input";
+  }
+  return "unknown";
+}
+
+const char *CPU::fault_code_to_string(FaultCode code) {
+  switch (code) {
+  case FaultCode::NONE:
+    return "none";
+  case FaultCode::INVALID_OPCODE:
+    return "invalid opcode";
+  case FaultCode::INVALID_MODE:
+    return "invalid addressing mode";
+  case FaultCode::INVALID_REGISTER:
+    return "invalid register";
+  }
+  return "unknown";
+}
+
+void CPU::raise_fault(FaultCode code) {
+  fault_.code = code;
+  fault_.pc = registers_.get_mar();
+  fault_.instruction_word = registers_.get_ir();
+  faulted_ = true;
+  halted_ = true;
+}
+
+bool CPU::step() {
+  return with_policy([this](auto &policy) {
+    policy.begin_run(*this);
+    bool running = step_with(policy);
+    policy.end_run(*this);
+    return running;
+  });
+}
 
-    ++cycle_count;
-    return !halted_;
-  } catch (const std::exception &e) {
-    std::cerr << "CPU Error: " << e.what() << std::endl;
-    halted_ = true;
+template <typename Policy> bool CPU::step_with(Policy &policy) {
+  if (halted_)
     return false;
+
+  waiting_for_input_ = false;
+
+  // Fetch-Decode-Execute cycle
+  uint16_t current_pc = registers_.get_pc();
+  DecodedInstruction instr = fetch_and_decode();
+
+  policy.before_execute(*this, current_pc, instr);
+
+  // Sampled before execute: the instruction that enables counting is not
+  // counted, the one that disables it is
+  const bool counting = memory_.is_perf_counting();
+  bool taken = false;
+  if (counting) {
+    switch (instr.opcode) {
+    case Opcode::JMP:
+    case Opcode::CALL:
+    case Opcode::RET:
+      taken = true;
+      break;
+    case Opcode::JZ:
+    case Opcode::JNZ:
+    case Opcode::JC:
+    case Opcode::JNC:
+    case Opcode::JN:
+      taken = check_condition(instr.opcode);
+      break;
+    default:
+      break;
+    }
+  }
+
+  execute(instr);
+
+  // IN with no input available, or a fault: the instruction did not retire
+  if (waiting_for_input_ || faulted_) {
+    return false;
+  }
+
+  // Update timer and cycle counter
+  // (the top byte of IR is the instruction's opcode/mode key)
+  const uint32_t cycles =
+      timing_model_
+          ? timing_model_->cost(static_cast<uint8_t>(registers_.get_ir() >> 8))
+          : 1;
+  retire(1, cycles);
+  if (counting) {
+    count_retired(instr, taken, cycles);
+  }
+  policy.after_retire(*this);
+  return !halted_;
+}
+
+void CPU::count_retired(const DecodedInstruction &instr, bool taken,
+                        uint32_t cycles) {
+  uint32_t *live = memory_.perf_counters().live;
+  live[Memory::PERF_CYCLES] += cycles;
+  ++live[Memory::PERF_INSTRUCTIONS];
+  if (taken) {
+    ++live[Memory::PERF_TAKEN_BRANCHES];
+  }
+  live[Memory::PERF_MEMORY_READS] += data_reads(instr.opcode, instr.mode);
+  live[Memory::PERF_MEMORY_WRITES] += data_writes(instr.opcode);
+  if (instr.opcode == Opcode::CALL) {
+    ++live[Memory::PERF_CALL_DEPTH];
+  } else if (instr.opcode == Opcode::RET && live[Memory::PERF_CALL_DEPTH] > 0) {
+    --live[Memory::PERF_CALL_DEPTH];
+  }
+}
+
+uint32_t CPU::data_reads(Opcode opcode, AddressingMode mode) {
+  switch (opcode) {
+  case Opcode::LOAD:
+  case Opcode::POP:
+  case Opcode::RET:
+    return 1;
+  case Opcode::MOV:
+  case Opcode::ADD:
+  case Opcode::SUB:
+  case Opcode::AND:
+  case Opcode::OR:
+  case Opcode::XOR:
+  case Opcode::CMP:
+  case Opcode::SHL:
+  case Opcode::SHR:
+    // Register and immediate operands do not touch memory
+    return mode != AddressingMode::REGISTER &&
+                   mode != AddressingMode::IMMEDIATE
+               ? 1
+               : 0;
+  default:
+    return 0;
+  }
+}
+
+uint32_t CPU::data_writes(Opcode opcode) {
+  switch (opcode) {
+  case Opcode::STORE:
+  case Opcode::PUSH:
+  case Opcode::CALL:
+    return 1;
+  default:
+    return 0;
   }
 }
 
@@ -140,10 +530,219 @@ CPU::DecodedInstruction CPU::decode() {
     registers_.increment_pc(2);
   }
 
+  instr.fault = validate(instr);
   return instr;
 }
 
+CPU::DecodedInstruction CPU::fetch_and_decode() {
+  uint16_t pc = registers_.get_pc();
+
+  // Only cache instructions whose bytes (including a possible extra word)
+  // lie entirely in the program region; anything else may touch I/O.
+  if (!decode_cache_enabled_ || pc < Memory::PROGRAM_START ||
+      pc > Memory::PROGRAM_END - 3) {
+    fetch();
+    return decode();
+  }
+
+  if (decode_cache_.empty()) {
+    decode_cache_.assign(DECODE_CACHE_SIZE, PredecodedEntry{});
+  }
+
+  PredecodedEntry &entry = decode_cache_[pc - Memory::PROGRAM_START];
+  if (!entry.valid) {
+    fetch();
+    entry.instr = decode();
+    entry.instruction_word = registers_.get_ir();
+    entry.valid = true;
+    return entry.instr;
+  }
+
+  // Cache hit: reproduce the architectural side effects of fetch/decode
+  registers_.set_mar(pc);
+  registers_.set_mdr(entry.instruction_word);
+  registers_.set_ir(entry.instruction_word);
+  registers_.increment_pc(entry.instr.has_extra_word ? 4 : 2);
+  return entry.instr;
+}
+
+void CPU::set_decode_cache_enabled(bool enabled) {
+  decode_cache_enabled_ = enabled;
+  flush_decode_cache();
+}
+
+void CPU::set_macro_fusion(bool enabled) {
+  macro_fusion_ = enabled;
+  if (blocks_) {
+    blocks_->flush();
+  }
+}
+
+void CPU::set_superinstructions(bool enabled) {
+  superinstructions_ = enabled;
+  if (blocks_) {
+    blocks_->flush();
+  }
+}
+
+bool CPU::native_code_supported() { return X86Jit::supported(); }
+
+void CPU::flush_decode_cache() {
+  for (auto &entry : decode_cache_) {
+    entry.valid = false;
+  }
+}
+
+void CPU::invalidate_decoded(uint16_t address, uint16_t length) {
+  if (blocks_ && blocks_->covers(address, length)) {
+    blocks_invalidated_ = true;
+    blocks_->mark_self_modifying(address, length);
+  }
+  if (address <= Memory::PROGRAM_END &&
+      static_cast<uint32_t>(address) + length > Memory::PROGRAM_START) {
+    code_modified_ = true;
+  }
+  if (decode_cache_.empty()) {
+    return;
+  }
+  // An entry decoded at PC covers up to 4 bytes (PC..PC+3), so a store to
+  // [address, address + length) can affect entries starting 3 bytes earlier.
+  uint32_t first = address >= 3 ? address - 3u : 0u;
+  uint32_t last = static_cast<uint32_t>(address) + length - 1;
+  if (last < Memory::PROGRAM_START || first > Memory::PROGRAM_END) {
+    return;
+  }
+  if (first < Memory::PROGRAM_START) {
+    first = Memory::PROGRAM_START;
+  }
+  if (last > Memory::PROGRAM_END) {
+    last = Memory::PROGRAM_END;
+  }
+  for (uint32_t a = first; a <= last; ++a) {
+    decode_cache_[a - Memory::PROGRAM_START].valid = false;
+  }
+}
+
+void CPU::store_word(uint16_t address, uint16_t value) {
+  memory_.write_word(address, value);
+  invalidate_decoded(address, 2);
+  if (address == Memory::IO_PERF_CONTROL ||
+      address == Memory::IO_PERF_CONTROL - 1) {
+    leave_engine_ = true;
+  }
+}
+
+void CPU::store_byte(uint16_t address, uint8_t value) {
+  memory_.write_byte(address, value);
+  invalidate_decoded(address, 1);
+  if (address == Memory::IO_PERF_CONTROL) {
+    leave_engine_ = true;
+  }
+}
+
+CPU::DecodedInstruction CPU::decode_at(uint16_t pc,
+                                       uint16_t &instruction_word) {
+  DecodedInstruction instr;
+  instruction_word = memory_.read_word(pc);
+
+  instr.opcode = extract_opcode(instruction_word);
+  instr.mode = extract_mode(instruction_word);
+  instr.rd = extract_rd(instruction_word);
+  instr.rs = extract_rs(instruction_word);
+  instr.has_extra_word = instr.mode == AddressingMode::IMMEDIATE ||
+                         instr.mode == AddressingMode::DIRECT ||
+                         instr.mode == AddressingMode::REGISTER_OFFSET ||
+                         instr.mode == AddressingMode::PC_RELATIVE;
+  instr.extra_word =
+      instr.has_extra_word ? memory_.read_word(static_cast<uint16_t>(pc + 2))
+                           : 0;
+  instr.fault = validate(instr);
+  return instr;
+}
+
+CPU::FaultCode CPU::validate(const DecodedInstruction &instr) {
+  bool uses_rd = true;
+  bool operand_mode = false; // REGISTER..PC_RELATIVE
+  bool address_mode = false; // DIRECT..PC_RELATIVE
+  switch (instr.opcode) {
+  case Opcode::NOP:
+  case Opcode::HALT:
+  case Opcode::RET:
+    // Mode and register fields are ignored
+    return FaultCode::NONE;
+  case Opcode::PUSH:
+  case Opcode::POP:
+    break;
+  case Opcode::LOAD:
+  case Opcode::STORE:
+    address_mode = true;
+    break;
+  case Opcode::JMP:
+  case Opcode::JZ:
+  case Opcode::JNZ:
+  case Opcode::JC:
+  case Opcode::JNC:
+  case Opcode::JN:
+  case Opcode::CALL:
+    uses_rd = false;
+    address_mode = true;
+    break;
+  case Opcode::MOV:
+  case Opcode::ADD:
+  case Opcode::SUB:
+  case Opcode::AND:
+  case Opcode::OR:
+  case Opcode::XOR:
+  case Opcode::CMP:
+  case Opcode::SHL:
+  case Opcode::SHR:
+  case Opcode::IN:
+  case Opcode::OUT:
+    operand_mode = true;
+    break;
+  default:
+    return FaultCode::INVALID_OPCODE;
+  }
+
+  bool uses_rs = false;
+  if (operand_mode || address_mode) {
+    switch (instr.mode) {
+    case AddressingMode::REGISTER:
+      if (address_mode) {
+        return FaultCode::INVALID_MODE;
+      }
+      uses_rs = true;
+      break;
+    case AddressingMode::IMMEDIATE:
+      if (address_mode) {
+        return FaultCode::INVALID_MODE;
+      }
+      break;
+    case AddressingMode::REGISTER_INDIRECT:
+    case AddressingMode::REGISTER_OFFSET:
+      uses_rs = true;
+      break;
+    case AddressingMode::DIRECT:
+    case AddressingMode::PC_RELATIVE:
+      break;
+    default:
+      return FaultCode::INVALID_MODE;
+    }
+  }
+
+  if ((uses_rd && instr.rd > Registers::R3) ||
+      (uses_rs && instr.rs > Registers::R3)) {
+    return FaultCode::INVALID_REGISTER;
+  }
+  return FaultCode::NONE;
+}
+
 void CPU::execute(const DecodedInstruction &instr) {
+  if (instr.fault != FaultCode::NONE) {
+    raise_fault(instr.fault);
+    return;
+  }
+
   switch (instr.opcode) {
   case Opcode::NOP:
     execute_nop();
@@ -213,8 +812,8 @@ void CPU::execute(const DecodedInstruction &instr) {
     execute_io(instr, false);
     break;
   default:
-    throw std::runtime_error("Unknown opcode: " +
-                             std::to_string(static_cast<int>(instr.opcode)));
+    // Undefined opcodes are rejected by validate()
+    break;
   }
 }
 
@@ -260,55 +859,16 @@ void CPU::execute_arithmetic(const DecodedInstruction &instr,
   }
 }
 
-uint16_t CPU::resolve_operand(const DecodedInstruction &instr,
-                              bool is_destination) {
+uint16_t CPU::resolve_operand(const DecodedInstruction &instr) {
   switch (instr.mode) {
   case AddressingMode::REGISTER:
     return registers_.get_gpr(instr.rs);
 
   case AddressingMode::IMMEDIATE:
-    if (is_destination) {
-      throw std::runtime_error("Cannot use immediate mode for destination");
-    }
     return instr.extra_word;
 
-  case AddressingMode::DIRECT:
-    if (is_destination) {
-      memory_.write_word(instr.extra_word, registers_.get_gpr(instr.rd));
-      return 0; // Not used for destination writes
-    }
-    return memory_.read_word(instr.extra_word);
-
-  case AddressingMode::REGISTER_INDIRECT: {
-    uint16_t address = registers_.get_gpr(instr.rs);
-    if (is_destination) {
-      memory_.write_word(address, registers_.get_gpr(instr.rd));
-      return 0;
-    }
-    return memory_.read_word(address);
-  }
-
-  case AddressingMode::REGISTER_OFFSET: {
-    uint16_t address = registers_.get_gpr(instr.rs) + instr.extra_word;
-    if (is_destination) {
-      memory_.write_word(address, registers_.get_gpr(instr.rd));
-      return 0;
-    }
-    return memory_.read_word(address);
-  }
-
-  case AddressingMode::PC_RELATIVE: {
-    uint16_t address =
-        registers_.get_pc() + static_cast<int16_t>(instr.extra_word);
-    if (is_destination) {
-      memory_.write_word(address, registers_.get_gpr(instr.rd));
-      return 0;
-    }
-    return memory_.read_word(address);
-  }
-
   default:
-    throw std::runtime_error("Unsupported addressing mode");
+    return memory_.read_word(calculate_effective_address(instr));
   }
 }
 
@@ -327,7 +887,7 @@ void CPU::print_instruction(const DecodedInstruction &instr) const {
             << std::endl;
 }
 
-std::string CPU::opcode_to_string(Opcode opcode) const {
+std::string CPU::opcode_to_string(Opcode opcode) {
   switch (opcode) {
   case Opcode::NOP:
     return "NOP";
@@ -384,7 +944,7 @@ std::string CPU::opcode_to_string(Opcode opcode) const {
   }
 }
 
-std::string CPU::mode_to_string(AddressingMode mode) const {
+std::string CPU::mode_to_string(AddressingMode mode) {
   switch (mode) {
   case AddressingMode::REGISTER:
     return "REG";
@@ -394,6 +954,8 @@ std::string CPU::mode_to_string(AddressingMode mode) const {
     return "DIR";
   case AddressingMode::REGISTER_INDIRECT:
     return "IND";
+  case AddressingMode::REGISTER_OFFSET:
+    return "OFF";
   case AddressingMode::PC_RELATIVE:
     return "REL";
   default:
@@ -418,7 +980,7 @@ void CPU::execute_store(const DecodedInstruction &instr) {
   // STORE: Write register to memory
   uint16_t address = calculate_effective_address(instr);
   uint16_t value = registers_.get_gpr(instr.rd);
-  memory_.write_word(address, value);
+  store_word(address, value);
 }
 
 void CPU::execute_jump(const DecodedInstruction &instr) {
@@ -464,13 +1026,20 @@ void CPU::execute_io(const DecodedInstruction &instr, bool is_input) {
   if (is_input) {
     // IN: Read from I/O port
     uint16_t port = resolve_operand(instr);
-    uint8_t value = memory_.read_byte(Memory::IO_START + (port & 0xFF));
+    uint16_t address = Memory::IO_START + (port & 0xFF);
+    if (address == Memory::IO_INPUT_DATA && !memory_.is_input_ready()) {
+      // Rewind so the IN is retried when the run resumes
+      waiting_for_input_ = true;
+      registers_.set_pc(registers_.get_pc() - (instr.has_extra_word ? 4 : 2));
+      return;
+    }
+    uint8_t value = memory_.read_byte(address);
     registers_.set_gpr(instr.rd, static_cast<uint16_t>(value));
   } else {
     // OUT: Write to I/O port
     uint16_t port = resolve_operand(instr);
     uint8_t value = static_cast<uint8_t>(registers_.get_gpr(instr.rd) & 0xFF);
-    memory_.write_byte(Memory::IO_START + (port & 0xFF), value);
+    store_byte(Memory::IO_START + (port & 0xFF), value);
   }
 }
 
@@ -486,13 +1055,14 @@ uint16_t CPU::calculate_effective_address(const DecodedInstruction &instr) {
   case AddressingMode::PC_RELATIVE:
     return registers_.get_pc() + static_cast<int16_t>(instr.extra_word);
   default:
-    throw std::runtime_error("Invalid addressing mode for address calculation");
+    // REGISTER/IMMEDIATE/undefined modes are rejected by validate()
+    return 0;
   }
 }
 
 void CPU::push_word(uint16_t value) {
   registers_.push_sp(); // Pre-decrement SP
-  memory_.write_word(registers_.get_sp(), value);
+  store_word(registers_.get_sp(), value);
 }
 
 uint16_t CPU::pop_word() {
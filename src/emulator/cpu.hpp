@@ -4,10 +4,27 @@
 #include "memory.hpp"
 #include "registers.hpp"
 #include "trace_recorder.hpp"
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
+#include <unordered_set>
 #include <vector>
 
+struct Block;
+struct MicroOp;
+class BlockCache;
+class X86Jit;
+class ExecutionHistory;
+class HotspotProfile;
+class CallGraphProfile;
+class BranchProfile;
+class CacheHierarchy;
+class PipelineModel;
+class SequenceProfile;
+class TimingModel;
+
 class CPU {
 public:
   // Instruction opcodes from architecture specification
@@ -49,6 +66,21 @@ public:
     PC_RELATIVE = 5        // PC-relative (extra word)
   };
 
+  // Why an instruction was rejected. Faults are detected when the
+  // instruction is decoded; a faulting instruction has no side effects.
+  enum class FaultCode : uint8_t {
+    NONE = 0,
+    INVALID_OPCODE = 1,  // opcode field above OUT
+    INVALID_MODE = 2,    // mode undefined, or not allowed for the opcode
+    INVALID_REGISTER = 3 // rd/rs names a register above R3
+  };
+
+  struct Fault {
+    FaultCode code = FaultCode::NONE;
+    uint16_t pc = 0;               // address of the faulting instruction
+    uint16_t instruction_word = 0; // its first word
+  };
+
   // Decoded instruction structure
   struct DecodedInstruction {
     Opcode opcode;
@@ -57,18 +89,139 @@ public:
     uint8_t rs;          // Source register (0-3)
     uint16_t extra_word; // For immediate/address/offset
     bool has_extra_word;
+    FaultCode fault; // set by decode; NONE for valid instructions
+  };
+
+  // Interpreter cores selectable at runtime
+  enum class Engine : uint8_t {
+    INTERPRETER = 0, // step(): central switch in execute()
+    THREADED = 1,    // run_threaded(): per-opcode/mode handler table
+    BLOCK = 2,       // run_blocks(): translated, chained basic blocks
+    COMPILED = 3     // run_compiled(): blocks with register-cached state
+  };
+
+  // Why run(), run_for() or run_until() returned
+  enum class StopReason : uint8_t {
+    HALTED,           // HALT executed
+    BUDGET_EXHAUSTED, // instruction budget or wall-clock deadline reached
+    BREAKPOINT,       // breakpoint PC reached or run_until predicate held
+    FAULT,            // instruction raised an error
+    WAITING_IO        // IN from the input port with no input available
+  };
+
+  // Limits for one run_for()/run_until() call. Zero instructions means no
+  // instruction limit; the deadline is checked between slices of
+  // RUN_SLICE instructions.
+  struct RunBudget {
+    uint64_t max_instructions = 0;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+  };
+
+  struct RunResult {
+    StopReason reason;
+    uint64_t instructions; // instructions retired by this call
+    uint64_t cycle;        // instance cycle counter after the call
+  };
+
+  // Counters for the run statistics, accumulated since reset()
+  struct Statistics {
+    uint64_t cycles = 0; // modelled cycles, one per instruction without a model
+    uint64_t fused_pairs = 0; // CMP/SUB + Jcc pairs retired in one dispatch
+    uint64_t superinstructions = 0; // superinstruction dispatches
   };
 
+  // Machine state captured by snapshot(): registers, run state, counters,
+  // timer, performance counters and memory. Memory pages are shared
+  // copy-on-write with the CPU, so a snapshot copies no memory; afterwards
+  // the CPU copies each page on its first write, so repeated snapshots cost
+  // only the pages dirtied in between. Engine settings, breakpoints and I/O
+  // callbacks are not part of a snapshot. snapshot_file.hpp saves and maps
+  // snapshots on disk.
+  struct Snapshot {
+    Registers registers;
+    bool halted = false;
+    bool faulted = false;
+    bool waiting_for_input = false;
+    bool code_modified = false;
+    Fault fault;
+    uint64_t cycle_count = 0;
+    Statistics statistics;
+    uint16_t timer_counter = 0;
+    bool timer_running = false;
+    Memory::PerfCounters perf_counters;
+    MemoryImage memory;
+  };
+
+  static constexpr uint32_t RUN_SLICE = 4096;
+  static const char *stop_reason_to_string(StopReason reason);
+  static const char *fault_code_to_string(FaultCode code);
+  static std::string opcode_to_string(Opcode opcode);
+  static std::string mode_to_string(AddressingMode mode);
+
+  // Fault checks for a decoded instruction (opcode, then mode, then
+  // register fields). Only fields the opcode actually uses are checked.
+  static FaultCode validate(const DecodedInstruction &instr);
+
+  // Data words an instruction reads or writes in memory: operand loads and
+  // stores and the stack word of PUSH, POP, CALL and RET. Instruction
+  // fetch is not included.
+  static uint32_t data_reads(Opcode opcode, AddressingMode mode);
+  static uint32_t data_writes(Opcode opcode);
+
   CPU();
-  ~CPU() = default;
+  ~CPU();
 
   // Main execution interface
-  void reset();
+  void reset(); // Registers and run state; memory is left as it is
+  // Make the CPU as good as new for another run of the loaded program:
+  // memory reverts to the image from the last load_program()/load_image()
+  // (only pages written since are touched), registers, run state, timer
+  // and I/O callbacks are reset and PC is the load address. Engine
+  // settings, breakpoints and instrumentation are kept, and so are cached
+  // decodes and blocks unless the program wrote to its code.
+  void reset_for_reuse();
   void load_program(const std::vector<uint8_t> &program,
                     uint16_t start_address = 0x8000);
-  void run();  // Run until HALT
+  // Map a prepared image copy-on-write (see Memory::capture()) in place of
+  // the whole memory and start at start_address. Many CPUs can share one
+  // image; each pays only for the pages it writes.
+  void load_image(const MemoryImage &image, uint16_t start_address = 0x8000);
+
+  // Clone of this CPU: registers, run state, counters, engine settings,
+  // breakpoints, timer and I/O callbacks are copied and memory is shared
+  // copy-on-write, so the cost is one page copy per page either side
+  // writes afterwards. Trace recorders, sequence profiles and execution
+  // histories are not inherited. Replace the child's I/O callbacks if it
+  // must not share the parent's streams.
+  std::unique_ptr<CPU> fork();
+
+  Snapshot snapshot();
+  void restore(const Snapshot &snapshot);
+  RunResult run(); // Run until HALT, fault or input wait (no budget)
+  RunResult run_for(const RunBudget &budget);
+  // Stop once predicate(cpu) holds after an instruction retires
+  RunResult run_until(const std::function<bool(const CPU &)> &predicate);
+  RunResult run_until(const std::function<bool(const CPU &)> &predicate,
+                      const RunBudget &budget);
   bool step(); // Execute one instruction, return false if HALT
 
+  // Reverse execution (cpu_history.cpp). While a history is attached, runs
+  // use the interpreter and record how to undo each instruction (see
+  // execution_history.hpp); nullptr detaches it.
+  void set_history(std::shared_ptr<ExecutionHistory> history);
+  // Go back to the state before the last retired instruction, or to the
+  // state at an earlier cycle. False, with the CPU unchanged, if the
+  // history does not reach that far.
+  bool step_back();
+  bool run_backwards_to(uint64_t cycle);
+
+  // Breakpoints stop a run before the instruction at pc executes. A run
+  // that starts on a breakpoint executes that instruction first.
+  void add_breakpoint(uint16_t pc) { breakpoints_.insert(pc); }
+  void remove_breakpoint(uint16_t pc) { breakpoints_.erase(pc); }
+  void clear_breakpoints() { breakpoints_.clear(); }
+
   // Trace recorder integration
   void set_trace_recorder(std::shared_ptr<TraceRecorder> recorder) {
     tracer_ = recorder;
@@ -77,12 +230,94 @@ public:
   // CPU state access
   const Registers &get_registers() const { return registers_; }
   const Memory &get_memory() const { return memory_; }
+  // For hooking up host I/O callbacks. Stores made through this reference
+  // bypass the predecode and block caches.
+  Memory &get_memory() { return memory_; }
   bool is_halted() const { return halted_; }
+  bool has_faulted() const { return faulted_; }
+  const Fault &get_fault() const { return fault_; }
+  bool is_waiting_for_input() const { return waiting_for_input_; }
+  uint64_t get_cycle_count() const { return cycle_count_; }
+  const Statistics &get_statistics() const { return stats_; }
 
   // Debug interface
   void dump_state() const;
   void set_debug_mode(bool enabled) { debug_mode_ = enabled; }
 
+  // Engine selection. Traced runs always use the interpreter.
+  void set_engine(Engine engine) { engine_ = engine; }
+  Engine get_engine() const { return engine_; }
+
+  // Predecode cache control (enabled by default)
+  void set_decode_cache_enabled(bool enabled);
+  bool is_decode_cache_enabled() const { return decode_cache_enabled_; }
+
+  // Macro-op fusion of CMP/SUB + Jcc in the block and compiled engines
+  // (enabled by default)
+  void set_macro_fusion(bool enabled);
+  bool is_macro_fusion() const { return macro_fusion_; }
+
+  // Host machine code for the compiled engine (enabled by default). Only
+  // x86-64 hosts have a translator; elsewhere, or with this off, compiled
+  // blocks run through their handlers.
+  void set_native_code(bool enabled) { native_code_ = enabled; }
+  bool is_native_code() const { return native_code_; }
+  static bool native_code_supported();
+
+  // Generated superinstructions in the block engine (enabled by default)
+  void set_superinstructions(bool enabled);
+  bool is_superinstructions() const { return superinstructions_; }
+
+  // Observers. Each setter attaches one to every following run (on the
+  // interpreter) or detaches it with nullptr. Any number can be attached
+  // at once, together with a trace recorder and a history; a run feeds
+  // all of them in a single pass.
+
+  // Count opcode/mode pairs and triples into profile while running
+  void set_sequence_profile(std::shared_ptr<SequenceProfile> profile) {
+    sequence_profile_ = profile;
+  }
+
+  // Count instructions and cycles per PC into profile while running
+  void set_hotspot_profile(std::shared_ptr<HotspotProfile> profile) {
+    hotspot_profile_ = profile;
+  }
+
+  // Charge cycles to call paths in profile while running
+  void set_call_graph_profile(std::shared_ptr<CallGraphProfile> profile) {
+    call_graph_profile_ = profile;
+  }
+
+  // Time retired instructions on a five-stage pipeline model while running
+  void set_pipeline_model(std::shared_ptr<PipelineModel> model) {
+    pipeline_model_ = model;
+  }
+
+  // Run every retired Jcc, JMP, CALL and RET through the predictors of
+  // profile (branch_predictor.hpp) while running
+  void set_branch_profile(std::shared_ptr<BranchProfile> profile) {
+    branch_profile_ = profile;
+  }
+
+  // Pass every instruction fetch and data access through the caches of
+  // hierarchy (cache_model.hpp) while running
+  void set_cache_hierarchy(std::shared_ptr<CacheHierarchy> hierarchy) {
+    cache_hierarchy_ = hierarchy;
+  }
+
+  // Charge each instruction the cycles of model (timing_model.hpp) on the
+  // timer, the cycles statistic and the cycle performance counter, so they
+  // report modelled cycles; runs with a model use the interpreter. nullptr
+  // goes back to one cycle per instruction. The instruction count
+  // (get_cycle_count(), budgets) is not affected.
+  void set_timing_model(std::shared_ptr<const TimingModel> model) {
+    timing_model_ = model;
+  }
+
+  // Lazy condition flags in the ALU (enabled by default)
+  void set_lazy_flags(bool enabled) { alu_.set_lazy_flags(enabled); }
+  bool is_lazy_flags() const { return alu_.is_lazy_flags(); }
+
 private:
   // CPU components
   Memory memory_;
@@ -91,11 +326,125 @@ private:
 
   // CPU state
   bool halted_;
+  bool faulted_;
+  Fault fault_;
+  bool waiting_for_input_;
   bool debug_mode_;
+  Engine engine_;
+  uint64_t cycle_count_; // instructions retired since reset()
+  Statistics stats_;
+  std::unordered_set<uint16_t> breakpoints_;
+
+  RunResult run_loop(const RunBudget &budget,
+                     const std::function<bool(const CPU &)> *predicate);
+
+  // Instrumentation (cpu_instrumentation.hpp). run_loop() and step() pick
+  // a policy from the attached observers and debug_mode_ once and run the
+  // templated core.
+  friend struct TracePolicy;
+  friend struct DebugPolicy;
+  friend struct ProfilePolicy;
+  friend struct HistoryPolicy;
+  friend struct HotspotPolicy;
+  friend struct CallGraphPolicy;
+  friend struct PipelinePolicy;
+  friend struct BranchPolicy;
+  friend struct CachePolicy;
+  template <typename Fn> auto with_policy(Fn &&fn);
+  template <typename Policy>
+  RunResult run_with(Policy &policy, const RunBudget &budget,
+                     const std::function<bool(const CPU &)> *predicate);
+  template <typename Policy> bool step_with(Policy &policy);
+  // Record a fault for the instruction in MAR/IR and stop the CPU
+  void raise_fault(FaultCode code);
+  // Account for n retired instructions taking `cycles` modelled cycles:
+  // timer ticks, cycle statistic and instruction counter. The fast engines
+  // batch this but flush before any instruction that may touch the I/O
+  // page, so devices always see the exact cycle.
+  void retire(uint32_t n) { retire(n, n); }
+  void retire(uint32_t n, uint32_t cycles) {
+    memory_.tick(cycles);
+    cycle_count_ += n;
+    stats_.cycles += cycles;
+  }
+  // Update the live performance counters (memory.hpp) for one retired
+  // instruction; step_with() calls this while counting is enabled
+  void count_retired(const DecodedInstruction &instr, bool taken,
+                     uint32_t cycles);
+  // Set by a CPU store to the performance counter control register. The
+  // threaded, block and compiled cores do not count, so they return at the
+  // next instruction boundary and run_with() picks the interpreter while
+  // counting is enabled.
+  bool leave_engine_;
+
+  // Predecode cache: one entry per byte address of the program region
+  // (0x8000-0xEFFF). Entries are filled on first fetch and invalidated by
+  // any store that overlaps the instruction bytes they were decoded from.
+  struct PredecodedEntry {
+    DecodedInstruction instr;
+    uint16_t instruction_word;
+    bool valid;
+  };
+  static constexpr uint32_t DECODE_CACHE_SIZE =
+      Memory::PROGRAM_END - Memory::PROGRAM_START + 1;
+  std::vector<PredecodedEntry> decode_cache_;
+  bool decode_cache_enabled_;
+
+  // Threaded-code core (cpu_threaded.cpp). Handlers (cpu_handlers.hpp) are
+  // specialised per opcode/addressing-mode pair, which is the top byte of
+  // the instruction word. Returns the number of instructions executed.
+  friend struct InstructionHandlers;
+  uint32_t run_threaded(uint32_t max_instructions);
+
+  // Basic-block core (cpu_blocks.cpp). Blocks are translated once into
+  // micro-op arrays and chained to their successors; a store into
+  // translated code sets blocks_invalidated_ and the cache is flushed
+  // before the next block runs.
+  // A CMP/SUB directly followed by a conditional jump is translated into
+  // one fused micro-op (FusedHandlers) when macro_fusion_ is set.
+  std::unique_ptr<BlockCache> blocks_;
+  bool blocks_invalidated_;
+  bool macro_fusion_;
+  bool superinstructions_;
+  friend struct FusedHandlers;
+  friend struct SuperHandlers;
+  uint32_t run_blocks(uint32_t max_instructions);
+  Block *translate_block(uint16_t pc);
+  // fused: op ran as a fused pair, so the jump was the last instruction
+  void sync_fetch_registers(const MicroOp &op, bool fused);
+
+  // Compiled core (cpu_compiled.cpp). Runs the same blocks with guest
+  // R0-R3/SP/PC/FLAGS held in a local GuestState and falls back to
+  // execute() for I/O accesses and self-modifying code. With native_code_
+  // on an x86-64 host, blocks are translated to machine code by jit_
+  // (jit_x86_64.hpp) and the handlers only finish blocks that native code
+  // left early.
+  friend struct CompiledHandlers;
+  friend class X86Jit;
+  std::unique_ptr<X86Jit> jit_;
+  bool native_code_;
+  uint32_t run_compiled(uint32_t max_instructions);
+
+  // Lockstep engine (lockstep.cpp) keeps this CPU's registers in its own
+  // lane arrays and runs step() for instructions it cannot vectorise.
+  // code_modified_ is set by any CPU store into the program region since
+  // load_program().
+  friend class LockstepEngine;
+  bool code_modified_;
+
+  // snapshot() state without clearing the history (restore() clears it)
+  void restore_state(const Snapshot &snapshot);
+
+  // Memory as loaded, for reset_for_reuse()
+  MemoryImage loaded_image_;
+  uint16_t load_address_;
 
   // Fetch-Decode-Execute cycle
   void fetch();
   DecodedInstruction decode();
+  DecodedInstruction fetch_and_decode();
+  // Decode the instruction at pc without touching CPU registers
+  DecodedInstruction decode_at(uint16_t pc, uint16_t &instruction_word);
   void execute(const DecodedInstruction &instr);
 
   // Instruction decoding helpers
@@ -105,8 +454,7 @@ private:
   uint8_t extract_rs(uint16_t instruction_word);
 
   // Addressing mode resolution
-  uint16_t resolve_operand(const DecodedInstruction &instr,
-                           bool is_destination = false);
+  uint16_t resolve_operand(const DecodedInstruction &instr);
   uint16_t calculate_effective_address(const DecodedInstruction &instr);
 
   // Instruction implementations
@@ -124,6 +472,15 @@ private:
   void execute_pop(const DecodedInstruction &instr);
   void execute_io(const DecodedInstruction &instr, bool is_input);
 
+  // Predecode cache maintenance
+  void flush_decode_cache();
+  void invalidate_decoded(uint16_t address, uint16_t length);
+
+  // Stores issued by the CPU go through these so the predecode cache
+  // stays coherent with memory (self-modifying code)
+  void store_word(uint16_t address, uint16_t value);
+  void store_byte(uint16_t address, uint8_t value);
+
   // Helper functions
   void push_word(uint16_t value);
   uint16_t pop_word();
@@ -131,7 +488,13 @@ private:
 
   // Debug helpers
   void print_instruction(const DecodedInstruction &instr) const;
-  std::string opcode_to_string(Opcode opcode) const;
-  std::string mode_to_string(AddressingMode mode) const;
   std::shared_ptr<TraceRecorder> tracer_;
+  std::shared_ptr<SequenceProfile> sequence_profile_;
+  std::shared_ptr<ExecutionHistory> history_;
+  std::shared_ptr<HotspotProfile> hotspot_profile_;
+  std::shared_ptr<CallGraphProfile> call_graph_profile_;
+  std::shared_ptr<PipelineModel> pipeline_model_;
+  std::shared_ptr<BranchProfile> branch_profile_;
+  std::shared_ptr<CacheHierarchy> cache_hierarchy_;
+  std::shared_ptr<const TimingModel> timing_model_;
 };
\ No newline at end of file
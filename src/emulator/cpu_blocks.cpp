@@ -0,0 +1,310 @@
+#include "block_cache.hpp"
+#include "superinstructions.hpp"
+
+// Basic-block engine.
+//
+// Straight-line runs of instructions ending at JMP/Jcc/CALL/RET/HALT are
+// decoded once into a Block of MicroOps, each carrying its specialised
+// handler from cpu_handlers.hpp. Block exits are linked to the successor
+// blocks they lead to, so steady-state loops go from block to block
+// without a cache lookup. Between instructions only PC and a pending
+// timer tick count are maintained; the ticks are applied to the timer
+// right before an instruction that could observe it and at block exit.
+//
+// Loop conditions are usually a CMP or SUB immediately followed by a
+// conditional jump. Such pairs are fused into one MicroOp: the ALU
+// operation still records FLAGS as usual, but the branch decision is taken
+// from the operands directly and both instructions retire in one dispatch.
+// Other frequent sequences run as generated superinstructions
+// (superinstructions.cpp).
+
+namespace {
+
+constexpr size_t MAX_BLOCK_LENGTH = 64;
+
+bool ends_block(CPU::Opcode opcode) {
+  switch (opcode) {
+  case CPU::Opcode::HALT:
+  case CPU::Opcode::JMP:
+  case CPU::Opcode::JZ:
+  case CPU::Opcode::JNZ:
+  case CPU::Opcode::JC:
+  case CPU::Opcode::JNC:
+  case CPU::Opcode::JN:
+  case CPU::Opcode::CALL:
+  case CPU::Opcode::RET:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether executing op may read or write the I/O page (and so observe the
+// timer). Memory operands with an address known at translation time are
+// checked directly; anything register-based is assumed to.
+bool may_touch_io(const CPU::DecodedInstruction &instr, uint16_t next_pc) {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+
+  switch (instr.opcode) {
+  case Opcode::NOP:
+  case Opcode::HALT:
+  case Opcode::JMP:
+  case Opcode::JZ:
+  case Opcode::JNZ:
+  case Opcode::JC:
+  case Opcode::JNC:
+  case Opcode::JN:
+    return false;
+  case Opcode::CALL:
+  case Opcode::RET:
+  case Opcode::PUSH:
+  case Opcode::POP:
+  case Opcode::IN:
+  case Opcode::OUT:
+    return true;
+  default:
+    break;
+  }
+
+  switch (instr.mode) {
+  case AddressingMode::REGISTER:
+  case AddressingMode::IMMEDIATE:
+    return false;
+  case AddressingMode::DIRECT:
+    return is_io_word(instr.extra_word);
+  case AddressingMode::PC_RELATIVE:
+    return is_io_word(
+        static_cast<uint16_t>(next_pc + static_cast<int16_t>(instr.extra_word)));
+  default:
+    return true;
+  }
+}
+
+bool may_fuse(const CPU::DecodedInstruction &instr) {
+  return (instr.opcode == CPU::Opcode::CMP ||
+          instr.opcode == CPU::Opcode::SUB) &&
+         (instr.mode == CPU::AddressingMode::REGISTER ||
+          instr.mode == CPU::AddressingMode::IMMEDIATE);
+}
+
+} // namespace
+
+struct FusedHandlers {
+  using Fused = FusedHandler;
+
+  // PC already points past the jump when this runs
+  template <uint8_t Op, uint8_t Mode, uint8_t Branch>
+  static void fused(CPU &cpu, const MicroOp &op) {
+    constexpr ALU::Operation alu_op = InstructionHandlers::alu_operation(Op);
+    const CPU::DecodedInstruction &instr = op.instr;
+    uint16_t a = cpu.registers_.get_gpr(instr.rd);
+    uint16_t b = InstructionHandlers::operand<Mode>(cpu, instr);
+    cpu.alu_.template execute<alu_op>(a, b, cpu.registers_);
+    uint16_t result = static_cast<uint16_t>(a - b);
+    if constexpr (alu_op == ALU::Operation::SUB) {
+      cpu.registers_.set_gpr(instr.rd, result);
+    }
+    if (fused_condition<Branch>(a, b, result)) {
+      cpu.registers_.set_pc(op.branch_target);
+    }
+  }
+};
+
+FusedHandler fused_handler_for(const CPU::DecodedInstruction &first,
+                               const CPU::DecodedInstruction &branch) {
+  return select_fused<FusedHandlers>(first, branch);
+}
+
+// MAR/MDR/IR are only written back for the last instruction of a block;
+// nothing can observe them in between.
+void CPU::sync_fetch_registers(const MicroOp &op, bool fused) {
+  if (fused) {
+    registers_.set_mar(static_cast<uint16_t>(
+        op.branch_next_pc - (op.branch.has_extra_word ? 4 : 2)));
+    registers_.set_mdr(op.branch_word);
+    registers_.set_ir(op.branch_word);
+    return;
+  }
+  registers_.set_mar(
+      static_cast<uint16_t>(op.next_pc - (op.instr.has_extra_word ? 4 : 2)));
+  registers_.set_mdr(op.instruction_word);
+  registers_.set_ir(op.instruction_word);
+}
+
+Block *CPU::translate_block(uint16_t pc) {
+  const InstructionHandler *handlers = instruction_handler_table();
+  auto block = std::make_unique<Block>();
+  block->start_pc = pc;
+
+  uint16_t current = pc;
+  while (block->ops.size() < MAX_BLOCK_LENGTH &&
+         current >= Memory::PROGRAM_START &&
+         current <= Memory::PROGRAM_END - 3) {
+    MicroOp op;
+    op.instr = decode_at(current, op.instruction_word);
+    if (op.instr.fault != FaultCode::NONE) {
+      // Left to the single-instruction path, which raises the fault
+      break;
+    }
+    op.handler = handlers[op.instruction_word >> 8];
+    op.compiled = compiled_handler_for(op.instr);
+    op.next_pc =
+        static_cast<uint16_t>(current + (op.instr.has_extra_word ? 4 : 2));
+    op.sync_timer = may_touch_io(op.instr, op.next_pc);
+
+    if (macro_fusion_ && may_fuse(op.instr) &&
+        op.next_pc <= Memory::PROGRAM_END - 3) {
+      op.branch = decode_at(op.next_pc, op.branch_word);
+      op.fused = fused_handler_for(op.instr, op.branch);
+      if (op.fused) {
+        op.fused_compiled = compiled_fused_handler_for(op.instr, op.branch);
+        op.branch_next_pc = static_cast<uint16_t>(
+            op.next_pc + (op.branch.has_extra_word ? 4 : 2));
+        op.branch_target =
+            op.branch.mode == AddressingMode::DIRECT
+                ? op.branch.extra_word
+                : static_cast<uint16_t>(
+                      op.branch_next_pc +
+                      static_cast<int16_t>(op.branch.extra_word));
+        block->ops.push_back(op);
+        current = op.branch_next_pc;
+        break; // the jump ends the block
+      }
+    }
+    block->ops.push_back(op);
+
+    current = op.next_pc;
+    if (ends_block(op.instr.opcode)) {
+      break;
+    }
+  }
+
+  if (block->ops.empty()) {
+    return nullptr;
+  }
+  if (superinstructions_) {
+    apply_superinstructions(block->ops);
+  }
+  block->end_pc = current;
+  return blocks_->insert(std::move(block));
+}
+
+uint32_t CPU::run_blocks(uint32_t max_instructions) {
+  uint32_t executed = 0;
+  if (halted_ || max_instructions == 0) {
+    return executed;
+  }
+  waiting_for_input_ = false;
+  if (!blocks_) {
+    blocks_ = std::make_unique<BlockCache>();
+  }
+
+  Block *block = nullptr;
+  const MicroOp *last = nullptr;
+  bool last_fused = false;
+  uint32_t pending_ticks = 0;
+  uint64_t fused_pairs = 0;
+  uint64_t supers = 0;
+
+  while (!halted_ && !waiting_for_input_ && !leave_engine_ &&
+         executed < max_instructions) {
+    uint16_t pc = registers_.get_pc();
+
+    // Follow a chained exit if one matches, otherwise look up/translate
+    Block *next = nullptr;
+    if (block) {
+      if (block->successor[0] && block->successor_pc[0] == pc) {
+        next = block->successor[0];
+      } else if (block->successor[1] && block->successor_pc[1] == pc) {
+        next = block->successor[1];
+      }
+    }
+    if (!next) {
+      next = blocks_->find(pc);
+      if (!next) {
+        next = translate_block(pc);
+      }
+      if (!next) {
+        // Outside the translatable region: run one instruction directly
+        block = nullptr;
+        execute(fetch_and_decode());
+        if (!waiting_for_input_ && !faulted_) {
+          retire(1);
+          ++executed;
+        }
+        continue;
+      }
+      if (block) {
+        int slot = block->successor[0] ? 1 : 0;
+        block->successor[slot] = next;
+        block->successor_pc[slot] = pc;
+      }
+    }
+    block = next;
+
+    const MicroOp *ops = block->ops.data();
+    const size_t count = block->ops.size();
+    for (size_t i = 0; i < count; ++i) {
+      const MicroOp &op = ops[i];
+      if (executed >= max_instructions) {
+        break;
+      }
+      if (op.super && max_instructions - executed >= op.super_length) {
+        uint32_t parts = op.super(*this, &op, pending_ticks);
+        last = &ops[i + parts - 1];
+        last_fused = last->fused != nullptr;
+        executed += parts + (last_fused ? 1 : 0);
+        fused_pairs += last_fused ? 1 : 0;
+        ++supers;
+        i += parts - 1;
+        if (blocks_invalidated_ || leave_engine_) {
+          break;
+        }
+        continue;
+      }
+      if (op.sync_timer && pending_ticks) {
+        retire(pending_ticks);
+        pending_ticks = 0;
+      }
+      last = &op;
+      // A fused pair runs split if the budget ends between its halves
+      last_fused = op.fused && max_instructions - executed >= 2;
+      if (last_fused) {
+        registers_.set_pc(op.branch_next_pc);
+        op.fused(*this, op);
+        pending_ticks += 2;
+        executed += 2;
+        ++fused_pairs;
+        continue;
+      }
+      registers_.set_pc(op.next_pc);
+      op.handler(*this, op.instr);
+      if (waiting_for_input_) {
+        break;
+      }
+      ++pending_ticks;
+      ++executed;
+      if (blocks_invalidated_ || leave_engine_) {
+        break;
+      }
+    }
+
+    retire(pending_ticks);
+    pending_ticks = 0;
+    if (last) {
+      sync_fetch_registers(*last, last_fused);
+      last = nullptr;
+    }
+
+    if (blocks_invalidated_) {
+      blocks_->flush();
+      blocks_invalidated_ = false;
+      block = nullptr;
+    }
+  }
+
+  stats_.fused_pairs += fused_pairs;
+  stats_.superinstructions += supers;
+  return executed;
+}
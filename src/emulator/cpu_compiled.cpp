@@ -0,0 +1,459 @@
+#include "block_cache.hpp"
+#include "jit_x86_64.hpp"
+
+// Compiled block engine.
+//
+// Uses the blocks built by translate_block(), but runs each MicroOp through
+// a register-cached handler: guest R0-R3, SP, PC and FLAGS are kept in a
+// local GuestState for as long as execution stays inside compiled code and
+// are only written back to Registers when the run ends or an instruction
+// has to go through the interpreter. Flags are computed inline with the
+// same rules as ALU::execute().
+//
+// Fused CMP/SUB + Jcc micro-ops compute the flags into GuestState and
+// branch on them in the same handler.
+//
+// Instructions fall back to CPU::execute() when they access the I/O page,
+// are HALT/IN/OUT, or live on a code page that has been overwritten since
+// it was translated. Faulting instructions end translation and are raised
+// by the single-instruction path.
+//
+// On x86-64 hosts the handlers are the fallback: each block is first
+// translated to machine code (jit_x86_64.cpp) and run_compiled() only
+// dispatches between native runs, finishing with the handlers any block
+// that native code left early.
+
+namespace {
+
+constexpr uint8_t FLAG_Z = 1 << Registers::FLAG_Z;
+constexpr uint8_t FLAG_N = 1 << Registers::FLAG_N;
+constexpr uint8_t FLAG_C = 1 << Registers::FLAG_C;
+constexpr uint8_t FLAG_V = 1 << Registers::FLAG_V;
+
+inline uint8_t zn_flags(uint16_t result) {
+  return static_cast<uint8_t>((result == 0 ? FLAG_Z : 0) |
+                              ((result & 0x8000) ? FLAG_N : 0));
+}
+
+} // namespace
+
+struct CompiledHandlers {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+  using Ops = InstructionHandlers;
+  using Fused = CompiledHandler;
+
+  // ALU operation with flags, matching ALU::execute<Op>()
+  template <ALU::Operation Op>
+  static inline uint16_t alu(uint16_t a, uint16_t b, uint8_t &flags) {
+    if constexpr (Op == ALU::Operation::ADD) {
+      uint32_t wide = static_cast<uint32_t>(a) + b;
+      uint16_t result = static_cast<uint16_t>(wide);
+      bool overflow = ((a ^ b) & 0x8000) == 0 && ((a ^ result) & 0x8000);
+      flags = static_cast<uint8_t>(zn_flags(result) |
+                                   (wide > 0xFFFF ? FLAG_C : 0) |
+                                   (overflow ? FLAG_V : 0));
+      return result;
+    } else if constexpr (Op == ALU::Operation::SUB ||
+                         Op == ALU::Operation::CMP) {
+      uint16_t result = static_cast<uint16_t>(a - b);
+      bool overflow = ((a ^ b) & 0x8000) && ((a ^ result) & 0x8000);
+      flags = static_cast<uint8_t>(zn_flags(result) | (a < b ? FLAG_C : 0) |
+                                   (overflow ? FLAG_V : 0));
+      return Op == ALU::Operation::CMP ? a : result;
+    } else if constexpr (Op == ALU::Operation::AND) {
+      uint16_t result = a & b;
+      flags = zn_flags(result);
+      return result;
+    } else if constexpr (Op == ALU::Operation::OR) {
+      uint16_t result = a | b;
+      flags = zn_flags(result);
+      return result;
+    } else if constexpr (Op == ALU::Operation::XOR) {
+      uint16_t result = a ^ b;
+      flags = zn_flags(result);
+      return result;
+    } else if constexpr (Op == ALU::Operation::SHL) {
+      bool carry = b > 0 && b <= 16 && (a & (1 << (16 - b))) != 0;
+      uint16_t result = b >= 16 ? 0 : static_cast<uint16_t>(a << b);
+      flags = static_cast<uint8_t>(zn_flags(result) | (carry ? FLAG_C : 0));
+      return result;
+    } else {
+      bool carry = b > 0 && b <= 16 && (a & (1 << (b - 1))) != 0;
+      uint16_t result = b >= 16 ? 0 : static_cast<uint16_t>(a >> b);
+      flags = static_cast<uint8_t>(zn_flags(result) | (carry ? FLAG_C : 0));
+      return result;
+    }
+  }
+
+  template <uint8_t Mode>
+  static inline uint16_t address(const GuestState &s, const MicroOp &op) {
+    constexpr AddressingMode m = static_cast<AddressingMode>(Mode);
+    if constexpr (m == AddressingMode::DIRECT) {
+      return op.instr.extra_word;
+    } else if constexpr (m == AddressingMode::REGISTER_INDIRECT) {
+      return s.gpr[op.instr.rs];
+    } else if constexpr (m == AddressingMode::REGISTER_OFFSET) {
+      return static_cast<uint16_t>(s.gpr[op.instr.rs] + op.instr.extra_word);
+    } else {
+      return static_cast<uint16_t>(s.pc +
+                                   static_cast<int16_t>(op.instr.extra_word));
+    }
+  }
+
+  // Source operand; false if it would read the I/O page
+  template <uint8_t Mode>
+  static inline bool operand(CPU &cpu, const GuestState &s, const MicroOp &op,
+                             uint16_t &value) {
+    constexpr AddressingMode m = static_cast<AddressingMode>(Mode);
+    if constexpr (m == AddressingMode::REGISTER) {
+      value = s.gpr[op.instr.rs];
+    } else if constexpr (m == AddressingMode::IMMEDIATE) {
+      value = op.instr.extra_word;
+    } else {
+      uint16_t addr = address<Mode>(s, op);
+      if (is_io_word(addr)) {
+        return false;
+      }
+      value = cpu.memory_.read_word(addr);
+    }
+    return true;
+  }
+
+  template <uint8_t Op> static inline bool condition(uint8_t flags) {
+    constexpr Opcode o = static_cast<Opcode>(Op);
+    if constexpr (o == Opcode::JMP || o == Opcode::CALL) {
+      return true;
+    } else if constexpr (o == Opcode::JZ) {
+      return (flags & FLAG_Z) != 0;
+    } else if constexpr (o == Opcode::JNZ) {
+      return (flags & FLAG_Z) == 0;
+    } else if constexpr (o == Opcode::JC) {
+      return (flags & FLAG_C) != 0;
+    } else if constexpr (o == Opcode::JNC) {
+      return (flags & FLAG_C) == 0;
+    } else {
+      return (flags & FLAG_N) != 0;
+    }
+  }
+
+  // CMP/SUB + Jcc pair; s.pc already points past the jump
+  template <uint8_t Op, uint8_t Mode, uint8_t Branch>
+  static bool fused(CPU &, GuestState &s, const MicroOp &op) {
+    constexpr ALU::Operation alu_op = Ops::alu_operation(Op);
+    const CPU::DecodedInstruction &instr = op.instr;
+    uint16_t a = s.gpr[instr.rd];
+    uint16_t b = static_cast<AddressingMode>(Mode) == AddressingMode::REGISTER
+                     ? s.gpr[instr.rs]
+                     : instr.extra_word;
+    uint16_t result = alu<alu_op>(a, b, s.flags);
+    if constexpr (alu_op == ALU::Operation::SUB) {
+      s.gpr[instr.rd] = result;
+    }
+    if (fused_condition<Branch>(a, b, static_cast<uint16_t>(a - b))) {
+      s.pc = op.branch_target;
+    }
+    return true;
+  }
+
+  template <uint8_t Op, uint8_t Mode>
+  static bool exec(CPU &cpu, GuestState &s, const MicroOp &op) {
+    constexpr Opcode o = static_cast<Opcode>(Op);
+    const CPU::DecodedInstruction &instr = op.instr;
+
+    if constexpr (o == Opcode::NOP) {
+      return true;
+    } else if constexpr (o == Opcode::MOV && Ops::is_operand_mode(Mode)) {
+      uint16_t value;
+      if (!operand<Mode>(cpu, s, op, value)) {
+        return false;
+      }
+      s.gpr[instr.rd] = value;
+      return true;
+    } else if constexpr (Ops::is_alu(Op) && Ops::is_operand_mode(Mode)) {
+      constexpr ALU::Operation alu_op = Ops::alu_operation(Op);
+      uint16_t operand_b;
+      if (!operand<Mode>(cpu, s, op, operand_b)) {
+        return false;
+      }
+      uint16_t result = alu<alu_op>(s.gpr[instr.rd], operand_b, s.flags);
+      if constexpr (alu_op != ALU::Operation::CMP) {
+        s.gpr[instr.rd] = result;
+      }
+      return true;
+    } else if constexpr (o == Opcode::LOAD && Ops::is_address_mode(Mode)) {
+      uint16_t addr = address<Mode>(s, op);
+      if (is_io_word(addr)) {
+        return false;
+      }
+      s.gpr[instr.rd] = cpu.memory_.read_word(addr);
+      return true;
+    } else if constexpr (o == Opcode::STORE && Ops::is_address_mode(Mode)) {
+      uint16_t addr = address<Mode>(s, op);
+      if (is_io_word(addr)) {
+        return false;
+      }
+      cpu.store_word(addr, s.gpr[instr.rd]);
+      return true;
+    } else if constexpr (Ops::is_branch(Op) && Ops::is_address_mode(Mode)) {
+      if (!condition<Op>(s.flags)) {
+        return true;
+      }
+      uint16_t target = address<Mode>(s, op);
+      if constexpr (o == Opcode::CALL) {
+        uint16_t sp = static_cast<uint16_t>(s.sp - 2);
+        if (is_io_word(sp)) {
+          return false;
+        }
+        s.sp = sp;
+        cpu.store_word(sp, s.pc);
+      }
+      s.pc = target;
+      return true;
+    } else if constexpr (o == Opcode::RET || o == Opcode::POP) {
+      if (is_io_word(s.sp)) {
+        return false;
+      }
+      uint16_t value = cpu.memory_.read_word(s.sp);
+      s.sp = static_cast<uint16_t>(s.sp + 2);
+      if constexpr (o == Opcode::RET) {
+        s.pc = value;
+      } else {
+        s.gpr[instr.rd] = value;
+      }
+      return true;
+    } else if constexpr (o == Opcode::PUSH) {
+      uint16_t sp = static_cast<uint16_t>(s.sp - 2);
+      if (is_io_word(sp)) {
+        return false;
+      }
+      s.sp = sp;
+      cpu.store_word(sp, s.gpr[instr.rd]);
+      return true;
+    } else {
+      // HALT, IN, OUT and undefined encodings always use the interpreter
+      (void)cpu;
+      (void)s;
+      (void)instr;
+      return false;
+    }
+  }
+};
+
+CompiledHandler compiled_handler_for(const CPU::DecodedInstruction &instr) {
+  using Opcode = CPU::Opcode;
+
+#define SOFTCPU_COMPILED_ADDRESS(OP, MODE) &CompiledHandlers::exec<OP, MODE>,
+  static const CompiledHandler handlers[256] = {
+      SOFTCPU_HANDLERS(SOFTCPU_COMPILED_ADDRESS)};
+#undef SOFTCPU_COMPILED_ADDRESS
+
+  // Faulting instructions are never translated; HALT and I/O always go
+  // through the interpreter
+  if (instr.fault != CPU::FaultCode::NONE || instr.opcode == Opcode::HALT ||
+      instr.opcode == Opcode::IN || instr.opcode == Opcode::OUT) {
+    return nullptr;
+  }
+  uint8_t op = static_cast<uint8_t>(instr.opcode);
+  uint8_t mode = static_cast<uint8_t>(instr.mode);
+  return handlers[(op << 3) | mode];
+}
+
+CompiledHandler
+compiled_fused_handler_for(const CPU::DecodedInstruction &first,
+                           const CPU::DecodedInstruction &branch) {
+  return select_fused<CompiledHandlers>(first, branch);
+}
+
+uint32_t CPU::run_compiled(uint32_t max_instructions) {
+  uint32_t executed = 0;
+  if (halted_ || max_instructions == 0) {
+    return executed;
+  }
+  waiting_for_input_ = false;
+  if (!blocks_) {
+    blocks_ = std::make_unique<BlockCache>();
+  }
+
+  GuestState state;
+  auto load_state = [&]() {
+    for (uint8_t i = 0; i < 4; ++i) {
+      state.gpr[i] = registers_.get_gpr(i);
+    }
+    state.sp = registers_.get_sp();
+    state.pc = registers_.get_pc();
+    state.flags = registers_.get_flags();
+  };
+  auto store_state = [&]() {
+    for (uint8_t i = 0; i < 4; ++i) {
+      registers_.set_gpr(i, state.gpr[i]);
+    }
+    registers_.set_sp(state.sp);
+    registers_.set_pc(state.pc);
+    registers_.set_flags(state.flags);
+  };
+
+  X86Jit *jit = nullptr;
+  if (native_code_ && X86Jit::supported()) {
+    if (!jit_) {
+      jit_ = std::make_unique<X86Jit>(*this);
+    }
+    if (jit_->ready()) {
+      jit = jit_.get();
+    }
+  }
+
+  Block *block = nullptr;
+  const MicroOp *last = nullptr;
+  bool last_fused = false;
+  uint32_t pending_ticks = 0;
+  uint64_t fused_pairs = 0;
+  uint8_t *link = nullptr; // native exit that led to state.pc
+  load_state();
+
+  while (!halted_ && !waiting_for_input_ && !leave_engine_ &&
+         executed < max_instructions) {
+    uint16_t pc = state.pc;
+    uint8_t *link_site = link;
+    link = nullptr;
+
+    Block *next = nullptr;
+    if (block) {
+      if (block->successor[0] && block->successor_pc[0] == pc) {
+        next = block->successor[0];
+      } else if (block->successor[1] && block->successor_pc[1] == pc) {
+        next = block->successor[1];
+      }
+    }
+    if (!next && !blocks_->is_self_modifying(pc)) {
+      next = blocks_->find(pc);
+      if (!next) {
+        next = translate_block(pc);
+      }
+      if (next && block) {
+        int slot = block->successor[0] ? 1 : 0;
+        block->successor[slot] = next;
+        block->successor_pc[slot] = pc;
+      }
+    }
+    if (!next) {
+      // Untranslatable or self-modifying code: interpret one instruction
+      block = nullptr;
+      retire(pending_ticks);
+      pending_ticks = 0;
+      store_state();
+      execute(fetch_and_decode());
+      load_state();
+      if (!waiting_for_input_ && !faulted_) {
+        retire(1);
+        ++executed;
+      }
+      continue;
+    }
+    block = next;
+
+    size_t first = 0;
+    if (jit) {
+      if (!block->native && !jit->translate(*block, *blocks_)) {
+        // Code buffer full: drop every block and its code, then retranslate
+        blocks_->flush();
+        block = nullptr;
+        continue;
+      }
+      if (link_site) {
+        jit->link(link_site, *block);
+      }
+
+      X86Jit::Frame frame;
+      frame.state = state;
+      frame.budget = max_instructions - executed;
+      frame.entry = block->native;
+      jit->run(frame);
+      uint32_t ran = max_instructions - executed - frame.budget;
+      executed += ran;
+      pending_ticks += ran;
+      fused_pairs += frame.fused_pairs;
+      state = frame.state;
+      block = frame.block;
+
+      switch (frame.exit) {
+      case X86Jit::Exit::BLOCK_END:
+        last = &block->ops.back();
+        last_fused = last->fused_compiled != nullptr;
+        link = frame.link;
+        first = block->ops.size();
+        break;
+      case X86Jit::Exit::SIDE_EXIT:
+        if (frame.op > 0) {
+          last = &block->ops[frame.op - 1];
+          last_fused = false;
+        }
+        first = frame.op;
+        break;
+      case X86Jit::Exit::LEAVE:
+        last = &block->ops[frame.op];
+        last_fused = false;
+        first = block->ops.size();
+        break;
+      case X86Jit::Exit::BUDGET:
+        if (frame.previous) {
+          last = frame.previous;
+          last_fused = last->fused_compiled != nullptr;
+        }
+        break;
+      }
+    }
+
+    // The rest of the block, or all of it without native code
+    for (size_t i = first; i < block->ops.size(); ++i) {
+      const MicroOp &op = block->ops[i];
+      if (executed >= max_instructions) {
+        break;
+      }
+      last = &op;
+      // A fused pair runs split if the budget ends between its halves
+      last_fused = op.fused_compiled && max_instructions - executed >= 2;
+      if (last_fused) {
+        state.pc = op.branch_next_pc;
+        op.fused_compiled(*this, state, op);
+        pending_ticks += 2;
+        executed += 2;
+        ++fused_pairs;
+        continue;
+      }
+      state.pc = op.next_pc;
+      if (!op.compiled || !op.compiled(*this, state, op)) {
+        retire(pending_ticks);
+        pending_ticks = 0;
+        store_state();
+        execute(op.instr);
+        load_state();
+        if (waiting_for_input_) {
+          break;
+        }
+      }
+      ++pending_ticks;
+      ++executed;
+      if (halted_ || blocks_invalidated_ || leave_engine_) {
+        break;
+      }
+    }
+
+    if (last) {
+      sync_fetch_registers(*last, last_fused);
+      last = nullptr;
+    }
+
+    if (blocks_invalidated_) {
+      blocks_->flush();
+      blocks_invalidated_ = false;
+      block = nullptr;
+    }
+  }
+
+  retire(pending_ticks);
+  store_state();
+
+  stats_.fused_pairs += fused_pairs;
+  return executed;
+}
@@ -0,0 +1,182 @@
+#include "cpu_fleet.hpp"
+#include "lockstep.hpp"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Work-stealing pool.
+//
+// Jobs are dealt round-robin into one deque per worker up front. A worker
+// takes jobs from the back of its own deque and, once that is empty,
+// steals from the front of the others. No jobs are added while the pool
+// runs, so a worker that finds every deque empty is done. With lockstep
+// lanes set, a queue entry is a group of consecutive jobs instead.
+
+namespace {
+
+class WorkQueue {
+public:
+  void push(size_t job) { jobs_.push_back(job); }
+
+  bool pop(size_t &job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    job = jobs_.back();
+    jobs_.pop_back();
+    return true;
+  }
+
+  bool steal(size_t &job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    job = jobs_.front();
+    jobs_.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex_;
+  std::deque<size_t> jobs_;
+};
+
+} // namespace
+
+CpuFleet::CpuFleet(std::vector<uint8_t> program, uint16_t start_address)
+    : program_(std::move(program)), start_address_(start_address),
+      engine_(CPU::Engine::COMPILED), max_instructions_(0), threads_(0),
+      lockstep_lanes_(0) {}
+
+CpuFleet::Result CpuFleet::run_job(const Job &job, CPU &cpu) const {
+  Result result;
+  result.name = job.name;
+
+  cpu.reset_for_reuse();
+  size_t input_pos = 0;
+  Memory &memory = cpu.get_memory();
+  memory.set_input_ready_callback(
+      [&]() { return input_pos < job.input.size(); });
+  memory.set_input_callback([&]() { return job.input[input_pos++]; });
+  memory.set_output_callback(
+      [&](uint8_t value) { result.output.push_back(value); });
+
+  CPU::RunBudget budget;
+  budget.max_instructions = max_instructions_;
+  CPU::RunResult run = cpu.run_for(budget);
+
+  result.reason = run.reason;
+  result.instructions = run.instructions;
+  result.cycle = run.cycle;
+  result.fault = cpu.get_fault();
+  for (uint8_t i = 0; i < 4; ++i) {
+    result.gpr[i] = cpu.get_registers().get_gpr(i);
+  }
+  // The callbacks refer to this job's buffers
+  memory.reset_io();
+  return result;
+}
+
+void CpuFleet::run_lockstep(size_t first, size_t count,
+                            const MemoryImage &image,
+                            std::vector<Result> &results) const {
+  LockstepEngine engine(image, count, start_address_);
+  std::vector<size_t> input_pos(count, 0);
+  for (size_t lane = 0; lane < count; ++lane) {
+    const Job &job = jobs_[first + lane];
+    Result &result = results[first + lane];
+    size_t &pos = input_pos[lane];
+    result.name = job.name;
+    Memory &memory = engine.lane(lane).get_memory();
+    memory.set_input_ready_callback(
+        [&job, &pos]() { return pos < job.input.size(); });
+    memory.set_input_callback([&job, &pos]() { return job.input[pos++]; });
+    memory.set_output_callback(
+        [&result](uint8_t value) { result.output.push_back(value); });
+  }
+
+  engine.run(max_instructions_);
+
+  for (size_t lane = 0; lane < count; ++lane) {
+    const CPU &cpu = engine.lane(lane);
+    Result &result = results[first + lane];
+    result.reason = engine.stop_reason(lane);
+    result.instructions = cpu.get_cycle_count();
+    result.cycle = cpu.get_cycle_count();
+    result.fault = cpu.get_fault();
+    for (uint8_t i = 0; i < 4; ++i) {
+      result.gpr[i] = cpu.get_registers().get_gpr(i);
+    }
+  }
+}
+
+CpuFleet::Report CpuFleet::run() const {
+  Report report;
+  report.results.resize(jobs_.size());
+
+  unsigned threads = threads_ ? threads_ : std::thread::hardware_concurrency();
+  if (threads == 0) {
+    threads = 1;
+  }
+  const size_t group = lockstep_lanes_ > 1 ? lockstep_lanes_ : 1;
+  const size_t units = (jobs_.size() + group - 1) / group;
+  if (threads > units) {
+    threads = units == 0 ? 1 : static_cast<unsigned>(units);
+  }
+  report.threads = threads;
+
+  Memory loader;
+  loader.load_program(program_, start_address_);
+  const MemoryImage image = loader.capture();
+
+  std::vector<WorkQueue> queues(threads);
+  for (size_t i = 0; i < units; ++i) {
+    queues[i % threads].push(i);
+  }
+
+  auto worker = [&](unsigned self) {
+    CPU cpu;
+    cpu.set_engine(engine_);
+    cpu.load_image(image, start_address_);
+    size_t unit;
+    while (true) {
+      bool found = queues[self].pop(unit);
+      for (unsigned k = 1; !found && k < threads; ++k) {
+        found = queues[(self + k) % threads].steal(unit);
+      }
+      if (!found) {
+        return;
+      }
+      // Each result slot is written by exactly one worker
+      if (group > 1) {
+        size_t first = unit * group;
+        run_lockstep(first, std::min(group, jobs_.size() - first), image,
+                     report.results);
+      } else {
+        report.results[unit] = run_job(jobs_[unit], cpu);
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t) {
+    pool.emplace_back(worker, t);
+  }
+  worker(0);
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+  report.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  for (const Result &result : report.results) {
+    report.total_instructions += result.instructions;
+  }
+  return report;
+}
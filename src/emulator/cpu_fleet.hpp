@@ -0,0 +1,73 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runs one program image on many independent CPU instances across a
+// work-stealing thread pool. The program is loaded once into a MemoryImage
+// that every instance maps copy-on-write, so a job only allocates the
+// pages it writes. Each worker keeps one CPU and recycles it with
+// CPU::reset_for_reuse() between jobs. Every job gets its own input
+// and output buffers in place of the std::cin/std::cout callbacks; an IN
+// after the input is used up stops that job with StopReason::WAITING_IO.
+class CpuFleet {
+public:
+  struct Job {
+    std::string name;
+    std::vector<uint8_t> input; // bytes returned by IN from the input port
+  };
+
+  struct Result {
+    std::string name;
+    CPU::StopReason reason;
+    uint64_t instructions; // instructions retired
+    uint64_t cycle;        // instance cycle counter at the end of the run
+    CPU::Fault fault;
+    uint16_t gpr[4];
+    std::vector<uint8_t> output; // bytes written to the output port
+  };
+
+  struct Report {
+    std::vector<Result> results; // in job order
+    uint64_t total_instructions = 0;
+    double seconds = 0;   // wall-clock time of run()
+    unsigned threads = 0; // workers used
+  };
+
+  explicit CpuFleet(std::vector<uint8_t> program,
+                    uint16_t start_address = Memory::PROGRAM_START);
+
+  void set_engine(CPU::Engine engine) { engine_ = engine; }
+  // Budget applied to every job (RunBudget::deadline is ignored)
+  void set_max_instructions(uint64_t max_instructions) {
+    max_instructions_ = max_instructions;
+  }
+  // Worker count; 0 (the default) uses one per hardware thread
+  void set_threads(unsigned threads) { threads_ = threads; }
+  // Above 1, consecutive jobs are run in groups of this many lanes on a
+  // LockstepEngine (lockstep.hpp) in place of the selected engine
+  void set_lockstep_lanes(size_t lanes) { lockstep_lanes_ = lanes; }
+
+  void add_job(Job job) { jobs_.push_back(std::move(job)); }
+  size_t job_count() const { return jobs_.size(); }
+
+  // Run every job added so far
+  Report run() const;
+
+private:
+  std::vector<uint8_t> program_;
+  uint16_t start_address_;
+  CPU::Engine engine_;
+  uint64_t max_instructions_;
+  unsigned threads_;
+  size_t lockstep_lanes_;
+  std::vector<Job> jobs_;
+
+  // Run job on a pooled CPU that has the program image loaded
+  Result run_job(const Job &job, CPU &cpu) const;
+  // Jobs [first, first + count) in lockstep, results written in place
+  void run_lockstep(size_t first, size_t count, const MemoryImage &image,
+                    std::vector<Result> &results) const;
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "cpu.hpp"
+
+// Per-opcode/mode instruction handlers shared by the threaded and block
+// engines. The top byte of every instruction word is (opcode << 3) | mode,
+// so it indexes a 256-entry handler table directly. Each handler is a
+// template instantiation with the opcode, ALU operation and addressing mode
+// fixed at compile time. Opcode/mode pairs that the ISA does not define
+// route to CPU::execute(), which reports the error exactly as the
+// interpreter does.
+
+struct InstructionHandlers {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+  using DecodedInstruction = CPU::DecodedInstruction;
+
+  static constexpr bool is_alu(uint8_t op) {
+    return op >= static_cast<uint8_t>(Opcode::ADD) &&
+           op <= static_cast<uint8_t>(Opcode::SHR);
+  }
+
+  static constexpr bool is_branch(uint8_t op) {
+    return op >= static_cast<uint8_t>(Opcode::JMP) &&
+           op <= static_cast<uint8_t>(Opcode::CALL);
+  }
+
+  // Modes accepted by resolve_operand() / calculate_effective_address()
+  static constexpr bool is_operand_mode(uint8_t mode) {
+    return mode <= static_cast<uint8_t>(AddressingMode::PC_RELATIVE);
+  }
+
+  static constexpr bool is_address_mode(uint8_t mode) {
+    return mode >= static_cast<uint8_t>(AddressingMode::DIRECT) &&
+           mode <= static_cast<uint8_t>(AddressingMode::PC_RELATIVE);
+  }
+
+  static constexpr ALU::Operation alu_operation(uint8_t op) {
+    switch (static_cast<Opcode>(op)) {
+    case Opcode::ADD:
+      return ALU::Operation::ADD;
+    case Opcode::SUB:
+      return ALU::Operation::SUB;
+    case Opcode::AND:
+      return ALU::Operation::AND;
+    case Opcode::OR:
+      return ALU::Operation::OR;
+    case Opcode::XOR:
+      return ALU::Operation::XOR;
+    case Opcode::CMP:
+      return ALU::Operation::CMP;
+    case Opcode::SHL:
+      return ALU::Operation::SHL;
+    default:
+      return ALU::Operation::SHR;
+    }
+  }
+
+  // Source operand for a fixed addressing mode (resolve_operand())
+  template <uint8_t Mode>
+  static inline uint16_t operand(CPU &cpu, const DecodedInstruction &instr) {
+    constexpr AddressingMode m = static_cast<AddressingMode>(Mode);
+    if constexpr (m == AddressingMode::REGISTER) {
+      return cpu.registers_.get_gpr(instr.rs);
+    } else if constexpr (m == AddressingMode::IMMEDIATE) {
+      return instr.extra_word;
+    } else {
+      return cpu.memory_.read_word(effective_address<Mode>(cpu, instr));
+    }
+  }
+
+  // Effective address for a fixed addressing mode
+  // (calculate_effective_address())
+  template <uint8_t Mode>
+  static inline uint16_t effective_address(CPU &cpu,
+                                           const DecodedInstruction &instr) {
+    constexpr AddressingMode m = static_cast<AddressingMode>(Mode);
+    if constexpr (m == AddressingMode::DIRECT) {
+      return instr.extra_word;
+    } else if constexpr (m == AddressingMode::REGISTER_INDIRECT) {
+      return cpu.registers_.get_gpr(instr.rs);
+    } else if constexpr (m == AddressingMode::REGISTER_OFFSET) {
+      return cpu.registers_.get_gpr(instr.rs) + instr.extra_word;
+    } else {
+      return cpu.registers_.get_pc() + static_cast<int16_t>(instr.extra_word);
+    }
+  }
+
+  template <uint8_t Op> static inline bool condition(const Registers &regs) {
+    constexpr Opcode o = static_cast<Opcode>(Op);
+    if constexpr (o == Opcode::JMP || o == Opcode::CALL) {
+      return true;
+    } else if constexpr (o == Opcode::JZ) {
+      return regs.is_zero();
+    } else if constexpr (o == Opcode::JNZ) {
+      return !regs.is_zero();
+    } else if constexpr (o == Opcode::JC) {
+      return regs.is_carry();
+    } else if constexpr (o == Opcode::JNC) {
+      return !regs.is_carry();
+    } else {
+      return regs.is_negative();
+    }
+  }
+
+  template <uint8_t Op, uint8_t Mode>
+  static void exec(CPU &cpu, const DecodedInstruction &instr) {
+    constexpr Opcode o = static_cast<Opcode>(Op);
+
+    if constexpr (o == Opcode::NOP) {
+      // Do nothing
+    } else if constexpr (o == Opcode::HALT) {
+      cpu.execute_halt();
+    } else if constexpr (o == Opcode::MOV && is_operand_mode(Mode)) {
+      cpu.registers_.set_gpr(instr.rd, operand<Mode>(cpu, instr));
+    } else if constexpr (is_alu(Op) && is_operand_mode(Mode)) {
+      constexpr ALU::Operation alu_op = alu_operation(Op);
+      uint16_t operand_a = cpu.registers_.get_gpr(instr.rd);
+      uint16_t operand_b = operand<Mode>(cpu, instr);
+      uint16_t result =
+          cpu.alu_.template execute<alu_op>(operand_a, operand_b,
+                                            cpu.registers_);
+      if constexpr (alu_op != ALU::Operation::CMP) {
+        cpu.registers_.set_gpr(instr.rd, result);
+      }
+    } else if constexpr (o == Opcode::LOAD && is_address_mode(Mode)) {
+      uint16_t address = effective_address<Mode>(cpu, instr);
+      cpu.registers_.set_gpr(instr.rd, cpu.memory_.read_word(address));
+    } else if constexpr (o == Opcode::STORE && is_address_mode(Mode)) {
+      uint16_t address = effective_address<Mode>(cpu, instr);
+      cpu.store_word(address, cpu.registers_.get_gpr(instr.rd));
+    } else if constexpr (is_branch(Op) && is_address_mode(Mode)) {
+      if (condition<Op>(cpu.registers_)) {
+        if constexpr (o == Opcode::CALL) {
+          cpu.push_word(cpu.registers_.get_pc());
+        }
+        cpu.registers_.set_pc(effective_address<Mode>(cpu, instr));
+      }
+    } else if constexpr (o == Opcode::RET) {
+      cpu.registers_.set_pc(cpu.pop_word());
+    } else if constexpr (o == Opcode::PUSH) {
+      cpu.push_word(cpu.registers_.get_gpr(instr.rd));
+    } else if constexpr (o == Opcode::POP) {
+      cpu.registers_.set_gpr(instr.rd, cpu.pop_word());
+    } else if constexpr (o == Opcode::IN && is_operand_mode(Mode)) {
+      // Rare, and may have to wait for input: use the generic path
+      cpu.execute_io(instr, true);
+    } else if constexpr (o == Opcode::OUT && is_operand_mode(Mode)) {
+      uint16_t port = operand<Mode>(cpu, instr);
+      uint8_t value =
+          static_cast<uint8_t>(cpu.registers_.get_gpr(instr.rd) & 0xFF);
+      cpu.store_byte(Memory::IO_START + (port & 0xFF), value);
+    } else {
+      // Undefined opcode or mode: let the generic path raise the fault
+      cpu.execute(instr);
+    }
+  }
+
+  // FAULT_HANDLER slot: instruction failed validation at decode
+  static void fault(CPU &cpu, const DecodedInstruction &instr) {
+    cpu.raise_fault(instr.fault);
+  }
+};
+
+// X-macros enumerating every (opcode, mode) slot of the handler table
+#define SOFTCPU_MODES(X, OP)                                                   \
+  X(OP, 0) X(OP, 1) X(OP, 2) X(OP, 3) X(OP, 4) X(OP, 5) X(OP, 6) X(OP, 7)
+#define SOFTCPU_HANDLERS(X)                                                    \
+  SOFTCPU_MODES(X, 0) SOFTCPU_MODES(X, 1) SOFTCPU_MODES(X, 2)                  \
+  SOFTCPU_MODES(X, 3) SOFTCPU_MODES(X, 4) SOFTCPU_MODES(X, 5)                  \
+  SOFTCPU_MODES(X, 6) SOFTCPU_MODES(X, 7) SOFTCPU_MODES(X, 8)                  \
+  SOFTCPU_MODES(X, 9) SOFTCPU_MODES(X, 10) SOFTCPU_MODES(X, 11)                \
+  SOFTCPU_MODES(X, 12) SOFTCPU_MODES(X, 13) SOFTCPU_MODES(X, 14)               \
+  SOFTCPU_MODES(X, 15) SOFTCPU_MODES(X, 16) SOFTCPU_MODES(X, 17)               \
+  SOFTCPU_MODES(X, 18) SOFTCPU_MODES(X, 19) SOFTCPU_MODES(X, 20)               \
+  SOFTCPU_MODES(X, 21) SOFTCPU_MODES(X, 22) SOFTCPU_MODES(X, 23)               \
+  SOFTCPU_MODES(X, 24) SOFTCPU_MODES(X, 25) SOFTCPU_MODES(X, 26)               \
+  SOFTCPU_MODES(X, 27) SOFTCPU_MODES(X, 28) SOFTCPU_MODES(X, 29)               \
+  SOFTCPU_MODES(X, 30) SOFTCPU_MODES(X, 31)
+
+using InstructionHandler = void (*)(CPU &, const CPU::DecodedInstruction &);
+
+// Extra handler table slot for instructions that failed validation, so
+// dispatch needs no separate fault check
+constexpr uint32_t FAULT_HANDLER = 256;
+constexpr uint32_t HANDLER_TABLE_SIZE = 257;
+
+inline uint32_t handler_index(const CPU::DecodedInstruction &instr,
+                              uint16_t instruction_word) {
+  return instr.fault == CPU::FaultCode::NONE ? instruction_word >> 8u
+                                             : FAULT_HANDLER;
+}
+
+// Handler table indexed by handler_index()
+const InstructionHandler *instruction_handler_table();
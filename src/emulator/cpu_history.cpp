@@ -0,0 +1,63 @@
+#include "cpu.hpp"
+#include "execution_history.hpp"
+
+void CPU::set_history(std::shared_ptr<ExecutionHistory> history) {
+  history_ = std::move(history);
+  if (history_) {
+    history_->clear();
+  }
+}
+
+bool CPU::step_back() {
+  return cycle_count_ > 0 && run_backwards_to(cycle_count_ - 1);
+}
+
+bool CPU::run_backwards_to(uint64_t cycle) {
+  // The history must end where the CPU is now
+  if (!history_ || history_->empty() ||
+      history_->newest_cycle() != cycle_count_ ||
+      cycle < history_->oldest_cycle() || cycle > cycle_count_) {
+    return false;
+  }
+  if (cycle == cycle_count_) {
+    return true;
+  }
+
+  // Segment holding cycle: jump to the checkpoint that ends it and forget
+  // everything after
+  std::deque<ExecutionHistory::Segment> &segments = history_->segments_;
+  size_t index = segments.size() - 1;
+  while (segments[index].start_cycle > cycle) {
+    --index;
+  }
+  if (index + 1 < segments.size()) {
+    restore_state(segments[index + 1].checkpoint);
+    segments.erase(segments.begin() + static_cast<std::ptrdiff_t>(index + 1),
+                   segments.end());
+  }
+
+  ExecutionHistory::Segment &segment = segments.back();
+  while (cycle_count_ > cycle) {
+    const ExecutionHistory::UndoRecord &record = segment.records.back();
+    for (size_t i = segment.writes.size(); i-- > record.first_write;) {
+      const MemWriteEvent &write = segment.writes[i];
+      memory_.write_byte(write.address, write.old_value);
+      invalidate_decoded(write.address, 1);
+    }
+    segment.writes.resize(record.first_write);
+    registers_ = record.registers;
+    stats_.cycles = record.cycles;
+    memory_.set_timer_state(record.timer_counter, record.timer_running);
+    segment.perf_states.resize(record.perf_state + 1);
+    memory_.set_perf_counters(segment.perf_states.back());
+    segment.records.pop_back();
+    --cycle_count_;
+  }
+
+  // Every recorded instruction started on a running CPU
+  halted_ = false;
+  faulted_ = false;
+  fault_ = Fault();
+  waiting_for_input_ = false;
+  return true;
+}
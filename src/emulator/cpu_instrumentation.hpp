@@ -0,0 +1,495 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "branch_predictor.hpp"
+#include "cache_model.hpp"
+#include "call_graph_profile.hpp"
+#include "execution_history.hpp"
+#include "hotspot_profile.hpp"
+#include "pipeline_model.hpp"
+#include "sequence_profile.hpp"
+#include <functional>
+#include <iostream>
+#include <optional>
+
+// Instrumentation policies for the interpreter core. CPU::step_with() and
+// CPU::run_with() are templates over one of these, so the hooks of the
+// policy in use are inlined and NullPolicy compiles them out entirely. The
+// policy is chosen once per run (or per step() call), not per instruction.
+//
+//   begin_run / end_run   bracket a run; install and remove observers
+//   before_execute        instruction fetched and decoded, not yet executed
+//   after_retire          instruction retired, cycle_count_ already advanced
+
+struct NullPolicy {
+  static constexpr bool per_instruction = false;
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+  void before_execute(CPU &, uint16_t, const CPU::DecodedInstruction &) {}
+  void after_retire(CPU &) {}
+};
+
+// Feeds the TraceRecorder. The memory observer is installed once per run,
+// after any observer already installed; Memory keeps all writes on its
+// slow path while one is installed.
+struct TracePolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit TracePolicy(TraceRecorder &recorder) : tracer(recorder) {}
+
+  void begin_run(CPU &cpu) {
+    previous = cpu.memory_.trace_callback();
+    TraceRecorder *recorder = &tracer;
+    auto chained = previous;
+    cpu.memory_.set_trace_callback(
+        [recorder, chained](uint16_t addr, uint8_t oldv, uint8_t newv) {
+          if (chained) {
+            chained(addr, oldv, newv);
+          }
+          recorder->record_mem_write(MemWriteEvent{addr, oldv, newv});
+        });
+  }
+
+  void end_run(CPU &cpu) { cpu.memory_.set_trace_callback(previous); }
+
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    tracer.start_cycle(cpu.cycle_count_, pc);
+    tracer.record_registers(cpu.registers_);
+    DecodedInstrView dv;
+    dv.opcode = static_cast<uint8_t>(instr.opcode);
+    dv.mode = static_cast<uint8_t>(instr.mode);
+    dv.rd = instr.rd;
+    dv.rs = instr.rs;
+    dv.extra_word = instr.extra_word;
+    dv.has_extra_word = instr.has_extra_word;
+    tracer.record_decoded(dv);
+  }
+
+  void after_retire(CPU &) { tracer.end_cycle(); }
+
+  TraceRecorder &tracer;
+  std::function<void(uint16_t, uint8_t, uint8_t)> previous;
+};
+
+// Disassembles each instruction and reports progress (debug mode)
+struct DebugPolicy {
+  static constexpr bool per_instruction = true;
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &cpu, uint16_t,
+                      const CPU::DecodedInstruction &instr) {
+    cpu.print_instruction(instr);
+  }
+
+  void after_retire(CPU &cpu) {
+    if (cpu.cycle_count_ % 10000 == 0) {
+      std::cout << "Executed " << cpu.cycle_count_ << " cycles..."
+                << std::endl;
+    }
+  }
+};
+
+// Counts opcode/mode sequences for superinstruction generation
+struct ProfilePolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit ProfilePolicy(SequenceProfile &sequences) : profile(sequences) {}
+
+  void begin_run(CPU &) { profile.break_sequence(); }
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &, uint16_t, const CPU::DecodedInstruction &instr) {
+    if (instr.fault != CPU::FaultCode::NONE) {
+      profile.break_sequence();
+      return;
+    }
+    profile.record(static_cast<uint8_t>(
+        (static_cast<uint8_t>(instr.opcode) << 3) |
+        static_cast<uint8_t>(instr.mode)));
+  }
+
+  void after_retire(CPU &) {}
+
+  SequenceProfile &profile;
+};
+
+// Counts each retired instruction and the cycles it took at its PC
+struct HotspotPolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit HotspotPolicy(HotspotProfile &hotspots) : profile(hotspots) {}
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &) {
+    current_pc = pc;
+    start_cycle = cpu.stats_.cycles;
+  }
+
+  void after_retire(CPU &cpu) {
+    profile.record(current_pc, cpu.stats_.cycles - start_cycle);
+  }
+
+  HotspotProfile &profile;
+  uint16_t current_pc = 0;
+  uint64_t start_cycle = 0;
+};
+
+// Charges each retired instruction to the current call path and follows
+// CALL/RET on the profile's shadow stack
+struct CallGraphPolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit CallGraphPolicy(CallGraphProfile &call_graph)
+      : profile(call_graph) {}
+
+  void begin_run(CPU &cpu) { profile.start(cpu.registers_.get_pc()); }
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &cpu, uint16_t,
+                      const CPU::DecodedInstruction &instr) {
+    opcode = instr.opcode;
+    start_cycle = cpu.stats_.cycles;
+  }
+
+  void after_retire(CPU &cpu) {
+    profile.record(cpu.stats_.cycles - start_cycle);
+    if (opcode == CPU::Opcode::CALL) {
+      profile.enter(cpu.registers_.get_pc());
+    } else if (opcode == CPU::Opcode::RET) {
+      profile.leave();
+    }
+  }
+
+  CallGraphProfile &profile;
+  CPU::Opcode opcode = CPU::Opcode::NOP;
+  uint64_t start_cycle = 0;
+};
+
+// Feeds each retired instruction to a PipelineModel. A transfer is taken
+// when the instruction leaves PC anywhere but after its own words.
+struct PipelinePolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit PipelinePolicy(PipelineModel &pipeline) : model(pipeline) {}
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    current = instr;
+    fall_through = static_cast<uint16_t>(pc + (instr.has_extra_word ? 4 : 2));
+  }
+
+  void after_retire(CPU &cpu) {
+    model.record(current, cpu.registers_.get_pc() != fall_through);
+  }
+
+  PipelineModel &model;
+  CPU::DecodedInstruction current = {};
+  uint16_t fall_through = 0;
+};
+
+// Hands each retired control transfer to a BranchProfile. Direction and
+// destination are worked out before execute, from the flags and operands
+// the instruction will use.
+struct BranchPolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit BranchPolicy(BranchProfile &branches) : profile(branches) {}
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    pending = true;
+    event.pc = pc;
+    event.taken = true;
+    event.fall_through =
+        static_cast<uint16_t>(pc + (instr.has_extra_word ? 4 : 2));
+    switch (instr.opcode) {
+    case CPU::Opcode::JZ:
+    case CPU::Opcode::JNZ:
+    case CPU::Opcode::JC:
+    case CPU::Opcode::JNC:
+    case CPU::Opcode::JN:
+      event.kind = BranchKind::CONDITIONAL;
+      event.taken = cpu.check_condition(instr.opcode);
+      break;
+    case CPU::Opcode::JMP:
+      event.kind = BranchKind::JUMP;
+      break;
+    case CPU::Opcode::CALL:
+      event.kind = BranchKind::CALL;
+      break;
+    case CPU::Opcode::RET:
+      event.kind = BranchKind::RETURN;
+      return; // destination known after execute
+    default:
+      pending = false;
+      return;
+    }
+    event.target = cpu.calculate_effective_address(instr);
+  }
+
+  void after_retire(CPU &cpu) {
+    if (!pending) {
+      return;
+    }
+    if (event.kind == BranchKind::RETURN) {
+      event.target = cpu.registers_.get_pc();
+    }
+    profile.record(event);
+  }
+
+  BranchProfile &profile;
+  BranchEvent event = {};
+  bool pending = false;
+};
+
+// Feeds a CacheHierarchy the fetches and data accesses of each retired
+// instruction. The addresses are worked out before execute, from the
+// registers the instruction will use, and replayed once it retires, so an
+// IN that waits for input is counted when it is retried.
+struct CachePolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit CachePolicy(CacheHierarchy &caches) : hierarchy(caches) {}
+
+  void begin_run(CPU &) {}
+  void end_run(CPU &) {}
+
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    current_pc = pc;
+    extra_word = instr.has_extra_word;
+    count = 0;
+    const uint16_t sp = cpu.registers_.get_sp();
+    switch (instr.opcode) {
+    case CPU::Opcode::LOAD:
+      add(cpu.calculate_effective_address(instr), false);
+      break;
+    case CPU::Opcode::STORE:
+      add(cpu.calculate_effective_address(instr), true);
+      break;
+    case CPU::Opcode::PUSH:
+    case CPU::Opcode::CALL:
+      add(static_cast<uint16_t>(sp - 2), true);
+      break;
+    case CPU::Opcode::POP:
+    case CPU::Opcode::RET:
+      add(sp, false);
+      break;
+    case CPU::Opcode::IN:
+    case CPU::Opcode::OUT: {
+      // The port number may itself be an operand in memory
+      uint16_t port = 0;
+      bool known = true;
+      if (instr.mode == CPU::AddressingMode::REGISTER) {
+        port = cpu.registers_.get_gpr(instr.rs);
+      } else if (instr.mode == CPU::AddressingMode::IMMEDIATE) {
+        port = instr.extra_word;
+      } else {
+        const uint16_t address = cpu.calculate_effective_address(instr);
+        add(address, false);
+        // Reading the I/O page here could consume input
+        known = address < Memory::IO_START - 1;
+        port = known ? cpu.memory_.read_word(address) : 0;
+      }
+      if (known) {
+        add(static_cast<uint16_t>(Memory::IO_START + (port & 0xFF)),
+            instr.opcode == CPU::Opcode::OUT);
+      }
+      break;
+    }
+    default:
+      if (CPU::data_reads(instr.opcode, instr.mode)) {
+        add(cpu.calculate_effective_address(instr), false);
+      }
+      break;
+    }
+  }
+
+  void after_retire(CPU &) {
+    hierarchy.fetch(current_pc, current_pc);
+    if (extra_word) {
+      hierarchy.fetch(current_pc, static_cast<uint16_t>(current_pc + 2));
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      if (writes[i]) {
+        hierarchy.write(current_pc, addresses[i]);
+      } else {
+        hierarchy.read(current_pc, addresses[i]);
+      }
+    }
+  }
+
+  void add(uint16_t address, bool write) {
+    addresses[count] = address;
+    writes[count] = write;
+    ++count;
+  }
+
+  CacheHierarchy &hierarchy;
+  uint16_t current_pc = 0;
+  bool extra_word = false;
+  // At most a memory operand and an I/O port
+  uint16_t addresses[2] = {};
+  bool writes[2] = {};
+  uint32_t count = 0;
+};
+
+// Records undo information into an ExecutionHistory. Stores are observed
+// through the memory trace callback; the registers, timer and performance
+// counters before each instruction are taken when the previous one retires
+// (or the run starts), since before_execute already sees the fetched
+// instruction.
+struct HistoryPolicy {
+  static constexpr bool per_instruction = true;
+
+  explicit HistoryPolicy(ExecutionHistory &execution_history)
+      : history(execution_history) {}
+
+  void begin_run(CPU &cpu) {
+    // Anything that ran without the history breaks the undo chain
+    if (!history.empty() && history.newest_cycle() != cpu.cycle_count_) {
+      history.clear();
+    }
+    if (history.empty()) {
+      history.open_segment(cpu);
+    }
+    previous = cpu.memory_.trace_callback();
+    ExecutionHistory *target = &history;
+    auto chained = previous;
+    cpu.memory_.set_trace_callback(
+        [target, chained](uint16_t addr, uint8_t oldv, uint8_t newv) {
+          if (chained) {
+            chained(addr, oldv, newv);
+          }
+          target->segments_.back().writes.push_back(
+              MemWriteEvent{addr, oldv, newv});
+        });
+    capture(cpu);
+  }
+
+  void end_run(CPU &cpu) { cpu.memory_.set_trace_callback(previous); }
+
+  void before_execute(CPU &, uint16_t, const CPU::DecodedInstruction &) {}
+
+  void after_retire(CPU &cpu) {
+    ExecutionHistory::Segment &segment = history.segments_.back();
+    segment.records.push_back(history.pending_);
+    if (segment.records.size() >= history.checkpoint_interval_) {
+      history.open_segment(cpu);
+    }
+    capture(cpu);
+  }
+
+  void capture(CPU &cpu) {
+    ExecutionHistory::UndoRecord &pending = history.pending_;
+    ExecutionHistory::Segment &segment = history.segments_.back();
+    pending.registers = cpu.registers_;
+    pending.first_write = static_cast<uint32_t>(segment.writes.size());
+    pending.cycles = cpu.stats_.cycles;
+    pending.timer_counter = cpu.memory_.get_timer_counter();
+    pending.timer_running = cpu.memory_.is_timer_running();
+    if (segment.perf_states.back() != cpu.memory_.perf_counters()) {
+      segment.perf_states.push_back(cpu.memory_.perf_counters());
+    }
+    pending.perf_state = static_cast<uint32_t>(segment.perf_states.size() - 1);
+  }
+
+  ExecutionHistory &history;
+  std::function<void(uint16_t, uint8_t, uint8_t)> previous;
+};
+
+// Runs the hooks of both policies, First before Second
+template <typename First, typename Second>
+struct CombinedPolicy : First, Second {
+  static constexpr bool per_instruction =
+      First::per_instruction || Second::per_instruction;
+
+  template <typename... Args>
+  explicit CombinedPolicy(Args &&...args)
+      : First(std::forward<Args>(args)...) {}
+
+  void begin_run(CPU &cpu) {
+    First::begin_run(cpu);
+    Second::begin_run(cpu);
+  }
+  void end_run(CPU &cpu) {
+    Second::end_run(cpu);
+    First::end_run(cpu);
+  }
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    First::before_execute(cpu, pc, instr);
+    Second::before_execute(cpu, pc, instr);
+  }
+  void after_retire(CPU &cpu) {
+    First::after_retire(cpu);
+    Second::after_retire(cpu);
+  }
+};
+
+// Runs the hooks of Policy if it is engaged and nothing otherwise, so one
+// chain of CombinedPolicy serves any set of attached observers
+template <typename Policy> struct OptionalPolicy {
+  static constexpr bool per_instruction = Policy::per_instruction;
+
+  void begin_run(CPU &cpu) {
+    if (policy) {
+      policy->begin_run(cpu);
+    }
+  }
+  void end_run(CPU &cpu) {
+    if (policy) {
+      policy->end_run(cpu);
+    }
+  }
+  void before_execute(CPU &cpu, uint16_t pc,
+                      const CPU::DecodedInstruction &instr) {
+    if (policy) {
+      policy->before_execute(cpu, pc, instr);
+    }
+  }
+  void after_retire(CPU &cpu) {
+    if (policy) {
+      policy->after_retire(cpu);
+    }
+  }
+
+  std::optional<Policy> policy;
+};
+
+template <typename... Policies> struct PolicyChain;
+template <typename Last> struct PolicyChain<Last> {
+  using type = Last;
+};
+template <typename First, typename... Rest>
+struct PolicyChain<First, Rest...> {
+  using type = CombinedPolicy<First, typename PolicyChain<Rest...>::type>;
+};
+
+// Every observer a run can feed, in hook order. CPU::with_policy()
+// engages the ones attached to the CPU.
+using ObserverPolicy =
+    PolicyChain<OptionalPolicy<TracePolicy>, OptionalPolicy<HistoryPolicy>,
+                OptionalPolicy<HotspotPolicy>, OptionalPolicy<CallGraphPolicy>,
+                OptionalPolicy<PipelinePolicy>, OptionalPolicy<BranchPolicy>,
+                OptionalPolicy<CachePolicy>, OptionalPolicy<ProfilePolicy>,
+                OptionalPolicy<DebugPolicy>>::type;
+
+// The observer of type Policy within an ObserverPolicy
+template <typename Policy>
+std::optional<Policy> &observer(ObserverPolicy &observers) {
+  return static_cast<OptionalPolicy<Policy> &>(observers).policy;
+}
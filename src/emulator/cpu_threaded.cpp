@@ -0,0 +1,80 @@
+#include "cpu_handlers.hpp"
+
+// Threaded-code interpreter core.
+//
+// With GCC/Clang the handlers from cpu_handlers.hpp are labels in one
+// function and each one ends in its own indirect jump to the next handler
+// (computed goto). Other compilers fall back to the function-pointer table
+// called from a loop.
+
+#if defined(__GNUC__) && !defined(SOFTCPU_NO_COMPUTED_GOTO)
+#define SOFTCPU_COMPUTED_GOTO 1
+#endif
+
+const InstructionHandler *instruction_handler_table() {
+#define SOFTCPU_HANDLER_ADDRESS(OP, MODE) &InstructionHandlers::exec<OP, MODE>,
+  static const InstructionHandler handlers[HANDLER_TABLE_SIZE] = {
+      SOFTCPU_HANDLERS(SOFTCPU_HANDLER_ADDRESS)
+      // FAULT_HANDLER
+      &InstructionHandlers::fault};
+#undef SOFTCPU_HANDLER_ADDRESS
+  return handlers;
+}
+
+uint32_t CPU::run_threaded(uint32_t max_instructions) {
+  uint32_t executed = 0;
+  if (halted_ || max_instructions == 0) {
+    return executed;
+  }
+  waiting_for_input_ = false;
+
+  DecodedInstruction instr;
+
+#ifdef SOFTCPU_COMPUTED_GOTO
+#define SOFTCPU_LABEL_ADDRESS(OP, MODE) &&handler_##OP##_##MODE,
+  static const void *const labels[HANDLER_TABLE_SIZE] = {
+      SOFTCPU_HANDLERS(SOFTCPU_LABEL_ADDRESS)
+      // FAULT_HANDLER
+      &&handler_fault};
+#undef SOFTCPU_LABEL_ADDRESS
+
+  // Per-instruction bookkeeping, then jump straight to the next handler
+#define SOFTCPU_DISPATCH()                                                     \
+  do {                                                                         \
+    if (waiting_for_input_)                                                    \
+      goto done;                                                               \
+    retire(1);                                                                 \
+    if (++executed >= max_instructions || halted_ || leave_engine_)            \
+      goto done;                                                               \
+    instr = fetch_and_decode();                                                \
+    goto *labels[handler_index(instr, registers_.get_ir())];                   \
+  } while (0)
+
+  instr = fetch_and_decode();
+  goto *labels[handler_index(instr, registers_.get_ir())];
+
+#define SOFTCPU_LABEL_BODY(OP, MODE)                                           \
+  handler_##OP##_##MODE : InstructionHandlers::exec<OP, MODE>(*this, instr);   \
+  SOFTCPU_DISPATCH();
+  SOFTCPU_HANDLERS(SOFTCPU_LABEL_BODY)
+#undef SOFTCPU_LABEL_BODY
+#undef SOFTCPU_DISPATCH
+
+handler_fault:
+  raise_fault(instr.fault);
+done:;
+#else
+  const InstructionHandler *handlers = instruction_handler_table();
+
+  do {
+    instr = fetch_and_decode();
+    handlers[handler_index(instr, registers_.get_ir())](*this, instr);
+    if (waiting_for_input_ || faulted_) {
+      break;
+    }
+    retire(1);
+  } while (++executed < max_instructions && !halted_ && !leave_engine_);
+#endif
+
+  return executed;
+}
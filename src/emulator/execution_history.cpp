@@ -0,0 +1,40 @@
+#include "execution_history.hpp"
+#include <algorithm>
+
+ExecutionHistory::ExecutionHistory(uint64_t checkpoint_interval,
+                                   size_t max_checkpoints)
+    : checkpoint_interval_(std::max<uint64_t>(checkpoint_interval, 1)),
+      max_checkpoints_(std::max<size_t>(max_checkpoints, 1)), pending_() {}
+
+uint64_t ExecutionHistory::oldest_cycle() const {
+  return segments_.empty() ? 0 : segments_.front().start_cycle;
+}
+
+uint64_t ExecutionHistory::newest_cycle() const {
+  return segments_.empty()
+             ? 0
+             : segments_.back().start_cycle + segments_.back().records.size();
+}
+
+size_t ExecutionHistory::record_count() const {
+  size_t count = 0;
+  for (const Segment &segment : segments_) {
+    count += segment.records.size();
+  }
+  return count;
+}
+
+void ExecutionHistory::clear() { segments_.clear(); }
+
+void ExecutionHistory::open_segment(CPU &cpu) {
+  Segment segment;
+  segment.start_cycle = cpu.get_cycle_count();
+  segment.checkpoint = cpu.snapshot();
+  segment.perf_states.push_back(segment.checkpoint.perf_counters);
+  segment.records.reserve(
+      static_cast<size_t>(std::min<uint64_t>(checkpoint_interval_, 65536)));
+  segments_.push_back(std::move(segment));
+  while (segments_.size() > max_checkpoints_) {
+    segments_.pop_front();
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "trace_recorder.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Execution history for reverse execution (CPU::step_back() and
+// CPU::run_backwards_to()).
+//
+// While a history is attached, every retired instruction leaves an undo
+// record: the registers, timer and performance counter state before it and
+// the old value of each byte it stored. Every checkpoint_interval
+// instructions the history takes a CPU snapshot and starts a new segment.
+// To reach cycle c the CPU restores the checkpoint that ends c's segment
+// (or stays where it is if c is in the newest one) and unwinds at most
+// checkpoint_interval undo records, so going back costs the same however
+// long the run has been.
+//
+// Snapshots share unmodified pages copy-on-write, so a checkpoint costs
+// one page copy per page written in its segment. Only the newest
+// max_checkpoints segments are kept; older cycles become unreachable.
+//
+// The history describes execution only. Output already sent is not taken
+// back, input is read again from the input callback when execution passes
+// an IN a second time, and memory written by the host between runs is not
+// recorded. Reset, restore and loading a program clear the history, and
+// so does running the CPU without it (fast engines, traced runs).
+class ExecutionHistory {
+public:
+  explicit ExecutionHistory(uint64_t checkpoint_interval = 65536,
+                            size_t max_checkpoints = 64);
+
+  uint64_t checkpoint_interval() const { return checkpoint_interval_; }
+  size_t max_checkpoints() const { return max_checkpoints_; }
+
+  bool empty() const { return segments_.empty(); }
+  // Earliest and latest cycle the CPU can be taken back to
+  uint64_t oldest_cycle() const;
+  uint64_t newest_cycle() const;
+  size_t checkpoint_count() const { return segments_.size(); }
+  size_t record_count() const;
+
+  void clear();
+
+private:
+  friend class CPU;
+  friend struct HistoryPolicy;
+
+  // State before one instruction; its stores are
+  // writes[first_write, next record's first_write)
+  struct UndoRecord {
+    Registers registers;
+    uint32_t first_write;
+    uint64_t cycles; // modelled cycles statistic
+    uint16_t timer_counter;
+    bool timer_running;
+    uint32_t perf_state; // index into the segment's perf_states
+  };
+
+  struct Segment {
+    uint64_t start_cycle;
+    CPU::Snapshot checkpoint; // state at start_cycle
+    std::vector<UndoRecord> records;
+    std::vector<MemWriteEvent> writes;
+    // Performance counter states, appended only when they change
+    std::vector<Memory::PerfCounters> perf_states;
+  };
+
+  // Start a new segment at the CPU's current state
+  void open_segment(CPU &cpu);
+
+  uint64_t checkpoint_interval_;
+  size_t max_checkpoints_;
+  std::deque<Segment> segments_;
+
+  // State before the instruction being executed
+  UndoRecord pending_;
+};
@@ -0,0 +1,33 @@
+#include "hotspot_profile.hpp"
+#include <algorithm>
+#include <numeric>
+
+HotspotProfile::HotspotProfile()
+    : instructions_(ADDRESS_COUNT, 0), cycles_(ADDRESS_COUNT, 0) {}
+
+uint64_t HotspotProfile::total_instructions() const {
+  return std::accumulate(instructions_.begin(), instructions_.end(),
+                         uint64_t(0));
+}
+
+uint64_t HotspotProfile::total_cycles() const {
+  return std::accumulate(cycles_.begin(), cycles_.end(), uint64_t(0));
+}
+
+std::vector<uint16_t> HotspotProfile::hot_pcs() const {
+  std::vector<uint16_t> pcs;
+  for (uint32_t pc = 0; pc < ADDRESS_COUNT; ++pc) {
+    if (instructions_[pc]) {
+      pcs.push_back(static_cast<uint16_t>(pc));
+    }
+  }
+  std::stable_sort(pcs.begin(), pcs.end(), [this](uint16_t a, uint16_t b) {
+    return cycles_[a] > cycles_[b];
+  });
+  return pcs;
+}
+
+void HotspotProfile::clear() {
+  std::fill(instructions_.begin(), instructions_.end(), 0);
+  std::fill(cycles_.begin(), cycles_.end(), 0);
+}
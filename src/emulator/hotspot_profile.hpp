@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Instructions retired and cycles spent per PC, for hot-spot profiling.
+// The counters are dense arrays with one slot per address, so recording
+// an instruction is two increments with no hashing or allocation.
+class HotspotProfile {
+public:
+  static constexpr uint32_t ADDRESS_COUNT = 0x10000;
+
+  HotspotProfile();
+
+  void record(uint16_t pc, uint64_t cycles) {
+    ++instructions_[pc];
+    cycles_[pc] += cycles;
+  }
+
+  uint64_t instructions(uint16_t pc) const { return instructions_[pc]; }
+  uint64_t cycles(uint16_t pc) const { return cycles_[pc]; }
+  uint64_t total_instructions() const;
+  uint64_t total_cycles() const;
+
+  // Addresses that retired an instruction, most cycles first (ties by
+  // address, so the order is reproducible)
+  std::vector<uint16_t> hot_pcs() const;
+
+  void clear();
+
+private:
+  std::vector<uint64_t> instructions_;
+  std::vector<uint64_t> cycles_;
+};
@@ -0,0 +1,162 @@
+#include "io_log.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'C', 'P', 'U', 'I', 'O', 'L', 'G'};
+constexpr uint8_t VERSION = 1;
+
+void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+bool get_varint(const std::vector<uint8_t> &in, size_t &pos, uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (pos >= in.size()) {
+      return false;
+    }
+    uint8_t byte = in[pos++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+std::vector<uint8_t> IoLog::input_bytes() const {
+  std::vector<uint8_t> bytes;
+  for (const Event &event : events_) {
+    if (event.source == Source::INPUT) {
+      bytes.push_back(event.value);
+    }
+  }
+  return bytes;
+}
+
+bool IoLog::source_for(uint16_t address, Source &source) {
+  switch (address) {
+  case Memory::IO_INPUT_DATA:
+    source = Source::INPUT;
+    return true;
+  case Memory::IO_TIMER_BASE:
+    source = Source::TIMER_LOW;
+    return true;
+  case Memory::IO_TIMER_BASE + 1:
+    source = Source::TIMER_HIGH;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool IoLog::save(const std::string &path) const {
+  std::vector<uint8_t> bytes(MAGIC, MAGIC + sizeof(MAGIC));
+  bytes.push_back(VERSION);
+  put_varint(bytes, events_.size());
+  uint64_t cycle = 0;
+  for (const Event &event : events_) {
+    put_varint(bytes, event.cycle - cycle);
+    bytes.push_back(static_cast<uint8_t>(event.source));
+    bytes.push_back(event.value);
+    cycle = event.cycle;
+  }
+
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+  out.write(reinterpret_cast<const char *>(bytes.data()),
+            static_cast<std::streamsize>(bytes.size()));
+  return static_cast<bool>(out);
+}
+
+bool IoLog::load(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+  if (bytes.size() < sizeof(MAGIC) + 1 ||
+      std::memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0 ||
+      bytes[sizeof(MAGIC)] != VERSION) {
+    return false;
+  }
+
+  size_t pos = sizeof(MAGIC) + 1;
+  uint64_t count;
+  if (!get_varint(bytes, pos, count)) {
+    return false;
+  }
+  std::vector<Event> events;
+  uint64_t cycle = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t delta;
+    if (!get_varint(bytes, pos, delta) || pos + 2 > bytes.size() ||
+        bytes[pos] > static_cast<uint8_t>(Source::TIMER_HIGH)) {
+      return false;
+    }
+    cycle += delta;
+    events.push_back(
+        Event{cycle, static_cast<Source>(bytes[pos]), bytes[pos + 1]});
+    pos += 2;
+  }
+  if (pos != bytes.size()) {
+    return false;
+  }
+  events_ = std::move(events);
+  return true;
+}
+
+void record_io(CPU &cpu, std::shared_ptr<IoLog> log) {
+  const CPU *source_cpu = &cpu;
+  cpu.get_memory().set_device_read_hook(
+      [source_cpu, log](uint16_t address, uint8_t value) {
+        IoLog::Source source;
+        if (IoLog::source_for(address, source)) {
+          log->add(IoLog::Event{source_cpu->get_cycle_count(), source, value});
+        }
+        return value;
+      });
+}
+
+std::shared_ptr<const IoReplayStatus>
+replay_io(CPU &cpu, std::shared_ptr<const IoLog> log) {
+  auto status = std::make_shared<IoReplayStatus>();
+  const CPU *target = &cpu;
+  Memory &memory = cpu.get_memory();
+  memory.set_output_callback([](uint8_t) {});
+  memory.set_input_callback([]() -> uint8_t { return 0; });
+  memory.set_input_ready_callback([status, log]() {
+    return !status->diverged && status->position < log->events().size() &&
+           log->events()[status->position].source == IoLog::Source::INPUT;
+  });
+  memory.set_device_read_hook(
+      [status, log, target](uint16_t address, uint8_t value) {
+        IoLog::Source source;
+        if (!IoLog::source_for(address, source) || status->diverged) {
+          return value;
+        }
+        const std::vector<IoLog::Event> &events = log->events();
+        uint64_t cycle = target->get_cycle_count();
+        if (status->position >= events.size() ||
+            events[status->position].source != source ||
+            events[status->position].cycle != cycle) {
+          status->diverged = true;
+          status->divergence_cycle = cycle;
+          return value;
+        }
+        return events[status->position++].value;
+      });
+  return status;
+}
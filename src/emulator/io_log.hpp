@@ -0,0 +1,67 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Deterministic I/O record and replay.
+//
+// The only inputs a guest can observe that do not follow from the program
+// and its memory are the bytes read from the input port and the timer
+// registers, so an IoLog holds exactly those reads, in order, each with
+// the cycle (instructions retired before the reading instruction). The
+// cycle is exact on every engine.
+//
+// On disk a log is a small header followed by one record per read:
+// the cycle delta as a LEB128 varint, the source and the value.
+class IoLog {
+public:
+  enum class Source : uint8_t {
+    INPUT = 0,     // IO_INPUT_DATA
+    TIMER_LOW = 1, // IO_TIMER_BASE
+    TIMER_HIGH = 2 // IO_TIMER_BASE + 1
+  };
+
+  struct Event {
+    uint64_t cycle;
+    Source source;
+    uint8_t value;
+  };
+
+  void add(const Event &event) { events_.push_back(event); }
+  const std::vector<Event> &events() const { return events_; }
+  void clear() { events_.clear(); }
+  // Values of the INPUT events, e.g. as a CpuFleet job's input
+  std::vector<uint8_t> input_bytes() const;
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+
+  // Source read at a device address; false for untracked addresses
+  static bool source_for(uint16_t address, Source &source);
+
+private:
+  std::vector<Event> events_;
+};
+
+// Log every input port and timer read of cpu from now on. The CPU's input
+// callback still supplies the input bytes.
+void record_io(CPU &cpu, std::shared_ptr<IoLog> log);
+
+// Progress of a replay
+struct IoReplayStatus {
+  size_t position = 0;   // events consumed
+  bool diverged = false; // a read did not match the next event
+  uint64_t divergence_cycle = 0;
+};
+
+// Feed log back into cpu: input port and timer reads return the logged
+// values, the input port is ready exactly while the next event is an input
+// byte (so the run stops with WAITING_IO where the log ends), and output
+// is discarded. Nothing touches the terminal. A read whose source or cycle
+// differs from the next event marks the replay as diverged and the input
+// port stays unready from then on.
+std::shared_ptr<const IoReplayStatus>
+replay_io(CPU &cpu, std::shared_ptr<const IoLog> log);
@@ -0,0 +1,1071 @@
+#include "jit_x86_64.hpp"
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(SOFTCPU_NO_JIT)
+#define SOFTCPU_X86_64_JIT 1
+#endif
+
+#ifdef SOFTCPU_X86_64_JIT
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+#endif
+
+uint32_t X86Jit::read_word(CPU *cpu, uint32_t address) {
+  return cpu->memory_.read_word(static_cast<uint16_t>(address));
+}
+
+const uint8_t *const *X86Jit::read_page_table() const {
+  return cpu_.memory_.read_page_table();
+}
+
+uint8_t *const *X86Jit::write_page_table() const {
+  return cpu_.memory_.write_page_table();
+}
+
+// Returns nonzero if native code has to return to run_compiled()
+uint32_t X86Jit::write_word(CPU *cpu, uint32_t address, uint32_t value) {
+  cpu->store_word(static_cast<uint16_t>(address),
+                  static_cast<uint16_t>(value));
+  return cpu->blocks_invalidated_ || cpu->leave_engine_;
+}
+
+#ifdef SOFTCPU_X86_64_JIT
+
+namespace {
+
+constexpr size_t CODE_BUFFER_SIZE = 4u << 20;
+constexpr uint32_t REGION_SIZE =
+    Memory::PROGRAM_END - Memory::PROGRAM_START + 1;
+
+enum Reg : uint8_t {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes (low nibble of Jcc/SETcc/CMOVcc)
+enum Cond : uint8_t {
+  CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4,
+  CC_NE = 0x5, CC_BE = 0x6, CC_S = 0x8
+};
+
+// Guest register homes while native code runs
+constexpr Reg GPR[4] = {RBX, RBP, R12, R13};
+constexpr Reg GUEST_SP = R14;
+constexpr Reg GUEST_FLAGS = R15;
+
+// Stack frame of the trampoline: [rsp] Frame *, [rsp + 8] budget,
+// [rsp + 12] fused pairs
+constexpr int32_t SLOT_FRAME = 0;
+constexpr int32_t SLOT_BUDGET = 8;
+constexpr int32_t SLOT_FUSED = 12;
+
+constexpr int32_t frame_offset(size_t offset) {
+  return static_cast<int32_t>(offset);
+}
+constexpr int32_t OFF_GPR = frame_offset(offsetof(X86Jit::Frame, state) +
+                                         offsetof(GuestState, gpr));
+constexpr int32_t OFF_SP = frame_offset(offsetof(X86Jit::Frame, state) +
+                                        offsetof(GuestState, sp));
+constexpr int32_t OFF_PC = frame_offset(offsetof(X86Jit::Frame, state) +
+                                        offsetof(GuestState, pc));
+constexpr int32_t OFF_FLAGS = frame_offset(offsetof(X86Jit::Frame, state) +
+                                           offsetof(GuestState, flags));
+constexpr int32_t OFF_BUDGET = frame_offset(offsetof(X86Jit::Frame, budget));
+constexpr int32_t OFF_FUSED =
+    frame_offset(offsetof(X86Jit::Frame, fused_pairs));
+constexpr int32_t OFF_ENTRY = frame_offset(offsetof(X86Jit::Frame, entry));
+constexpr int32_t OFF_BLOCK = frame_offset(offsetof(X86Jit::Frame, block));
+constexpr int32_t OFF_LINK = frame_offset(offsetof(X86Jit::Frame, link));
+constexpr int32_t OFF_PREVIOUS =
+    frame_offset(offsetof(X86Jit::Frame, previous));
+constexpr int32_t OFF_OP = frame_offset(offsetof(X86Jit::Frame, op));
+constexpr int32_t OFF_EXIT = frame_offset(offsetof(X86Jit::Frame, exit));
+
+void patch_rel32(uint8_t *site, const uint8_t *target) {
+  int32_t rel = static_cast<int32_t>(target - (site + 4));
+  std::memcpy(site, &rel, sizeof(rel));
+}
+
+// [base + index * scale + disp]; index RSP means none
+struct Mem {
+  Reg base;
+  int32_t disp = 0;
+  Reg index = RSP;
+  uint8_t scale = 1;
+};
+
+// Encoder for the handful of instructions the translator uses. Writes
+// stop at the end of the buffer and set overflowed().
+class Assembler {
+public:
+  enum Size { BYTE, WORD, DWORD, QWORD };
+
+  Assembler(uint8_t *begin, uint8_t *end) : p_(begin), end_(end) {}
+
+  uint8_t *here() const { return p_; }
+  bool overflowed() const { return overflow_; }
+
+  void byte(uint8_t b) {
+    if (p_ < end_) {
+      *p_++ = b;
+    } else {
+      overflow_ = true;
+    }
+  }
+  void imm16(uint16_t v) {
+    byte(static_cast<uint8_t>(v));
+    byte(static_cast<uint8_t>(v >> 8));
+  }
+  void imm32(uint32_t v) {
+    imm16(static_cast<uint16_t>(v));
+    imm16(static_cast<uint16_t>(v >> 16));
+  }
+  void imm64(uint64_t v) {
+    imm32(static_cast<uint32_t>(v));
+    imm32(static_cast<uint32_t>(v >> 32));
+  }
+
+  // reg is a register or an opcode extension; rm a register
+  void rr(Size size, std::initializer_list<uint8_t> opcode, int reg, int rm) {
+    prefix(size, reg, 0, rm, size == BYTE && (is_high_byte(reg) ||
+                                              is_high_byte(rm)));
+    for (uint8_t b : opcode) {
+      byte(b);
+    }
+    byte(static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7)));
+  }
+
+  void rm(Size size, std::initializer_list<uint8_t> opcode, int reg, Mem m) {
+    prefix(size, reg, m.index, m.base, size == BYTE && is_high_byte(reg));
+    for (uint8_t b : opcode) {
+      byte(b);
+    }
+    int mod = m.disp == 0 && (m.base & 7) != RBP
+                  ? 0
+                  : (m.disp >= -128 && m.disp <= 127 ? 1 : 2);
+    uint8_t scale = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+    byte(static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | RSP));
+    byte(static_cast<uint8_t>(scale << 6 | (m.index & 7) << 3 | (m.base & 7)));
+    if (mod == 1) {
+      byte(static_cast<uint8_t>(m.disp));
+    } else if (mod == 2) {
+      imm32(static_cast<uint32_t>(m.disp));
+    }
+  }
+
+  void mov_ri(Reg r, uint32_t v) {
+    if (r & 8) {
+      byte(0x41);
+    }
+    byte(static_cast<uint8_t>(0xB8 + (r & 7)));
+    imm32(v);
+  }
+  void mov_ri64(Reg r, uint64_t v) {
+    byte(static_cast<uint8_t>(0x48 | (r >> 3)));
+    byte(static_cast<uint8_t>(0xB8 + (r & 7)));
+    imm64(v);
+  }
+  void mov_ri64(Reg r, const void *p) {
+    mov_ri64(r, reinterpret_cast<uint64_t>(p));
+  }
+
+  // Jump/Jcc with a rel32 to fill in later; returns the rel32 field
+  uint8_t *jmp() {
+    byte(0xE9);
+    imm32(0);
+    return p_ - 4;
+  }
+  uint8_t *jcc(Cond cc) {
+    byte(0x0F);
+    byte(static_cast<uint8_t>(0x80 | cc));
+    imm32(0);
+    return p_ - 4;
+  }
+  void jmp_to(const uint8_t *target) { patch(jmp(), target); }
+  void bind(uint8_t *site) { patch(site, p_); }
+  void patch(uint8_t *site, const uint8_t *target) {
+    if (!overflow_) {
+      patch_rel32(site, target);
+    }
+  }
+
+  void push(Reg r) {
+    if (r & 8) {
+      byte(0x41);
+    }
+    byte(static_cast<uint8_t>(0x50 + (r & 7)));
+  }
+  void pop(Reg r) {
+    if (r & 8) {
+      byte(0x41);
+    }
+    byte(static_cast<uint8_t>(0x58 + (r & 7)));
+  }
+
+private:
+  uint8_t *p_;
+  uint8_t *end_;
+  bool overflow_ = false;
+
+  static bool is_high_byte(int r) { return r >= RSP && r <= RDI; }
+
+  void prefix(Size size, int reg, int index, int base, bool force_rex) {
+    if (size == WORD) {
+      byte(0x66);
+    }
+    uint8_t rex = static_cast<uint8_t>(0x40 | (size == QWORD ? 8 : 0) |
+                                       (reg & 8 ? 4 : 0) |
+                                       (index & 8 ? 2 : 0) | (base & 8 ? 1 : 0));
+    if (rex != 0x40 || force_rex) {
+      byte(rex);
+    }
+  }
+};
+
+} // namespace
+
+// Translates one Block. Code layout: budget check, the ops in order, then
+// the out-of-line exit stubs that return to run_compiled().
+class X86BlockEmitter {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+  using Size = Assembler::Size;
+
+public:
+  X86BlockEmitter(X86Jit &jit, Block &block, uint8_t *begin, uint8_t *end)
+      : jit_(jit), block_(block), a_(begin, end) {}
+
+  // Returns the end of the code, or nullptr if the buffer overflowed
+  uint8_t *emit() {
+    const std::vector<MicroOp> &ops = block_.ops;
+    length_ = static_cast<uint32_t>(ops.size());
+    if (ops.back().fused_compiled) {
+      ++length_;
+    }
+    analyse_flags();
+
+    // Budget check; the whole block is paid for up front and side exits
+    // refund what they did not run
+    a_.rm(Size::DWORD, {0x81}, 7, Mem{RSP, SLOT_BUDGET});
+    a_.imm32(length_);
+    budget_exit_ = a_.jcc(CC_B);
+    a_.rm(Size::DWORD, {0x81}, 5, Mem{RSP, SLOT_BUDGET});
+    a_.imm32(length_);
+
+    bool open = true;
+    for (uint32_t i = 0; i < ops.size() && open; ++i) {
+      open = emit_op(i);
+    }
+    if (open) {
+      const MicroOp &last = ops.back();
+      set_previous(last);
+      static_exit(a_.jmp(), last.next_pc);
+    }
+
+    emit_stubs();
+    return a_.overflowed() ? nullptr : a_.here();
+  }
+
+private:
+  X86Jit &jit_;
+  Block &block_;
+  Assembler a_;
+  uint32_t length_ = 0;
+  std::vector<bool> flags_live_;
+  uint8_t *budget_exit_ = nullptr;
+
+  struct Exit {
+    uint8_t *site;
+    uint32_t op;
+  };
+  std::vector<Exit> side_exits_;
+  std::vector<Exit> leave_exits_; // the next PC is in ecx
+  struct StaticExit {
+    uint8_t *site;
+    uint16_t pc;
+  };
+  std::vector<StaticExit> static_exits_;
+
+  CPU &cpu() { return jit_.cpu_; }
+
+  // flags_live_[i]: FLAGS written by op i can be observed, by a later
+  // reader or by the interpreter after an exit, before they are rewritten
+  void analyse_flags() {
+    const std::vector<MicroOp> &ops = block_.ops;
+    flags_live_.assign(ops.size(), false);
+    bool live = true;
+    for (size_t i = ops.size(); i-- > 0;) {
+      const CPU::DecodedInstruction &instr = ops[i].instr;
+      uint8_t op = static_cast<uint8_t>(instr.opcode);
+      bool writes = InstructionHandlers::is_alu(op);
+      flags_live_[i] = live;
+      if (writes) {
+        live = false;
+      }
+      bool reads = InstructionHandlers::is_branch(op) && !ops[i].fused_compiled;
+      if (reads || may_exit(ops[i])) {
+        live = true;
+      }
+    }
+  }
+
+  static bool may_exit(const MicroOp &op) {
+    const CPU::DecodedInstruction &instr = op.instr;
+    switch (instr.opcode) {
+    case Opcode::NOP:
+    case Opcode::JMP:
+    case Opcode::JZ:
+    case Opcode::JNZ:
+    case Opcode::JC:
+    case Opcode::JNC:
+    case Opcode::JN:
+      return false;
+    case Opcode::MOV:
+    case Opcode::ADD:
+    case Opcode::SUB:
+    case Opcode::AND:
+    case Opcode::OR:
+    case Opcode::XOR:
+    case Opcode::CMP:
+    case Opcode::SHL:
+    case Opcode::SHR:
+      return instr.mode != AddressingMode::REGISTER &&
+             instr.mode != AddressingMode::IMMEDIATE;
+    default:
+      return true;
+    }
+  }
+
+  // PC of op i before it is fetched
+  uint16_t pc_of(uint32_t i) const {
+    return i == 0 ? block_.start_pc : block_.ops[i - 1].next_pc;
+  }
+
+  bool emit_op(uint32_t i) {
+    const MicroOp &op = block_.ops[i];
+    const CPU::DecodedInstruction &instr = op.instr;
+    uint8_t opcode = static_cast<uint8_t>(instr.opcode);
+    uint8_t mode = static_cast<uint8_t>(instr.mode);
+
+    if (!op.compiled) {
+      side_exit(a_.jmp(), i);
+      return false;
+    }
+    if (op.fused_compiled) {
+      emit_fused(op);
+      return false;
+    }
+    if (instr.opcode == Opcode::NOP) {
+      return true;
+    }
+    if (instr.opcode == Opcode::MOV &&
+        InstructionHandlers::is_operand_mode(mode)) {
+      return emit_mov(i);
+    }
+    if (InstructionHandlers::is_alu(opcode) &&
+        InstructionHandlers::is_operand_mode(mode)) {
+      return emit_alu(i);
+    }
+    if (instr.opcode == Opcode::LOAD &&
+        InstructionHandlers::is_address_mode(mode)) {
+      bool constant;
+      uint16_t address = effective_address(op, constant);
+      if (!read_word(i, constant, address)) {
+        return false;
+      }
+      a_.rr(Size::DWORD, {0x89}, RAX, GPR[instr.rd]);
+      return true;
+    }
+    if (instr.opcode == Opcode::STORE &&
+        InstructionHandlers::is_address_mode(mode)) {
+      bool constant;
+      uint16_t address = effective_address(op, constant);
+      return write_word(i, constant, address, GPR[instr.rd], 0,
+                        [&] { a_.mov_ri(RCX, op.next_pc); });
+    }
+    if (InstructionHandlers::is_branch(opcode) &&
+        InstructionHandlers::is_address_mode(mode)) {
+      emit_branch(i);
+      return false;
+    }
+    if (instr.opcode == Opcode::PUSH) {
+      // ecx = SP - 2, checked before anything changes
+      a_.rm(Size::DWORD, {0x8D}, RCX, Mem{GUEST_SP, -2});
+      a_.rr(Size::DWORD, {0x0F, 0xB7}, RCX, RCX);
+      io_check(i);
+      a_.rr(Size::DWORD, {0x89}, RCX, GUEST_SP);
+      return write_word(i, false, 0, GPR[instr.rd], 0,
+                        [&] { a_.mov_ri(RCX, op.next_pc); });
+    }
+    if (instr.opcode == Opcode::POP || instr.opcode == Opcode::RET) {
+      a_.rr(Size::DWORD, {0x0F, 0xB7}, RCX, GUEST_SP);
+      read_word(i, false, 0);
+      a_.rm(Size::DWORD, {0x8D}, GUEST_SP, Mem{GUEST_SP, 2});
+      if (instr.opcode == Opcode::POP) {
+        a_.rr(Size::DWORD, {0x89}, RAX, GPR[instr.rd]);
+        return true;
+      }
+      a_.rr(Size::DWORD, {0x89}, RAX, RCX);
+      dynamic_exit();
+      return false;
+    }
+    // HALT, IN, OUT and undefined encodings
+    side_exit(a_.jmp(), i);
+    return false;
+  }
+
+  // Constant address, or emit code leaving it zero-extended in ecx
+  uint16_t effective_address(const MicroOp &op, bool &constant) {
+    const CPU::DecodedInstruction &instr = op.instr;
+    constant = true;
+    switch (instr.mode) {
+    case AddressingMode::DIRECT:
+      return instr.extra_word;
+    case AddressingMode::PC_RELATIVE:
+      return static_cast<uint16_t>(op.next_pc +
+                                   static_cast<int16_t>(instr.extra_word));
+    case AddressingMode::REGISTER_INDIRECT:
+      constant = false;
+      a_.rr(Size::DWORD, {0x0F, 0xB7}, RCX, GPR[instr.rs]);
+      return 0;
+    default: // REGISTER_OFFSET
+      constant = false;
+      a_.rm(Size::DWORD, {0x8D}, RCX, Mem{GPR[instr.rs], instr.extra_word});
+      a_.rr(Size::DWORD, {0x0F, 0xB7}, RCX, RCX);
+      return 0;
+    }
+  }
+
+  // Side exit for op i if the word at ecx touches the I/O page
+  void io_check(uint32_t i) {
+    a_.rm(Size::DWORD, {0x8D}, RAX,
+          Mem{RCX, -static_cast<int32_t>(Memory::IO_START - 1)});
+    a_.rr(Size::DWORD, {0x81}, 7, RAX);
+    a_.imm32(Memory::IO_END - Memory::IO_START + 2);
+    side_exit(a_.jcc(CC_B), i);
+  }
+
+  // Word at the address into eax. False if op i always exits instead.
+  bool read_word(uint32_t i, bool constant, uint16_t address) {
+    const uint8_t *const *table = jit_.read_page_table();
+    uint8_t *slow;
+    if (constant) {
+      if (is_io_word(address)) {
+        side_exit(a_.jmp(), i);
+        return false;
+      }
+      uint8_t offset = static_cast<uint8_t>(address);
+      a_.mov_ri(RCX, address);
+      if (offset == 0xFF) {
+        call_read();
+        return true;
+      }
+      a_.mov_ri64(RAX, &table[address >> 8]);
+      a_.rm(Size::QWORD, {0x8B}, RDX, Mem{RAX});
+      a_.rr(Size::QWORD, {0x85}, RDX, RDX);
+      slow = a_.jcc(CC_E);
+      a_.rm(Size::DWORD, {0x0F, 0xB7}, RAX, Mem{RDX, offset});
+    } else {
+      io_check(i);
+      page_lookup(table);
+      slow = a_.jcc(CC_E);
+      a_.rr(Size::BYTE, {0x80}, 7, RCX);
+      a_.byte(0xFF);
+      uint8_t *straddles = a_.jcc(CC_E);
+      a_.rr(Size::DWORD, {0x0F, 0xB6}, R8, RCX);
+      a_.rm(Size::DWORD, {0x0F, 0xB7}, RAX, Mem{RDX, 0, R8, 1});
+      uint8_t *done = a_.jmp();
+      a_.bind(straddles);
+      a_.bind(slow);
+      call_read();
+      a_.bind(done);
+      return true;
+    }
+    uint8_t *done = a_.jmp();
+    a_.bind(slow);
+    call_read();
+    a_.bind(done);
+    return true;
+  }
+
+  // rdx = table[ecx >> 8], flags set on rdx == 0
+  void page_lookup(const void *table) {
+    a_.rr(Size::DWORD, {0x89}, RCX, RDX);
+    a_.rr(Size::DWORD, {0xC1}, 5, RDX);
+    a_.byte(8);
+    a_.mov_ri64(RAX, table);
+    a_.rm(Size::QWORD, {0x8B}, RDX, Mem{RAX, 0, RDX, 8});
+    a_.rr(Size::QWORD, {0x85}, RDX, RDX);
+  }
+
+  void call_read() {
+    a_.mov_ri64(RDI, &cpu());
+    a_.rr(Size::DWORD, {0x89}, RCX, RSI);
+    a_.mov_ri64(RAX, reinterpret_cast<const void *>(&X86Jit::read_word));
+    a_.rr(Size::DWORD, {0xFF}, 2, RAX);
+  }
+
+  // Store value (a guest register, or imm if value is RSP) to the
+  // address. Stores that may hit translated code, and pages that are not
+  // writable in place, go through CPU::store_word(); if that requires
+  // leaving, next_pc loads the PC after op i into ecx for the exit.
+  template <typename LoadNextPc>
+  bool write_word(uint32_t i, bool constant, uint16_t address, Reg value,
+                  uint16_t imm, LoadNextPc next_pc) {
+    uint8_t *const *table = jit_.write_page_table();
+    std::vector<uint8_t *> slow;
+    uint8_t *done = nullptr;
+    if (constant) {
+      if (is_io_word(address)) {
+        side_exit(a_.jmp(), i);
+        return false;
+      }
+      a_.mov_ri(RCX, address);
+      uint8_t offset = static_cast<uint8_t>(address);
+      if (offset != 0xFF && !may_hit_code(address)) {
+        a_.mov_ri64(RAX, &table[address >> 8]);
+        a_.rm(Size::QWORD, {0x8B}, RDX, Mem{RAX});
+        a_.rr(Size::QWORD, {0x85}, RDX, RDX);
+        slow.push_back(a_.jcc(CC_E));
+        store_value(Mem{RDX, offset}, value, imm);
+        done = a_.jmp();
+      }
+    } else {
+      io_check(i);
+      // [0x7FFF, 0xEFFE]: the word overlaps the program region
+      a_.rm(Size::DWORD, {0x8D}, RAX,
+            Mem{RCX, -static_cast<int32_t>(Memory::PROGRAM_START - 1)});
+      a_.rr(Size::DWORD, {0x81}, 7, RAX);
+      a_.imm32(Memory::PROGRAM_END - Memory::PROGRAM_START + 1);
+      slow.push_back(a_.jcc(CC_B));
+      page_lookup(table);
+      slow.push_back(a_.jcc(CC_E));
+      a_.rr(Size::BYTE, {0x80}, 7, RCX);
+      a_.byte(0xFF);
+      slow.push_back(a_.jcc(CC_E));
+      a_.rr(Size::DWORD, {0x0F, 0xB6}, R8, RCX);
+      store_value(Mem{RDX, 0, R8, 1}, value, imm);
+      done = a_.jmp();
+    }
+    for (uint8_t *site : slow) {
+      a_.bind(site);
+    }
+    a_.mov_ri64(RDI, &cpu());
+    a_.rr(Size::DWORD, {0x89}, RCX, RSI);
+    if (value == RSP) {
+      a_.mov_ri(RDX, imm);
+    } else {
+      a_.rr(Size::DWORD, {0x89}, value, RDX);
+    }
+    a_.mov_ri64(RAX, reinterpret_cast<const void *>(&X86Jit::write_word));
+    a_.rr(Size::DWORD, {0xFF}, 2, RAX);
+    a_.rr(Size::DWORD, {0x85}, RAX, RAX);
+    uint8_t *stay = a_.jcc(CC_E);
+    next_pc();
+    leave_exit(a_.jmp(), i);
+    a_.bind(stay);
+    if (done) {
+      a_.bind(done);
+    }
+    return true;
+  }
+
+  static bool may_hit_code(uint16_t address) {
+    return address >= Memory::PROGRAM_START - 1 &&
+           address <= Memory::PROGRAM_END;
+  }
+
+  void store_value(Mem m, Reg value, uint16_t imm) {
+    if (value == RSP) {
+      a_.rm(Size::WORD, {0xC7}, 0, m);
+      a_.imm16(imm);
+    } else {
+      a_.rm(Size::WORD, {0x89}, value, m);
+    }
+  }
+
+  bool emit_mov(uint32_t i) {
+    const MicroOp &op = block_.ops[i];
+    const CPU::DecodedInstruction &instr = op.instr;
+    Reg rd = GPR[instr.rd];
+    if (instr.mode == AddressingMode::REGISTER) {
+      a_.rr(Size::DWORD, {0x89}, GPR[instr.rs], rd);
+    } else if (instr.mode == AddressingMode::IMMEDIATE) {
+      a_.mov_ri(rd, instr.extra_word);
+    } else {
+      bool constant;
+      uint16_t address = effective_address(op, constant);
+      if (!read_word(i, constant, address)) {
+        return false;
+      }
+      a_.rr(Size::DWORD, {0x89}, RAX, rd);
+    }
+    return true;
+  }
+
+  bool emit_alu(uint32_t i) {
+    const MicroOp &op = block_.ops[i];
+    const CPU::DecodedInstruction &instr = op.instr;
+    Reg rd = GPR[instr.rd];
+    bool immediate = instr.mode == AddressingMode::IMMEDIATE;
+    Reg source = RAX;
+    if (instr.mode == AddressingMode::REGISTER) {
+      source = GPR[instr.rs];
+    } else if (!immediate) {
+      bool constant;
+      uint16_t address = effective_address(op, constant);
+      if (!read_word(i, constant, address)) {
+        return false;
+      }
+    }
+
+    if (instr.opcode == Opcode::SHL || instr.opcode == Opcode::SHR) {
+      emit_shift(instr.opcode == Opcode::SHL, rd, immediate, source,
+                 instr.extra_word, flags_live_[i]);
+      return true;
+    }
+
+    // 16-bit host ALU ops set ZF/SF/CF/OF exactly as the guest defines
+    // them; AND/OR/XOR clear CF and OF
+    struct Encoding {
+      uint8_t rr;
+      uint8_t extension;
+    };
+    Encoding e;
+    switch (instr.opcode) {
+    case Opcode::ADD:
+      e = {0x01, 0};
+      break;
+    case Opcode::SUB:
+      e = {0x29, 5};
+      break;
+    case Opcode::AND:
+      e = {0x21, 4};
+      break;
+    case Opcode::OR:
+      e = {0x09, 1};
+      break;
+    case Opcode::XOR:
+      e = {0x31, 6};
+      break;
+    default: // CMP
+      e = {0x39, 7};
+      break;
+    }
+    if (immediate) {
+      a_.rr(Size::WORD, {0x81}, e.extension, rd);
+      a_.imm16(instr.extra_word);
+    } else {
+      a_.rr(Size::WORD, {e.rr}, source, rd);
+    }
+    if (flags_live_[i]) {
+      bool logic = instr.opcode == Opcode::AND || instr.opcode == Opcode::OR ||
+                   instr.opcode == Opcode::XOR;
+      materialise_flags(!logic);
+    }
+    return true;
+  }
+
+  // Shifts run in 32 bits so counts up to 31 need no special case; larger
+  // counts behave like 31. SHL: bit 16 is the last bit shifted out. SHR
+  // shifts (a << 1) so bit 0 ends up holding it.
+  void emit_shift(bool left, Reg rd, bool immediate, Reg source, uint16_t imm,
+                  bool flags) {
+    uint8_t count = 0;
+    if (immediate) {
+      count = static_cast<uint8_t>(std::min<uint16_t>(imm, 31));
+    } else {
+      a_.mov_ri(RCX, 31);
+      a_.rr(Size::WORD, {0x81}, 7, source);
+      a_.imm16(31);
+      a_.rr(Size::DWORD, {0x0F, 0x40 | CC_BE}, RCX, source);
+    }
+    a_.rr(Size::DWORD, {0x0F, 0xB7}, RAX, rd);
+    if (!left) {
+      a_.rr(Size::DWORD, {0xD1}, 4, RAX);
+    }
+    if (immediate) {
+      a_.rr(Size::DWORD, {0xC1}, left ? 4 : 5, RAX);
+      a_.byte(count);
+    } else {
+      a_.rr(Size::DWORD, {0xD3}, left ? 4 : 5, RAX);
+    }
+    if (left) {
+      if (flags) {
+        a_.rr(Size::DWORD, {0x0F, 0xBA}, 4, RAX);
+        a_.byte(16);
+      }
+    } else {
+      a_.rr(Size::DWORD, {0xD1}, 5, RAX);
+    }
+    if (flags) {
+      a_.rr(Size::BYTE, {0x0F, 0x90 | CC_B}, 0, R10);
+    }
+    a_.rr(Size::DWORD, {0x89}, RAX, rd);
+    if (flags) {
+      a_.rr(Size::WORD, {0x85}, RAX, RAX);
+      a_.rr(Size::BYTE, {0x0F, 0x90 | CC_E}, 0, R8);
+      a_.rr(Size::BYTE, {0x0F, 0x90 | CC_S}, 0, R9);
+      a_.rr(Size::DWORD, {0x0F, 0xB6}, R8, R8);
+      a_.rr(Size::DWORD, {0x0F, 0xB6}, R9, R9);
+      a_.rr(Size::DWORD, {0x0F, 0xB6}, R10, R10);
+      a_.rm(Size::DWORD, {0x8D}, R8, Mem{R8, 0, R9, 2});
+      a_.rm(Size::DWORD, {0x8D}, GUEST_FLAGS, Mem{R8, 0, R10, 4});
+    }
+  }
+
+  // FLAGS = Z | N << 1 [| C << 2 | V << 3] from the host flags, which are
+  // left intact for a following Jcc
+  void materialise_flags(bool arithmetic) {
+    a_.rr(Size::BYTE, {0x0F, 0x90 | CC_E}, 0, R8);
+    a_.rr(Size::BYTE, {0x0F, 0x90 | CC_S}, 0, R9);
+    if (arithmetic) {
+      a_.rr(Size::BYTE, {0x0F, 0x90 | CC_B}, 0, R10);
+      a_.rr(Size::BYTE, {0x0F, 0x90 | CC_O}, 0, R11);
+    }
+    a_.rr(Size::DWORD, {0x0F, 0xB6}, R8, R8);
+    a_.rr(Size::DWORD, {0x0F, 0xB6}, R9, R9);
+    if (!arithmetic) {
+      a_.rm(Size::DWORD, {0x8D}, GUEST_FLAGS, Mem{R8, 0, R9, 2});
+      return;
+    }
+    a_.rr(Size::DWORD, {0x0F, 0xB6}, R10, R10);
+    a_.rr(Size::DWORD, {0x0F, 0xB6}, R11, R11);
+    a_.rm(Size::DWORD, {0x8D}, R8, Mem{R8, 0, R9, 2});
+    a_.rm(Size::DWORD, {0x8D}, R10, Mem{R10, 0, R11, 2});
+    a_.rm(Size::DWORD, {0x8D}, GUEST_FLAGS, Mem{R8, 0, R10, 4});
+  }
+
+  static Cond host_condition(Opcode branch) {
+    switch (branch) {
+    case Opcode::JZ:
+      return CC_E;
+    case Opcode::JNZ:
+      return CC_NE;
+    case Opcode::JC:
+      return CC_B;
+    case Opcode::JNC:
+      return CC_AE;
+    default: // JN
+      return CC_S;
+    }
+  }
+
+  // CMP/SUB + Jcc: the host jump tests the host flags directly
+  void emit_fused(const MicroOp &op) {
+    const CPU::DecodedInstruction &instr = op.instr;
+    Reg rd = GPR[instr.rd];
+    a_.rm(Size::DWORD, {0x83}, 0, Mem{RSP, SLOT_FUSED});
+    a_.byte(1);
+    uint8_t extension = instr.opcode == Opcode::CMP ? 7 : 5;
+    if (instr.mode == AddressingMode::IMMEDIATE) {
+      a_.rr(Size::WORD, {0x81}, extension, rd);
+      a_.imm16(instr.extra_word);
+    } else {
+      a_.rr(Size::WORD, {static_cast<uint8_t>(extension == 7 ? 0x39 : 0x29)},
+            GPR[instr.rs], rd);
+    }
+    materialise_flags(true);
+    set_previous(op);
+    static_exit(a_.jcc(host_condition(op.branch.opcode)), op.branch_target);
+    static_exit(a_.jmp(), op.branch_next_pc);
+  }
+
+  void emit_branch(uint32_t i) {
+    const MicroOp &op = block_.ops[i];
+    const CPU::DecodedInstruction &instr = op.instr;
+    bool constant = instr.mode == AddressingMode::DIRECT ||
+                    instr.mode == AddressingMode::PC_RELATIVE;
+    uint16_t target = constant ? static_cast<uint16_t>(
+                                     instr.mode == AddressingMode::DIRECT
+                                         ? instr.extra_word
+                                         : op.next_pc + static_cast<int16_t>(
+                                                            instr.extra_word))
+                               : 0;
+    set_previous(op);
+
+    if (instr.opcode == Opcode::JMP || instr.opcode == Opcode::CALL) {
+      if (instr.opcode == Opcode::CALL) {
+        a_.rm(Size::DWORD, {0x8D}, RCX, Mem{GUEST_SP, -2});
+        a_.rr(Size::DWORD, {0x0F, 0xB7}, RCX, RCX);
+        io_check(i);
+        a_.rr(Size::DWORD, {0x89}, RCX, GUEST_SP);
+        write_word(i, false, 0, RSP, op.next_pc,
+                   [&] { load_target(op, constant, target); });
+        set_previous(op);
+      }
+      if (constant) {
+        static_exit(a_.jmp(), target);
+      } else {
+        load_target(op, false, 0);
+        dynamic_exit();
+      }
+      return;
+    }
+
+    // Jcc on the materialised FLAGS
+    uint8_t mask;
+    bool when_set;
+    switch (instr.opcode) {
+    case Opcode::JZ:
+      mask = 1 << Registers::FLAG_Z, when_set = true;
+      break;
+    case Opcode::JNZ:
+      mask = 1 << Registers::FLAG_Z, when_set = false;
+      break;
+    case Opcode::JC:
+      mask = 1 << Registers::FLAG_C, when_set = true;
+      break;
+    case Opcode::JNC:
+      mask = 1 << Registers::FLAG_C, when_set = false;
+      break;
+    default: // JN
+      mask = 1 << Registers::FLAG_N, when_set = true;
+      break;
+    }
+    a_.rr(Size::BYTE, {0xF6}, 0, GUEST_FLAGS);
+    a_.byte(mask);
+    Cond taken = when_set ? CC_NE : CC_E;
+    if (constant) {
+      static_exit(a_.jcc(taken), target);
+      static_exit(a_.jmp(), op.next_pc);
+      return;
+    }
+    uint8_t *jump = a_.jcc(taken);
+    static_exit(a_.jmp(), op.next_pc);
+    a_.bind(jump);
+    load_target(op, false, 0);
+    dynamic_exit();
+  }
+
+  // Jump target into ecx
+  void load_target(const MicroOp &op, bool constant, uint16_t target) {
+    if (constant) {
+      a_.mov_ri(RCX, target);
+      return;
+    }
+    bool unused;
+    effective_address(op, unused);
+  }
+
+  // rax tells the next block's budget exit which instruction ran last
+  void set_previous(const MicroOp &op) { a_.mov_ri64(RAX, &op); }
+
+  // Continue at the PC in ecx: jump straight to its native code if there
+  // is any, otherwise return to run_compiled()
+  void dynamic_exit() {
+    const MicroOp &last = block_.ops.back();
+    a_.rm(Size::DWORD, {0x8D}, RAX,
+          Mem{RCX, -static_cast<int32_t>(Memory::PROGRAM_START)});
+    a_.rr(Size::DWORD, {0x81}, 7, RAX);
+    a_.imm32(REGION_SIZE);
+    uint8_t *outside = a_.jcc(CC_AE);
+    a_.mov_ri64(RDX, jit_.entries_.data());
+    a_.rm(Size::DWORD, {0x8B}, RDX, Mem{RDX, 0, RAX, 4});
+    a_.rr(Size::DWORD, {0x85}, RDX, RDX);
+    uint8_t *untranslated = a_.jcc(CC_E);
+    a_.mov_ri64(RSI, jit_.buffer_);
+    a_.rr(Size::QWORD, {0x01}, RSI, RDX);
+    set_previous(last);
+    a_.rr(Size::DWORD, {0xFF}, 4, RDX);
+    a_.bind(outside);
+    a_.bind(untranslated);
+    a_.rm(Size::QWORD, {0x8B}, RAX, Mem{RSP, SLOT_FRAME});
+    a_.rm(Size::WORD, {0x89}, RCX, Mem{RAX, OFF_PC});
+    exit_tail(X86Jit::Exit::BLOCK_END,
+              static_cast<uint32_t>(block_.ops.size()));
+  }
+
+  void side_exit(uint8_t *site, uint32_t op) {
+    side_exits_.push_back({site, op});
+  }
+  void leave_exit(uint8_t *site, uint32_t op) {
+    leave_exits_.push_back({site, op});
+  }
+  void static_exit(uint8_t *site, uint16_t pc) {
+    static_exits_.push_back({site, pc});
+  }
+
+  // Frame pointer in rax, state.pc already stored
+  void exit_tail(X86Jit::Exit exit, uint32_t op) {
+    a_.mov_ri64(RDX, &block_);
+    a_.rm(Size::QWORD, {0x89}, RDX, Mem{RAX, OFF_BLOCK});
+    a_.rm(Size::DWORD, {0xC7}, 0, Mem{RAX, OFF_OP});
+    a_.imm32(op);
+    a_.rm(Size::BYTE, {0xC6}, 0, Mem{RAX, OFF_EXIT});
+    a_.byte(static_cast<uint8_t>(exit));
+    a_.jmp_to(jit_.leave_);
+  }
+
+  void refund(uint32_t instructions) {
+    if (instructions) {
+      a_.rm(Size::DWORD, {0x81}, 0, Mem{RSP, SLOT_BUDGET});
+      a_.imm32(instructions);
+    }
+  }
+
+  void emit_stubs() {
+    a_.bind(budget_exit_);
+    a_.rm(Size::QWORD, {0x8B}, RDX, Mem{RSP, SLOT_FRAME});
+    a_.rm(Size::QWORD, {0x89}, RAX, Mem{RDX, OFF_PREVIOUS});
+    a_.rr(Size::QWORD, {0x89}, RDX, RAX);
+    a_.rm(Size::WORD, {0xC7}, 0, Mem{RAX, OFF_PC});
+    a_.imm16(block_.start_pc);
+    exit_tail(X86Jit::Exit::BUDGET, 0);
+
+    // One stub per op for the side exits, which all leave the same state
+    std::sort(side_exits_.begin(), side_exits_.end(),
+              [](const Exit &x, const Exit &y) { return x.op < y.op; });
+    for (size_t k = 0; k < side_exits_.size(); ++k) {
+      uint32_t op = side_exits_[k].op;
+      a_.bind(side_exits_[k].site);
+      while (k + 1 < side_exits_.size() && side_exits_[k + 1].op == op) {
+        a_.bind(side_exits_[++k].site);
+      }
+      refund(length_ - op);
+      a_.rm(Size::QWORD, {0x8B}, RAX, Mem{RSP, SLOT_FRAME});
+      a_.rm(Size::WORD, {0xC7}, 0, Mem{RAX, OFF_PC});
+      a_.imm16(pc_of(op));
+      exit_tail(X86Jit::Exit::SIDE_EXIT, op);
+    }
+
+    for (const Exit &exit : leave_exits_) {
+      a_.bind(exit.site);
+      refund(length_ - exit.op - 1);
+      a_.rm(Size::QWORD, {0x8B}, RAX, Mem{RSP, SLOT_FRAME});
+      a_.rm(Size::WORD, {0x89}, RCX, Mem{RAX, OFF_PC});
+      exit_tail(X86Jit::Exit::LEAVE, exit.op);
+    }
+
+    // Static exits stay patchable: run_compiled() links the jump at site
+    // to the target block once that is translated
+    for (const StaticExit &exit : static_exits_) {
+      a_.bind(exit.site);
+      a_.rm(Size::QWORD, {0x8B}, RAX, Mem{RSP, SLOT_FRAME});
+      a_.rm(Size::WORD, {0xC7}, 0, Mem{RAX, OFF_PC});
+      a_.imm16(exit.pc);
+      a_.mov_ri64(RDX, exit.site);
+      a_.rm(Size::QWORD, {0x89}, RDX, Mem{RAX, OFF_LINK});
+      exit_tail(X86Jit::Exit::BLOCK_END,
+                static_cast<uint32_t>(block_.ops.size()));
+    }
+  }
+};
+
+bool X86Jit::supported() { return true; }
+
+X86Jit::X86Jit(CPU &cpu) : cpu_(cpu), entries_(REGION_SIZE, 0) {
+  void *buffer = mmap(nullptr, CODE_BUFFER_SIZE,
+                      PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    return;
+  }
+  buffer_ = static_cast<uint8_t *>(buffer);
+  emit_trampoline();
+}
+
+X86Jit::~X86Jit() {
+  if (buffer_) {
+    munmap(buffer_, CODE_BUFFER_SIZE);
+  }
+}
+
+// enter_(Frame *): saves the callee-saved registers, loads the guest
+// registers and jumps to frame->entry. leave_ stores them back and
+// returns to the caller of enter_.
+void X86Jit::emit_trampoline() {
+  using Size = Assembler::Size;
+  Assembler a(buffer_, buffer_ + CODE_BUFFER_SIZE);
+  const Reg saved[] = {RBX, RBP, R12, R13, R14, R15};
+
+  enter_ = a.here();
+  for (Reg r : saved) {
+    a.push(r);
+  }
+  // Six pushes leave rsp 8 bytes off 16-byte alignment; 24 more keeps
+  // calls from generated code aligned
+  a.rr(Size::QWORD, {0x83}, 5, RSP);
+  a.byte(24);
+  a.rm(Size::QWORD, {0x89}, RDI, Mem{RSP, SLOT_FRAME});
+  a.rm(Size::DWORD, {0x8B}, RAX, Mem{RDI, OFF_BUDGET});
+  a.rm(Size::DWORD, {0x89}, RAX, Mem{RSP, SLOT_BUDGET});
+  a.rm(Size::DWORD, {0xC7}, 0, Mem{RSP, SLOT_FUSED});
+  a.imm32(0);
+  for (uint8_t i = 0; i < 4; ++i) {
+    a.rm(Size::DWORD, {0x0F, 0xB7}, GPR[i], Mem{RDI, OFF_GPR + 2 * i});
+  }
+  a.rm(Size::DWORD, {0x0F, 0xB7}, GUEST_SP, Mem{RDI, OFF_SP});
+  a.rm(Size::DWORD, {0x0F, 0xB6}, GUEST_FLAGS, Mem{RDI, OFF_FLAGS});
+  a.rr(Size::DWORD, {0x31}, RAX, RAX); // no previous instruction
+  a.rm(Size::DWORD, {0xFF}, 4, Mem{RDI, OFF_ENTRY});
+
+  leave_ = a.here();
+  a.rm(Size::QWORD, {0x8B}, RAX, Mem{RSP, SLOT_FRAME});
+  for (uint8_t i = 0; i < 4; ++i) {
+    a.rm(Size::WORD, {0x89}, GPR[i], Mem{RAX, OFF_GPR + 2 * i});
+  }
+  a.rm(Size::WORD, {0x89}, GUEST_SP, Mem{RAX, OFF_SP});
+  a.rm(Size::BYTE, {0x88}, GUEST_FLAGS, Mem{RAX, OFF_FLAGS});
+  a.rm(Size::DWORD, {0x8B}, RCX, Mem{RSP, SLOT_BUDGET});
+  a.rm(Size::DWORD, {0x89}, RCX, Mem{RAX, OFF_BUDGET});
+  a.rm(Size::DWORD, {0x8B}, RCX, Mem{RSP, SLOT_FUSED});
+  a.rm(Size::DWORD, {0x89}, RCX, Mem{RAX, OFF_FUSED});
+  a.rr(Size::QWORD, {0x83}, 0, RSP);
+  a.byte(24);
+  for (int k = 5; k >= 0; --k) {
+    a.pop(saved[k]);
+  }
+  a.byte(0xC3);
+
+  used_ = static_cast<size_t>(a.here() - buffer_);
+  trampoline_size_ = used_;
+}
+
+void X86Jit::reset() {
+  used_ = trampoline_size_;
+  std::fill(entries_.begin(), entries_.end(), 0);
+}
+
+bool X86Jit::translate(Block &block, const BlockCache &cache) {
+  if (generation_ != cache.generation()) {
+    reset();
+    generation_ = cache.generation();
+  }
+  X86BlockEmitter emitter(*this, block, buffer_ + used_,
+                          buffer_ + CODE_BUFFER_SIZE);
+  uint8_t *end = emitter.emit();
+  if (!end) {
+    return false;
+  }
+  block.native = buffer_ + used_;
+  entries_[block.start_pc - Memory::PROGRAM_START] =
+      static_cast<uint32_t>(used_);
+  used_ = static_cast<size_t>(end - buffer_);
+  return true;
+}
+
+void X86Jit::run(Frame &frame) {
+  frame.link = nullptr;
+  frame.previous = nullptr;
+  reinterpret_cast<void (*)(Frame *)>(enter_)(&frame);
+}
+
+void X86Jit::link(uint8_t *site, const Block &target) {
+  patch_rel32(site, target.native);
+}
+
+#else
+
+bool X86Jit::supported() { return false; }
+X86Jit::X86Jit(CPU &cpu) : cpu_(cpu) {}
+X86Jit::~X86Jit() = default;
+void X86Jit::emit_trampoline() {}
+void X86Jit::reset() {}
+bool X86Jit::translate(Block &, const BlockCache &) { return false; }
+void X86Jit::run(Frame &) {}
+void X86Jit::link(uint8_t *, const Block &) {}
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "block_cache.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// x86-64 translator for the compiled engine (jit_x86_64.cpp).
+//
+// Turns a Block into host machine code in an executable mmap'd buffer.
+// While native code runs, guest R0-R3 live in rbx/rbp/r12/r13, SP in r14
+// and FLAGS in r15; PC is implied by the code address. Blocks are entered
+// through a trampoline that loads those registers from a NativeFrame and
+// stores them back when control leaves native code. Exits to blocks that
+// are already translated are patched into direct jumps, and indirect jumps
+// look the target up in a PC-indexed table, so hot loops stay in host code
+// without returning to run_compiled().
+//
+// Native code returns to run_compiled() before an instruction that
+// touches the I/O page or must always be interpreted (HALT, IN, OUT), and
+// after a store that invalidated translated code or must leave the engine.
+// Blocks on self-modifying pages are never translated.
+//
+// Only built for x86-64 hosts with mmap(); elsewhere supported() is false
+// and run_compiled() keeps using the compiled handlers.
+class X86Jit {
+public:
+  // Why native code returned
+  enum class Exit : uint8_t {
+    BLOCK_END, // left the last block at its end; state.pc is the next PC
+    SIDE_EXIT, // ops[op] must run on the interpreter, it has not started
+    LEAVE,     // ops[op] completed a store that requires leaving the engine
+    BUDGET     // fewer instructions left than the block needs
+  };
+
+  // Shared with the generated code; the offsets are baked into it
+  struct Frame {
+    GuestState state;
+    uint32_t budget = 0;      // instructions native code may retire
+    uint32_t fused_pairs = 0; // fused pairs retired
+    const uint8_t *entry = nullptr;
+    Block *block = nullptr; // block that control left from
+    uint8_t *link = nullptr; // static exit to patch to state.pc, or null
+    // Last instruction retired before a BUDGET exit, null if it was not
+    // native code
+    const MicroOp *previous = nullptr;
+    uint32_t op = 0;
+    Exit exit = Exit::BLOCK_END;
+  };
+
+  static bool supported();
+
+  explicit X86Jit(CPU &cpu);
+  ~X86Jit();
+  X86Jit(const X86Jit &) = delete;
+  X86Jit &operator=(const X86Jit &) = delete;
+
+  // False if the code buffer could not be mapped
+  bool ready() const { return buffer_ != nullptr; }
+
+  // Set block.native. Returns false if the buffer is full; the caller
+  // flushes the block cache, which discards all native code.
+  bool translate(Block &block, const BlockCache &cache);
+
+  // Run native code from frame.entry until it exits
+  void run(Frame &frame);
+
+  // Point the static exit at site directly to target's code
+  void link(uint8_t *site, const Block &target);
+
+private:
+  CPU &cpu_;
+  uint8_t *buffer_ = nullptr;
+  size_t used_ = 0;
+  uint8_t *enter_ = nullptr; // trampoline: void (*)(Frame *)
+  uint8_t *leave_ = nullptr; // common exit path of the generated code
+  size_t trampoline_size_ = 0;
+  uint64_t generation_ = 0;  // BlockCache::generation() of the code
+  // Native entry of the block at each program-region PC, as an offset
+  // into buffer_ (0 if none), for indirect jumps
+  std::vector<uint32_t> entries_;
+
+  void reset();
+  void emit_trampoline();
+
+  friend class X86BlockEmitter;
+  const uint8_t *const *read_page_table() const;
+  uint8_t *const *write_page_table() const;
+  // Out-of-line memory paths called from generated code
+  static uint32_t read_word(CPU *cpu, uint32_t address);
+  static uint32_t write_word(CPU *cpu, uint32_t address, uint32_t value);
+};
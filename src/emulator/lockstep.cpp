@@ -0,0 +1,655 @@
+#include "lockstep.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Lockstep engine.
+//
+// Lane state is held in uint16_t arrays padded to a multiple of the SIMD
+// width. A kernel processes the chunks of lanes that hold group members
+// and merges its results into the arrays under mask_, so other lanes in
+// those chunks keep their values; a group narrower than one vector runs
+// the Scalar kernels on just its lanes instead. Flags are computed
+// eagerly with the same rules as ALU::execute(), as branch-free lane-wise
+// expressions:
+//   Z = r == 0, N = r >> 15
+//   ADD: C = r <u a, V = ~(a ^ b) & (a ^ r) >> 15
+//   SUB: C = a <u b, V =  (a ^ b) & (a ^ r) >> 15
+// with unsigned compares done as signed compares on values biased by
+// 0x8000. Shifts by an immediate use the vector shift; shifts by a
+// register have a per-lane count and run lane by lane.
+
+namespace {
+
+// One lane per "vector"; same semantics as the intrinsics below. Used for
+// groups narrower than a vector, and as Simd when the build has no SSE2.
+struct Scalar {
+  using V = uint16_t;
+  static constexpr size_t WIDTH = 1;
+  static constexpr const char *NAME = "scalar";
+
+  static V load(const uint16_t *p) { return *p; }
+  static void store(uint16_t *p, V v) { *p = v; }
+  static V set1(uint16_t x) { return x; }
+  static V add(V a, V b) { return static_cast<V>(a + b); }
+  static V sub(V a, V b) { return static_cast<V>(a - b); }
+  static V and_(V a, V b) { return a & b; }
+  static V or_(V a, V b) { return a | b; }
+  static V xor_(V a, V b) { return a ^ b; }
+  static V andnot(V a, V b) { return static_cast<V>(~a & b); }
+  static V cmpeq(V a, V b) { return a == b ? 0xFFFF : 0; }
+  static V cmpgt(V a, V b) {
+    return static_cast<int16_t>(a) > static_cast<int16_t>(b) ? 0xFFFF : 0;
+  }
+  static V sll(V a, int n) { return n > 15 ? 0 : static_cast<V>(a << n); }
+  static V srl(V a, int n) { return n > 15 ? 0 : static_cast<V>(a >> n); }
+};
+
+#if defined(__AVX2__)
+
+struct Simd {
+  using V = __m256i;
+  static constexpr size_t WIDTH = 16;
+  static constexpr const char *NAME = "AVX2";
+
+  static V load(const uint16_t *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  }
+  static void store(uint16_t *p, V v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+  }
+  static V set1(uint16_t x) { return _mm256_set1_epi16(static_cast<short>(x)); }
+  static V add(V a, V b) { return _mm256_add_epi16(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_epi16(a, b); }
+  static V and_(V a, V b) { return _mm256_and_si256(a, b); }
+  static V or_(V a, V b) { return _mm256_or_si256(a, b); }
+  static V xor_(V a, V b) { return _mm256_xor_si256(a, b); }
+  static V andnot(V a, V b) { return _mm256_andnot_si256(a, b); } // ~a & b
+  static V cmpeq(V a, V b) { return _mm256_cmpeq_epi16(a, b); }
+  static V cmpgt(V a, V b) { return _mm256_cmpgt_epi16(a, b); } // signed
+  static V sll(V a, int n) { return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+  static V srl(V a, int n) { return _mm256_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+};
+
+#elif defined(__SSE2__)
+
+struct Simd {
+  using V = __m128i;
+  static constexpr size_t WIDTH = 8;
+  static constexpr const char *NAME = "SSE2";
+
+  static V load(const uint16_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  }
+  static void store(uint16_t *p, V v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+  }
+  static V set1(uint16_t x) { return _mm_set1_epi16(static_cast<short>(x)); }
+  static V add(V a, V b) { return _mm_add_epi16(a, b); }
+  static V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+  static V and_(V a, V b) { return _mm_and_si128(a, b); }
+  static V or_(V a, V b) { return _mm_or_si128(a, b); }
+  static V xor_(V a, V b) { return _mm_xor_si128(a, b); }
+  static V andnot(V a, V b) { return _mm_andnot_si128(a, b); } // ~a & b
+  static V cmpeq(V a, V b) { return _mm_cmpeq_epi16(a, b); }
+  static V cmpgt(V a, V b) { return _mm_cmpgt_epi16(a, b); } // signed
+  static V sll(V a, int n) { return _mm_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+  static V srl(V a, int n) { return _mm_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+};
+
+#else
+
+using Simd = Scalar;
+
+#endif
+
+// Room for the widest kernel, whatever the build uses
+constexpr size_t MAX_WIDTH = 16;
+
+using Opcode = CPU::Opcode;
+using AddressingMode = CPU::AddressingMode;
+
+constexpr uint16_t FLAG_Z = 1 << Registers::FLAG_Z;
+constexpr uint16_t FLAG_N = 1 << Registers::FLAG_N;
+constexpr uint16_t FLAG_C = 1 << Registers::FLAG_C;
+constexpr uint16_t FLAG_V = 1 << Registers::FLAG_V;
+
+// The helpers and kernels below take the lane type S: Simd, or Scalar for
+// groups narrower than a vector
+
+// (mask & a) | (~mask & b)
+template <typename S>
+inline typename S::V select(typename S::V mask, typename S::V a,
+                            typename S::V b) {
+  return S::or_(S::and_(mask, a), S::andnot(mask, b));
+}
+
+template <typename S> inline typename S::V zn_flags(typename S::V r) {
+  auto z = S::and_(S::cmpeq(r, S::set1(0)), S::set1(FLAG_Z));
+  auto n = S::and_(S::srl(r, 15 - Registers::FLAG_N), S::set1(FLAG_N));
+  return S::or_(z, n);
+}
+
+// Unsigned a < b
+template <typename S>
+inline typename S::V less_unsigned(typename S::V a, typename S::V b) {
+  auto bias = S::set1(0x8000);
+  return S::cmpgt(S::xor_(b, bias), S::xor_(a, bias));
+}
+
+// Bit 15 of x moved to the V flag position
+template <typename S> inline typename S::V overflow_bit(typename S::V x) {
+  return S::and_(S::srl(x, 15 - Registers::FLAG_V), S::set1(FLAG_V));
+}
+
+// ALU operation on one chunk; shift counts are the immediate
+template <typename S, ALU::Operation Op>
+inline typename S::V alu(typename S::V a, typename S::V b, int shift,
+                         typename S::V &flags) {
+  using V = typename S::V;
+  if constexpr (Op == ALU::Operation::ADD) {
+    V r = S::add(a, b);
+    V c = S::and_(less_unsigned<S>(r, a), S::set1(FLAG_C));
+    V v = overflow_bit<S>(S::andnot(S::xor_(a, b), S::xor_(a, r)));
+    flags = S::or_(S::or_(zn_flags<S>(r), c), v);
+    return r;
+  } else if constexpr (Op == ALU::Operation::SUB ||
+                       Op == ALU::Operation::CMP) {
+    V r = S::sub(a, b);
+    V c = S::and_(less_unsigned<S>(a, b), S::set1(FLAG_C));
+    V v = overflow_bit<S>(S::and_(S::xor_(a, b), S::xor_(a, r)));
+    flags = S::or_(S::or_(zn_flags<S>(r), c), v);
+    return r;
+  } else if constexpr (Op == ALU::Operation::AND) {
+    V r = S::and_(a, b);
+    flags = zn_flags<S>(r);
+    return r;
+  } else if constexpr (Op == ALU::Operation::OR) {
+    V r = S::or_(a, b);
+    flags = zn_flags<S>(r);
+    return r;
+  } else if constexpr (Op == ALU::Operation::XOR) {
+    V r = S::xor_(a, b);
+    flags = zn_flags<S>(r);
+    return r;
+  } else {
+    // Carry is the last bit shifted out, for counts 1..16
+    constexpr bool left = Op == ALU::Operation::SHL;
+    V r = left ? S::sll(a, shift) : S::srl(a, shift);
+    V c = S::set1(0);
+    if (shift > 0 && shift <= 16) {
+      V out = left ? S::srl(a, 16 - shift) : S::srl(a, shift - 1);
+      c = S::sll(S::and_(out, S::set1(1)), Registers::FLAG_C);
+    }
+    flags = S::or_(zn_flags<S>(r), c);
+    return r;
+  }
+}
+
+// Scalar form of the shift rules for register-mode shift counts
+inline uint16_t shift_lane(bool left, uint16_t a, uint16_t b,
+                           uint16_t &flags) {
+  bool carry = b > 0 && b <= 16 &&
+               (a & (left ? 1 << (16 - b) : 1 << (b - 1))) != 0;
+  uint16_t r = b >= 16 ? 0 : static_cast<uint16_t>(left ? a << b : a >> b);
+  flags = static_cast<uint16_t>((r == 0 ? FLAG_Z : 0) |
+                                ((r & 0x8000) ? FLAG_N : 0) |
+                                (carry ? FLAG_C : 0));
+  return r;
+}
+
+bool is_alu(Opcode o) {
+  return o >= Opcode::ADD && o <= Opcode::SHR;
+}
+
+bool is_branch(Opcode o) { return o >= Opcode::JMP && o <= Opcode::JN; }
+
+// Instructions the kernels run; everything else goes through step()
+bool vectorizable(const CPU::DecodedInstruction &instr) {
+  if (instr.fault != CPU::FaultCode::NONE) {
+    return false;
+  }
+  bool operand = instr.mode == AddressingMode::REGISTER ||
+                 instr.mode == AddressingMode::IMMEDIATE;
+  bool target = instr.mode == AddressingMode::DIRECT ||
+                instr.mode == AddressingMode::PC_RELATIVE;
+  if (instr.opcode == Opcode::NOP) {
+    return true;
+  }
+  if (instr.opcode == Opcode::MOV || is_alu(instr.opcode)) {
+    return operand;
+  }
+  return is_branch(instr.opcode) && target;
+}
+
+ALU::Operation alu_operation(Opcode o) {
+  switch (o) {
+  case Opcode::ADD:
+    return ALU::Operation::ADD;
+  case Opcode::SUB:
+    return ALU::Operation::SUB;
+  case Opcode::AND:
+    return ALU::Operation::AND;
+  case Opcode::OR:
+    return ALU::Operation::OR;
+  case Opcode::XOR:
+    return ALU::Operation::XOR;
+  case Opcode::CMP:
+    return ALU::Operation::CMP;
+  case Opcode::SHL:
+    return ALU::Operation::SHL;
+  default:
+    return ALU::Operation::SHR;
+  }
+}
+
+struct LaneArrays {
+  uint16_t *gpr[4];
+  uint16_t *flags;
+  const uint16_t *mask;
+  // First lane of each S::WIDTH chunk to process: the chunks that hold
+  // group lanes, or the group itself for Scalar
+  const std::vector<size_t> *chunks;
+};
+
+template <typename S, ALU::Operation Op>
+void alu_kernel(const LaneArrays &lanes, const CPU::DecodedInstruction &instr) {
+  using V = typename S::V;
+  const bool immediate = instr.mode == AddressingMode::IMMEDIATE;
+  const int shift = immediate ? std::min<int>(instr.extra_word, 17) : 0;
+  uint16_t *dst = lanes.gpr[instr.rd];
+  const uint16_t *src = lanes.gpr[instr.rs];
+  const V imm = S::set1(instr.extra_word);
+  for (size_t c : *lanes.chunks) {
+    V m = S::load(lanes.mask + c);
+    V a = S::load(dst + c);
+    V b = immediate ? imm : S::load(src + c);
+    V flags;
+    V r = alu<S, Op>(a, b, shift, flags);
+    if constexpr (Op != ALU::Operation::CMP) {
+      S::store(dst + c, select<S>(m, r, a));
+    }
+    S::store(lanes.flags + c, select<S>(m, flags, S::load(lanes.flags + c)));
+  }
+}
+
+template <typename S>
+void mov_kernel(const LaneArrays &lanes, const CPU::DecodedInstruction &instr) {
+  using V = typename S::V;
+  const bool immediate = instr.mode == AddressingMode::IMMEDIATE;
+  uint16_t *dst = lanes.gpr[instr.rd];
+  const uint16_t *src = lanes.gpr[instr.rs];
+  const V imm = S::set1(instr.extra_word);
+  for (size_t c : *lanes.chunks) {
+    V m = S::load(lanes.mask + c);
+    V b = immediate ? imm : S::load(src + c);
+    S::store(dst + c, select<S>(m, b, S::load(dst + c)));
+  }
+}
+
+void shift_register_kernel(const LaneArrays &lanes,
+                           const std::vector<size_t> &group,
+                           const CPU::DecodedInstruction &instr) {
+  const bool left = instr.opcode == Opcode::SHL;
+  for (size_t i : group) {
+    uint16_t b = lanes.gpr[instr.rs][i];
+    lanes.gpr[instr.rd][i] =
+        shift_lane(left, lanes.gpr[instr.rd][i], b, lanes.flags[i]);
+  }
+}
+
+template <typename S>
+void run_kernel(const LaneArrays &lanes, const std::vector<size_t> &group,
+                const CPU::DecodedInstruction &instr) {
+  if (instr.opcode == Opcode::MOV) {
+    mov_kernel<S>(lanes, instr);
+    return;
+  }
+  switch (alu_operation(instr.opcode)) {
+  case ALU::Operation::ADD:
+    alu_kernel<S, ALU::Operation::ADD>(lanes, instr);
+    break;
+  case ALU::Operation::SUB:
+    alu_kernel<S, ALU::Operation::SUB>(lanes, instr);
+    break;
+  case ALU::Operation::AND:
+    alu_kernel<S, ALU::Operation::AND>(lanes, instr);
+    break;
+  case ALU::Operation::OR:
+    alu_kernel<S, ALU::Operation::OR>(lanes, instr);
+    break;
+  case ALU::Operation::XOR:
+    alu_kernel<S, ALU::Operation::XOR>(lanes, instr);
+    break;
+  case ALU::Operation::CMP:
+    alu_kernel<S, ALU::Operation::CMP>(lanes, instr);
+    break;
+  case ALU::Operation::SHL:
+  case ALU::Operation::SHR:
+    if (instr.mode == AddressingMode::REGISTER) {
+      shift_register_kernel(lanes, group, instr);
+    } else if (instr.opcode == Opcode::SHL) {
+      alu_kernel<S, ALU::Operation::SHL>(lanes, instr);
+    } else {
+      alu_kernel<S, ALU::Operation::SHR>(lanes, instr);
+    }
+    break;
+  }
+}
+
+bool branch_taken(Opcode o, uint16_t flags) {
+  switch (o) {
+  case Opcode::JMP:
+    return true;
+  case Opcode::JZ:
+    return (flags & FLAG_Z) != 0;
+  case Opcode::JNZ:
+    return (flags & FLAG_Z) == 0;
+  case Opcode::JC:
+    return (flags & FLAG_C) != 0;
+  case Opcode::JNC:
+    return (flags & FLAG_C) == 0;
+  default:
+    return (flags & FLAG_N) != 0;
+  }
+}
+
+} // namespace
+
+MemoryImage LockstepEngine::load_image(const std::vector<uint8_t> &program,
+                                       uint16_t start_address) {
+  Memory loader;
+  loader.load_program(program, start_address);
+  return loader.capture();
+}
+
+LockstepEngine::LockstepEngine(const std::vector<uint8_t> &program,
+                               size_t lanes, uint16_t start_address)
+    : LockstepEngine(load_image(program, start_address), lanes,
+                     start_address) {}
+
+LockstepEngine::LockstepEngine(const MemoryImage &image, size_t lanes,
+                               uint16_t start_address)
+    : padded_((lanes + MAX_WIDTH - 1) / MAX_WIDTH * MAX_WIDTH) {
+  for (size_t i = 0; i < lanes; ++i) {
+    cpus_.push_back(std::make_unique<CPU>());
+    cpus_.back()->load_image(image, start_address);
+  }
+  for (auto &reg : gpr_) {
+    reg.assign(padded_, 0);
+  }
+  sp_.assign(padded_, 0);
+  pc_.assign(padded_, 0);
+  flags_.assign(padded_, 0);
+  mask_.assign(padded_, 0);
+  pending_.assign(lanes, 0);
+  last_pc_.assign(lanes, -1);
+  budget_.assign(lanes, 0);
+  solo_.assign(lanes, 0);
+  bucket_.assign(0x10000, -1);
+  next_lane_.assign(lanes, -1);
+}
+
+LockstepEngine::~LockstepEngine() = default;
+
+const char *LockstepEngine::simd_isa() { return Simd::NAME; }
+
+void LockstepEngine::load_lane(size_t i) {
+  const Registers &regs = cpus_[i]->registers_;
+  for (uint8_t r = 0; r < 4; ++r) {
+    gpr_[r][i] = regs.get_gpr(r);
+  }
+  sp_[i] = regs.get_sp();
+  pc_[i] = regs.get_pc();
+  flags_[i] = regs.get_flags();
+  last_pc_[i] = -1;
+}
+
+void LockstepEngine::store_lane(size_t i) {
+  CPU &cpu = *cpus_[i];
+  Registers &regs = cpu.registers_;
+  for (uint8_t r = 0; r < 4; ++r) {
+    regs.set_gpr(r, gpr_[r][i]);
+  }
+  regs.set_sp(sp_[i]);
+  regs.set_pc(pc_[i]);
+  regs.set_flags(static_cast<uint8_t>(flags_[i]));
+  if (last_pc_[i] >= 0) {
+    // Fetch registers as the interpreter leaves them
+    const DecodedEntry &entry =
+        decoded_[static_cast<uint16_t>(last_pc_[i]) - Memory::PROGRAM_START];
+    regs.set_mar(static_cast<uint16_t>(last_pc_[i]));
+    regs.set_mdr(entry.word);
+    regs.set_ir(entry.word);
+    last_pc_[i] = -1;
+  }
+  while (pending_[i] > 0) {
+    uint32_t n = static_cast<uint32_t>(
+        std::min<uint64_t>(pending_[i], std::numeric_limits<uint32_t>::max()));
+    cpu.retire(n);
+    pending_[i] -= n;
+  }
+}
+
+bool LockstepEngine::runnable(size_t i) const {
+  const CPU &cpu = *cpus_[i];
+  return budget_[i] > 0 && !cpu.halted_ && !cpu.waiting_for_input_;
+}
+
+void LockstepEngine::schedule(size_t i) {
+  if (!runnable(i)) {
+    return;
+  }
+  if (solo_[i]) {
+    solo_lanes_.push_back(i);
+    return;
+  }
+  int32_t &head = bucket_[pc_[i]];
+  if (head < 0) {
+    ready_.push_back(pc_[i]);
+    std::push_heap(ready_.begin(), ready_.end(), std::greater<uint16_t>());
+  }
+  next_lane_[i] = head;
+  head = static_cast<int32_t>(i);
+}
+
+uint16_t LockstepEngine::take_group(std::vector<size_t> &group) {
+  std::pop_heap(ready_.begin(), ready_.end(), std::greater<uint16_t>());
+  const uint16_t pc = ready_.back();
+  ready_.pop_back();
+  group.clear();
+  for (int32_t i = bucket_[pc]; i >= 0; i = next_lane_[i]) {
+    group.push_back(static_cast<size_t>(i));
+  }
+  bucket_[pc] = -1;
+  std::sort(group.begin(), group.end());
+  return pc;
+}
+
+CPU::StopReason LockstepEngine::stop_reason(size_t index) const {
+  const CPU &cpu = *cpus_[index];
+  if (cpu.faulted_) {
+    return CPU::StopReason::FAULT;
+  }
+  if (cpu.halted_) {
+    return CPU::StopReason::HALTED;
+  }
+  if (cpu.waiting_for_input_) {
+    return CPU::StopReason::WAITING_IO;
+  }
+  return CPU::StopReason::BUDGET_EXHAUSTED;
+}
+
+void LockstepEngine::scalar_step(size_t i) {
+  CPU &cpu = *cpus_[i];
+  store_lane(i);
+  uint64_t before = cpu.cycle_count_;
+  cpu.step();
+  uint64_t retired = cpu.cycle_count_ - before;
+  budget_[i] -= retired;
+  stats_.scalar_instructions += retired;
+  load_lane(i);
+  if (cpu.code_modified_ || cpu.memory_.is_perf_counting() ||
+      cpu.timing_model_) {
+    solo_[i] = 1;
+  }
+}
+
+const LockstepEngine::DecodedEntry *
+LockstepEngine::decode(size_t representative, uint16_t pc) {
+  // Same bounds as the predecode cache: the instruction and a possible
+  // extra word must lie in the program region
+  if (pc < Memory::PROGRAM_START || pc > Memory::PROGRAM_END - 3) {
+    return nullptr;
+  }
+  if (decoded_.empty()) {
+    decoded_.assign(Memory::PROGRAM_END - Memory::PROGRAM_START + 1,
+                    DecodedEntry{});
+  }
+  DecodedEntry &entry = decoded_[pc - Memory::PROGRAM_START];
+  if (!entry.valid) {
+    entry.instr = cpus_[representative]->decode_at(pc, entry.word);
+    entry.valid = true;
+  }
+  return &entry;
+}
+
+void LockstepEngine::run_group(const std::vector<size_t> &group, uint16_t pc) {
+  uint64_t limit = std::numeric_limits<uint64_t>::max();
+  for (size_t i : group) {
+    mask_[i] = 0xFFFF;
+    limit = std::min(limit, budget_[i]);
+  }
+  // Groups narrower than a vector run lane by lane; wider ones only
+  // touch the chunks that hold their lanes
+  const bool narrow = group.size() < Simd::WIDTH;
+  chunks_.clear();
+  for (size_t i : group) {
+    size_t chunk = i / Simd::WIDTH * Simd::WIDTH;
+    if (chunks_.empty() || chunks_.back() != chunk) {
+      chunks_.push_back(chunk);
+    }
+  }
+  LaneArrays lanes{{gpr_[0].data(), gpr_[1].data(), gpr_[2].data(),
+                    gpr_[3].data()},
+                   flags_.data(),
+                   mask_.data(),
+                   narrow ? &group : &chunks_};
+
+  uint64_t executed = 0;
+  int32_t last = -1;
+  bool jumped = false;
+  while (executed < limit) {
+    const DecodedEntry *entry = decode(group.front(), pc);
+    if (!entry || !vectorizable(entry->instr)) {
+      break;
+    }
+    const CPU::DecodedInstruction &instr = entry->instr;
+    uint16_t next = static_cast<uint16_t>(pc + (instr.has_extra_word ? 4 : 2));
+    last = pc;
+    ++executed;
+    ++stats_.vector_steps;
+    stats_.narrow_steps += narrow ? 1 : 0;
+
+    if (is_branch(instr.opcode)) {
+      uint16_t target = instr.mode == AddressingMode::DIRECT
+                            ? instr.extra_word
+                            : static_cast<uint16_t>(
+                                  next +
+                                  static_cast<int16_t>(instr.extra_word));
+      size_t taken = 0;
+      for (size_t i : group) {
+        bool t = branch_taken(instr.opcode, flags_[i]);
+        pc_[i] = t ? target : next;
+        taken += t;
+      }
+      if (taken != 0 && taken != group.size()) {
+        ++stats_.divergences;
+      }
+      jumped = true;
+      break;
+    }
+    if (instr.opcode != Opcode::NOP && narrow) {
+      run_kernel<Scalar>(lanes, group, instr);
+    } else if (instr.opcode != Opcode::NOP) {
+      run_kernel<Simd>(lanes, group, instr);
+    }
+    pc = next;
+  }
+
+  for (size_t i : group) {
+    mask_[i] = 0;
+    if (!jumped) {
+      pc_[i] = pc;
+    }
+    if (executed > 0) {
+      pending_[i] += executed;
+      budget_[i] -= executed;
+      last_pc_[i] = last;
+    }
+  }
+  stats_.vector_instructions += executed * group.size();
+
+  // Stopped on an instruction the kernels do not handle
+  if (!jumped && executed < limit) {
+    for (size_t i : group) {
+      scalar_step(i);
+    }
+  }
+}
+
+void LockstepEngine::run(uint64_t max_instructions) {
+  const uint64_t budget = max_instructions
+                              ? max_instructions
+                              : std::numeric_limits<uint64_t>::max();
+  solo_lanes_.clear();
+  for (size_t i = 0; i < cpus_.size(); ++i) {
+    CPU &cpu = *cpus_[i];
+    cpu.waiting_for_input_ = false;
+    budget_[i] = budget;
+    solo_[i] = cpu.code_modified_ || cpu.memory_.is_perf_counting() ||
+               cpu.timing_model_;
+    load_lane(i);
+    schedule(i);
+  }
+
+  std::vector<size_t> group;
+  group.reserve(cpus_.size());
+  std::vector<size_t> solo;
+  while (true) {
+    // Lanes with modified code cannot share decodes, and counting or
+    // timed lanes need the interpreter; run them on their own
+    solo.swap(solo_lanes_);
+    for (size_t i : solo) {
+      store_lane(i);
+      CPU::RunBudget lane_budget;
+      lane_budget.max_instructions =
+          budget_[i] == std::numeric_limits<uint64_t>::max() ? 0 : budget_[i];
+      CPU::RunResult result = cpus_[i]->run_for(lane_budget);
+      budget_[i] -= std::min(budget_[i], result.instructions);
+      stats_.scalar_instructions += result.instructions;
+      load_lane(i);
+      schedule(i);
+    }
+    solo.clear();
+
+    // Lowest PC first, so lanes that fell behind catch up with the rest
+    if (ready_.empty()) {
+      break;
+    }
+    uint16_t pc = take_group(group);
+    run_group(group, pc);
+    for (size_t i : group) {
+      schedule(i);
+    }
+  }
+
+  for (size_t i = 0; i < cpus_.size(); ++i) {
+    store_lane(i);
+  }
+  solo_lanes_.clear();
+}
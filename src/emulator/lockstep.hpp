@@ -0,0 +1,109 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Runs N guests of the same program in lockstep. Each lane is a full CPU
+// (memory, I/O callbacks, timer), but while the engine runs, R0-R3, SP,
+// PC and FLAGS of all lanes live in structure-of-arrays form and lanes
+// that share a PC form a group: each decoded MOV/ALU instruction with a
+// register or immediate operand executes for the whole group at once
+// with SIMD kernels (AVX2 or SSE2, depending on the build flags). Groups
+// narrower than one vector run the same kernels lane by lane.
+//
+// Everything else (memory, stack, I/O, HALT) runs per lane through
+// CPU::step(). Conditional jumps are evaluated per lane; lanes whose
+// targets differ leave the group and are regrouped by PC when the engine
+// next schedules (lowest PC first, so they reconverge at join points). A
+// lane that writes to the program region is not grouped again.
+class LockstepEngine {
+public:
+  struct Statistics {
+    uint64_t vector_steps = 0;        // instructions run by a group kernel
+    uint64_t vector_instructions = 0; // lane instructions retired by them
+    uint64_t narrow_steps = 0; // vector_steps run lane by lane, not SIMD
+    uint64_t scalar_instructions = 0; // lane instructions run by step()
+    uint64_t divergences = 0;         // jumps that split a group
+  };
+
+  LockstepEngine(const std::vector<uint8_t> &program, size_t lanes,
+                 uint16_t start_address = Memory::PROGRAM_START);
+  // Lanes map image copy-on-write
+  LockstepEngine(const MemoryImage &image, size_t lanes,
+                 uint16_t start_address = Memory::PROGRAM_START);
+  ~LockstepEngine();
+
+  size_t lane_count() const { return cpus_.size(); }
+  // Set up I/O callbacks and input data before run(); the lane's state is
+  // up to date whenever run() is not executing
+  CPU &lane(size_t index) { return *cpus_[index]; }
+  const CPU &lane(size_t index) const { return *cpus_[index]; }
+
+  // Run until every lane has halted, faulted, is waiting for input or has
+  // retired max_instructions in this call (0: no limit)
+  void run(uint64_t max_instructions = 0);
+
+  // Why the lane stopped in the last run()
+  CPU::StopReason stop_reason(size_t index) const;
+  const Statistics &get_statistics() const { return stats_; }
+
+  // SIMD instruction set the kernels were built for
+  static const char *simd_isa();
+
+private:
+  std::vector<std::unique_ptr<CPU>> cpus_;
+  size_t padded_; // lane count rounded up to the widest SIMD width
+
+  // Structure-of-arrays lane state, padded_ entries each
+  std::vector<uint16_t> gpr_[4];
+  std::vector<uint16_t> sp_;
+  std::vector<uint16_t> pc_;
+  std::vector<uint16_t> flags_;
+  std::vector<uint16_t> mask_; // 0xFFFF for lanes in the current group
+
+  // Per-lane bookkeeping
+  std::vector<uint64_t> pending_; // retired by kernels, not yet counted
+  std::vector<int32_t> last_pc_;  // last kernel instruction, -1 if none
+  std::vector<uint64_t> budget_;  // instructions left in this run
+  std::vector<uint8_t> solo_; // wrote to code, counting or timed: not grouped
+
+  // Scheduler: runnable grouped lanes are bucketed by PC, each bucket a
+  // list through next_lane_, and the PCs with a bucket form a min-heap
+  std::vector<int32_t> bucket_;    // first lane at each PC, -1 if none
+  std::vector<int32_t> next_lane_; // next lane in the same bucket, -1 if none
+  std::vector<uint16_t> ready_;    // heap of PCs with a bucket, lowest first
+  std::vector<size_t> solo_lanes_; // runnable solo lanes
+  std::vector<size_t> chunks_;     // SIMD chunks of the current group
+
+  // Decoded program, shared by every grouped lane
+  struct DecodedEntry {
+    CPU::DecodedInstruction instr;
+    uint16_t word;
+    bool valid;
+  };
+  std::vector<DecodedEntry> decoded_;
+
+  Statistics stats_;
+
+  static MemoryImage load_image(const std::vector<uint8_t> &program,
+                                uint16_t start_address);
+  // Copy a lane between its CPU and the arrays. store_lane() also applies
+  // the pending instruction count to the cycle counter and timer.
+  void load_lane(size_t i);
+  void store_lane(size_t i);
+  bool runnable(size_t i) const;
+  // Queue a runnable lane for the scheduler: in its PC bucket, or with
+  // the solo lanes
+  void schedule(size_t i);
+  // Empty the lowest PC's bucket into group, in lane order
+  uint16_t take_group(std::vector<size_t> &group);
+  void scalar_step(size_t i);
+  // Shared decode of the instruction at pc (program region only)
+  const DecodedEntry *decode(size_t representative, uint16_t pc);
+  // Run the lanes in group (in lane order), all at pc, until a jump, an
+  // instruction the kernels do not handle, or the smallest budget in the
+  // group runs out
+  void run_group(const std::vector<size_t> &group, uint16_t pc);
+};
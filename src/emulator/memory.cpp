@@ -1,10 +1,33 @@
 #include "memory.hpp"
+#include <iterator>
 #include <iomanip>
 #include <iostream>
 #include <stdexcept>
 
-Memory::Memory() : memory_(MEMORY_SIZE, 0) {
+namespace {
+
+// Every unwritten page of every Memory maps this one
+const std::shared_ptr<Memory::Page> &zero_page() {
+  static const std::shared_ptr<Memory::Page> page =
+      std::make_shared<Memory::Page>();
+  return page;
+}
+
+} // namespace
+
+MemoryImage::MemoryImage() { pages_.fill(zero_page()); }
+
+bool MemoryImage::is_zero_page(uint32_t page) const {
+  return pages_[page] == zero_page();
+}
+
+Memory::Memory() {
   // Initialize memory to zero
+  pages_.fill(zero_page());
+  reset_io();
+}
+
+void Memory::reset_io() {
   // Set default I/O callbacks
   output_callback_ = [](uint8_t value) {
     std::cout << static_cast<char>(value) << std::flush;
@@ -15,34 +38,68 @@ Memory::Memory() : memory_(MEMORY_SIZE, 0) {
     std::cin >> c;
     return static_cast<uint8_t>(c);
   };
+  input_ready_callback_ = nullptr;
+  trace_callback_ = nullptr;
+  device_read_hook_ = nullptr;
+  timer_counter_ = 0;
+  timer_running_ = false;
+  perf_ = PerfCounters();
+
+  update_page_tables();
+}
+
+void Memory::update_page_tables() {
+  for (uint32_t page = 0; page < PAGE_COUNT; ++page) {
+    update_page_table(page);
+  }
 }
 
-uint8_t Memory::read_byte(uint16_t address) {
+void Memory::update_page_table(uint32_t page) {
+  const uint32_t io_page = IO_START / PAGE_SIZE;
+  uint8_t *data = page == io_page ? nullptr : pages_[page]->bytes.data();
+  read_pages_[page] = data;
+  write_pages_[page] = trace_callback_ || !owned_[page] ? nullptr : data;
+}
+
+uint8_t *Memory::writable_page(uint32_t page) {
+  if (!owned_[page]) {
+    // The last holder of a shared page can take it over without a copy
+    if (pages_[page].use_count() != 1) {
+      pages_[page] = std::make_shared<Page>(*pages_[page]);
+    }
+    owned_[page] = true;
+    update_page_table(page);
+  }
+  return pages_[page]->bytes.data();
+}
+
+uint8_t Memory::read_byte_slow(uint16_t address) {
   if (is_io_address(address)) {
     return handle_io_read(address);
   }
-  return memory_[address];
+  return pages_[address >> 8]->bytes[address & 0xFF];
 }
 
-void Memory::write_byte(uint16_t address, uint8_t value) {
+void Memory::write_byte_slow(uint16_t address, uint8_t value) {
   if (is_io_address(address)) {
     handle_io_write(address, value);
     return;
   }
-  uint8_t old = memory_[address];
-  memory_[address] = value;
+  uint8_t &byte = writable_page(address >> 8)[address & 0xFF];
+  uint8_t old = byte;
+  byte = value;
   // trace callback
   if (trace_callback_) trace_callback_(address, old, value);
 }
 
-uint16_t Memory::read_word(uint16_t address) {
+uint16_t Memory::read_word_slow(uint16_t address) {
   // Little-endian: low byte at lower address
   uint8_t low = read_byte(address);
   uint8_t high = read_byte(address + 1);
   return static_cast<uint16_t>(low) | (static_cast<uint16_t>(high) << 8);
 }
 
-void Memory::write_word(uint16_t address, uint16_t value) {
+void Memory::write_word_slow(uint16_t address, uint16_t value) {
   // Little-endian: low byte at lower address
   write_byte(address, static_cast<uint8_t>(value & 0xFF));
   write_byte(address + 1, static_cast<uint8_t>((value >> 8) & 0xFF));
@@ -55,8 +112,48 @@ void Memory::load_program(const std::vector<uint8_t> &program,
   }
 
   for (size_t i = 0; i < program.size(); ++i) {
-    memory_[start_address + i] = program[i];
+    uint32_t address = start_address + static_cast<uint32_t>(i);
+    writable_page(address >> 8)[address & 0xFF] = program[i];
+  }
+}
+
+MemoryImage Memory::capture() {
+  MemoryImage image;
+  for (uint32_t page = 0; page < PAGE_COUNT; ++page) {
+    image.pages_[page] = pages_[page];
+  }
+  // The pages are shared from now on
+  owned_.reset();
+  update_page_tables();
+  return image;
+}
+
+void Memory::map(const MemoryImage &image) {
+  for (uint32_t page = 0; page < PAGE_COUNT; ++page) {
+    pages_[page] = image.pages_[page];
   }
+  owned_.reset();
+  update_page_tables();
+}
+
+void Memory::revert_to(const MemoryImage &image) {
+  for (uint32_t page = 0; page < PAGE_COUNT; ++page) {
+    if (pages_[page] != image.pages_[page]) {
+      pages_[page] = image.pages_[page];
+      owned_[page] = false;
+      update_page_table(page);
+    }
+  }
+}
+
+void Memory::fork_from(Memory &source) {
+  map(source.capture());
+  output_callback_ = source.output_callback_;
+  input_callback_ = source.input_callback_;
+  input_ready_callback_ = source.input_ready_callback_;
+  timer_counter_ = source.timer_counter_;
+  timer_running_ = source.timer_running_;
+  perf_ = source.perf_;
 }
 
 void Memory::dump_memory(uint16_t start, uint16_t length) {
@@ -70,7 +167,10 @@ void Memory::dump_memory(uint16_t start, uint16_t length) {
 
     for (int j = 0; j < 16 && (i + j) < length; ++j) {
       std::cout << std::hex << std::setw(2) << std::setfill('0')
-                << static_cast<int>(memory_[start + i + j]) << " ";
+                << static_cast<int>(
+                       pages_[(start + i + j) >> 8 & 0xFF]
+                           ->bytes[(start + i + j) & 0xFF])
+                << " ";
     }
     std::cout << "\n";
   }
@@ -85,8 +185,13 @@ void Memory::set_input_callback(std::function<uint8_t()> callback) {
   input_callback_ = callback;
 }
 
+void Memory::set_input_ready_callback(std::function<bool()> callback) {
+  input_ready_callback_ = callback;
+}
+
 void Memory::set_trace_callback(std::function<void(uint16_t,uint8_t,uint8_t)> callback) {
   trace_callback_ = callback;
+  update_page_tables();
 }
 
 bool Memory::is_io_address(uint16_t address) const {
@@ -106,32 +211,65 @@ void Memory::handle_io_write(uint16_t address, uint8_t value) {
       timer_counter_ = 0; // Reset counter when stopped
     }
     break;
-  default:
+  case IO_PERF_CONTROL:
+    if (value & PERF_RESET) {
+      std::fill(std::begin(perf_.live), std::end(perf_.live), 0);
+    }
+    if (value & PERF_LATCH) {
+      std::copy(std::begin(perf_.live), std::end(perf_.live),
+                std::begin(perf_.latched));
+    }
+    perf_.enabled = (value & PERF_ENABLE) != 0;
+    break;
+  default: {
     // For other I/O addresses, just store in memory for now
-    memory_[address] = value;
+    uint8_t &byte = writable_page(address >> 8)[address & 0xFF];
+    uint8_t old = byte;
+    byte = value;
+    if (trace_callback_) trace_callback_(address, old, value);
     break;
   }
+  }
 }
 
 uint8_t Memory::handle_io_read(uint16_t address) {
+  uint8_t value;
   switch (address) {
   case IO_INPUT_DATA:
-    if (input_callback_) {
-      return input_callback_();
-    }
-    return 0;
+    value = input_callback_ ? input_callback_() : 0;
+    break;
   case IO_TIMER_BASE: // Timer counter low byte (0xF010)
-    return static_cast<uint8_t>(timer_counter_ & 0xFF);
+    value = static_cast<uint8_t>(timer_counter_ & 0xFF);
+    break;
   case IO_TIMER_BASE + 1: // Timer control/counter high byte (0xF011)
-    return static_cast<uint8_t>((timer_counter_ >> 8) & 0xFF);
+    value = static_cast<uint8_t>((timer_counter_ >> 8) & 0xFF);
+    break;
+  case IO_PERF_CONTROL:
+    return perf_.enabled ? PERF_ENABLE : 0;
   default:
+    if (address >= IO_PERF_COUNTERS &&
+        address < IO_PERF_COUNTERS + 4 * PERF_COUNTER_COUNT) {
+      uint32_t offset = address - IO_PERF_COUNTERS;
+      return static_cast<uint8_t>(perf_.latched[offset / 4] >>
+                                  (8 * (offset % 4)));
+    }
     // For other I/O addresses, just read from memory
-    return memory_[address];
+    return pages_[address >> 8]->bytes[address & 0xFF];
   }
+  if (device_read_hook_) {
+    value = device_read_hook_(address, value);
+  }
+  return value;
 }
 
 void Memory::tick() {
   if (timer_running_) {
     timer_counter_++;
   }
-}
\ No newline at end of file
+}
+
+void Memory::tick(uint32_t cycles) {
+  if (timer_running_) {
+    timer_counter_ = static_cast<uint16_t>(timer_counter_ + cycles);
+  }
+}
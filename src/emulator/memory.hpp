@@ -1,9 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <vector>
 
+class MemoryImage;
+
 class Memory {
 public:
   // Memory layout constants from architecture spec
@@ -22,45 +28,226 @@ public:
   static constexpr uint16_t IO_INPUT_DATA = 0xF001;
   static constexpr uint16_t IO_TIMER_BASE = 0xF010;
 
+  // Performance counter block. Writing IO_PERF_CONTROL sets the PERF_*
+  // control bits; reading it returns PERF_ENABLE. The counters at
+  // IO_PERF_COUNTERS are 32-bit little-endian words in PerfCounter order
+  // and read the values copied by the last PERF_LATCH, so a guest reading
+  // several bytes sees one consistent sample. The CPU counts into the live
+  // values while PERF_ENABLE is set.
+  static constexpr uint16_t IO_PERF_CONTROL = 0xF020;
+  static constexpr uint16_t IO_PERF_COUNTERS = 0xF024;
+  static constexpr uint8_t PERF_ENABLE = 0x01; // count while set
+  static constexpr uint8_t PERF_LATCH = 0x02;  // copy live values to latch
+  static constexpr uint8_t PERF_RESET = 0x04;  // zero live values (first)
+  enum PerfCounter : uint8_t {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS = 1,
+    PERF_TAKEN_BRANCHES = 2, // JMP, CALL, RET and taken Jcc
+    PERF_MEMORY_READS = 3,   // data words read by instructions
+    PERF_MEMORY_WRITES = 4,  // data words written by instructions
+    PERF_CALL_DEPTH = 5,     // CALLs minus RETs, not below zero
+    PERF_COUNTER_COUNT = 6
+  };
+  struct PerfCounters {
+    bool enabled = false;
+    uint32_t live[PERF_COUNTER_COUNT] = {};
+    uint32_t latched[PERF_COUNTER_COUNT] = {};
+    bool operator==(const PerfCounters &other) const {
+      return enabled == other.enabled &&
+             std::equal(live, live + PERF_COUNTER_COUNT, other.live) &&
+             std::equal(latched, latched + PERF_COUNTER_COUNT, other.latched);
+    }
+    bool operator!=(const PerfCounters &other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Page dispatch: 256 pages of 256 bytes. RAM, program and reserved pages
+  // are served inline from the page tables; only the I/O page goes through
+  // the device handlers.
+  //
+  // Pages are reference counted and copy-on-write: a new Memory maps every
+  // page to one shared zero page, and capture()/map() share pages between
+  // instances. A page is copied on its first write, after which writes to
+  // it take the inline path again.
+  static constexpr uint32_t PAGE_SIZE = 0x100;
+  static constexpr uint32_t PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
+  struct Page {
+    std::array<uint8_t, PAGE_SIZE> bytes{};
+  };
+
   Memory();
+  // Page tables point into pages_; use capture()/map() or fork_from()
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
 
   // Basic memory operations
-  uint8_t read_byte(uint16_t address);
-  void write_byte(uint16_t address, uint8_t value);
+  uint8_t read_byte(uint16_t address) {
+    const uint8_t *page = read_pages_[address >> 8];
+    if (page) {
+      return page[address & 0xFF];
+    }
+    return read_byte_slow(address);
+  }
+  void write_byte(uint16_t address, uint8_t value) {
+    uint8_t *page = write_pages_[address >> 8];
+    if (page) {
+      page[address & 0xFF] = value;
+      return;
+    }
+    write_byte_slow(address, value);
+  }
 
-  // Word operations (little-endian)
-  uint16_t read_word(uint16_t address);
-  void write_word(uint16_t address, uint16_t value);
+  // Word operations (little-endian). The fast path assembles the word from
+  // bytes, so it is safe for odd addresses and big-endian hosts; words
+  // that straddle a page boundary take the byte path.
+  uint16_t read_word(uint16_t address) {
+    const uint8_t *page = read_pages_[address >> 8];
+    uint8_t offset = static_cast<uint8_t>(address);
+    if (page && offset != 0xFF) {
+      return static_cast<uint16_t>(page[offset] | (page[offset + 1] << 8));
+    }
+    return read_word_slow(address);
+  }
+  void write_word(uint16_t address, uint16_t value) {
+    uint8_t *page = write_pages_[address >> 8];
+    uint8_t offset = static_cast<uint8_t>(address);
+    if (page && offset != 0xFF) {
+      page[offset] = static_cast<uint8_t>(value & 0xFF);
+      page[offset + 1] = static_cast<uint8_t>(value >> 8);
+      return;
+    }
+    write_word_slow(address, value);
+  }
+
+  // The page tables behind the fast paths above, for generated code
+  // (jit_x86_64.cpp). The arrays stay in place; their entries change as
+  // pages are mapped and copied.
+  const uint8_t *const *read_page_table() const { return read_pages_.data(); }
+  uint8_t *const *write_page_table() const { return write_pages_.data(); }
 
   // Program loading
   void load_program(const std::vector<uint8_t> &program,
                     uint16_t start_address = PROGRAM_START);
 
+  // Copy-on-write sharing. capture() returns the current contents without
+  // copying (this memory copies a page again on its next write to it);
+  // map() replaces the contents with an image. Timer and callbacks are not
+  // part of an image.
+  MemoryImage capture();
+  void map(const MemoryImage &image);
+  // Share source's pages and copy its timer and counter state and I/O
+  // callbacks
+  void fork_from(Memory &source);
+  // Map image's pages wherever this memory's differ from it; a memory
+  // mapped from image (or captured into it) only touches the pages
+  // written since, so the cost is proportional to the dirty pages
+  void revert_to(const MemoryImage &image);
+  // Pages this memory has copied or allocated (not shared with anyone),
+  // i.e. the pages written since the last capture() or map()
+  size_t private_page_count() const { return owned_.count(); }
+
   // Memory dump for debugging
   void dump_memory(uint16_t start, uint16_t length);
 
   // I/O callbacks
   void set_output_callback(std::function<void(uint8_t)> callback);
   void set_input_callback(std::function<uint8_t()> callback);
-  // Trace callback for memory writes (byte-level)
+  // Optional readiness check for the input port. When it returns false an
+  // IN from IO_INPUT_DATA stops the run with StopReason::WAITING_IO
+  // instead of calling the input callback.
+  void set_input_ready_callback(std::function<bool()> callback);
+  bool is_input_ready() const {
+    return !input_ready_callback_ || input_ready_callback_();
+  }
+  // Trace callback for memory writes (byte-level). While one is set all
+  // writes take the slow path so every byte is reported.
   void set_trace_callback(std::function<void(uint16_t,uint8_t,uint8_t)> callback);
+  const std::function<void(uint16_t,uint8_t,uint8_t)> &trace_callback() const {
+    return trace_callback_;
+  }
+  // Observer for reads of the input port and the timer registers: called
+  // with the address and the value the device produced, and the CPU sees
+  // the value it returns (I/O record and replay, io_log.hpp)
+  void set_device_read_hook(std::function<uint8_t(uint16_t, uint8_t)> hook) {
+    device_read_hook_ = std::move(hook);
+  }
+  // Default console callbacks, no input-ready, trace or device read hook, timer
+  // and performance counters stopped and cleared: the device state of a
+  // new Memory
+  void reset_io();
 
   // Timer support
   void tick(); // Increment timer if running
+  void tick(uint32_t cycles); // Batched form of tick()
   uint16_t get_timer_counter() const { return timer_counter_; }
   bool is_timer_running() const { return timer_running_; }
+  // Restore timer state (snapshots); no I/O side effects
+  void set_timer_state(uint16_t counter, bool running) {
+    timer_counter_ = counter;
+    timer_running_ = running;
+  }
+
+  // Performance counters; the CPU updates the live values directly
+  bool is_perf_counting() const { return perf_.enabled; }
+  PerfCounters &perf_counters() { return perf_; }
+  const PerfCounters &perf_counters() const { return perf_; }
+  void set_perf_counters(const PerfCounters &counters) { perf_ = counters; }
 
 private:
-  std::vector<uint8_t> memory_;
+  std::array<std::shared_ptr<Page>, PAGE_COUNT> pages_;
+  std::bitset<PAGE_COUNT> owned_; // page is private to this memory
+  // Null entries route the page to the slow path; write_pages_ only maps
+  // owned pages
+  std::array<const uint8_t *, PAGE_COUNT> read_pages_;
+  std::array<uint8_t *, PAGE_COUNT> write_pages_;
   std::function<void(uint8_t)> output_callback_;
   std::function<uint8_t()> input_callback_;
+  std::function<bool()> input_ready_callback_;
   std::function<void(uint16_t,uint8_t,uint8_t)> trace_callback_;
+  std::function<uint8_t(uint16_t, uint8_t)> device_read_hook_;
 
   // Timer state
   uint16_t timer_counter_ = 0;
   bool timer_running_ = false;
 
+  PerfCounters perf_;
+
   bool is_io_address(uint16_t address) const;
+  void update_page_tables();
+  void update_page_table(uint32_t page);
+  // Make the page private (copying it if shared) and return its bytes
+  uint8_t *writable_page(uint32_t page);
+  uint8_t read_byte_slow(uint16_t address);
+  void write_byte_slow(uint16_t address, uint8_t value);
+  uint16_t read_word_slow(uint16_t address);
+  void write_word_slow(uint16_t address, uint16_t value);
   void handle_io_write(uint16_t address, uint8_t value);
   uint8_t handle_io_read(uint16_t address);
-};
\ No newline at end of file
+};
+
+// Contents of a whole address space as shared, immutable pages. Cheap to
+// copy; any number of Memory instances (on any thread) can map one image
+// and pay only for the pages they write.
+class MemoryImage {
+public:
+  MemoryImage();
+  uint8_t read_byte(uint16_t address) const {
+    return pages_[address >> 8]->bytes[address & 0xFF];
+  }
+  const uint8_t *page_data(uint32_t page) const {
+    return pages_[page]->bytes.data();
+  }
+  // True for pages mapped to the shared zero page (never written)
+  bool is_zero_page(uint32_t page) const;
+  // Replace a page. The data must not change while any Memory maps it;
+  // it may live in foreign storage (e.g. a file mapping) kept alive by the
+  // shared_ptr's owner.
+  void set_page(uint32_t page, std::shared_ptr<Memory::Page> data) {
+    pages_[page] = std::move(data);
+  }
+
+private:
+  friend class Memory;
+  std::array<std::shared_ptr<Memory::Page>, Memory::PAGE_COUNT> pages_;
+};
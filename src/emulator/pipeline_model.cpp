@@ -0,0 +1,225 @@
+#include "pipeline_model.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// EX cycle of the first instruction: IF in cycle 0, ID in cycle 1
+constexpr uint64_t FIRST_EX = 2;
+
+constexpr uint8_t bit(PipelineModel::Resource resource) {
+  return static_cast<uint8_t>(1u << resource);
+}
+
+} // namespace
+
+PipelineModel::PipelineModel() : PipelineModel(Config()) {}
+
+PipelineModel::PipelineModel(const Config &config) : config_(config) {
+  for (uint32_t key = 0; key < shapes_.size(); ++key) {
+    shapes_[key] = shape_of(static_cast<CPU::Opcode>(key >> 3),
+                            static_cast<CPU::AddressingMode>(key & 7));
+  }
+  clear();
+}
+
+PipelineModel::Shape PipelineModel::shape_of(CPU::Opcode opcode,
+                                             CPU::AddressingMode mode) {
+  using Opcode = CPU::Opcode;
+  using AddressingMode = CPU::AddressingMode;
+  Shape shape = {};
+  // Operand or address register
+  shape.reads_rs = mode == AddressingMode::REGISTER ||
+                   mode == AddressingMode::REGISTER_INDIRECT ||
+                   mode == AddressingMode::REGISTER_OFFSET;
+  const bool memory_operand = mode != AddressingMode::REGISTER &&
+                              mode != AddressingMode::IMMEDIATE;
+
+  switch (opcode) {
+  case Opcode::MOV:
+    shape.writes_rd = true;
+    shape.rd_from_memory = memory_operand;
+    break;
+  case Opcode::LOAD:
+  case Opcode::IN:
+    shape.writes_rd = true;
+    shape.rd_from_memory = true;
+    break;
+  case Opcode::STORE:
+  case Opcode::OUT:
+    shape.reads_rd = true;
+    break;
+  case Opcode::ADD:
+  case Opcode::SUB:
+  case Opcode::AND:
+  case Opcode::OR:
+  case Opcode::XOR:
+  case Opcode::SHL:
+  case Opcode::SHR:
+  case Opcode::CMP:
+    shape.reads_rd = true;
+    shape.writes_rd = opcode != Opcode::CMP;
+    shape.rd_from_memory = memory_operand;
+    shape.flags_from_memory = memory_operand;
+    shape.writes = bit(RES_FLAGS);
+    break;
+  case Opcode::JMP:
+    break;
+  case Opcode::JZ:
+  case Opcode::JNZ:
+  case Opcode::JC:
+  case Opcode::JNC:
+  case Opcode::JN:
+    shape.reads = bit(RES_FLAGS);
+    break;
+  case Opcode::CALL:
+    shape.reads = bit(RES_SP);
+    shape.writes = bit(RES_SP);
+    break;
+  case Opcode::RET:
+    shape.reads_rs = false;
+    shape.reads = bit(RES_SP);
+    shape.writes = bit(RES_SP);
+    break;
+  case Opcode::PUSH:
+    shape.reads_rs = false;
+    shape.reads_rd = true;
+    shape.reads = bit(RES_SP);
+    shape.writes = bit(RES_SP);
+    break;
+  case Opcode::POP:
+    shape.reads_rs = false;
+    shape.writes_rd = true;
+    shape.rd_from_memory = true;
+    shape.reads = bit(RES_SP);
+    shape.writes = bit(RES_SP);
+    break;
+  default: // NOP, HALT
+    shape.reads_rs = false;
+    break;
+  }
+  return shape;
+}
+
+void PipelineModel::record(const CPU::DecodedInstruction &instr, bool taken) {
+  const Shape &shape = shapes_[(static_cast<uint8_t>(instr.opcode) << 3) |
+                               static_cast<uint8_t>(instr.mode)];
+  uint8_t reads = shape.reads;
+  if (shape.reads_rd) {
+    reads |= static_cast<uint8_t>(1u << (instr.rd & 3));
+  }
+  if (shape.reads_rs) {
+    reads |= static_cast<uint8_t>(1u << (instr.rs & 3));
+  }
+
+  // Enter EX once every source operand is available
+  const uint64_t issue = next_ex_;
+  uint64_t ex = issue;
+  int blocking = -1;
+  for (int r = 0; r < RESOURCE_COUNT; ++r) {
+    if ((reads & (1u << r)) && ready_[r] > ex) {
+      ex = ready_[r];
+      blocking = r;
+    }
+  }
+  if (blocking >= 0) {
+    const uint64_t stall = ex - issue;
+    stats_.stall_cycles[from_memory_[blocking] ? STALL_LOAD_USE : STALL_DATA] +=
+        stall;
+    stats_.resource_stalls[blocking] += stall;
+  }
+
+  // An operand written back before this instruction's ID comes from the
+  // register file, a younger one from a pipeline latch
+  if (config_.forwarding) {
+    for (int r = 0; r < RESOURCE_COUNT; ++r) {
+      if ((reads & (1u << r)) && produced_[r] != 0) {
+        const uint64_t distance = ex - produced_[r];
+        if (distance == 1) {
+          ++stats_.forwards[FORWARD_EX_MEM];
+        } else if (distance == 2) {
+          ++stats_.forwards[FORWARD_MEM_WB];
+        }
+      }
+    }
+  }
+
+  // Results: EX values are forwarded a cycle after EX, memory values a
+  // cycle after MEM; without forwarding both wait for WB
+  auto produce = [&](int r, bool memory) {
+    produced_[r] = ex;
+    from_memory_[r] = memory;
+    ready_[r] = config_.forwarding ? ex + (memory ? 2 : 1) : ex + 3;
+  };
+  for (int r = 0; r < RESOURCE_COUNT; ++r) {
+    if (shape.writes & (1u << r)) {
+      produce(r, r == RES_FLAGS && shape.flags_from_memory);
+    }
+  }
+  if (shape.writes_rd) {
+    produce(instr.rd & 3, shape.rd_from_memory);
+  }
+
+  // Wrong-path fetches after a control transfer
+  uint32_t penalty = 0;
+  int flush = -1;
+  switch (instr.opcode) {
+  case CPU::Opcode::JMP:
+  case CPU::Opcode::CALL:
+    flush = FLUSH_JUMP;
+    penalty = config_.jump_penalty;
+    break;
+  case CPU::Opcode::RET:
+    flush = FLUSH_RETURN;
+    penalty = config_.return_penalty;
+    break;
+  case CPU::Opcode::JZ:
+  case CPU::Opcode::JNZ:
+  case CPU::Opcode::JC:
+  case CPU::Opcode::JNC:
+  case CPU::Opcode::JN:
+    if (taken) {
+      flush = FLUSH_BRANCH;
+      penalty = config_.branch_penalty;
+    }
+    break;
+  default:
+    break;
+  }
+  if (flush >= 0) {
+    ++stats_.flushes[flush];
+    stats_.flush_cycles[flush] += penalty;
+  }
+
+  next_ex_ = ex + 1 + penalty;
+  ++stats_.instructions;
+  // The last instruction leaves WB two cycles after EX
+  stats_.cycles = ex + 3;
+}
+
+void PipelineModel::clear() {
+  stats_ = Statistics();
+  next_ex_ = FIRST_EX;
+  std::fill(std::begin(ready_), std::end(ready_), 0);
+  std::fill(std::begin(produced_), std::end(produced_), 0);
+  std::fill(std::begin(from_memory_), std::end(from_memory_), false);
+}
+
+const char *PipelineModel::resource_name(Resource resource) {
+  switch (resource) {
+  case RES_R0:
+    return "R0";
+  case RES_R1:
+    return "R1";
+  case RES_R2:
+    return "R2";
+  case RES_R3:
+    return "R3";
+  case RES_SP:
+    return "SP";
+  case RES_FLAGS:
+    return "FLAGS";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <array>
+#include <cstdint>
+
+// Timing of a classic five-stage in-order pipeline (IF ID EX MEM WB)
+// running the instructions the CPU retires, for CPU::set_pipeline_model().
+//
+// The model is analytical: for each instruction it works out the cycle the
+// instruction enters EX from the cycles its source registers become
+// available and from the flushes of earlier control transfers, so the cost
+// per instruction is constant and full workloads run at interpreter speed.
+// It does not change how the CPU executes or counts cycles.
+//
+// Data hazards are tracked on R0-R3, SP and FLAGS. Operands are needed at
+// the start of EX. With forwarding, an EX result feeds the next
+// instruction from the EX/MEM latch and a result read from memory (LOAD,
+// POP, IN and operands in memory) feeds EX from the MEM/WB latch, so only a
+// load followed by a use stalls, for one cycle. Without forwarding a value
+// is read from the register file in ID once it has been written back
+// (write in the first half of WB, read in the second).
+//
+// Control transfers are fetched past (predict not taken): a taken Jcc
+// resolves in EX and flushes branch_penalty cycles, JMP and CALL are known
+// in ID (jump_penalty) and RET reads its target in MEM (return_penalty).
+class PipelineModel {
+public:
+  struct Config {
+    bool forwarding = true;
+    uint32_t jump_penalty = 1;
+    uint32_t branch_penalty = 2;
+    uint32_t return_penalty = 3;
+  };
+
+  enum Resource : uint8_t {
+    RES_R0 = 0,
+    RES_R1 = 1,
+    RES_R2 = 2,
+    RES_R3 = 3,
+    RES_SP = 4,
+    RES_FLAGS = 5,
+    RESOURCE_COUNT = 6
+  };
+  enum StallCause : uint8_t {
+    STALL_DATA = 0,     // waiting for an EX result
+    STALL_LOAD_USE = 1, // waiting for a value read from memory
+    STALL_CAUSE_COUNT = 2
+  };
+  enum FlushCause : uint8_t {
+    FLUSH_BRANCH = 0, // taken Jcc
+    FLUSH_JUMP = 1,   // JMP and CALL
+    FLUSH_RETURN = 2, // RET
+    FLUSH_CAUSE_COUNT = 3
+  };
+  enum ForwardPath : uint8_t {
+    FORWARD_EX_MEM = 0, // producer one instruction ahead
+    FORWARD_MEM_WB = 1, // producer two cycles ahead
+    FORWARD_PATH_COUNT = 2
+  };
+
+  struct Statistics {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0; // first IF to last WB
+    uint64_t stall_cycles[STALL_CAUSE_COUNT] = {};
+    uint64_t resource_stalls[RESOURCE_COUNT] = {}; // stall cycles per register
+    uint64_t flushes[FLUSH_CAUSE_COUNT] = {};
+    uint64_t flush_cycles[FLUSH_CAUSE_COUNT] = {};
+    uint64_t forwards[FORWARD_PATH_COUNT] = {}; // operands, not instructions
+    double cpi() const {
+      return instructions ? static_cast<double>(cycles) /
+                                static_cast<double>(instructions)
+                          : 0.0;
+    }
+  };
+
+  PipelineModel();
+  explicit PipelineModel(const Config &config);
+
+  const Config &config() const { return config_; }
+  const Statistics &statistics() const { return stats_; }
+
+  // Account one retired instruction; taken when it left the fall-through
+  // path
+  void record(const CPU::DecodedInstruction &instr, bool taken);
+  void clear();
+
+  static const char *resource_name(Resource resource);
+
+private:
+  // Registers an opcode/mode pair reads and writes, besides rd and rs
+  struct Shape {
+    uint8_t reads;         // Resource bits
+    uint8_t writes;        // Resource bits written from EX
+    bool reads_rd;
+    bool reads_rs;
+    bool writes_rd;
+    bool rd_from_memory;   // rd written from MEM (a load)
+    bool flags_from_memory; // FLAGS of an ALU operation on a memory operand
+  };
+  static Shape shape_of(CPU::Opcode opcode, CPU::AddressingMode mode);
+
+  Config config_;
+  Statistics stats_;
+  std::array<Shape, 256> shapes_; // by instruction key (opcode << 3) | mode
+
+  uint64_t next_ex_; // earliest EX cycle of the next instruction
+  // Per resource: first EX cycle that can use the value, EX cycle of its
+  // producer (0 if none) and whether it came from memory
+  uint64_t ready_[RESOURCE_COUNT];
+  uint64_t produced_[RESOURCE_COUNT];
+  bool from_memory_[RESOURCE_COUNT];
+};
@@ -1,7 +1,6 @@
 #include "registers.hpp"
 #include <iostream>
 #include <iomanip>
-#include <stdexcept>
 
 Registers::Registers() {
     reset();
@@ -17,6 +16,10 @@ void Registers::reset() {
     pc_ = 0x8000;    // Start at program area as per memory map
     sp_ = 0x7FFF;    // Stack starts at top of RAM, grows downward
     flags_ = 0;      // All flags cleared
+    flag_source_ = FlagSource::MATERIALIZED;
+    flag_a_ = 0;
+    flag_b_ = 0;
+    flag_result_ = 0;
     
     // Initialize internal registers
     ir_ = 0;
@@ -24,37 +27,39 @@ void Registers::reset() {
     mdr_ = 0;
 }
 
-uint16_t Registers::get_gpr(uint8_t reg_index) const {
-    if (reg_index > 3) {
-        throw std::runtime_error("Invalid GPR index: " + std::to_string(reg_index));
-    }
-    return gpr_[reg_index];
-}
-
-void Registers::set_gpr(uint8_t reg_index, uint16_t value) {
-    if (reg_index > 3) {
-        throw std::runtime_error("Invalid GPR index: " + std::to_string(reg_index));
-    }
-    gpr_[reg_index] = value;
-}
-
-bool Registers::get_flag(uint8_t flag_bit) const {
-    if (flag_bit > 3) {
-        throw std::runtime_error("Invalid flag bit: " + std::to_string(flag_bit));
-    }
-    return (flags_ & (1 << flag_bit)) != 0;
-}
-
-void Registers::set_flag(uint8_t flag_bit, bool value) {
-    if (flag_bit > 3) {
-        throw std::runtime_error("Invalid flag bit: " + std::to_string(flag_bit));
-    }
-    
-    if (value) {
-        flags_ |= (1 << flag_bit);   // Set bit
-    } else {
-        flags_ &= ~(1 << flag_bit);  // Clear bit
+void Registers::materialize_flags() const {
+    const uint16_t a = flag_a_;
+    const uint16_t b = flag_b_;
+    const uint16_t result = flag_result_;
+    // Same rules as the eager ALU flag helpers
+    bool zero = result == 0;
+    bool negative = (result & 0x8000) != 0;
+    bool carry = false;
+    bool overflow = false;
+    switch (flag_source_) {
+    case FlagSource::ADD:
+        carry = static_cast<uint32_t>(a) + b > 0xFFFF;
+        overflow = ((a ^ b) & 0x8000) == 0 && ((a ^ result) & 0x8000) != 0;
+        break;
+    case FlagSource::SUB:
+        carry = a < b;
+        overflow = ((a ^ b) & 0x8000) != 0 && ((a ^ result) & 0x8000) != 0;
+        break;
+    case FlagSource::SHL:
+        carry = b > 0 && b <= 16 && (a & (1 << (16 - b))) != 0;
+        break;
+    case FlagSource::SHR:
+        carry = b > 0 && b <= 16 && (a & (1 << (b - 1))) != 0;
+        break;
+    case FlagSource::LOGIC:
+    case FlagSource::MATERIALIZED:
+        break;
     }
+    flags_ = static_cast<uint8_t>((zero ? 1 << FLAG_Z : 0) |
+                                  (negative ? 1 << FLAG_N : 0) |
+                                  (carry ? 1 << FLAG_C : 0) |
+                                  (overflow ? 1 << FLAG_V : 0));
+    flag_source_ = FlagSource::MATERIALIZED;
 }
 
 void Registers::dump_registers() const {
@@ -71,7 +76,7 @@ void Registers::dump_registers() const {
     std::cout << "  SP:    0x" << std::hex << std::setw(4) << std::setfill('0') 
               << sp_ << std::dec << std::endl;
     std::cout << "  FLAGS: 0x" << std::hex << std::setw(2) << std::setfill('0') 
-              << static_cast<int>(flags_) << " (" << flags_to_string() << ")" << std::dec << std::endl;
+              << static_cast<int>(get_flags()) << " (" << flags_to_string() << ")" << std::dec << std::endl;
     
     std::cout << "Internal:" << std::endl;
     std::cout << "  IR:  0x" << std::hex << std::setw(4) << std::setfill('0') 
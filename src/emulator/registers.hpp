@@ -16,12 +16,24 @@ public:
     static constexpr uint8_t FLAG_N = 1;  // Negative
     static constexpr uint8_t FLAG_C = 2;  // Carry
     static constexpr uint8_t FLAG_V = 3;  // Overflow
+
+    // Operation whose flags are pending in lazy-flags mode. MATERIALIZED
+    // means flags_ is up to date.
+    enum class FlagSource : uint8_t {
+        MATERIALIZED,
+        ADD,    // Z/N from result, C = carry out, V = signed overflow
+        SUB,    // SUB and CMP: C = borrow, V = signed overflow
+        LOGIC,  // AND/OR/XOR: C and V cleared
+        SHL,    // C = last bit shifted out, V cleared
+        SHR
+    };
     
     Registers();
     
-    // General Purpose Register access
-    uint16_t get_gpr(uint8_t reg_index) const;
-    void set_gpr(uint8_t reg_index, uint16_t value);
+    // General Purpose Register access. The decoder rejects register
+    // fields above R3, so the index is only masked, not checked.
+    uint16_t get_gpr(uint8_t reg_index) const { return gpr_[reg_index & 3]; }
+    void set_gpr(uint8_t reg_index, uint16_t value) { gpr_[reg_index & 3] = value; }
     
     // Program Counter
     uint16_t get_pc() const { return pc_; }
@@ -34,14 +46,42 @@ public:
     void push_sp() { sp_ -= 2; }  // Pre-decrement for push
     void pop_sp() { sp_ += 2; }   // Post-increment for pop
     
-    // Flags Register (8-bit, only lower 4 bits used)
-    uint8_t get_flags() const { return flags_; }
-    void set_flags(uint8_t value) { flags_ = value & 0x0F; }  // Mask upper 4 bits
+    // Flags Register (8-bit, only lower 4 bits used). Reading flags
+    // materialises any pending lazy flags.
+    uint8_t get_flags() const {
+        if (flag_source_ != FlagSource::MATERIALIZED) {
+            materialize_flags();
+        }
+        return flags_;
+    }
+    void set_flags(uint8_t value) {
+        flags_ = value & 0x0F;  // Mask upper 4 bits
+        flag_source_ = FlagSource::MATERIALIZED;
+    }
+
+    // Record an ALU operation instead of computing its flags (lazy-flags
+    // mode). The flags are derived from it on the next read.
+    void set_lazy_flags(FlagSource source, uint16_t operand_a,
+                        uint16_t operand_b, uint16_t result) {
+        flag_source_ = source;
+        flag_a_ = operand_a;
+        flag_b_ = operand_b;
+        flag_result_ = result;
+    }
+    bool has_pending_flags() const {
+        return flag_source_ != FlagSource::MATERIALIZED;
+    }
     
-    // Individual flag access
-    bool get_flag(uint8_t flag_bit) const;
-    void set_flag(uint8_t flag_bit, bool value);
-    void clear_flags() { flags_ = 0; }
+    // Individual flag access (flag_bit is one of the FLAG_* constants)
+    bool get_flag(uint8_t flag_bit) const {
+        return (get_flags() & (1 << (flag_bit & 3))) != 0;
+    }
+    void set_flag(uint8_t flag_bit, bool value) {
+        uint8_t mask = static_cast<uint8_t>(1 << (flag_bit & 3));
+        uint8_t flags = get_flags();
+        set_flags(static_cast<uint8_t>(value ? (flags | mask) : (flags & ~mask)));
+    }
+    void clear_flags() { set_flags(0); }
     
     // Convenience flag getters
     bool is_zero() const { return get_flag(FLAG_Z); }
@@ -71,7 +111,14 @@ private:
     uint16_t gpr_[4];     // R0-R3 General Purpose Registers
     uint16_t pc_;         // Program Counter
     uint16_t sp_;         // Stack Pointer
-    uint8_t flags_;       // Flags Register (Z, N, C, V)
+    mutable uint8_t flags_;  // Flags Register (Z, N, C, V)
+
+    // Pending lazy flags: last ALU operation, its operands and result
+    mutable FlagSource flag_source_;
+    uint16_t flag_a_;
+    uint16_t flag_b_;
+    uint16_t flag_result_;
+    void materialize_flags() const;
     
     // Internal registers
     uint16_t ir_;         // Instruction Register
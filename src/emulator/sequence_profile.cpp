@@ -0,0 +1,260 @@
+#include "sequence_profile.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+CPU::Opcode key_opcode(uint8_t key) {
+  return static_cast<CPU::Opcode>(key >> 3);
+}
+
+CPU::AddressingMode key_mode(uint8_t key) {
+  return static_cast<CPU::AddressingMode>(key & 7);
+}
+
+// JMP/Jcc/CALL/RET/HALT end a basic block
+bool ends_sequence(uint8_t key) {
+  CPU::Opcode opcode = key_opcode(key);
+  return opcode == CPU::Opcode::HALT ||
+         (opcode >= CPU::Opcode::JMP && opcode <= CPU::Opcode::RET);
+}
+
+// Whether translate_block() fuses these two (CMP/SUB + Jcc). A fused pair
+// can only end a superinstruction, as its first key.
+bool is_fused_pair(uint8_t first, uint8_t second) {
+  CPU::Opcode op = key_opcode(first);
+  CPU::AddressingMode mode = key_mode(first);
+  CPU::Opcode branch = key_opcode(second);
+  CPU::AddressingMode branch_mode = key_mode(second);
+  return (op == CPU::Opcode::CMP || op == CPU::Opcode::SUB) &&
+         (mode == CPU::AddressingMode::REGISTER ||
+          mode == CPU::AddressingMode::IMMEDIATE) &&
+         branch >= CPU::Opcode::JZ && branch <= CPU::Opcode::JN &&
+         (branch_mode == CPU::AddressingMode::DIRECT ||
+          branch_mode == CPU::AddressingMode::PC_RELATIVE);
+}
+
+// Whether a sequence can become a superinstruction: valid encodings, no
+// HALT or IN (they stop the run), and only the last instruction may end
+// the block
+bool is_eligible(const uint8_t *keys, uint8_t length) {
+  for (uint8_t i = 0; i < length; ++i) {
+    CPU::DecodedInstruction instr{};
+    instr.opcode = key_opcode(keys[i]);
+    instr.mode = key_mode(keys[i]);
+    if (CPU::validate(instr) != CPU::FaultCode::NONE ||
+        instr.opcode == CPU::Opcode::HALT || instr.opcode == CPU::Opcode::IN) {
+      return false;
+    }
+    if (i + 1 < length &&
+        (ends_sequence(keys[i]) || is_fused_pair(keys[i], keys[i + 1]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+SequenceProfile::SequenceProfile()
+    : pairs_(0x10000, 0), instructions_(0), history_{0, 0},
+      history_length_(0) {}
+
+void SequenceProfile::record(uint8_t key) {
+  ++instructions_;
+  if (history_length_ >= 1) {
+    ++pairs_[(static_cast<uint32_t>(history_[1]) << 8) | key];
+  }
+  if (history_length_ == 2) {
+    ++triples_[(static_cast<uint32_t>(history_[0]) << 16) |
+               (static_cast<uint32_t>(history_[1]) << 8) | key];
+  }
+  history_[0] = history_[1];
+  history_[1] = key;
+  history_length_ = history_length_ < 2 ? history_length_ + 1 : 2;
+  if (ends_sequence(key)) {
+    history_length_ = 0;
+  }
+}
+
+uint64_t SequenceProfile::pair_count(uint8_t first, uint8_t second) const {
+  return pairs_[(static_cast<uint32_t>(first) << 8) | second];
+}
+
+uint64_t SequenceProfile::triple_count(uint8_t first, uint8_t second,
+                                       uint8_t third) const {
+  auto it = triples_.find((static_cast<uint32_t>(first) << 16) |
+                          (static_cast<uint32_t>(second) << 8) | third);
+  return it == triples_.end() ? 0 : it->second;
+}
+
+void SequenceProfile::merge(const SequenceProfile &other) {
+  for (size_t i = 0; i < pairs_.size(); ++i) {
+    pairs_[i] += other.pairs_[i];
+  }
+  for (const auto &entry : other.triples_) {
+    triples_[entry.first] += entry.second;
+  }
+  instructions_ += other.instructions_;
+}
+
+std::string SequenceProfile::key_name(uint8_t key) {
+  return CPU::opcode_to_string(key_opcode(key)) + "." +
+         CPU::mode_to_string(key_mode(key));
+}
+
+bool SequenceProfile::save(const std::string &path) const {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  out << "# Opcode/mode sequence profile (software-cpu profile-seq)\n";
+  out << "instructions " << instructions_ << "\n";
+
+  auto write = [&](const char *kind, uint64_t count, const uint8_t *keys,
+                   uint8_t length) {
+    out << kind << " " << count << std::hex;
+    for (uint8_t i = 0; i < length; ++i) {
+      out << " " << std::setw(2) << std::setfill('0')
+          << static_cast<int>(keys[i]);
+    }
+    out << std::dec << std::setfill(' ') << "  #";
+    for (uint8_t i = 0; i < length; ++i) {
+      out << " " << key_name(keys[i]);
+    }
+    out << "\n";
+  };
+
+  for (uint32_t i = 0; i < pairs_.size(); ++i) {
+    if (pairs_[i]) {
+      uint8_t keys[2] = {static_cast<uint8_t>(i >> 8),
+                         static_cast<uint8_t>(i)};
+      write("pair", pairs_[i], keys, 2);
+    }
+  }
+  // Sorted, so the file is reproducible
+  std::vector<std::pair<uint32_t, uint64_t>> triples(triples_.begin(),
+                                                     triples_.end());
+  std::sort(triples.begin(), triples.end());
+  for (const auto &entry : triples) {
+    uint8_t keys[3] = {static_cast<uint8_t>(entry.first >> 16),
+                       static_cast<uint8_t>(entry.first >> 8),
+                       static_cast<uint8_t>(entry.first)};
+    write("triple", entry.second, keys, 3);
+  }
+  return static_cast<bool>(out);
+}
+
+bool SequenceProfile::load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::fill(pairs_.begin(), pairs_.end(), 0);
+  triples_.clear();
+  instructions_ = 0;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string kind;
+    if (!(fields >> kind)) {
+      continue;
+    }
+    uint64_t count = 0;
+    if (!(fields >> count)) {
+      return false;
+    }
+    if (kind == "instructions") {
+      instructions_ = count;
+      continue;
+    }
+    uint8_t length = kind == "pair" ? 2 : kind == "triple" ? 3 : 0;
+    if (length == 0) {
+      return false;
+    }
+    uint32_t index = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+      unsigned key = 0;
+      if (!(fields >> std::hex >> key) || key > 0xFF) {
+        return false;
+      }
+      index = (index << 8) | key;
+    }
+    if (length == 2) {
+      pairs_[index] += count;
+    } else {
+      triples_[index] += count;
+    }
+  }
+  return true;
+}
+
+std::vector<SequenceProfile::Sequence> SequenceProfile::candidates() const {
+  std::vector<Sequence> result;
+  for (uint32_t i = 0; i < pairs_.size(); ++i) {
+    Sequence seq{{static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i), 0},
+                 2, pairs_[i]};
+    if (seq.count && is_eligible(seq.keys, 2)) {
+      result.push_back(seq);
+    }
+  }
+  for (const auto &entry : triples_) {
+    Sequence seq{{static_cast<uint8_t>(entry.first >> 16),
+                  static_cast<uint8_t>(entry.first >> 8),
+                  static_cast<uint8_t>(entry.first)},
+                 3, entry.second};
+    if (seq.count && is_eligible(seq.keys, 3)) {
+      result.push_back(seq);
+    }
+  }
+
+  auto saved = [](const Sequence &s) { return s.count * (s.length - 1u); };
+  std::sort(result.begin(), result.end(),
+            [&](const Sequence &a, const Sequence &b) {
+              if (saved(a) != saved(b)) {
+                return saved(a) > saved(b);
+              }
+              if (a.length != b.length) {
+                return a.length > b.length;
+              }
+              return std::lexicographical_compare(a.keys, a.keys + a.length,
+                                                  b.keys, b.keys + b.length);
+            });
+  return result;
+}
+
+void write_superinstruction_header(const SequenceProfile &profile,
+                                   size_t count, const std::string &source,
+                                   std::ostream &out) {
+  std::vector<SequenceProfile::Sequence> selected = profile.candidates();
+  if (selected.size() > count) {
+    selected.resize(count);
+  }
+
+  out << "// Generated by `software-cpu gen-superinstructions` from\n"
+      << "// " << source << ". Do not edit; regenerate with\n"
+      << "// `make superinstructions`.\n"
+      << "#pragma once\n\n"
+      << "// X(length, key0, key1, key2) for each superinstruction, best\n"
+      << "// first. Keys are (opcode << 3) | mode; unused keys are 0.\n"
+      << "#define SOFTCPU_SUPERINSTRUCTIONS(X)";
+  for (const auto &seq : selected) {
+    out << " \\\n  X(" << static_cast<int>(seq.length) << std::hex;
+    for (uint8_t i = 0; i < 3; ++i) {
+      out << ", 0x" << std::setw(2) << std::setfill('0')
+          << static_cast<int>(i < seq.length ? seq.keys[i] : 0);
+    }
+    out << std::dec << std::setfill(' ') << ") /*";
+    for (uint8_t i = 0; i < seq.length; ++i) {
+      out << " " << SequenceProfile::key_name(seq.keys[i]);
+    }
+    out << ": " << seq.count << " */";
+  }
+  out << "\n";
+}
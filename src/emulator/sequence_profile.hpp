@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counts adjacent opcode/mode sequences over a run, as input for
+// superinstruction generation. An instruction is identified by its key,
+// the top byte of its instruction word ((opcode << 3) | mode). Sequences
+// never span a JMP/Jcc/CALL/RET/HALT, because superinstructions are only
+// formed inside a basic block.
+class SequenceProfile {
+public:
+  SequenceProfile();
+
+  // Record one executed instruction
+  void record(uint8_t key);
+  // Forget the history (start of a run, or a break in the sequence)
+  void break_sequence() { history_length_ = 0; }
+
+  uint64_t pair_count(uint8_t first, uint8_t second) const;
+  uint64_t triple_count(uint8_t first, uint8_t second, uint8_t third) const;
+  uint64_t instructions() const { return instructions_; }
+
+  // Add the counts of another profile (several programs, one profile)
+  void merge(const SequenceProfile &other);
+
+  // Text format, one sequence per line: "pair|triple <count> <keys...>"
+  // with keys in hex, followed by a comment with the mnemonics
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+
+  // Sequence of two or three keys and its execution count
+  struct Sequence {
+    uint8_t keys[3];
+    uint8_t length;
+    uint64_t count;
+  };
+
+  // Sequences that can become superinstructions, ordered by the number of
+  // dispatches they would save (count * (length - 1)), most first. Ties
+  // are broken by key so the result is reproducible.
+  std::vector<Sequence> candidates() const;
+
+  // "PUSH.REG" style name for a key
+  static std::string key_name(uint8_t key);
+
+private:
+  std::vector<uint64_t> pairs_; // dense, indexed by (first << 8) | second
+  std::unordered_map<uint32_t, uint64_t> triples_;
+  uint64_t instructions_;
+  uint8_t history_[2];
+  uint8_t history_length_;
+};
+
+// Write the superinstruction table header (superinstructions.generated.hpp)
+// for the best `count` candidates of a profile
+void write_superinstruction_header(const SequenceProfile &profile,
+                                   size_t count, const std::string &source,
+                                   std::ostream &out);
@@ -0,0 +1,228 @@
+#include "snapshot_file.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'C', 'P', 'U', 'S', 'N', 'A', 'P'};
+constexpr uint32_t VERSION = 3;
+
+// magic, version, page count, 10 registers, 8 state bytes, fault pc and
+// word, cycle count, 3 statistics, timer counter, timer running, counters
+// enabled, live and latched performance counters
+constexpr size_t HEADER_SIZE = 8 + 4 + 4 + 20 + 8 + 4 + 8 + 24 + 4 +
+                               8 * Memory::PERF_COUNTER_COUNT;
+
+class Writer {
+public:
+  void u8(uint8_t v) { bytes.push_back(v); }
+  void u16(uint16_t v) {
+    u8(static_cast<uint8_t>(v));
+    u8(static_cast<uint8_t>(v >> 8));
+  }
+  void u32(uint32_t v) {
+    u16(static_cast<uint16_t>(v));
+    u16(static_cast<uint16_t>(v >> 16));
+  }
+  void u64(uint64_t v) {
+    u32(static_cast<uint32_t>(v));
+    u32(static_cast<uint32_t>(v >> 32));
+  }
+  std::vector<uint8_t> bytes;
+};
+
+class Reader {
+public:
+  explicit Reader(const uint8_t *p) : p_(p) {}
+  uint8_t u8() { return *p_++; }
+  uint16_t u16() {
+    uint16_t lo = u8();
+    return static_cast<uint16_t>(lo | (u8() << 8));
+  }
+  uint32_t u32() {
+    uint32_t lo = u16();
+    return lo | (static_cast<uint32_t>(u16()) << 16);
+  }
+  uint64_t u64() {
+    uint64_t lo = u32();
+    return lo | (static_cast<uint64_t>(u32()) << 32);
+  }
+
+private:
+  const uint8_t *p_;
+};
+
+// Owner of a file mapping; pages alias into it
+struct Mapping {
+  void *address = MAP_FAILED;
+  size_t length = 0;
+  ~Mapping() {
+    if (address != MAP_FAILED) {
+      munmap(address, length);
+    }
+  }
+};
+
+bool all_zero(const uint8_t *data) {
+  for (uint32_t i = 0; i < Memory::PAGE_SIZE; ++i) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool save_snapshot(const CPU::Snapshot &snapshot, const std::string &path) {
+  std::vector<uint8_t> pages;
+  for (uint32_t page = 0; page < Memory::PAGE_COUNT; ++page) {
+    if (!snapshot.memory.is_zero_page(page) &&
+        !all_zero(snapshot.memory.page_data(page))) {
+      pages.push_back(static_cast<uint8_t>(page));
+    }
+  }
+
+  const Registers &regs = snapshot.registers;
+  Writer w;
+  w.bytes.insert(w.bytes.end(), MAGIC, MAGIC + sizeof(MAGIC));
+  w.u32(VERSION);
+  w.u32(static_cast<uint32_t>(pages.size()));
+  for (uint8_t r = 0; r < 4; ++r) {
+    w.u16(regs.get_gpr(r));
+  }
+  w.u16(regs.get_pc());
+  w.u16(regs.get_sp());
+  w.u16(regs.get_flags());
+  w.u16(regs.get_ir());
+  w.u16(regs.get_mar());
+  w.u16(regs.get_mdr());
+  w.u8(snapshot.halted);
+  w.u8(snapshot.faulted);
+  w.u8(snapshot.waiting_for_input);
+  w.u8(snapshot.code_modified);
+  w.u8(static_cast<uint8_t>(snapshot.fault.code));
+  w.u8(0);
+  w.u8(0);
+  w.u8(0);
+  w.u16(snapshot.fault.pc);
+  w.u16(snapshot.fault.instruction_word);
+  w.u64(snapshot.cycle_count);
+  w.u64(snapshot.statistics.cycles);
+  w.u64(snapshot.statistics.fused_pairs);
+  w.u64(snapshot.statistics.superinstructions);
+  w.u16(snapshot.timer_counter);
+  w.u8(snapshot.timer_running);
+  w.u8(snapshot.perf_counters.enabled);
+  for (uint32_t value : snapshot.perf_counters.live) {
+    w.u32(value);
+  }
+  for (uint32_t value : snapshot.perf_counters.latched) {
+    w.u32(value);
+  }
+  w.bytes.insert(w.bytes.end(), pages.begin(), pages.end());
+  for (uint8_t page : pages) {
+    const uint8_t *data = snapshot.memory.page_data(page);
+    w.bytes.insert(w.bytes.end(), data, data + Memory::PAGE_SIZE);
+  }
+
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+  out.write(reinterpret_cast<const char *>(w.bytes.data()),
+            static_cast<std::streamsize>(w.bytes.size()));
+  return static_cast<bool>(out);
+}
+
+bool load_snapshot(const std::string &path, CPU::Snapshot &snapshot) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  auto mapping = std::make_shared<Mapping>();
+  if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(HEADER_SIZE)) {
+    mapping->length = static_cast<size_t>(info.st_size);
+    // Private and writable: a CPU that ends up the only user of a page
+    // writes to it in place, and that must not reach the file
+    mapping->address = mmap(nullptr, mapping->length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (mapping->address == MAP_FAILED) {
+    return false;
+  }
+
+  const uint8_t *base = static_cast<const uint8_t *>(mapping->address);
+  if (std::memcmp(base, MAGIC, sizeof(MAGIC)) != 0) {
+    return false;
+  }
+  Reader r(base + sizeof(MAGIC));
+  if (r.u32() != VERSION) {
+    return false;
+  }
+  uint32_t page_count = r.u32();
+  if (page_count > Memory::PAGE_COUNT ||
+      mapping->length != HEADER_SIZE + page_count * (1 + Memory::PAGE_SIZE)) {
+    return false;
+  }
+
+  CPU::Snapshot loaded;
+  Registers &regs = loaded.registers;
+  for (uint8_t i = 0; i < 4; ++i) {
+    regs.set_gpr(i, r.u16());
+  }
+  regs.set_pc(r.u16());
+  regs.set_sp(r.u16());
+  regs.set_flags(static_cast<uint8_t>(r.u16()));
+  regs.set_ir(r.u16());
+  regs.set_mar(r.u16());
+  regs.set_mdr(r.u16());
+  loaded.halted = r.u8() != 0;
+  loaded.faulted = r.u8() != 0;
+  loaded.waiting_for_input = r.u8() != 0;
+  loaded.code_modified = r.u8() != 0;
+  // Only the defined codes, and none unless the CPU faulted
+  uint8_t fault_code = r.u8();
+  if (fault_code > static_cast<uint8_t>(CPU::FaultCode::INVALID_REGISTER) ||
+      (!loaded.faulted && fault_code != 0)) {
+    return false;
+  }
+  loaded.fault.code = static_cast<CPU::FaultCode>(fault_code);
+  r.u8();
+  r.u8();
+  r.u8();
+  loaded.fault.pc = r.u16();
+  loaded.fault.instruction_word = r.u16();
+  loaded.cycle_count = r.u64();
+  loaded.statistics.cycles = r.u64();
+  loaded.statistics.fused_pairs = r.u64();
+  loaded.statistics.superinstructions = r.u64();
+  loaded.timer_counter = r.u16();
+  loaded.timer_running = r.u8() != 0;
+  loaded.perf_counters.enabled = r.u8() != 0;
+  for (uint32_t &value : loaded.perf_counters.live) {
+    value = r.u32();
+  }
+  for (uint32_t &value : loaded.perf_counters.latched) {
+    value = r.u32();
+  }
+
+  const uint8_t *table = base + HEADER_SIZE;
+  uint8_t *data = static_cast<uint8_t *>(mapping->address) + HEADER_SIZE +
+                  page_count;
+  for (uint32_t i = 0; i < page_count; ++i) {
+    // Aliasing shared_ptr: the page keeps the whole mapping alive
+    loaded.memory.set_page(
+        table[i], std::shared_ptr<Memory::Page>(
+                      mapping, reinterpret_cast<Memory::Page *>(
+                                   data + i * Memory::PAGE_SIZE)));
+  }
+  snapshot = std::move(loaded);
+  return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <string>
+
+// On-disk CPU snapshots.
+//
+// Little-endian binary file: a fixed header with the registers, run state,
+// counters, timer and performance counters, then a table of the pages that
+// are not all zero and their 256-byte contents. Never-written pages are
+// omitted, so a snapshot of a small program is a few hundred bytes.
+//
+// load_snapshot() maps the file instead of reading it: the snapshot's
+// memory pages point straight into the mapping (kept alive by the pages
+// that use it), so loading costs one mmap plus the header parse, and a
+// CPU restored from it copies a page only when it writes to it.
+
+bool save_snapshot(const CPU::Snapshot &snapshot, const std::string &path);
+bool load_snapshot(const std::string &path, CPU::Snapshot &snapshot);
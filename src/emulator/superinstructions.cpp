@@ -0,0 +1,123 @@
+#include "superinstructions.hpp"
+#include "block_cache.hpp"
+#include "superinstructions.generated.hpp"
+
+// Generated superinstructions.
+//
+// A superinstruction is the block engine's per-op loop body unrolled over
+// a fixed sequence of opcode/mode pairs: each part still syncs the timer,
+// sets PC and runs its InstructionHandlers::exec specialisation, but the
+// parts are called directly instead of through the handler pointer. A
+// store into translated code or to the performance counter control ends
+// the sequence early, like it ends the block. The last part may be a
+// CMP/SUB fused with the jump after it, in which case it runs the fused
+// handler and the jump retires with it.
+
+struct SuperHandlers {
+  // CMP/SUB with a register or immediate operand
+  static constexpr bool may_fuse(uint8_t key) {
+    return ((key >> 3) == static_cast<uint8_t>(CPU::Opcode::CMP) ||
+            (key >> 3) == static_cast<uint8_t>(CPU::Opcode::SUB)) &&
+           (key & 7) <= static_cast<uint8_t>(CPU::AddressingMode::IMMEDIATE);
+  }
+
+  template <uint8_t Key>
+  static inline bool step(CPU &cpu, const MicroOp &op,
+                          uint32_t &pending_ticks) {
+    if (op.sync_timer && pending_ticks) {
+      cpu.retire(pending_ticks);
+      pending_ticks = 0;
+    }
+    if constexpr (may_fuse(Key)) {
+      if (op.fused) {
+        cpu.registers_.set_pc(op.branch_next_pc);
+        op.fused(cpu, op);
+        pending_ticks += 2;
+        return true;
+      }
+    }
+    cpu.registers_.set_pc(op.next_pc);
+    InstructionHandlers::exec<(Key >> 3), (Key & 7)>(cpu, op.instr);
+    ++pending_ticks;
+    return !cpu.blocks_invalidated_ && !cpu.leave_engine_;
+  }
+
+  // Returns the number of ops run
+  template <uint8_t Length, uint8_t K0, uint8_t K1, uint8_t K2>
+  static uint32_t exec(CPU &cpu, const MicroOp *ops,
+                       uint32_t &pending_ticks) {
+    if (!step<K0>(cpu, ops[0], pending_ticks)) {
+      return 1;
+    }
+    if (!step<K1>(cpu, ops[1], pending_ticks)) {
+      return 2;
+    }
+    if constexpr (Length == 3) {
+      step<K2>(cpu, ops[2], pending_ticks);
+    }
+    return Length;
+  }
+};
+
+namespace {
+
+struct Entry {
+  SuperinstructionPattern pattern;
+  SuperHandler handler;
+};
+
+const std::vector<Entry> &entries() {
+#define SOFTCPU_SUPER_ENTRY(LENGTH, K0, K1, K2)                                \
+  Entry{{LENGTH, {K0, K1, K2}}, &SuperHandlers::exec<LENGTH, K0, K1, K2>},
+  static const std::vector<Entry> table = {
+      SOFTCPU_SUPERINSTRUCTIONS(SOFTCPU_SUPER_ENTRY)};
+#undef SOFTCPU_SUPER_ENTRY
+  return table;
+}
+
+bool matches(const SuperinstructionPattern &pattern, const MicroOp *ops,
+             size_t available) {
+  if (pattern.length > available) {
+    return false;
+  }
+  // Only the last op may be fused (it is the last op of its block anyway)
+  for (uint8_t i = 0; i < pattern.length; ++i) {
+    if ((ops[i].fused && i + 1 < pattern.length) ||
+        (ops[i].instruction_word >> 8) != pattern.keys[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+const std::vector<SuperinstructionPattern> &superinstruction_patterns() {
+  static const std::vector<SuperinstructionPattern> patterns = [] {
+    std::vector<SuperinstructionPattern> result;
+    for (const Entry &entry : entries()) {
+      result.push_back(entry.pattern);
+    }
+    return result;
+  }();
+  return patterns;
+}
+
+void apply_superinstructions(std::vector<MicroOp> &ops) {
+  const std::vector<Entry> &table = entries();
+  size_t i = 0;
+  while (i < ops.size()) {
+    size_t advance = 1;
+    // The table is ordered best first
+    for (const Entry &entry : table) {
+      if (matches(entry.pattern, &ops[i], ops.size() - i)) {
+        advance = entry.pattern.length;
+        ops[i].super = entry.handler;
+        ops[i].super_length = static_cast<uint8_t>(
+            advance + (ops[i + advance - 1].fused ? 1 : 0));
+        break;
+      }
+    }
+    i += advance;
+  }
+}
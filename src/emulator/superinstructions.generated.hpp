@@ -0,0 +1,32 @@
+// Generated by `software-cpu gen-superinstructions` from
+// src/emulator/superinstructions.profile. Do not edit; regenerate with
+// `make superinstructions`.
+#pragma once
+
+// X(length, key0, key1, key2) for each superinstruction, best
+// first. Keys are (opcode << 3) | mode; unused keys are 0.
+#define SOFTCPU_SUPERINSTRUCTIONS(X) \
+  X(3, 0x10, 0x39, 0x51) /* MOV.REG AND.IMM CMP.IMM: 26 */ \
+  X(3, 0x59, 0x61, 0x6d) /* SHL.IMM SHR.IMM JMP.REL: 26 */ \
+  X(2, 0x23, 0x29, 0x00) /* STORE.IND ADD.IMM: 35 */ \
+  X(3, 0x28, 0x59, 0x61) /* ADD.REG SHL.IMM SHR.IMM: 15 */ \
+  X(3, 0x23, 0x29, 0x23) /* STORE.IND ADD.IMM STORE.IND: 13 */ \
+  X(3, 0x23, 0x29, 0x6d) /* STORE.IND ADD.IMM JMP.REL: 13 */ \
+  X(3, 0x29, 0x23, 0x29) /* ADD.IMM STORE.IND ADD.IMM: 13 */ \
+  X(2, 0x10, 0x39, 0x00) /* MOV.REG AND.IMM: 26 */ \
+  X(2, 0x39, 0x51, 0x00) /* AND.IMM CMP.IMM: 26 */ \
+  X(2, 0x59, 0x61, 0x00) /* SHL.IMM SHR.IMM: 26 */ \
+  X(2, 0x61, 0x6d, 0x00) /* SHR.IMM JMP.REL: 26 */ \
+  X(2, 0x11, 0x11, 0x00) /* MOV.IMM MOV.IMM: 20 */ \
+  X(3, 0x11, 0x11, 0x9d) /* MOV.IMM MOV.IMM CALL.REL: 9 */ \
+  X(3, 0x11, 0x23, 0x51) /* MOV.IMM STORE.IND CMP.IMM: 8 */ \
+  X(3, 0x29, 0x11, 0x11) /* ADD.IMM MOV.IMM MOV.IMM: 8 */ \
+  X(2, 0x11, 0x23, 0x00) /* MOV.IMM STORE.IND: 15 */ \
+  X(2, 0x28, 0x59, 0x00) /* ADD.REG SHL.IMM: 15 */ \
+  X(2, 0x1b, 0x51, 0x00) /* LOAD.IND CMP.IMM: 14 */ \
+  X(2, 0x29, 0x23, 0x00) /* ADD.IMM STORE.IND: 13 */ \
+  X(2, 0x29, 0x6d, 0x00) /* ADD.IMM JMP.REL: 13 */ \
+  X(3, 0x23, 0x29, 0xa8) /* STORE.IND ADD.IMM PUSH.REG: 6 */ \
+  X(3, 0x28, 0xb0, 0x31) /* ADD.REG POP.REG SUB.IMM: 6 */ \
+  X(3, 0x29, 0xa8, 0x28) /* ADD.IMM PUSH.REG ADD.REG: 6 */ \
+  X(3, 0xa8, 0x28, 0xb0) /* PUSH.REG ADD.REG POP.REG: 6 */
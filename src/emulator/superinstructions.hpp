@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct MicroOp;
+
+// Superinstructions for the block engine. The table is generated from a
+// sequence profile (SequenceProfile, `make superinstructions`) into
+// superinstructions.generated.hpp; each entry is a run of two or three
+// instructions that executes with one dispatch.
+struct SuperinstructionPattern {
+  uint8_t length;
+  uint8_t keys[3]; // (opcode << 3) | mode of each instruction
+};
+
+// Patterns generated when gen-superinstructions is not given --count
+constexpr size_t DEFAULT_SUPERINSTRUCTION_COUNT = 24;
+
+const std::vector<SuperinstructionPattern> &superinstruction_patterns();
+
+// Mark the ops of a translated block that start a superinstruction
+void apply_superinstructions(std::vector<MicroOp> &ops);
@@ -0,0 +1,88 @@
+# Opcode/mode sequence profile (software-cpu profile-seq)
+instructions 679
+pair 1 10 28  # MOV.REG ADD.REG
+pair 26 10 39  # MOV.REG AND.IMM
+pair 9 10 a0  # MOV.REG RET.REG
+pair 1 11 08  # MOV.IMM HALT.REG
+pair 20 11 11  # MOV.IMM MOV.IMM
+pair 2 11 1b  # MOV.IMM LOAD.IND
+pair 15 11 23  # MOV.IMM STORE.IND
+pair 9 11 51  # MOV.IMM CMP.IMM
+pair 11 11 9d  # MOV.IMM CALL.REL
+pair 4 11 a0  # MOV.IMM RET.REG
+pair 3 11 a8  # MOV.IMM PUSH.REG
+pair 3 1b 23  # LOAD.IND STORE.IND
+pair 14 1b 51  # LOAD.IND CMP.IMM
+pair 3 23 08  # STORE.IND HALT.REG
+pair 3 23 11  # STORE.IND MOV.IMM
+pair 35 23 29  # STORE.IND ADD.IMM
+pair 8 23 51  # STORE.IND CMP.IMM
+pair 15 28 59  # ADD.REG SHL.IMM
+pair 1 28 a0  # ADD.REG RET.REG
+pair 6 28 b0  # ADD.REG POP.REG
+pair 8 29 11  # ADD.IMM MOV.IMM
+pair 13 29 23  # ADD.IMM STORE.IND
+pair 3 29 51  # ADD.IMM CMP.IMM
+pair 13 29 6d  # ADD.IMM JMP.REL
+pair 6 29 a8  # ADD.IMM PUSH.REG
+pair 6 31 51  # SUB.IMM CMP.IMM
+pair 3 31 9d  # SUB.IMM CALL.REL
+pair 26 39 51  # AND.IMM CMP.IMM
+pair 106 51 75  # CMP.IMM JZ.REL
+pair 13 51 7d  # CMP.IMM JNZ.REL
+pair 3 51 85  # CMP.IMM JC.REL
+pair 26 59 61  # SHL.IMM SHR.IMM
+pair 26 61 6d  # SHR.IMM JMP.REL
+pair 3 a8 11  # PUSH.REG MOV.IMM
+pair 6 a8 28  # PUSH.REG ADD.REG
+pair 3 a8 31  # PUSH.REG SUB.IMM
+pair 1 a8 a8  # PUSH.REG PUSH.REG
+pair 1 a8 b0  # PUSH.REG POP.REG
+pair 6 b0 31  # POP.REG SUB.IMM
+pair 4 b0 51  # POP.REG CMP.IMM
+pair 3 b0 9d  # POP.REG CALL.REL
+pair 1 b0 b0  # POP.REG POP.REG
+triple 1 10 28 a0  # MOV.REG ADD.REG RET.REG
+triple 26 10 39 51  # MOV.REG AND.IMM CMP.IMM
+triple 5 11 11 11  # MOV.IMM MOV.IMM MOV.IMM
+triple 1 11 11 1b  # MOV.IMM MOV.IMM LOAD.IND
+triple 4 11 11 23  # MOV.IMM MOV.IMM STORE.IND
+triple 9 11 11 9d  # MOV.IMM MOV.IMM CALL.REL
+triple 1 11 11 a8  # MOV.IMM MOV.IMM PUSH.REG
+triple 1 11 1b 23  # MOV.IMM LOAD.IND STORE.IND
+triple 1 11 1b 51  # MOV.IMM LOAD.IND CMP.IMM
+triple 3 11 23 08  # MOV.IMM STORE.IND HALT.REG
+triple 3 11 23 11  # MOV.IMM STORE.IND MOV.IMM
+triple 1 11 23 29  # MOV.IMM STORE.IND ADD.IMM
+triple 8 11 23 51  # MOV.IMM STORE.IND CMP.IMM
+triple 9 11 51 75  # MOV.IMM CMP.IMM JZ.REL
+triple 2 11 a8 11  # MOV.IMM PUSH.REG MOV.IMM
+triple 1 11 a8 b0  # MOV.IMM PUSH.REG POP.REG
+triple 3 1b 23 29  # LOAD.IND STORE.IND ADD.IMM
+triple 14 1b 51 75  # LOAD.IND CMP.IMM JZ.REL
+triple 1 23 11 08  # STORE.IND MOV.IMM HALT.REG
+triple 1 23 11 1b  # STORE.IND MOV.IMM LOAD.IND
+triple 1 23 11 23  # STORE.IND MOV.IMM STORE.IND
+triple 13 23 29 23  # STORE.IND ADD.IMM STORE.IND
+triple 3 23 29 51  # STORE.IND ADD.IMM CMP.IMM
+triple 13 23 29 6d  # STORE.IND ADD.IMM JMP.REL
+triple 6 23 29 a8  # STORE.IND ADD.IMM PUSH.REG
+triple 8 23 51 7d  # STORE.IND CMP.IMM JNZ.REL
+triple 15 28 59 61  # ADD.REG SHL.IMM SHR.IMM
+triple 6 28 b0 31  # ADD.REG POP.REG SUB.IMM
+triple 8 29 11 11  # ADD.IMM MOV.IMM MOV.IMM
+triple 13 29 23 29  # ADD.IMM STORE.IND ADD.IMM
+triple 3 29 51 85  # ADD.IMM CMP.IMM JC.REL
+triple 6 29 a8 28  # ADD.IMM PUSH.REG ADD.REG
+triple 6 31 51 75  # SUB.IMM CMP.IMM JZ.REL
+triple 26 39 51 75  # AND.IMM CMP.IMM JZ.REL
+triple 26 59 61 6d  # SHL.IMM SHR.IMM JMP.REL
+triple 1 a8 11 11  # PUSH.REG MOV.IMM MOV.IMM
+triple 2 a8 11 a8  # PUSH.REG MOV.IMM PUSH.REG
+triple 6 a8 28 b0  # PUSH.REG ADD.REG POP.REG
+triple 3 a8 31 9d  # PUSH.REG SUB.IMM CALL.REL
+triple 1 a8 a8 11  # PUSH.REG PUSH.REG MOV.IMM
+triple 1 a8 b0 51  # PUSH.REG POP.REG CMP.IMM
+triple 6 b0 31 51  # POP.REG SUB.IMM CMP.IMM
+triple 4 b0 51 7d  # POP.REG CMP.IMM JNZ.REL
+triple 1 b0 b0 51  # POP.REG POP.REG CMP.IMM
@@ -0,0 +1,100 @@
+#include "timing_model.hpp"
+#include <fstream>
+#include <sstream>
+
+TimingModel::TimingModel() : memory_access_cost_(0) {
+  opcode_costs_.fill(1);
+  mode_costs_.fill(0);
+  update();
+}
+
+void TimingModel::set_opcode_cost(CPU::Opcode opcode, uint32_t cycles) {
+  opcode_costs_[static_cast<uint8_t>(opcode) % OPCODE_COUNT] = cycles;
+  update();
+}
+
+void TimingModel::set_mode_cost(CPU::AddressingMode mode, uint32_t cycles) {
+  mode_costs_[static_cast<uint8_t>(mode) % MODE_COUNT] = cycles;
+  update();
+}
+
+void TimingModel::set_memory_access_cost(uint32_t cycles) {
+  memory_access_cost_ = cycles;
+  update();
+}
+
+uint32_t TimingModel::opcode_cost(CPU::Opcode opcode) const {
+  return opcode_costs_[static_cast<uint8_t>(opcode) % OPCODE_COUNT];
+}
+
+uint32_t TimingModel::mode_cost(CPU::AddressingMode mode) const {
+  return mode_costs_[static_cast<uint8_t>(mode) % MODE_COUNT];
+}
+
+void TimingModel::update() {
+  for (uint32_t key = 0; key < costs_.size(); ++key) {
+    auto opcode = static_cast<CPU::Opcode>(key >> 3);
+    auto mode = static_cast<CPU::AddressingMode>(key & 7);
+    uint32_t accesses = CPU::data_reads(opcode, mode) + CPU::data_writes(opcode);
+    costs_[key] = opcode_costs_[key >> 3] + mode_costs_[key & 7] +
+                  accesses * memory_access_cost_;
+  }
+}
+
+bool TimingModel::load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  TimingModel loaded = *this;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string kind;
+    if (!(fields >> kind)) {
+      continue;
+    }
+    std::string name;
+    if (kind != "memory" && !(fields >> name)) {
+      return false;
+    }
+    uint32_t cycles = 0;
+    std::string extra;
+    if (!(fields >> cycles) || fields >> extra) {
+      return false;
+    }
+
+    if (kind == "memory") {
+      loaded.memory_access_cost_ = cycles;
+    } else if (kind == "opcode") {
+      uint8_t opcode = 0;
+      while (opcode <= static_cast<uint8_t>(CPU::Opcode::OUT) &&
+             CPU::opcode_to_string(static_cast<CPU::Opcode>(opcode)) != name) {
+        ++opcode;
+      }
+      if (opcode > static_cast<uint8_t>(CPU::Opcode::OUT)) {
+        return false;
+      }
+      loaded.opcode_costs_[opcode] = cycles;
+    } else if (kind == "mode") {
+      uint8_t mode = 0;
+      while (mode <= static_cast<uint8_t>(CPU::AddressingMode::PC_RELATIVE) &&
+             CPU::mode_to_string(static_cast<CPU::AddressingMode>(mode)) !=
+                 name) {
+        ++mode;
+      }
+      if (mode > static_cast<uint8_t>(CPU::AddressingMode::PC_RELATIVE)) {
+        return false;
+      }
+      loaded.mode_costs_[mode] = cycles;
+    } else {
+      return false;
+    }
+  }
+
+  loaded.update();
+  *this = loaded;
+  return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Cycle costs for CPU::set_timing_model().
+//
+// An instruction costs the cycles of its opcode, plus those of its
+// addressing mode, plus memory_access_cost for each data word it reads or
+// writes (CPU::data_reads()/data_writes(): operand loads and stores, and
+// the stack word of PUSH, POP, CALL and RET). Instruction fetch, including
+// the extra word, is part of the mode cost. The default model charges one
+// cycle per instruction, which is what the CPU counts without a model.
+//
+// Costs only depend on the opcode/mode pair, so they are kept in a table
+// indexed by the key of the instruction (the top byte of its word).
+class TimingModel {
+public:
+  TimingModel();
+
+  void set_opcode_cost(CPU::Opcode opcode, uint32_t cycles);
+  void set_mode_cost(CPU::AddressingMode mode, uint32_t cycles);
+  void set_memory_access_cost(uint32_t cycles);
+
+  uint32_t opcode_cost(CPU::Opcode opcode) const;
+  uint32_t mode_cost(CPU::AddressingMode mode) const;
+  uint32_t memory_access_cost() const { return memory_access_cost_; }
+
+  // Cycles for the instruction with key (opcode << 3) | mode
+  uint32_t cost(uint8_t key) const { return costs_[key]; }
+
+  // Text format, one cost per line, '#' starts a comment:
+  //   opcode <mnemonic> <cycles>   e.g. "opcode LOAD 3"
+  //   mode <REG|IMM|DIR|IND|OFF|REL> <cycles>
+  //   memory <cycles>              per data word read or written
+  // Entries not given keep their default. False, with the model
+  // unchanged, on a missing file or a malformed line.
+  bool load(const std::string &path);
+
+private:
+  static constexpr size_t OPCODE_COUNT = 32;
+  static constexpr size_t MODE_COUNT = 8;
+
+  // Refill costs_ after a change
+  void update();
+
+  std::array<uint32_t, OPCODE_COUNT> opcode_costs_;
+  std::array<uint32_t, MODE_COUNT> mode_costs_;
+  uint32_t memory_access_cost_;
+  std::array<uint32_t, 256> costs_;
+};
@@ -31,7 +31,7 @@ void TraceRecorder::ensure_open() {
   first_write_ = true;
 }
 
-void TraceRecorder::start_cycle(uint32_t cycle, uint16_t pc) {
+void TraceRecorder::start_cycle(uint64_t cycle, uint16_t pc) {
   current_cycle_ = cycle;
   current_pc_ = pc;
   mem_events_.clear();
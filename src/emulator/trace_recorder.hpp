@@ -33,7 +33,7 @@ public:
     void set_output_path(const std::string& path);
 
     // Called at start of each CPU cycle
-    void start_cycle(uint32_t cycle, uint16_t pc);
+    void start_cycle(uint64_t cycle, uint16_t pc);
 
     // Record a snapshot of registers
     void record_registers(const Registers& regs);
@@ -53,7 +53,7 @@ private:
     std::mutex mu_;
 
     // Per-cycle buffer
-    uint32_t current_cycle_ = 0;
+    uint64_t current_cycle_ = 0;
     uint16_t current_pc_ = 0;
     uint16_t regs_gpr_[4];
     uint16_t regs_pc_;
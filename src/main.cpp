@@ -1,28 +1,103 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
 
 #include "assembler/assembler.hpp"
+#include "emulator/branch_predictor.hpp"
+#include "emulator/cache_model.hpp"
+#include "emulator/call_graph_profile.hpp"
 #include "emulator/cpu.hpp"
+#include "emulator/cpu_fleet.hpp"
+#include "emulator/execution_history.hpp"
+#include "emulator/hotspot_profile.hpp"
+#include "emulator/io_log.hpp"
+#include "emulator/pipeline_model.hpp"
+#include "emulator/sequence_profile.hpp"
+#include "emulator/snapshot_file.hpp"
+#include "emulator/superinstructions.hpp"
+#include "emulator/timing_model.hpp"
 #include "emulator/trace_recorder.hpp"
 
 void print_usage(const char *program_name) {
   std::cout << "Usage:" << std::endl;
   std::cout << "  " << program_name
-            << " assemble <input.asm> <output.bin> [output.map.json]"
+            << " assemble <input.asm> <output.bin> [output.map.json] "
+               "[output.sym]"
             << std::endl;
-  std::cout << "  " << program_name << " run <program.bin>" << std::endl;
-  std::cout << "  " << program_name << " run-trace <program.bin> <trace.json>"
+  std::cout << "  " << program_name
+            << " run <program.bin> "
+               "[--engine=interpreter|threaded|block|compiled] "
+               "[--max-cycles=N] [--load-snapshot=FILE] [--save-snapshot=FILE] "
+               "[--record-io=FILE|--replay-io=FILE] [--timing=FILE]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " run-trace <program.bin> <trace.json> [--max-cycles=N]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " debug <program.bin>   (Enter steps, 'b' steps back)"
+            << std::endl;
+  std::cout << "  " << program_name << " batch <manifest> [--threads=N]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " profile <program.bin> <program.map.json> [--top=N] "
+               "[--output=FILE] [--max-cycles=N] [--timing=FILE]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " callgraph <program.bin> <program.sym> [--merge-recursion] "
+               "[--top=N] [--output=FILE] [--max-cycles=N] [--timing=FILE]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " pipeline <program.bin> [--no-forwarding] [--max-cycles=N]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " branches <program.bin> <program.map.json> "
+               "[--predictor=SPEC]... [--top=N] [--output=FILE] "
+               "[--max-cycles=N]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " cache <program.bin> [--l1i=SPEC] [--l1d=SPEC] [--l2=SPEC] "
+               "[--top=N] [--max-cycles=N]"
+            << std::endl;
+  std::cout << "  " << program_name
+            << " profile-seq <output.profile> <program.bin>..." << std::endl;
+  std::cout << "  " << program_name
+            << " gen-superinstructions <input.profile> <output.hpp> "
+               "[--count=N]"
             << std::endl;
-  std::cout << "  " << program_name << " debug <program.bin>" << std::endl;
   std::cout << "  " << program_name << " test" << std::endl;
 }
 
+// JSON string literal; other control characters are dropped
+void write_json_string(std::ostream &out, const std::string &text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"')
+      out << "\\\"";
+    else if (c == '\\')
+      out << "\\\\";
+    else if (c == '\n')
+      out << "\\n";
+    else if (c == '\r')
+      out << "\\r";
+    else if (c == '\t')
+      out << "\\t";
+    else if (static_cast<unsigned char>(c) < 32) {
+    } else
+      out << c;
+  }
+  out << '"';
+}
+
 void write_source_map(const std::string &path,
                       const std::vector<SourceMapEntry> &map) {
   std::ofstream out(path);
@@ -37,23 +112,9 @@ void write_source_map(const std::string &path,
     out << "    \"address\": " << entry.address << ",\n";
     out << "    \"line\": " << entry.line_number << ",\n";
 
-    out << "    \"source\": \"";
-    for (char c : entry.source_line) {
-      if (c == '"')
-        out << "\\\"";
-      else if (c == '\\')
-        out << "\\\\";
-      else if (c == '\n')
-        out << "\\n";
-      else if (c == '\r')
-        out << "\\r";
-      else if (c == '\t')
-        out << "\\t";
-      else if (static_cast<unsigned char>(c) < 32) {
-      } else
-        out << c;
-    }
-    out << "\",\n";
+    out << "    \"source\": ";
+    write_json_string(out, entry.source_line);
+    out << ",\n";
 
     out << "    \"bytes\": [";
     for (size_t j = 0; j < entry.bytes.size(); ++j) {
@@ -71,8 +132,81 @@ void write_source_map(const std::string &path,
   std::cout << "Wrote source map to " << path << "\n";
 }
 
+bool read_source_map(const std::string &path,
+                     std::vector<SourceMapEntry> &map) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string text((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  return parse_source_map(text, map);
+}
+
+// Symbol file: one "<hex address> <label>" line per label
+void write_symbols(const std::string &path,
+                   const std::vector<SymbolEntry> &symbols) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "Failed to open symbol output file: " << path << "\n";
+    return;
+  }
+  out << std::hex << std::setfill('0');
+  for (const SymbolEntry &symbol : symbols) {
+    out << std::setw(4) << symbol.address << " " << symbol.name << "\n";
+  }
+  std::cout << "Wrote symbols to " << path << "\n";
+}
+
+bool read_symbols(const std::string &path, std::vector<SymbolEntry> &symbols) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  symbols.clear();
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string address;
+    SymbolEntry symbol;
+    if (!(fields >> address)) {
+      continue;
+    }
+    if (!(fields >> symbol.name) || address.size() > 4 ||
+        address.find_first_not_of("0123456789abcdefABCDEF") !=
+            std::string::npos) {
+      return false;
+    }
+    symbol.address = static_cast<uint16_t>(std::stoul(address, nullptr, 16));
+    symbols.push_back(symbol);
+  }
+  return true;
+}
+
+// Read a program binary; false, after reporting it, if it cannot be opened
+bool read_program_file(const std::string &path, std::vector<uint8_t> &program) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "Failed to open program file: " << path << "\n";
+    return false;
+  }
+  program.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Index into map of the entry for each instruction address, -1 if none
+std::vector<int> source_line_index(const std::vector<SourceMapEntry> &map) {
+  std::vector<int> entry_at(Memory::MEMORY_SIZE, -1);
+  for (size_t k = 0; k < map.size(); ++k) {
+    entry_at[map[k].address] = static_cast<int>(k);
+  }
+  return entry_at;
+}
+
 int assemble_file(const std::string &input_path, const std::string &output_path,
-                  const std::string &map_path = "") {
+                  const std::string &map_path = "",
+                  const std::string &symbols_path = "") {
   std::ifstream in(input_path);
   if (!in) {
     std::cerr << "Failed to open input file: " << input_path << "\n";
@@ -84,8 +218,10 @@ int assemble_file(const std::string &input_path, const std::string &output_path,
 
   std::vector<std::uint8_t> bytes;
   std::vector<SourceMapEntry> map;
+  std::vector<SymbolEntry> symbols;
   try {
-    bytes = assemble(source, map_path.empty() ? nullptr : &map);
+    bytes = assemble(source, map_path.empty() ? nullptr : &map,
+                     symbols_path.empty() ? nullptr : &symbols);
   } catch (const std::exception &ex) {
     std::cerr << "Assembly error: " << ex.what() << "\n";
     return 1;
@@ -105,36 +241,1041 @@ int assemble_file(const std::string &input_path, const std::string &output_path,
   if (!map_path.empty()) {
     write_source_map(map_path, map);
   }
+  if (!symbols_path.empty()) {
+    write_symbols(symbols_path, symbols);
+  }
 
   return 0;
 }
 
-int run_program(const std::string &program_path) {
-  std::ifstream in(program_path, std::ios::binary);
-  if (!in) {
-    std::cerr << "Failed to open program file: " << program_path << "\n";
+bool parse_engine(const std::string &arg, CPU::Engine &engine) {
+  const std::string prefix = "--engine=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  std::string name = arg.substr(prefix.size());
+  if (name == "interpreter") {
+    engine = CPU::Engine::INTERPRETER;
+  } else if (name == "threaded") {
+    engine = CPU::Engine::THREADED;
+  } else if (name == "block") {
+    engine = CPU::Engine::BLOCK;
+  } else if (name == "compiled") {
+    engine = CPU::Engine::COMPILED;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Instruction budget for run/run-trace; 0 from --max-cycles=0 means none
+constexpr uint64_t DEFAULT_MAX_CYCLES = 100000;
+
+// Non-negative decimal number
+bool parse_count(const std::string &value, uint64_t &count) {
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  try {
+    count = std::stoull(value);
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+bool parse_max_cycles(const std::string &arg, uint64_t &max_cycles) {
+  const std::string prefix = "--max-cycles=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  return parse_count(arg.substr(prefix.size()), max_cycles);
+}
+
+// --top=N
+bool parse_top_option(const std::string &arg, uint64_t &top) {
+  const std::string prefix = "--top=";
+  return arg.compare(0, prefix.size(), prefix) == 0 &&
+         parse_count(arg.substr(prefix.size()), top);
+}
+
+// part as a percentage of whole, 0 if whole is 0
+double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * static_cast<double>(part) /
+                     static_cast<double>(whole)
+               : 0.0;
+}
+
+// --name=VALUE with a non-empty value
+bool parse_path_option(const std::string &arg, const std::string &name,
+                       std::string &value) {
+  const std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0 ||
+      arg.size() == prefix.size()) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+// Options of the run command
+struct RunOptions {
+  CPU::Engine engine = CPU::Engine::INTERPRETER;
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  std::string load_snapshot; // start from this snapshot instead of reset
+  std::string save_snapshot; // write the final state here
+  std::string record_io;     // log input and timer reads here
+  std::string replay_io;     // take input and timer reads from this log
+  std::string timing;        // timing model for modelled cycles
+};
+
+bool parse_run_option(const std::string &arg, RunOptions &options) {
+  return parse_engine(arg, options.engine) ||
+         parse_max_cycles(arg, options.max_cycles) ||
+         parse_path_option(arg, "load-snapshot", options.load_snapshot) ||
+         parse_path_option(arg, "save-snapshot", options.save_snapshot) ||
+         parse_path_option(arg, "record-io", options.record_io) ||
+         parse_path_option(arg, "replay-io", options.replay_io) ||
+         parse_path_option(arg, "timing", options.timing);
+}
+
+// Charge the cycles of the timing model in path (timing_model.hpp), if
+// any; false if the model cannot be loaded
+bool apply_timing_model(CPU &cpu, const std::string &path) {
+  if (path.empty()) {
+    return true;
+  }
+  auto model = std::make_shared<TimingModel>();
+  if (!model->load(path)) {
+    std::cerr << "Failed to load timing model: " << path << "\n";
+    return false;
+  }
+  cpu.set_timing_model(model);
+  return true;
+}
+
+void print_statistics(const CPU &cpu) {
+  const CPU::Statistics &stats = cpu.get_statistics();
+  std::cout << "=== Run Statistics ===" << std::endl;
+  std::cout << "Instructions retired: " << cpu.get_cycle_count() << std::endl;
+  std::cout << "Modelled cycles: " << stats.cycles << std::endl;
+  std::cout << "Fused compare-and-branch pairs: " << stats.fused_pairs
+            << std::endl;
+  std::cout << "Superinstruction dispatches: " << stats.superinstructions
+            << std::endl;
+}
+
+// Run each program on the interpreter and merge their opcode/mode
+// sequence counts into one profile
+int profile_sequences(const std::string &output_path,
+                      const std::vector<std::string> &programs) {
+  auto profile = std::make_shared<SequenceProfile>();
+  for (const std::string &path : programs) {
+    std::vector<uint8_t> program;
+    if (!read_program_file(path, program)) {
+      return 1;
+    }
+
+    CPU cpu;
+    cpu.set_sequence_profile(profile);
+    cpu.get_memory().set_output_callback([](uint8_t) {});
+    cpu.load_program(program);
+    CPU::RunBudget budget;
+    budget.max_instructions = DEFAULT_MAX_CYCLES;
+    CPU::RunResult result = cpu.run_for(budget);
+    std::cout << path << ": " << result.instructions << " instructions ("
+              << CPU::stop_reason_to_string(result.reason) << ")\n";
+  }
+
+  if (!profile->save(output_path)) {
+    std::cerr << "Failed to write profile: " << output_path << "\n";
     return 1;
   }
+  std::cout << "Wrote sequence profile to " << output_path << "\n";
+  return 0;
+}
 
-  std::vector<uint8_t> program((std::istreambuf_iterator<char>(in)),
-                               std::istreambuf_iterator<char>());
+int generate_superinstructions(const std::string &profile_path,
+                               const std::string &output_path,
+                               size_t count) {
+  SequenceProfile profile;
+  if (!profile.load(profile_path)) {
+    std::cerr << "Failed to read profile: " << profile_path << "\n";
+    return 1;
+  }
+  std::ofstream out(output_path);
+  if (!out) {
+    std::cerr << "Failed to open output file: " << output_path << "\n";
+    return 1;
+  }
+  write_superinstruction_header(profile, count, profile_path, out);
+  std::cout << "Wrote superinstruction table to " << output_path << "\n";
+  return 0;
+}
+
+int run_program(const std::string &program_path,
+                const RunOptions &options = RunOptions()) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
 
   std::cout << "Loading program (" << program.size() << " bytes)..."
             << std::endl;
 
   CPU cpu;
   cpu.set_debug_mode(true);
+  cpu.set_engine(options.engine);
+  if (!apply_timing_model(cpu, options.timing)) {
+    return 1;
+  }
   cpu.load_program(program);
 
+  if (!options.load_snapshot.empty()) {
+    CPU::Snapshot snapshot;
+    if (!load_snapshot(options.load_snapshot, snapshot)) {
+      std::cerr << "Failed to load snapshot: " << options.load_snapshot
+                << "\n";
+      return 1;
+    }
+    cpu.restore(snapshot);
+    std::cout << "Restored snapshot at cycle " << cpu.get_cycle_count()
+              << std::endl;
+  }
+
+  auto recorded = std::make_shared<IoLog>();
+  if (!options.record_io.empty()) {
+    record_io(cpu, recorded);
+  }
+  std::shared_ptr<const IoReplayStatus> replay;
+  auto replayed = std::make_shared<IoLog>();
+  if (!options.replay_io.empty()) {
+    if (!replayed->load(options.replay_io)) {
+      std::cerr << "Failed to load I/O log: " << options.replay_io << "\n";
+      return 1;
+    }
+    replay = replay_io(cpu, replayed);
+  }
+
   std::cout << "Running program..." << std::endl;
-  cpu.run();
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  cpu.run_for(budget);
 
   std::cout << "Program execution complete." << std::endl;
   cpu.dump_state();
+  print_statistics(cpu);
+
+  if (replay) {
+    std::cout << "Replayed " << replay->position << " of "
+              << replayed->events().size() << " I/O events" << std::endl;
+    if (replay->diverged) {
+      std::cerr << "Replay diverged from the log at cycle "
+                << replay->divergence_cycle << "\n";
+    }
+  }
+  if (!options.record_io.empty()) {
+    if (!recorded->save(options.record_io)) {
+      std::cerr << "Failed to write I/O log: " << options.record_io << "\n";
+      return 1;
+    }
+    std::cout << "Recorded " << recorded->events().size() << " I/O events to "
+              << options.record_io << std::endl;
+  }
+
+  if (!options.save_snapshot.empty()) {
+    if (!save_snapshot(cpu.snapshot(), options.save_snapshot)) {
+      std::cerr << "Failed to write snapshot: " << options.save_snapshot
+                << "\n";
+      return 1;
+    }
+    std::cout << "Wrote snapshot to " << options.save_snapshot << std::endl;
+  }
 
   return 0;
 }
 
+// Options of the profile command
+struct ProfileOptions {
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  uint64_t top = 10;                    // lines printed
+  std::string output = "profile.json"; // machine-readable profile
+  std::string timing;                   // timing model for the cycles
+};
+
+bool parse_profile_option(const std::string &arg, ProfileOptions &options) {
+  if (parse_top_option(arg, options.top)) {
+    return true;
+  }
+  return parse_max_cycles(arg, options.max_cycles) ||
+         parse_path_option(arg, "output", options.output) ||
+         parse_path_option(arg, "timing", options.timing);
+}
+
+// Counts of one source line (line 0: code with no source map entry)
+struct LineProfile {
+  int line;
+  std::string source;
+  uint64_t instructions;
+  uint64_t cycles;
+};
+
+// Run a program with a hot-spot profile attached, join the per-PC counts
+// to the source map, print the hottest lines and write all counts as JSON
+int profile_program(const std::string &program_path,
+                    const std::string &map_path,
+                    const ProfileOptions &options) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+  std::vector<SourceMapEntry> map;
+  if (!read_source_map(map_path, map)) {
+    std::cerr << "Failed to read source map: " << map_path << "\n";
+    return 1;
+  }
+
+  auto profile = std::make_shared<HotspotProfile>();
+  CPU cpu;
+  cpu.set_hotspot_profile(profile);
+  if (!apply_timing_model(cpu, options.timing)) {
+    return 1;
+  }
+  cpu.load_program(program);
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  auto start = std::chrono::steady_clock::now();
+  CPU::RunResult result = cpu.run_for(budget);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Profiled " << result.instructions << " instructions in "
+            << elapsed.count() << " s ("
+            << CPU::stop_reason_to_string(result.reason) << ")\n";
+
+  // Source line of each instruction address
+  const std::vector<int> entry_at = source_line_index(map);
+
+  const std::vector<uint16_t> pcs = profile->hot_pcs();
+  std::map<int, LineProfile> by_line;
+  for (uint16_t pc : pcs) {
+    int entry = entry_at[pc];
+    int line = entry < 0 ? 0 : map[entry].line_number;
+    auto inserted = by_line.emplace(
+        line, LineProfile{line, entry < 0 ? "(no source)" : "", 0, 0});
+    LineProfile &counts = inserted.first->second;
+    if (entry >= 0) {
+      counts.source = map[entry].source_line;
+    }
+    counts.instructions += profile->instructions(pc);
+    counts.cycles += profile->cycles(pc);
+  }
+  std::vector<LineProfile> lines;
+  for (auto &line : by_line) {
+    lines.push_back(line.second);
+  }
+  std::stable_sort(lines.begin(), lines.end(),
+                   [](const LineProfile &a, const LineProfile &b) {
+                     return a.cycles > b.cycles;
+                   });
+
+  const uint64_t total_cycles = profile->total_cycles();
+  std::cout << "=== Hottest Lines ===\n";
+  std::cout << std::setw(12) << "cycles" << std::setw(8) << "%"
+            << std::setw(14) << "instructions"
+            << "  line\n";
+  for (size_t i = 0; i < lines.size() && i < options.top; ++i) {
+    const LineProfile &line = lines[i];
+    std::cout << std::setw(12) << line.cycles << std::setw(7) << std::fixed
+              << std::setprecision(2) << percent(line.cycles, total_cycles)
+              << "%" << std::setw(14)
+              << line.instructions << "  " << line.line << ": "
+              << line.source << "\n";
+  }
+  std::cout.unsetf(std::ios::fixed);
+
+  std::ofstream out(options.output);
+  if (!out) {
+    std::cerr << "Failed to open profile output: " << options.output << "\n";
+    return 1;
+  }
+  out << "{\n  \"program\": ";
+  write_json_string(out, program_path);
+  out << ",\n  \"total_instructions\": " << profile->total_instructions()
+      << ",\n  \"total_cycles\": " << total_cycles << ",\n  \"lines\": [";
+  for (size_t i = 0; i < lines.size(); ++i) {
+    out << (i ? ",\n" : "\n") << "    {\"line\": " << lines[i].line
+        << ", \"instructions\": " << lines[i].instructions
+        << ", \"cycles\": " << lines[i].cycles << ", \"source\": ";
+    write_json_string(out, lines[i].source);
+    out << "}";
+  }
+  out << "\n  ],\n  \"pcs\": [";
+  for (size_t i = 0; i < pcs.size(); ++i) {
+    int entry = entry_at[pcs[i]];
+    out << (i ? ",\n" : "\n") << "    {\"pc\": " << pcs[i]
+        << ", \"line\": " << (entry < 0 ? 0 : map[entry].line_number)
+        << ", \"instructions\": " << profile->instructions(pcs[i])
+        << ", \"cycles\": " << profile->cycles(pcs[i]) << "}";
+  }
+  out << "\n  ]\n}\n";
+  std::cout << "Wrote profile to " << options.output << std::endl;
+  return 0;
+}
+
+// Options of the callgraph command
+struct CallGraphOptions {
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  uint64_t top = 10;                         // functions printed
+  std::string output = "callgraph.folded"; // collapsed stacks
+  bool merge_recursion = false;
+  std::string timing; // timing model for the cycles
+};
+
+bool parse_call_graph_option(const std::string &arg,
+                             CallGraphOptions &options) {
+  if (arg == "--merge-recursion") {
+    options.merge_recursion = true;
+    return true;
+  }
+  if (parse_top_option(arg, options.top)) {
+    return true;
+  }
+  return parse_max_cycles(arg, options.max_cycles) ||
+         parse_path_option(arg, "output", options.output) ||
+         parse_path_option(arg, "timing", options.timing);
+}
+
+// Run a program with a call-graph profile attached, print the functions
+// with the most inclusive cycles and write collapsed stacks for
+// flame-graph tools. Call targets are named from the symbol file.
+int profile_call_graph(const std::string &program_path,
+                       const std::string &symbols_path,
+                       const CallGraphOptions &options) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+  std::vector<SymbolEntry> symbols;
+  if (!read_symbols(symbols_path, symbols)) {
+    std::cerr << "Failed to read symbols: " << symbols_path << "\n";
+    return 1;
+  }
+  // First label at each address
+  std::map<uint16_t, std::string> labels;
+  for (const SymbolEntry &symbol : symbols) {
+    labels.emplace(symbol.address, symbol.name);
+  }
+  CallGraphProfile::SymbolLookup name = [&labels](uint16_t address) {
+    auto it = labels.find(address);
+    if (it != labels.end()) {
+      return it->second;
+    }
+    std::ostringstream hex;
+    hex << "0x" << std::hex << std::setw(4) << std::setfill('0') << address;
+    return hex.str();
+  };
+
+  auto profile = std::make_shared<CallGraphProfile>();
+  CPU cpu;
+  cpu.set_call_graph_profile(profile);
+  if (!apply_timing_model(cpu, options.timing)) {
+    return 1;
+  }
+  cpu.load_program(program);
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  CPU::RunResult result = cpu.run_for(budget);
+  std::cout << "Profiled " << result.instructions << " instructions ("
+            << CPU::stop_reason_to_string(result.reason) << ")\n";
+
+  std::vector<CallGraphProfile::FunctionSummary> functions =
+      profile->functions();
+  std::cout << "=== Functions by Inclusive Cycles ===\n";
+  std::cout << std::setw(12) << "inclusive" << std::setw(12) << "exclusive"
+            << std::setw(10) << "calls"
+            << "  function\n";
+  for (size_t i = 0; i < functions.size() && i < options.top; ++i) {
+    const CallGraphProfile::FunctionSummary &function = functions[i];
+    std::cout << std::setw(12) << function.inclusive_cycles << std::setw(12)
+              << function.exclusive_cycles << std::setw(10) << function.calls
+              << "  " << name(function.function) << "\n";
+  }
+
+  std::ofstream out(options.output);
+  if (!out) {
+    std::cerr << "Failed to open call graph output: " << options.output
+              << "\n";
+    return 1;
+  }
+  profile->write_collapsed(out, name, options.merge_recursion);
+  std::cout << "Wrote collapsed stacks to " << options.output << std::endl;
+  return 0;
+}
+
+// Options of the pipeline command
+struct PipelineOptions {
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  PipelineModel::Config config;
+};
+
+bool parse_pipeline_option(const std::string &arg, PipelineOptions &options) {
+  if (arg == "--no-forwarding") {
+    options.config.forwarding = false;
+    return true;
+  }
+  return parse_max_cycles(arg, options.max_cycles);
+}
+
+// Run a program on the five-stage pipeline model and report CPI, stall
+// and flush cycles by cause and the operands forwarded on each path
+int simulate_pipeline(const std::string &program_path,
+                      const PipelineOptions &options) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+
+  auto model = std::make_shared<PipelineModel>(options.config);
+  CPU cpu;
+  cpu.set_pipeline_model(model);
+  cpu.load_program(program);
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  CPU::RunResult result = cpu.run_for(budget);
+  std::cout << "Simulated " << result.instructions << " instructions ("
+            << CPU::stop_reason_to_string(result.reason) << ")\n";
+
+  const PipelineModel::Statistics &stats = model->statistics();
+  std::cout << "=== Pipeline (IF ID EX MEM WB, forwarding "
+            << (options.config.forwarding ? "on" : "off") << ") ===\n";
+  std::cout << "Cycles: " << stats.cycles << "\n";
+  std::cout << "CPI: " << std::fixed << std::setprecision(3) << stats.cpi()
+            << "\n";
+  std::cout << "Data hazard stalls: "
+            << stats.stall_cycles[PipelineModel::STALL_DATA] << "\n";
+  std::cout << "Load-use stalls: "
+            << stats.stall_cycles[PipelineModel::STALL_LOAD_USE] << "\n";
+  std::cout << "Stalls by register:";
+  for (int r = 0; r < PipelineModel::RESOURCE_COUNT; ++r) {
+    std::cout << " " << PipelineModel::resource_name(
+                            static_cast<PipelineModel::Resource>(r))
+              << "=" << stats.resource_stalls[r];
+  }
+  std::cout << "\n";
+  const char *flush_names[PipelineModel::FLUSH_CAUSE_COUNT] = {
+      "Taken branches", "Jumps and calls", "Returns"};
+  for (int f = 0; f < PipelineModel::FLUSH_CAUSE_COUNT; ++f) {
+    std::cout << flush_names[f] << ": " << stats.flushes[f] << " ("
+              << stats.flush_cycles[f] << " flush cycles)\n";
+  }
+  std::cout << "Forwarded from EX/MEM: "
+            << stats.forwards[PipelineModel::FORWARD_EX_MEM] << "\n";
+  std::cout << "Forwarded from MEM/WB: "
+            << stats.forwards[PipelineModel::FORWARD_MEM_WB] << "\n";
+  return 0;
+}
+
+// Options of the branches command
+struct BranchOptions {
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  uint64_t top = 10;                     // branches printed
+  std::string output = "branches.json"; // machine-readable report
+  std::vector<std::string> predictors;  // specs, default set if empty
+};
+
+bool parse_branch_option(const std::string &arg, BranchOptions &options) {
+  if (parse_top_option(arg, options.top)) {
+    return true;
+  }
+  std::string spec;
+  if (parse_path_option(arg, "predictor", spec)) {
+    if (!make_branch_predictor(spec)) {
+      return false;
+    }
+    options.predictors.push_back(spec);
+    return true;
+  }
+  return parse_max_cycles(arg, options.max_cycles) ||
+         parse_path_option(arg, "output", options.output);
+}
+
+const char *branch_kind_name(BranchKind kind) {
+  switch (kind) {
+  case BranchKind::CONDITIONAL:
+    return "conditional";
+  case BranchKind::JUMP:
+    return "jump";
+  case BranchKind::CALL:
+    return "call";
+  case BranchKind::RETURN:
+    return "return";
+  }
+  return "unknown";
+}
+
+// Run a program once with several branch predictors side by side, print
+// their accuracy and the branches they mispredict most, and write the
+// per-branch counts joined to the source map as JSON
+int profile_branches(const std::string &program_path,
+                     const std::string &map_path,
+                     const BranchOptions &options) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+  std::vector<SourceMapEntry> map;
+  if (!read_source_map(map_path, map)) {
+    std::cerr << "Failed to read source map: " << map_path << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> specs = options.predictors;
+  if (specs.empty()) {
+    specs = {"static", "bimodal", "gshare", "ras"};
+  }
+  auto profile = std::make_shared<BranchProfile>();
+  for (const std::string &spec : specs) {
+    profile->add_predictor(make_branch_predictor(spec));
+  }
+
+  // The pipeline model runs in the same pass, so each predictor's
+  // mispredictions can be priced at its flush penalties
+  auto pipeline = std::make_shared<PipelineModel>();
+  CPU cpu;
+  cpu.set_branch_profile(profile);
+  cpu.set_pipeline_model(pipeline);
+  cpu.load_program(program);
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  CPU::RunResult result = cpu.run_for(budget);
+  std::cout << "Profiled " << result.instructions << " instructions ("
+            << CPU::stop_reason_to_string(result.reason) << ")\n";
+
+  // Flush cycles: predict-not-taken as measured by the pipeline, and each
+  // predictor's mispredictions at the penalty of what it predicts
+  const PipelineModel::Config &penalties = pipeline->config();
+  const PipelineModel::Statistics &timing = pipeline->statistics();
+  auto flush_cycles = [&](size_t p) {
+    const uint32_t penalty =
+        profile->predictor(p).predicts(BranchKind::RETURN)
+            ? penalties.return_penalty
+            : penalties.branch_penalty;
+    return profile->mispredicted(p) * penalty;
+  };
+  std::cout << "=== Predictors ===\n" << std::fixed << std::setprecision(2);
+  for (size_t p = 0; p < profile->predictor_count(); ++p) {
+    std::cout << std::setw(18) << profile->predictor(p).name() << ": "
+              << profile->mispredicted(p) << " of " << profile->predicted(p)
+              << " mispredicted ("
+              << percent(profile->mispredicted(p), profile->predicted(p))
+              << "%), " << flush_cycles(p) << " flush cycles\n";
+  }
+  std::cout << "Pipeline (predict not taken): " << timing.cycles
+            << " cycles, "
+            << timing.flush_cycles[PipelineModel::FLUSH_BRANCH]
+            << " taken-branch and "
+            << timing.flush_cycles[PipelineModel::FLUSH_RETURN]
+            << " return flush cycles\n";
+
+  // Source line of each instruction address
+  const std::vector<int> entry_at = source_line_index(map);
+
+  // Worst branches first: most mispredictions over all predictors
+  std::vector<BranchProfile::Site> sites = profile->sites();
+  std::vector<BranchProfile::Site> worst = sites;
+  auto total_misses = [](const BranchProfile::Site &site) {
+    uint64_t total = 0;
+    for (uint64_t misses : site.mispredictions) {
+      total += misses;
+    }
+    return total;
+  };
+  std::stable_sort(worst.begin(), worst.end(),
+                   [&](const BranchProfile::Site &a,
+                       const BranchProfile::Site &b) {
+                     return total_misses(a) > total_misses(b);
+                   });
+  std::cout << "=== Most Mispredicted Branches (miss %) ===\n";
+  std::cout << std::setw(8) << "pc" << std::setw(12) << "executed"
+            << std::setw(9) << "taken%";
+  for (size_t p = 0; p < profile->predictor_count(); ++p) {
+    std::cout << std::setw(18) << profile->predictor(p).name();
+  }
+  std::cout << "  line\n";
+  for (size_t i = 0; i < worst.size() && i < options.top; ++i) {
+    const BranchProfile::Site &site = worst[i];
+    if (total_misses(site) == 0) {
+      break;
+    }
+    int entry = entry_at[site.pc];
+    std::cout << std::setw(8) << std::hex << site.pc << std::dec
+              << std::setw(12) << site.executions << std::setw(9)
+              << percent(site.taken, site.executions);
+    for (size_t p = 0; p < profile->predictor_count(); ++p) {
+      if (profile->predictor(p).predicts(site.kind)) {
+        std::cout << std::setw(18)
+                  << percent(site.mispredictions[p], site.executions);
+      } else {
+        std::cout << std::setw(18) << "-";
+      }
+    }
+    std::cout << "  "
+              << (entry < 0 ? std::string("(no source)")
+                            : std::to_string(map[entry].line_number) + ": " +
+                                  map[entry].source_line)
+              << "\n";
+  }
+  std::cout.unsetf(std::ios::fixed);
+
+  std::ofstream out(options.output);
+  if (!out) {
+    std::cerr << "Failed to open branch output: " << options.output << "\n";
+    return 1;
+  }
+  out << "{\n  \"program\": ";
+  write_json_string(out, program_path);
+  out << ",\n  \"predictors\": [";
+  for (size_t p = 0; p < profile->predictor_count(); ++p) {
+    out << (p ? ",\n" : "\n") << "    {\"name\": ";
+    write_json_string(out, profile->predictor(p).name());
+    out << ", \"predicted\": " << profile->predicted(p)
+        << ", \"mispredicted\": " << profile->mispredicted(p)
+        << ", \"flush_cycles\": " << flush_cycles(p) << "}";
+  }
+  out << "\n  ],\n  \"pipeline\": {\"cycles\": " << timing.cycles
+      << ", \"branch_flush_cycles\": "
+      << timing.flush_cycles[PipelineModel::FLUSH_BRANCH]
+      << ", \"return_flush_cycles\": "
+      << timing.flush_cycles[PipelineModel::FLUSH_RETURN]
+      << "},\n  \"branches\": [";
+  for (size_t i = 0; i < sites.size(); ++i) {
+    const BranchProfile::Site &site = sites[i];
+    int entry = entry_at[site.pc];
+    out << (i ? ",\n" : "\n") << "    {\"pc\": " << site.pc
+        << ", \"line\": " << (entry < 0 ? 0 : map[entry].line_number)
+        << ", \"kind\": \"" << branch_kind_name(site.kind)
+        << "\", \"executions\": " << site.executions
+        << ", \"taken\": " << site.taken << ", \"mispredictions\": [";
+    for (size_t p = 0; p < site.mispredictions.size(); ++p) {
+      out << (p ? ", " : "");
+      if (profile->predictor(p).predicts(site.kind)) {
+        out << site.mispredictions[p];
+      } else {
+        out << "null";
+      }
+    }
+    out << "], \"source\": ";
+    write_json_string(out, entry < 0 ? std::string() : map[entry].source_line);
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+  std::cout << "Wrote branch report to " << options.output << std::endl;
+  return 0;
+}
+
+// Options of the cache command
+struct CacheOptions {
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  uint64_t top = 10; // instructions printed
+  Cache::Config l1i;
+  Cache::Config l1d;
+  bool l2 = false;
+  Cache::Config l2_config;
+};
+
+bool parse_cache_option(const std::string &arg, CacheOptions &options) {
+  if (parse_top_option(arg, options.top)) {
+    return true;
+  }
+  std::string spec;
+  if (parse_path_option(arg, "l1i", spec)) {
+    return parse_cache_config(spec, options.l1i);
+  }
+  if (parse_path_option(arg, "l1d", spec)) {
+    return parse_cache_config(spec, options.l1d);
+  }
+  if (parse_path_option(arg, "l2", spec)) {
+    options.l2 = true;
+    return parse_cache_config(spec, options.l2_config);
+  }
+  return parse_max_cycles(arg, options.max_cycles);
+}
+
+// Run a program through split L1 caches and an optional L2 and report
+// hit rates per cache, per address region and for the instructions that
+// miss most
+int simulate_caches(const std::string &program_path,
+                    const CacheOptions &options) {
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+
+  auto caches = options.l2 ? std::make_shared<CacheHierarchy>(
+                                 options.l1i, options.l1d, options.l2_config)
+                           : std::make_shared<CacheHierarchy>(options.l1i,
+                                                              options.l1d);
+  CPU cpu;
+  cpu.set_cache_hierarchy(caches);
+  cpu.load_program(program);
+  CPU::RunBudget budget;
+  budget.max_instructions = options.max_cycles;
+  CPU::RunResult result = cpu.run_for(budget);
+  std::cout << "Simulated " << result.instructions << " instructions ("
+            << CPU::stop_reason_to_string(result.reason) << ")\n";
+
+  std::cout << "=== Caches ===\n" << std::fixed << std::setprecision(2);
+  auto print_cache = [&](const char *name, const Cache &cache) {
+    const Cache::Statistics &stats = cache.statistics();
+    std::cout << name << " (" << cache.describe() << "): " << stats.reads
+              << " reads, " << stats.writes << " writes, " << stats.misses()
+              << " misses (" << percent(stats.misses(), stats.accesses())
+              << "%), " << stats.writebacks << " writebacks\n";
+  };
+  print_cache("L1I", caches->l1i());
+  print_cache("L1D", caches->l1d());
+  if (caches->l2()) {
+    print_cache("L2", *caches->l2());
+  }
+  std::cout << "Memory: " << caches->memory_reads() << " line reads, "
+            << caches->memory_writes() << " writes\n";
+
+  std::cout << "=== Regions ===\n";
+  std::cout << std::setw(10) << "region" << std::setw(12) << "accesses"
+            << std::setw(12) << "L1 misses" << std::setw(9) << "miss%";
+  if (caches->l2()) {
+    std::cout << std::setw(12) << "L2 misses";
+  }
+  std::cout << "\n";
+  for (int r = 0; r < CacheHierarchy::REGION_COUNT; ++r) {
+    const auto region = static_cast<CacheHierarchy::Region>(r);
+    const CacheHierarchy::RegionStatistics &stats = caches->region(region);
+    if (stats.accesses == 0) {
+      continue;
+    }
+    std::cout << std::setw(10) << CacheHierarchy::region_name(region)
+              << std::setw(12) << stats.accesses;
+    if (region == CacheHierarchy::REGION_IO) {
+      std::cout << std::setw(12) << "uncached" << "\n";
+      continue;
+    }
+    std::cout << std::setw(12) << stats.l1_misses << std::setw(9)
+              << percent(stats.l1_misses, stats.accesses);
+    if (caches->l2()) {
+      std::cout << std::setw(12) << stats.l2_misses;
+    }
+    std::cout << "\n";
+  }
+
+  // Worst instructions first: most L1 misses, fetch and data
+  std::vector<CacheHierarchy::Site> sites = caches->sites();
+  auto misses = [](const CacheHierarchy::Site &site) {
+    return site.fetch_misses + site.data_misses;
+  };
+  std::stable_sort(sites.begin(), sites.end(),
+                   [&](const CacheHierarchy::Site &a,
+                       const CacheHierarchy::Site &b) {
+                     return misses(a) > misses(b);
+                   });
+  std::cout << "=== Most Missing Instructions ===\n";
+  std::cout << std::setw(8) << "pc" << std::setw(12) << "fetches"
+            << std::setw(12) << "I misses" << std::setw(12) << "data"
+            << std::setw(12) << "D misses"
+            << "\n";
+  for (size_t i = 0; i < sites.size() && i < options.top; ++i) {
+    const CacheHierarchy::Site &site = sites[i];
+    if (misses(site) == 0) {
+      break;
+    }
+    std::cout << std::setw(8) << std::hex << site.pc << std::dec
+              << std::setw(12) << site.fetches << std::setw(12)
+              << site.fetch_misses << std::setw(12) << site.data_accesses
+              << std::setw(12) << site.data_misses << "\n";
+  }
+  std::cout.unsetf(std::ios::fixed);
+  return 0;
+}
+
+// Job input from a manifest line: the rest of the line, with \\n, \\t,
+// \\\\ and \\xNN escapes
+bool parse_job_input(const std::string &text, std::vector<uint8_t> &input) {
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '\\') {
+      input.push_back(static_cast<uint8_t>(text[i]));
+      continue;
+    }
+    if (++i == text.size()) {
+      return false;
+    }
+    switch (text[i]) {
+    case 'n':
+      input.push_back('\n');
+      break;
+    case 't':
+      input.push_back('\t');
+      break;
+    case '\\':
+      input.push_back('\\');
+      break;
+    case 'x':
+      if (i + 2 >= text.size() ||
+          !std::isxdigit(static_cast<unsigned char>(text[i + 1])) ||
+          !std::isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+        return false;
+      }
+      input.push_back(
+          static_cast<uint8_t>(std::stoul(text.substr(i + 1, 2), nullptr, 16)));
+      i += 2;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+// Manifest format, one directive per line ('#' starts a comment line):
+//   program <program.bin>     required
+//   engine <name>             interpreter|threaded|block|compiled
+//   max-cycles <N>            per-job budget, 0 for none
+//   threads <N>               worker count, 0 for one per hardware thread
+//   lockstep <N>              run jobs N at a time on the lockstep engine
+//   job <name> [input]        one CPU instance; input as for parse_job_input
+//   job-replay <name> <log>   one CPU instance fed the input bytes of an
+//                             I/O log written by run --record-io
+int run_batch(const std::string &manifest_path, unsigned threads_override,
+              bool has_threads_override) {
+  std::ifstream manifest(manifest_path);
+  if (!manifest) {
+    std::cerr << "Failed to open manifest: " << manifest_path << "\n";
+    return 1;
+  }
+
+  std::string program_path;
+  CPU::Engine engine = CPU::Engine::COMPILED;
+  uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+  unsigned threads = 0;
+  uint64_t lockstep_lanes = 0;
+  std::vector<CpuFleet::Job> jobs;
+
+  std::string line;
+  int line_number = 0;
+  while (std::getline(manifest, line)) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    std::istringstream fields(line);
+    std::string directive;
+    if (!(fields >> directive) || directive[0] == '#') {
+      continue;
+    }
+    std::string value;
+    fields >> value;
+    bool ok = !value.empty();
+    if (directive == "program") {
+      program_path = value;
+    } else if (directive == "engine") {
+      ok = ok && parse_engine("--engine=" + value, engine);
+    } else if (directive == "max-cycles") {
+      ok = ok && parse_count(value, max_cycles);
+    } else if (directive == "threads") {
+      uint64_t count = 0;
+      ok = ok && parse_count(value, count);
+      threads = static_cast<unsigned>(count);
+    } else if (directive == "lockstep") {
+      ok = ok && parse_count(value, lockstep_lanes);
+    } else if (directive == "job") {
+      CpuFleet::Job job;
+      job.name = value;
+      std::string input;
+      if (fields.peek() == ' ') {
+        fields.get();
+      }
+      std::getline(fields, input);
+      ok = ok && parse_job_input(input, job.input);
+      jobs.push_back(std::move(job));
+    } else if (directive == "job-replay") {
+      std::string log_path;
+      IoLog log;
+      ok = ok && (fields >> log_path) && log.load(log_path);
+      CpuFleet::Job job;
+      job.name = value;
+      job.input = log.input_bytes();
+      jobs.push_back(std::move(job));
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::cerr << manifest_path << ":" << line_number
+                << ": invalid manifest line: " << line << "\n";
+      return 1;
+    }
+  }
+  if (program_path.empty()) {
+    std::cerr << manifest_path << ": missing 'program' line\n";
+    return 1;
+  }
+
+  std::vector<uint8_t> program;
+  if (!read_program_file(program_path, program)) {
+    return 1;
+  }
+
+  CpuFleet fleet(program);
+  fleet.set_engine(engine);
+  fleet.set_max_instructions(max_cycles);
+  fleet.set_threads(has_threads_override ? threads_override : threads);
+  fleet.set_lockstep_lanes(static_cast<size_t>(lockstep_lanes));
+  for (CpuFleet::Job &job : jobs) {
+    fleet.add_job(std::move(job));
+  }
+  CpuFleet::Report report = fleet.run();
+
+  std::cout << "job\tstop\tinstructions\tcycle\tR0\tR1\tR2\tR3\toutput\n";
+  for (const CpuFleet::Result &result : report.results) {
+    std::cout << result.name << "\t"
+              << CPU::stop_reason_to_string(result.reason) << "\t"
+              << result.instructions << "\t" << result.cycle;
+    for (uint16_t value : result.gpr) {
+      std::cout << "\t" << value;
+    }
+    std::cout << "\t\"";
+    for (uint8_t c : result.output) {
+      if (c == '\n') {
+        std::cout << "\\n";
+      } else if (c == '"' || c == '\\') {
+        std::cout << '\\' << static_cast<char>(c);
+      } else if (c < 32 || c > 126) {
+        std::cout << "\\x" << std::hex << std::setw(2) << std::setfill('0')
+                  << static_cast<int>(c) << std::dec << std::setfill(' ');
+      } else {
+        std::cout << static_cast<char>(c);
+      }
+    }
+    std::cout << "\"\n";
+  }
+
+  uint64_t halted = 0;
+  for (const CpuFleet::Result &result : report.results) {
+    halted += result.reason == CPU::StopReason::HALTED ? 1 : 0;
+  }
+  std::cout << "=== Batch Summary ===" << std::endl;
+  std::cout << "Jobs: " << report.results.size() << " (" << halted
+            << " halted), threads: " << report.threads << std::endl;
+  std::cout << "Instructions retired: " << report.total_instructions
+            << " in " << report.seconds << " s";
+  if (report.seconds > 0) {
+    std::cout << " ("
+              << static_cast<uint64_t>(report.total_instructions /
+                                       report.seconds)
+              << " instructions/s)";
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
 int run_test() {
   std::cout << "Running emulator test..." << std::endl;
 
@@ -172,23 +1313,34 @@ int main(int argc, char **argv) {
       return assemble_file(argv[2], argv[3]);
     } else if (argc == 5) {
       return assemble_file(argv[2], argv[3], argv[4]);
+    } else if (argc == 6) {
+      return assemble_file(argv[2], argv[3], argv[4], argv[5]);
     } else {
       print_usage(argv[0]);
       return 1;
     }
-  } else if (command == "run" && argc == 3) {
-    return run_program(argv[2]);
-  } else if (command == "run-trace" && argc == 4) {
+  } else if (command == "run" && argc >= 3) {
+    RunOptions options;
+    for (int i = 3; i < argc; ++i) {
+      if (!parse_run_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return run_program(argv[2], options);
+  } else if (command == "run-trace" && (argc == 4 || argc == 5)) {
     std::string program = argv[2];
     std::string trace_path = argv[3];
+    uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+    if (argc == 5 && !parse_max_cycles(argv[4], max_cycles)) {
+      print_usage(argv[0]);
+      return 1;
+    }
 
-    std::ifstream in(program, std::ios::binary);
-    if (!in) {
-      std::cerr << "Failed to open program file: " << program << "\n";
+    std::vector<uint8_t> program_bytes;
+    if (!read_program_file(program, program_bytes)) {
       return 1;
     }
-    std::vector<uint8_t> program_bytes((std::istreambuf_iterator<char>(in)),
-                                       std::istreambuf_iterator<char>());
 
     CPU cpu;
     cpu.set_debug_mode(true);
@@ -196,28 +1348,111 @@ int main(int argc, char **argv) {
     tracer->set_output_path(trace_path);
     cpu.set_trace_recorder(tracer);
     cpu.load_program(program_bytes);
-    cpu.run();
+    CPU::RunBudget budget;
+    budget.max_instructions = max_cycles;
+    cpu.run_for(budget);
     return 0;
   } else if (command == "debug" && argc == 3) {
     std::string program = argv[2];
-    std::ifstream in(program, std::ios::binary);
-    if (!in) {
-      std::cerr << "Failed to open program file: " << program << "\n";
+    std::vector<uint8_t> program_bytes;
+    if (!read_program_file(program, program_bytes)) {
       return 1;
     }
-    std::vector<uint8_t> program_bytes((std::istreambuf_iterator<char>(in)),
-                                       std::istreambuf_iterator<char>());
 
     CPU cpu;
     cpu.set_debug_mode(true);
+    cpu.set_history(std::make_shared<ExecutionHistory>());
     cpu.load_program(program_bytes);
+    std::string line;
     while (!cpu.is_halted()) {
-      std::cout << "Press Enter to step..." << std::endl;
-      std::cin.get();
-      cpu.step();
+      std::cout << "Press Enter to step, 'b' to step back..." << std::endl;
+      if (!std::getline(std::cin, line)) {
+        break;
+      }
+      if (line == "b") {
+        if (!cpu.step_back()) {
+          std::cout << "No earlier state recorded" << std::endl;
+          continue;
+        }
+      } else {
+        cpu.step();
+      }
       cpu.dump_state();
     }
     return 0;
+  } else if (command == "batch" && (argc == 3 || argc == 4)) {
+    uint64_t threads = 0;
+    if (argc == 4) {
+      const std::string prefix = "--threads=";
+      std::string arg = argv[3];
+      if (arg.compare(0, prefix.size(), prefix) != 0 ||
+          !parse_count(arg.substr(prefix.size()), threads)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return run_batch(argv[2], static_cast<unsigned>(threads), argc == 4);
+  } else if (command == "profile" && argc >= 4) {
+    ProfileOptions options;
+    for (int i = 4; i < argc; ++i) {
+      if (!parse_profile_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return profile_program(argv[2], argv[3], options);
+  } else if (command == "callgraph" && argc >= 4) {
+    CallGraphOptions options;
+    for (int i = 4; i < argc; ++i) {
+      if (!parse_call_graph_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return profile_call_graph(argv[2], argv[3], options);
+  } else if (command == "pipeline" && argc >= 3) {
+    PipelineOptions options;
+    for (int i = 3; i < argc; ++i) {
+      if (!parse_pipeline_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return simulate_pipeline(argv[2], options);
+  } else if (command == "branches" && argc >= 4) {
+    BranchOptions options;
+    for (int i = 4; i < argc; ++i) {
+      if (!parse_branch_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return profile_branches(argv[2], argv[3], options);
+  } else if (command == "cache" && argc >= 3) {
+    CacheOptions options;
+    for (int i = 3; i < argc; ++i) {
+      if (!parse_cache_option(argv[i], options)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return simulate_caches(argv[2], options);
+  } else if (command == "profile-seq" && argc >= 4) {
+    return profile_sequences(argv[2],
+                             std::vector<std::string>(argv + 3, argv + argc));
+  } else if (command == "gen-superinstructions" &&
+             (argc == 4 || argc == 5)) {
+    uint64_t count = DEFAULT_SUPERINSTRUCTION_COUNT;
+    if (argc == 5) {
+      const std::string prefix = "--count=";
+      std::string arg = argv[4];
+      if (arg.compare(0, prefix.size(), prefix) != 0 ||
+          !parse_count(arg.substr(prefix.size()), count)) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+    return generate_superinstructions(argv[2], argv[3], count);
   } else if (command == "test" && argc == 2) {
     return run_test();
   } else {
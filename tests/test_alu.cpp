@@ -13,8 +13,17 @@ void test_assert(bool condition, const char *test_name) {
   }
 }
 
-void test_add_operation() {
+// Flag mode used by make_alu(); main() runs every test in both modes
+bool lazy_flags_mode = false;
+
+ALU make_alu() {
   ALU alu;
+  alu.set_lazy_flags(lazy_flags_mode);
+  return alu;
+}
+
+void test_add_operation() {
+  ALU alu = make_alu();
   Registers regs;
 
   // Test basic addition
@@ -42,7 +51,7 @@ void test_add_operation() {
 }
 
 void test_sub_operation() {
-  ALU alu;
+  ALU alu = make_alu();
   Registers regs;
 
   // Test basic subtraction
@@ -64,7 +73,7 @@ void test_sub_operation() {
 }
 
 void test_cmp_operation() {
-  ALU alu;
+  ALU alu = make_alu();
   Registers regs;
 
   // Test compare (should not modify operand)
@@ -81,7 +90,7 @@ void test_cmp_operation() {
 }
 
 void test_logical_operations() {
-  ALU alu;
+  ALU alu = make_alu();
   Registers regs;
 
   // Test AND
@@ -105,7 +114,7 @@ void test_logical_operations() {
 }
 
 void test_shift_operations() {
-  ALU alu;
+  ALU alu = make_alu();
   Registers regs;
 
   // Test shift left
@@ -125,7 +134,7 @@ void test_shift_operations() {
 }
 
 void test_flag_updates() {
-  ALU alu;
+  ALU alu = make_alu();
   Registers regs;
 
   // Test zero flag
@@ -150,15 +159,71 @@ void test_flag_updates() {
               "Flags: Overflow flag set on signed overflow");
 }
 
+// Every operation on edge-case operands: lazy flags read back exactly as
+// the eager implementation computed them
+void test_lazy_matches_eager() {
+  const ALU::Operation ops[] = {
+      ALU::Operation::ADD, ALU::Operation::SUB, ALU::Operation::AND,
+      ALU::Operation::OR,  ALU::Operation::XOR, ALU::Operation::SHL,
+      ALU::Operation::SHR, ALU::Operation::CMP};
+  const uint16_t values[] = {0,      1,      2,      15,     16,    17,
+                             0x7FFF, 0x8000, 0x8001, 0xFFFE, 0xFFFF, 0x1234};
+
+  ALU eager;
+  eager.set_lazy_flags(false);
+  ALU lazy;
+  lazy.set_lazy_flags(true);
+
+  bool results_match = true;
+  bool flags_match = true;
+  bool deferred = true;
+  for (ALU::Operation op : ops) {
+    for (uint16_t a : values) {
+      for (uint16_t b : values) {
+        Registers eager_regs;
+        Registers lazy_regs;
+        uint16_t r1 = eager.execute(op, a, b, eager_regs);
+        uint16_t r2 = lazy.execute(op, a, b, lazy_regs);
+        results_match = results_match && r1 == r2;
+        deferred = deferred && lazy_regs.has_pending_flags();
+        flags_match = flags_match &&
+                      eager_regs.get_flags() == lazy_regs.get_flags() &&
+                      !lazy_regs.has_pending_flags();
+      }
+    }
+  }
+  test_assert(results_match, "Lazy: results match eager mode");
+  test_assert(deferred, "Lazy: flags are pending until read");
+  test_assert(flags_match, "Lazy: materialised flags match eager mode");
+
+  // A pending operation is replaced by the next one, and explicit flag
+  // writes apply on top of the materialised value
+  Registers regs;
+  lazy.execute(ALU::Operation::ADD, 0xFFFF, 1, regs);
+  lazy.execute(ALU::Operation::OR, 0x8000, 0, regs);
+  test_assert(regs.is_negative() && !regs.is_carry() && !regs.is_zero(),
+              "Lazy: only the last operation's flags are visible");
+  lazy.execute(ALU::Operation::SUB, 1, 2, regs);
+  regs.set_flag(Registers::FLAG_Z, true);
+  test_assert(regs.is_zero() && regs.is_carry() && regs.is_negative(),
+              "Lazy: set_flag keeps the other pending flags");
+}
+
 int main() {
   std::cout << "=== ALU Unit Tests ===" << std::endl << std::endl;
 
-  test_add_operation();
-  test_sub_operation();
-  test_cmp_operation();
-  test_logical_operations();
-  test_shift_operations();
-  test_flag_updates();
+  for (bool lazy : {false, true}) {
+    lazy_flags_mode = lazy;
+    std::cout << (lazy ? "--- Lazy flags ---" : "--- Eager flags ---")
+              << std::endl;
+    test_add_operation();
+    test_sub_operation();
+    test_cmp_operation();
+    test_logical_operations();
+    test_shift_operations();
+    test_flag_updates();
+  }
+  test_lazy_matches_eager();
 
   std::cout << std::endl << "=== All ALU Tests Passed! ===" << std::endl;
   return 0;
@@ -119,6 +119,13 @@ void test_labels() {
 
   std::vector<uint8_t> binary = assemble(source);
   test_assert(binary.size() > 0, "Labels: Label definition and reference");
+
+  std::vector<SymbolEntry> symbols;
+  assemble(source, nullptr, &symbols);
+  test_assert(symbols.size() == 2 && symbols[0].name == "START" &&
+                  symbols[0].address == 0x8000 && symbols[1].name == "END" &&
+                  symbols[1].address == 0x800C,
+              "Labels: Symbol table ordered by address");
 }
 
 void test_conditional_jumps() {
@@ -229,6 +236,33 @@ void test_error_handling() {
   test_assert(caught_error, "Error: Undefined label throws error");
 }
 
+void test_source_map() {
+  std::vector<SourceMapEntry> map;
+  bool parsed = parse_source_map(R"([
+  {
+    "address": 32768,
+    "line": 3,
+    "source": "MOV R0, #10",
+    "bytes": [8, 8, 10, 0]
+  }
+]
+)",
+                                 map);
+  test_assert(parsed && map.size() == 1 && map[0].address == 0x8000 &&
+                  map[0].line_number == 3 &&
+                  map[0].source_line == "MOV R0, #10" &&
+                  map[0].bytes.size() == 4,
+              "Source map: Written maps parse back");
+
+  bool rejected =
+      !parse_source_map(R"([{"address": 99999999999999999999999}])", map) &&
+      !parse_source_map(R"([{"address": 65536}])", map) &&
+      !parse_source_map(R"([{"bytes": [256]}])", map) &&
+      !parse_source_map(R"([{"address": 1}] x)", map) &&
+      !parse_source_map(R"([{"address": -}])", map);
+  test_assert(rejected, "Source map: Malformed maps are rejected");
+}
+
 int main() {
   std::cout << "=== Assembler Unit Tests ===" << std::endl << std::endl;
 
@@ -244,6 +278,7 @@ int main() {
   test_escape_sequences();
   test_all_jump_types();
   test_error_handling();
+  test_source_map();
 
   std::cout << std::endl << "=== All Assembler Tests Passed! ===" << std::endl;
   return 0;
@@ -1,6 +1,23 @@
+#include "../src/emulator/branch_predictor.hpp"
+#include "../src/emulator/cache_model.hpp"
+#include "../src/emulator/call_graph_profile.hpp"
 #include "../src/emulator/cpu.hpp"
+#include "../src/emulator/cpu_fleet.hpp"
+#include "../src/emulator/execution_history.hpp"
+#include "../src/emulator/hotspot_profile.hpp"
+#include "../src/emulator/io_log.hpp"
+#include "../src/emulator/lockstep.hpp"
+#include "../src/emulator/pipeline_model.hpp"
+#include "../src/emulator/sequence_profile.hpp"
+#include "../src/emulator/snapshot_file.hpp"
+#include "../src/emulator/superinstructions.hpp"
+#include "../src/emulator/timing_model.hpp"
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 #include <vector>
 
 // Test helper
@@ -246,6 +263,1865 @@ void test_load_store() {
               "LOAD/STORE: Value preserved through memory");
 }
 
+// Builds a loop that rewrites the immediate of an already-executed
+// ADD R0, #1 into ADD R0, #100 and runs it again.
+std::vector<uint8_t> make_self_modifying_program() {
+  std::vector<uint8_t> program;
+
+  // 0x8000: MOV R1, #0
+  add_word(program, make_instruction(2, 1, 1, 0));
+  add_word(program, 0);
+  // 0x8004: patch: ADD R0, #1 (immediate word lives at 0x8006)
+  add_word(program, make_instruction(5, 1, 0, 0));
+  add_word(program, 1);
+  // 0x8008: ADD R1, #1
+  add_word(program, make_instruction(5, 1, 1, 0));
+  add_word(program, 1);
+  // 0x800C: CMP R1, #2
+  add_word(program, make_instruction(10, 1, 1, 0));
+  add_word(program, 2);
+  // 0x8010: JZ done (PC-relative, 0x8014 + 0x0C = 0x8020)
+  add_word(program, make_instruction(14, 5, 0, 0));
+  add_word(program, 0x0C);
+  // 0x8014: MOV R2, #100
+  add_word(program, make_instruction(2, 1, 2, 0));
+  add_word(program, 100);
+  // 0x8018: STORE R2, [0x8006]
+  add_word(program, make_instruction(4, 2, 2, 0));
+  add_word(program, 0x8006);
+  // 0x801C: JMP patch (direct)
+  add_word(program, make_instruction(13, 2, 0, 0));
+  add_word(program, 0x8004);
+  // 0x8020: done: HALT
+  add_word(program, make_instruction(1, 0, 0, 0));
+
+  return program;
+}
+
+void test_self_modifying_code() {
+  CPU cpu;
+  cpu.load_program(make_self_modifying_program(), 0x8000);
+  cpu.run();
+
+  test_assert(cpu.get_registers().get_gpr(0) == 101,
+              "Predecode: store into cached instruction invalidates entry");
+
+  CPU uncached;
+  uncached.set_decode_cache_enabled(false);
+  uncached.load_program(make_self_modifying_program(), 0x8000);
+  uncached.run();
+
+  test_assert(uncached.get_registers().get_gpr(0) == 101,
+              "Predecode: uncached run matches cached run");
+}
+
+// Multiply 7 * 6 with a shift-add subroutine: exercises CALL/RET,
+// PUSH/POP, conditional jumps and every ALU class.
+std::vector<uint8_t> make_multiply_program() {
+  std::vector<uint8_t> program;
+
+  // 0x8000: MOV R0, #7
+  add_word(program, make_instruction(2, 1, 0, 0));
+  add_word(program, 7);
+  // 0x8004: MOV R1, #6
+  add_word(program, make_instruction(2, 1, 1, 0));
+  add_word(program, 6);
+  // 0x8008: CALL multiply (direct)
+  add_word(program, make_instruction(19, 2, 0, 0));
+  add_word(program, 0x8012);
+  // 0x800C: STORE R0, [0x9000]
+  add_word(program, make_instruction(4, 2, 0, 0));
+  add_word(program, 0x9000);
+  // 0x8010: HALT
+  add_word(program, make_instruction(1, 0, 0, 0));
+  // 0x8012: multiply: PUSH R3
+  add_word(program, make_instruction(21, 0, 3, 0));
+  // 0x8014: MOV R2, #0
+  add_word(program, make_instruction(2, 1, 2, 0));
+  add_word(program, 0);
+  // 0x8018: loop: CMP R1, #0
+  add_word(program, make_instruction(10, 1, 1, 0));
+  add_word(program, 0);
+  // 0x801C: JZ done (0x8020 + 0x18 = 0x8038)
+  add_word(program, make_instruction(14, 5, 0, 0));
+  add_word(program, 0x18);
+  // 0x8020: MOV R3, R1
+  add_word(program, make_instruction(2, 0, 3, 1));
+  // 0x8022: AND R3, #1
+  add_word(program, make_instruction(7, 1, 3, 0));
+  add_word(program, 1);
+  // 0x8026: JZ skip (0x802A + 2 = 0x802C)
+  add_word(program, make_instruction(14, 5, 0, 0));
+  add_word(program, 2);
+  // 0x802A: ADD R2, R0
+  add_word(program, make_instruction(5, 0, 2, 0));
+  // 0x802C: skip: SHL R0, #1
+  add_word(program, make_instruction(11, 1, 0, 0));
+  add_word(program, 1);
+  // 0x8030: SHR R1, #1
+  add_word(program, make_instruction(12, 1, 1, 0));
+  add_word(program, 1);
+  // 0x8034: JMP loop (direct)
+  add_word(program, make_instruction(13, 2, 0, 0));
+  add_word(program, 0x8018);
+  // 0x8038: done: MOV R0, R2
+  add_word(program, make_instruction(2, 0, 0, 2));
+  // 0x803A: XOR R2, R2
+  add_word(program, make_instruction(9, 0, 2, 2));
+  // 0x803C: OR R2, #0x10
+  add_word(program, make_instruction(8, 1, 2, 0));
+  add_word(program, 0x10);
+  // 0x8040: SUB R2, #1
+  add_word(program, make_instruction(6, 1, 2, 0));
+  add_word(program, 1);
+  // 0x8044: POP R3
+  add_word(program, make_instruction(22, 0, 3, 0));
+  // 0x8046: RET
+  add_word(program, make_instruction(20, 0, 0, 0));
+
+  return program;
+}
+
+bool same_architectural_state(const CPU &a, const CPU &b) {
+  const Registers &ra = a.get_registers();
+  const Registers &rb = b.get_registers();
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (ra.get_gpr(i) != rb.get_gpr(i))
+      return false;
+  }
+  return ra.get_pc() == rb.get_pc() && ra.get_sp() == rb.get_sp() &&
+         ra.get_flags() == rb.get_flags() && ra.get_ir() == rb.get_ir() &&
+         a.is_halted() == b.is_halted();
+}
+
+void test_alternate_engines() {
+  const std::vector<std::vector<uint8_t>> programs = {
+      make_multiply_program(), make_self_modifying_program()};
+  const CPU::Engine engines[] = {CPU::Engine::THREADED, CPU::Engine::BLOCK,
+                                 CPU::Engine::COMPILED};
+  const char *names[] = {"Threaded: final state matches interpreter",
+                         "Block: final state matches interpreter",
+                         "Compiled: final state matches interpreter"};
+
+  for (int e = 0; e < 3; ++e) {
+    CPU::Engine engine = engines[e];
+    for (const auto &program : programs) {
+      CPU interpreter;
+      interpreter.load_program(program, 0x8000);
+      interpreter.run();
+
+      CPU alternate;
+      alternate.set_engine(engine);
+      alternate.load_program(program, 0x8000);
+      alternate.run();
+
+      test_assert(same_architectural_state(interpreter, alternate), names[e]);
+    }
+  }
+
+  CPU threaded;
+  threaded.set_engine(CPU::Engine::THREADED);
+  threaded.load_program(make_multiply_program(), 0x8000);
+  threaded.run();
+  test_assert(threaded.get_registers().get_gpr(0) == 42,
+              "Threaded: shift-add multiply 7 * 6 = 42");
+  test_assert(threaded.get_registers().get_gpr(2) == 0x0F,
+              "Threaded: XOR/OR/SUB sequence");
+
+  for (const auto &program : programs) {
+    CPU lazy;
+    lazy.load_program(program, 0x8000);
+    lazy.run();
+    CPU eager;
+    eager.set_lazy_flags(false);
+    eager.load_program(program, 0x8000);
+    eager.run();
+    test_assert(same_architectural_state(lazy, eager),
+                "Lazy flags: final state matches eager flags");
+  }
+}
+
+void test_compiled_alu_flags() {
+  // Inline flag computation in the compiled engine must match the ALU
+  const uint16_t values[] = {0x0000, 0x0001, 0x0002, 0x000F,
+                             0x7FFF, 0x8000, 0x8001, 0xFFFF};
+  bool all_match = true;
+
+  for (uint8_t opcode = 5; opcode <= 12; ++opcode) {
+    for (uint16_t a : values) {
+      for (uint16_t b : values) {
+        std::vector<uint8_t> program;
+        add_word(program, make_instruction(2, 1, 0, 0)); // MOV R0, #a
+        add_word(program, a);
+        add_word(program, make_instruction(2, 1, 1, 0)); // MOV R1, #b
+        add_word(program, b);
+        add_word(program, make_instruction(opcode, 0, 0, 1)); // OP R0, R1
+        add_word(program, make_instruction(1, 0, 0, 0));      // HALT
+
+        CPU interpreter;
+        interpreter.load_program(program, 0x8000);
+        interpreter.run();
+
+        CPU compiled;
+        compiled.set_engine(CPU::Engine::COMPILED);
+        compiled.load_program(program, 0x8000);
+        compiled.run();
+
+        all_match =
+            all_match && same_architectural_state(interpreter, compiled);
+      }
+    }
+  }
+
+  test_assert(all_match, "Compiled: ALU results and flags match interpreter");
+}
+
+void test_block_engine_timer() {
+  // Timer reads inside a block must see one tick per executed instruction
+  std::vector<uint8_t> program;
+
+  // 0x8000: MOV R0, #1
+  add_word(program, make_instruction(2, 1, 0, 0));
+  add_word(program, 1);
+  // 0x8004: STORE R0, [0xF011] (start timer)
+  add_word(program, make_instruction(4, 2, 0, 0));
+  add_word(program, 0xF011);
+  // 0x8008: NOP x3
+  add_word(program, make_instruction(0, 0, 0, 0));
+  add_word(program, make_instruction(0, 0, 0, 0));
+  add_word(program, make_instruction(0, 0, 0, 0));
+  // 0x800E: LOAD R1, [0xF010]
+  add_word(program, make_instruction(3, 2, 1, 0));
+  add_word(program, 0xF010);
+  // 0x8012: HALT
+  add_word(program, make_instruction(1, 0, 0, 0));
+
+  CPU interpreter;
+  interpreter.load_program(program, 0x8000);
+  interpreter.run();
+
+  CPU block;
+  block.set_engine(CPU::Engine::BLOCK);
+  block.load_program(program, 0x8000);
+  block.run();
+
+  CPU compiled;
+  compiled.set_engine(CPU::Engine::COMPILED);
+  compiled.load_program(program, 0x8000);
+  compiled.run();
+
+  test_assert(interpreter.get_registers().get_gpr(1) == 4,
+              "Timer: four ticks observed after start");
+  test_assert(block.get_registers().get_gpr(1) == 4 &&
+                  block.get_memory().get_timer_counter() ==
+                      interpreter.get_memory().get_timer_counter(),
+              "Block: timer reads see per-instruction ticks");
+  test_assert(compiled.get_registers().get_gpr(1) == 4 &&
+                  compiled.get_memory().get_timer_counter() ==
+                      interpreter.get_memory().get_timer_counter(),
+              "Compiled: I/O accesses fall back with exact timer state");
+}
+
+// MOV R0, #0; loop: ADD R0, #1; JMP loop
+std::vector<uint8_t> make_counting_loop() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // MOV R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(5, 1, 0, 0)); // 0x8004: ADD R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(13, 2, 0, 0)); // 0x8008: JMP 0x8004
+  add_word(program, 0x8004);
+  return program;
+}
+
+void test_run_budget() {
+  const CPU::Engine engines[] = {CPU::Engine::INTERPRETER,
+                                 CPU::Engine::THREADED, CPU::Engine::BLOCK,
+                                 CPU::Engine::COMPILED};
+  bool all_stopped = true;
+  bool all_resumed = true;
+  bool all_counted = true;
+  for (CPU::Engine engine : engines) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.load_program(make_counting_loop(), 0x8000);
+
+    CPU::RunBudget budget;
+    budget.max_instructions = 1001;
+    CPU::RunResult result = cpu.run_for(budget);
+    all_stopped = all_stopped &&
+                  result.reason == CPU::StopReason::BUDGET_EXHAUSTED &&
+                  result.instructions == 1001 && result.cycle == 1001;
+    // MOV, then 500 ADD/JMP pairs
+    all_counted = all_counted && cpu.get_registers().get_gpr(0) == 500 &&
+                  cpu.get_registers().get_pc() == 0x8004;
+
+    budget.max_instructions = 10000;
+    result = cpu.run_for(budget);
+    all_resumed = all_resumed &&
+                  result.reason == CPU::StopReason::BUDGET_EXHAUSTED &&
+                  result.instructions == 10000 && result.cycle == 11001 &&
+                  cpu.get_cycle_count() == 11001 &&
+                  cpu.get_registers().get_gpr(0) == 5500;
+  }
+  test_assert(all_stopped, "Budget: all engines stop after max_instructions");
+  test_assert(all_counted, "Budget: state matches instructions retired");
+  test_assert(all_resumed, "Budget: run_for resumes where it stopped");
+
+  CPU timed;
+  timed.set_engine(CPU::Engine::THREADED);
+  timed.load_program(make_counting_loop(), 0x8000);
+  CPU::RunBudget deadline;
+  deadline.deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+  CPU::RunResult timed_result = timed.run_for(deadline);
+  test_assert(timed_result.reason == CPU::StopReason::BUDGET_EXHAUSTED &&
+                  timed_result.instructions > 0,
+              "Budget: wall-clock deadline stops an endless loop");
+
+  // Each instance keeps its own counter
+  CPU other;
+  other.load_program(make_counting_loop(), 0x8000);
+  test_assert(other.get_cycle_count() == 0,
+              "Budget: cycle counter is per instance");
+}
+
+// MOV R0, #0; loop: ADD R0, #1; CMP R0, #100; JNZ loop; SUB R0, #50;
+// JNC over; HALT; over: MOV R1, #1; HALT
+std::vector<uint8_t> make_compare_loop() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // MOV R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(5, 1, 0, 0)); // 0x8004: ADD R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(10, 1, 0, 0)); // 0x8008: CMP R0, #100
+  add_word(program, 100);
+  add_word(program, make_instruction(15, 2, 0, 0)); // 0x800C: JNZ 0x8004
+  add_word(program, 0x8004);
+  add_word(program, make_instruction(6, 1, 0, 0)); // 0x8010: SUB R0, #50
+  add_word(program, 50);
+  add_word(program, make_instruction(17, 5, 0, 0)); // 0x8014: JNC +2
+  add_word(program, 2);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8018: HALT
+  add_word(program, make_instruction(2, 1, 1, 0)); // 0x801A: MOV R1, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(1, 0, 0, 0)); // HALT
+  return program;
+}
+
+void test_macro_fusion() {
+  CPU interpreter;
+  interpreter.load_program(make_compare_loop(), 0x8000);
+  interpreter.run();
+
+  const CPU::Engine engines[] = {CPU::Engine::BLOCK, CPU::Engine::COMPILED};
+  bool all_match = true;
+  bool all_counted = true;
+  bool all_split = true;
+  for (CPU::Engine engine : engines) {
+    CPU fused;
+    fused.set_engine(engine);
+    fused.load_program(make_compare_loop(), 0x8000);
+    fused.run();
+    all_match = all_match && same_architectural_state(interpreter, fused) &&
+                fused.get_registers().get_gpr(0) == 50 &&
+                fused.get_registers().get_gpr(1) == 1 &&
+                fused.get_cycle_count() == interpreter.get_cycle_count();
+    // 100 loop exits plus the SUB/JNC pair
+    all_counted = all_counted && fused.get_statistics().fused_pairs == 101;
+
+    // A budget ending between CMP and JNZ runs the pair split
+    CPU split;
+    split.set_engine(engine);
+    split.load_program(make_compare_loop(), 0x8000);
+    CPU::RunBudget budget;
+    budget.max_instructions = 3;
+    CPU::RunResult result = split.run_for(budget);
+    all_split = all_split && result.instructions == 3 &&
+                split.get_registers().get_pc() == 0x800C &&
+                split.get_registers().get_ir() == make_instruction(10, 1, 0, 0);
+    split.run();
+    all_split = all_split && same_architectural_state(interpreter, split);
+  }
+  test_assert(all_match, "Fusion: final state matches interpreter");
+  test_assert(all_counted, "Fusion: fused pairs are counted");
+  test_assert(all_split, "Fusion: budget can stop between fused halves");
+
+  CPU unfused;
+  unfused.set_engine(CPU::Engine::BLOCK);
+  unfused.set_macro_fusion(false);
+  unfused.load_program(make_compare_loop(), 0x8000);
+  unfused.run();
+  test_assert(same_architectural_state(interpreter, unfused) &&
+                  unfused.get_statistics().fused_pairs == 0,
+              "Fusion: can be disabled");
+}
+
+// Loaded at 0x8100: words straddling pages and the program region, stores
+// next to (but not into) translated code, register shift counts, an
+// indirect CALL and timer I/O
+std::vector<uint8_t> make_memory_edge_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // MOV R0, #0x1234
+  add_word(program, 0x1234);
+  add_word(program, make_instruction(4, 2, 0, 0)); // STORE R0, [0x00FF]
+  add_word(program, 0x00FF);
+  add_word(program, make_instruction(3, 2, 1, 0)); // LOAD R1, [0x00FF]
+  add_word(program, 0x00FF);
+  add_word(program, make_instruction(2, 1, 2, 0)); // MOV R2, #0x7FFF
+  add_word(program, 0x7FFF);
+  add_word(program, make_instruction(4, 3, 0, 2)); // STORE R0, [R2]
+  add_word(program, make_instruction(3, 4, 3, 2)); // LOAD R3, [R2 + 1]
+  add_word(program, 1);
+  add_word(program, make_instruction(2, 1, 2, 0)); // MOV R2, #5
+  add_word(program, 5);
+  add_word(program, make_instruction(11, 0, 0, 2)); // SHL R0, R2
+  add_word(program, make_instruction(12, 1, 1, 0)); // SHR R1, #16
+  add_word(program, 16);
+  add_word(program, make_instruction(11, 1, 3, 0)); // SHL R3, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(2, 1, 2, 0)); // MOV R2, #0x8134
+  add_word(program, 0x8134);
+  add_word(program, make_instruction(19, 3, 0, 2)); // 0x8128: CALL [R2]
+  add_word(program, make_instruction(4, 2, 0, 0)); // STORE R0, [0xF011]
+  add_word(program, 0xF011);
+  add_word(program, make_instruction(3, 2, 1, 0)); // LOAD R1, [0xF010]
+  add_word(program, 0xF010);
+  add_word(program, make_instruction(1, 0, 0, 0)); // HALT
+  add_word(program, make_instruction(21, 0, 3, 0)); // 0x8134: PUSH R3
+  add_word(program, make_instruction(5, 1, 3, 0)); // ADD R3, #0x7FFF
+  add_word(program, 0x7FFF);
+  add_word(program, make_instruction(22, 0, 3, 0)); // POP R3
+  add_word(program, make_instruction(20, 0, 0, 0)); // RET
+  return program;
+}
+
+void test_native_code() {
+#if defined(__x86_64__) && defined(__unix__)
+  test_assert(CPU::native_code_supported(),
+              "Native: x86-64 hosts translate compiled blocks");
+#endif
+
+  struct Case {
+    std::vector<uint8_t> program;
+    uint16_t address;
+  };
+  const Case cases[] = {{make_multiply_program(), 0x8000},
+                        {make_self_modifying_program(), 0x8000},
+                        {make_compare_loop(), 0x8000},
+                        {make_memory_edge_program(), 0x8100}};
+
+  // Slices of a few instructions end native runs inside chained blocks
+  bool all_match = true;
+  for (uint64_t slice : {uint64_t(1), uint64_t(3), uint64_t(7), uint64_t(0)}) {
+    for (const Case &c : cases) {
+      CPU interpreter;
+      interpreter.load_program(c.program, c.address);
+      CPU handlers;
+      handlers.set_engine(CPU::Engine::COMPILED);
+      handlers.set_native_code(false);
+      handlers.load_program(c.program, c.address);
+      CPU native;
+      native.set_engine(CPU::Engine::COMPILED);
+      native.load_program(c.program, c.address);
+
+      for (int i = 0; i < 1000 && !interpreter.is_halted(); ++i) {
+        CPU::RunBudget budget;
+        budget.max_instructions = slice;
+        interpreter.run_for(budget);
+        handlers.run_for(budget);
+        native.run_for(budget);
+        const Registers &r = interpreter.get_registers();
+        const Registers &n = native.get_registers();
+        all_match = all_match &&
+                    same_architectural_state(interpreter, native) &&
+                    same_architectural_state(handlers, native) &&
+                    r.get_mar() == n.get_mar() && r.get_mdr() == n.get_mdr() &&
+                    interpreter.get_cycle_count() == native.get_cycle_count() &&
+                    interpreter.get_memory().get_timer_counter() ==
+                        native.get_memory().get_timer_counter();
+      }
+      for (uint32_t a = 0; a < 0x10000; ++a) {
+        uint16_t address = static_cast<uint16_t>(a);
+        if (address < Memory::IO_START || address > Memory::IO_END) {
+          all_match = all_match &&
+                      interpreter.get_memory().read_byte(address) ==
+                          native.get_memory().read_byte(address);
+        }
+      }
+    }
+  }
+  test_assert(all_match,
+              "Native: registers, memory and timer match the interpreter");
+
+  CPU edge;
+  edge.set_engine(CPU::Engine::COMPILED);
+  edge.load_program(make_memory_edge_program(), 0x8100);
+  edge.run();
+  test_assert(edge.get_registers().get_gpr(0) == 0x4680 &&
+                  edge.get_memory().read_byte(0x8000) == 0x12,
+              "Native: SHL by register and store over the program start");
+}
+
+void test_sequence_profile() {
+  auto profile = std::make_shared<SequenceProfile>();
+  CPU cpu;
+  cpu.set_sequence_profile(profile);
+  cpu.load_program(make_counting_loop(), 0x8000);
+  CPU::RunBudget budget;
+  budget.max_instructions = 21; // MOV, then 10 ADD/JMP pairs
+  cpu.run_for(budget);
+
+  const uint8_t mov_imm = (2 << 3) | 1;
+  const uint8_t add_imm = (5 << 3) | 1;
+  const uint8_t jmp_dir = (13 << 3) | 2;
+  test_assert(profile->instructions() == 21 &&
+                  profile->pair_count(mov_imm, add_imm) == 1 &&
+                  profile->pair_count(add_imm, jmp_dir) == 10 &&
+                  profile->triple_count(mov_imm, add_imm, jmp_dir) == 1,
+              "Profile: counts executed pairs and triples");
+  test_assert(profile->pair_count(jmp_dir, add_imm) == 0,
+              "Profile: sequences do not span a jump");
+
+  const std::string path = "build/test_cpu_sequences.profile";
+  SequenceProfile loaded;
+  bool round_trip = profile->save(path) && loaded.load(path);
+  auto expected = profile->candidates();
+  auto actual = loaded.candidates();
+  round_trip = round_trip && expected.size() == actual.size();
+  for (size_t i = 0; round_trip && i < expected.size(); ++i) {
+    round_trip = expected[i].count == actual[i].count &&
+                 expected[i].length == actual[i].length &&
+                 std::equal(expected[i].keys,
+                            expected[i].keys + expected[i].length,
+                            actual[i].keys);
+  }
+  test_assert(round_trip, "Profile: save/load keeps the candidates");
+}
+
+void test_hotspot_profile() {
+  auto profile = std::make_shared<HotspotProfile>();
+  CPU cpu;
+  cpu.set_engine(CPU::Engine::COMPILED); // profiled runs use the interpreter
+  cpu.set_hotspot_profile(profile);
+  cpu.load_program(make_counting_loop(), 0x8000);
+  CPU::RunBudget budget;
+  budget.max_instructions = 21; // MOV, then 10 ADD/JMP pairs
+  cpu.run_for(budget);
+
+  test_assert(profile->instructions(0x8000) == 1 &&
+                  profile->instructions(0x8004) == 10 &&
+                  profile->instructions(0x8008) == 10 &&
+                  profile->cycles(0x8004) == 10 &&
+                  profile->total_instructions() == 21 &&
+                  profile->total_cycles() == cpu.get_cycle_count(),
+              "Hot spots: counts instructions and cycles per PC");
+
+  std::vector<uint16_t> pcs = profile->hot_pcs();
+  test_assert(pcs == std::vector<uint16_t>({0x8004, 0x8008, 0x8000}),
+              "Hot spots: hottest PCs first, ties by address");
+
+  profile->clear();
+  test_assert(profile->total_instructions() == 0 && profile->hot_pcs().empty(),
+              "Hot spots: clear resets every counter");
+}
+
+void test_call_graph_profile() {
+  // main: MOV R0, #3; CALL f; HALT
+  // f: CMP R0, #0; JZ done; SUB R0, #1; CALL f; done: RET
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // 0x8000: MOV R0, #3
+  add_word(program, 3);
+  add_word(program, make_instruction(19, 2, 0, 0)); // 0x8004: CALL 0x800A
+  add_word(program, 0x800A);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8008: HALT
+  add_word(program, make_instruction(10, 1, 0, 0)); // 0x800A: CMP R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(14, 2, 0, 0)); // 0x800E: JZ 0x801A
+  add_word(program, 0x801A);
+  add_word(program, make_instruction(6, 1, 0, 0)); // 0x8012: SUB R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(19, 2, 0, 0)); // 0x8016: CALL 0x800A
+  add_word(program, 0x800A);
+  add_word(program, make_instruction(20, 0, 0, 0)); // 0x801A: RET
+
+  auto profile = std::make_shared<CallGraphProfile>();
+  CPU cpu;
+  cpu.set_call_graph_profile(profile);
+  cpu.load_program(program, 0x8000);
+  cpu.run();
+
+  // One node per recursion depth; CALL is charged to the caller and RET
+  // to the callee
+  std::vector<uint64_t> inclusive = profile->inclusive_cycles();
+  test_assert(cpu.is_halted() && profile->nodes().size() == 5 &&
+                  profile->nodes()[0].exclusive_cycles == 3 &&
+                  profile->nodes()[1].exclusive_cycles == 5 &&
+                  profile->nodes()[4].exclusive_cycles == 3 &&
+                  inclusive[0] == cpu.get_cycle_count() && inclusive[1] == 18 &&
+                  profile->depth() == 1,
+              "Call graph: exclusive and inclusive cycles per call path");
+
+  std::vector<CallGraphProfile::FunctionSummary> functions =
+      profile->functions();
+  test_assert(functions.size() == 2 && functions[0].function == 0x8000 &&
+                  functions[1].function == 0x800A &&
+                  functions[1].calls == 4 &&
+                  functions[1].inclusive_cycles == 18 &&
+                  functions[1].exclusive_cycles == 18,
+              "Call graph: recursion is counted once per function");
+
+  auto name = [](uint16_t address) {
+    return std::string(address == 0x8000 ? "main" : "f");
+  };
+  std::ostringstream full;
+  profile->write_collapsed(full, name, false);
+  std::ostringstream merged;
+  profile->write_collapsed(merged, name, true);
+  test_assert(full.str() == "main 3\nmain;f 5\nmain;f;f 5\nmain;f;f;f 5\n"
+                            "main;f;f;f;f 3\n" &&
+                  merged.str() == "main 3\nmain;f 18\n",
+              "Call graph: collapsed stacks, with and without merging");
+}
+
+// Runs one superinstruction pattern with every operand pointing somewhere
+// harmless: R2 = 0x1000 for data accesses, R3 = address of the final HALT
+// for jumps, and that address pushed three times for POP/RET.
+std::vector<uint8_t>
+make_superinstruction_program(const SuperinstructionPattern &pattern) {
+  auto has_extra = [](uint8_t mode) {
+    return mode == 1 || mode == 2 || mode == 4 || mode == 5;
+  };
+  uint16_t body_size = 0;
+  for (uint8_t i = 0; i < pattern.length; ++i) {
+    body_size += has_extra(pattern.keys[i] & 7) ? 4 : 2;
+  }
+  const uint16_t body = 0x801A; // after the 26-byte prologue
+  const uint16_t halt = static_cast<uint16_t>(body + body_size);
+
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // MOV R0, #0x1234
+  add_word(program, 0x1234);
+  add_word(program, make_instruction(2, 1, 1, 0)); // MOV R1, #5
+  add_word(program, 5);
+  add_word(program, make_instruction(2, 1, 2, 0)); // MOV R2, #0x1000
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(2, 1, 3, 0)); // MOV R3, #halt
+  add_word(program, halt);
+  for (int i = 0; i < 3; ++i) {
+    add_word(program, make_instruction(21, 0, 3, 0)); // PUSH R3
+  }
+  add_word(program, make_instruction(13, 2, 0, 0)); // JMP body
+  add_word(program, body);
+
+  for (uint8_t i = 0; i < pattern.length; ++i) {
+    uint8_t opcode = pattern.keys[i] >> 3;
+    uint8_t mode = pattern.keys[i] & 7;
+    bool branch = opcode >= 13 && opcode <= 19;
+    uint16_t next = static_cast<uint16_t>(0x8000 + program.size() +
+                                          (has_extra(mode) ? 4 : 2));
+    add_word(program, make_instruction(opcode, mode, 1, branch ? 3 : 2));
+    switch (mode) {
+    case 1: // IMMEDIATE
+      add_word(program, 3);
+      break;
+    case 2: // DIRECT
+      add_word(program, branch ? next : 0x1000);
+      break;
+    case 4: // REGISTER_OFFSET
+      add_word(program, branch ? 0 : 4);
+      break;
+    case 5: // PC_RELATIVE: next instruction, or RAM around 0x1000
+      add_word(program, branch ? 0 : 0x9000);
+      break;
+    default:
+      break;
+    }
+  }
+  add_word(program, make_instruction(1, 0, 0, 0)); // HALT
+  return program;
+}
+
+void test_superinstructions() {
+  const auto &patterns = superinstruction_patterns();
+  test_assert(!patterns.empty(), "Superinstructions: table is generated");
+
+  bool all_match = true;
+  bool all_used = true;
+  for (const SuperinstructionPattern &pattern : patterns) {
+    std::vector<uint8_t> program = make_superinstruction_program(pattern);
+
+    CPU interpreter;
+    interpreter.get_memory().set_output_callback([](uint8_t) {});
+    interpreter.load_program(program, 0x8000);
+    interpreter.run();
+
+    CPU block;
+    block.set_engine(CPU::Engine::BLOCK);
+    block.get_memory().set_output_callback([](uint8_t) {});
+    block.load_program(program, 0x8000);
+    block.run();
+
+    bool same = same_architectural_state(interpreter, block) &&
+                interpreter.is_halted() &&
+                interpreter.get_cycle_count() == block.get_cycle_count();
+    for (uint16_t a = 0x0FF0; a < 0x1010; a += 2) {
+      same = same && interpreter.get_memory().read_word(a) ==
+                         block.get_memory().read_word(a);
+    }
+    all_match = all_match && same;
+    all_used = all_used && block.get_statistics().superinstructions > 0;
+  }
+  test_assert(all_match,
+              "Superinstructions: every generated handler matches execute()");
+  test_assert(all_used, "Superinstructions: every pattern is dispatched");
+
+  const std::vector<std::vector<uint8_t>> programs = {
+      make_multiply_program(), make_self_modifying_program(),
+      make_compare_loop()};
+  bool programs_match = true;
+  for (const auto &program : programs) {
+    CPU interpreter;
+    interpreter.load_program(program, 0x8000);
+    interpreter.run();
+    CPU block;
+    block.set_engine(CPU::Engine::BLOCK);
+    block.load_program(program, 0x8000);
+    block.run();
+    CPU plain;
+    plain.set_engine(CPU::Engine::BLOCK);
+    plain.set_superinstructions(false);
+    plain.load_program(program, 0x8000);
+    plain.run();
+    programs_match = programs_match &&
+                     same_architectural_state(interpreter, block) &&
+                     same_architectural_state(interpreter, plain) &&
+                     plain.get_statistics().superinstructions == 0;
+  }
+  test_assert(programs_match,
+              "Superinstructions: programs match with and without them");
+}
+
+// loop: IN R0, #1; CMP R0, #'.'; JZ done; ADD R1, R0; OUT R0, #0;
+// JMP loop; done: HALT
+std::vector<uint8_t> make_echo_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(23, 1, 0, 0)); // 0x8000: IN R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(10, 1, 0, 0)); // 0x8004: CMP R0, #'.'
+  add_word(program, '.');
+  add_word(program, make_instruction(14, 2, 0, 0)); // 0x8008: JZ 0x8016
+  add_word(program, 0x8016);
+  add_word(program, make_instruction(5, 0, 1, 0)); // 0x800C: ADD R1, R0
+  add_word(program, make_instruction(24, 1, 0, 0)); // 0x800E: OUT R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(13, 2, 0, 0)); // 0x8012: JMP 0x8000
+  add_word(program, 0x8000);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8016: HALT
+  return program;
+}
+
+void test_fleet() {
+  auto make_fleet = [](unsigned threads) {
+    CpuFleet fleet(make_echo_program());
+    fleet.set_threads(threads);
+    fleet.set_max_instructions(10000);
+    for (int i = 0; i < 200; ++i) {
+      CpuFleet::Job job;
+      job.name = "job" + std::to_string(i);
+      for (int k = 0; k < i % 17; ++k) {
+        job.input.push_back(static_cast<uint8_t>('a' + (i + k) % 26));
+      }
+      if (i % 5 != 0) {
+        job.input.push_back('.');
+      }
+      fleet.add_job(std::move(job));
+    }
+    return fleet.run();
+  };
+
+  CpuFleet::Report serial = make_fleet(1);
+  CpuFleet::Report parallel = make_fleet(4);
+  test_assert(serial.results.size() == 200 && parallel.threads == 4,
+              "Fleet: one result per job");
+
+  bool all_correct = true;
+  bool all_match = true;
+  for (size_t i = 0; i < serial.results.size(); ++i) {
+    const CpuFleet::Result &a = serial.results[i];
+    const CpuFleet::Result &b = parallel.results[i];
+    size_t length = i % 17;
+    uint16_t sum = 0;
+    for (size_t k = 0; k < length; ++k) {
+      sum = static_cast<uint16_t>(sum + 'a' + (i + k) % 26);
+    }
+    CPU::StopReason expected = i % 5 != 0 ? CPU::StopReason::HALTED
+                                          : CPU::StopReason::WAITING_IO;
+    all_correct = all_correct && a.name == "job" + std::to_string(i) &&
+                  a.reason == expected && a.output.size() == length &&
+                  a.gpr[1] == sum;
+    all_match = all_match && a.name == b.name && a.reason == b.reason &&
+                a.instructions == b.instructions && a.cycle == b.cycle &&
+                a.output == b.output &&
+                std::equal(a.gpr, a.gpr + 4, b.gpr);
+  }
+  test_assert(all_correct, "Fleet: each instance has its own I/O buffers");
+  test_assert(all_match, "Fleet: results do not depend on thread count");
+  test_assert(serial.total_instructions == parallel.total_instructions,
+              "Fleet: totals aggregate every job");
+}
+
+// Collatz step count of the word at 0x1000, stored to 0x1002. Odd values
+// use a register-count shift (3n + 1 = n + (n << R3) + 1), so lanes with
+// different inputs take different branches every iteration.
+std::vector<uint8_t> make_collatz_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(3, 2, 0, 0)); // 0x8000: LOAD R0, [0x1000]
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(2, 1, 1, 0)); // 0x8004: MOV R1, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(2, 1, 3, 0)); // 0x8008: MOV R3, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(10, 1, 0, 0)); // 0x800C: CMP R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(14, 2, 0, 0)); // 0x8010: JZ 0x8038
+  add_word(program, 0x8038);
+  add_word(program, make_instruction(5, 1, 1, 0)); // 0x8014: ADD R1, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(2, 0, 2, 0)); // 0x8018: MOV R2, R0
+  add_word(program, make_instruction(7, 1, 2, 0)); // 0x801A: AND R2, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(15, 2, 0, 0)); // 0x801E: JNZ 0x802A
+  add_word(program, 0x802A);
+  add_word(program, make_instruction(12, 1, 0, 0)); // 0x8022: SHR R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(13, 5, 0, 0)); // 0x8026: JMP 0x800C
+  add_word(program, static_cast<uint16_t>(0x800C - 0x802A));
+  add_word(program, make_instruction(2, 0, 2, 0)); // 0x802A: MOV R2, R0
+  add_word(program, make_instruction(11, 0, 2, 3)); // 0x802C: SHL R2, R3
+  add_word(program, make_instruction(5, 0, 0, 2)); // 0x802E: ADD R0, R2
+  add_word(program, make_instruction(5, 1, 0, 0)); // 0x8030: ADD R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(13, 2, 0, 0)); // 0x8034: JMP 0x800C
+  add_word(program, 0x800C);
+  add_word(program, make_instruction(4, 2, 1, 0)); // 0x8038: STORE R1, [0x1002]
+  add_word(program, 0x1002);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x803C: HALT
+  return program;
+}
+
+void test_lockstep() {
+  const size_t lanes = 37; // not a multiple of any SIMD width
+  std::vector<uint8_t> program = make_collatz_program();
+  LockstepEngine engine(program, lanes);
+  for (size_t i = 0; i < lanes; ++i) {
+    engine.lane(i).get_memory().write_word(0x1000,
+                                           static_cast<uint16_t>(i + 1));
+  }
+  engine.run();
+
+  bool all_match = true;
+  bool all_halted = true;
+  for (size_t i = 0; i < lanes; ++i) {
+    CPU reference;
+    reference.load_program(program, 0x8000);
+    reference.get_memory().write_word(0x1000, static_cast<uint16_t>(i + 1));
+    reference.run();
+    CPU &lane = engine.lane(i);
+    all_match = all_match && same_architectural_state(reference, lane) &&
+                reference.get_cycle_count() == lane.get_cycle_count() &&
+                reference.get_memory().read_word(0x1002) ==
+                    lane.get_memory().read_word(0x1002);
+    all_halted = all_halted &&
+                 engine.stop_reason(i) == CPU::StopReason::HALTED;
+  }
+  const LockstepEngine::Statistics &stats = engine.get_statistics();
+  test_assert(all_match && all_halted,
+              "Lockstep: every lane matches an independent interpreter");
+  test_assert(stats.vector_instructions > stats.scalar_instructions &&
+                  stats.divergences > 0,
+              "Lockstep: divergent lanes are regrouped and vectorised");
+  const bool simd = std::string(LockstepEngine::simd_isa()) != "scalar";
+  test_assert(!simd || (stats.narrow_steps > 0 &&
+                        stats.narrow_steps < stats.vector_steps),
+              "Lockstep: groups narrower than a vector run lane by lane");
+
+  // Budgeted runs resume where they stopped
+  LockstepEngine sliced(program, 4);
+  for (size_t i = 0; i < 4; ++i) {
+    sliced.lane(i).get_memory().write_word(0x1000,
+                                           static_cast<uint16_t>(i + 25));
+  }
+  sliced.run(7);
+  bool budget_ok = true;
+  for (size_t i = 0; i < 4; ++i) {
+    budget_ok = budget_ok && sliced.lane(i).get_cycle_count() == 7 &&
+                sliced.stop_reason(i) == CPU::StopReason::BUDGET_EXHAUSTED;
+  }
+  for (int slice = 0; slice < 1000; ++slice) {
+    sliced.run(13);
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    CPU reference;
+    reference.load_program(program, 0x8000);
+    reference.get_memory().write_word(0x1000, static_cast<uint16_t>(i + 25));
+    reference.run();
+    budget_ok = budget_ok &&
+                same_architectural_state(reference, sliced.lane(i)) &&
+                reference.get_cycle_count() == sliced.lane(i).get_cycle_count();
+  }
+  test_assert(budget_ok, "Lockstep: budgets are per lane and resumable");
+
+  // A lane that rewrites its code leaves the group
+  LockstepEngine modifying(make_self_modifying_program(), 3);
+  modifying.run();
+  CPU reference;
+  reference.load_program(make_self_modifying_program(), 0x8000);
+  reference.run();
+  bool smc_ok = true;
+  for (size_t i = 0; i < 3; ++i) {
+    smc_ok = smc_ok && same_architectural_state(reference, modifying.lane(i));
+  }
+  test_assert(smc_ok, "Lockstep: self-modifying lanes run on their own");
+
+  // Fleet jobs in lockstep groups give the same results
+  auto make_fleet = [](size_t lockstep) {
+    CpuFleet fleet(make_echo_program());
+    fleet.set_threads(1);
+    fleet.set_lockstep_lanes(lockstep);
+    fleet.set_max_instructions(10000);
+    for (int i = 0; i < 40; ++i) {
+      CpuFleet::Job job;
+      job.name = "job" + std::to_string(i);
+      job.input.assign(static_cast<size_t>(i % 7), 'x');
+      if (i % 3 != 0) {
+        job.input.push_back('.');
+      }
+      fleet.add_job(std::move(job));
+    }
+    return fleet.run();
+  };
+  CpuFleet::Report plain = make_fleet(0);
+  CpuFleet::Report grouped = make_fleet(16);
+  bool fleet_match = plain.results.size() == grouped.results.size();
+  for (size_t i = 0; fleet_match && i < plain.results.size(); ++i) {
+    const CpuFleet::Result &a = plain.results[i];
+    const CpuFleet::Result &b = grouped.results[i];
+    fleet_match = a.name == b.name && a.reason == b.reason &&
+                  a.instructions == b.instructions && a.output == b.output &&
+                  std::equal(a.gpr, a.gpr + 4, b.gpr);
+  }
+  test_assert(fleet_match, "Lockstep: fleet groups match independent jobs");
+}
+
+void test_fork() {
+  std::vector<uint8_t> program = make_collatz_program();
+  CPU parent;
+  parent.load_program(program, 0x8000);
+  parent.get_memory().write_word(0x1000, 27);
+  CPU::RunBudget budget;
+  budget.max_instructions = 100;
+  parent.run_for(budget);
+
+  std::unique_ptr<CPU> child = parent.fork();
+  test_assert(same_architectural_state(parent, *child) &&
+                  child->get_cycle_count() == 100 &&
+                  child->get_memory().private_page_count() == 0,
+              "Fork: child starts from the parent's state");
+
+  child->get_memory().write_word(0x1000, 7);
+  parent.run();
+  child->run();
+  CPU reference;
+  reference.load_program(program, 0x8000);
+  reference.get_memory().write_word(0x1000, 27);
+  reference.run();
+  test_assert(same_architectural_state(reference, parent) &&
+                  reference.get_cycle_count() == parent.get_cycle_count() &&
+                  parent.get_memory().read_word(0x1000) == 27,
+              "Fork: parent is unaffected by the child");
+  test_assert(child->is_halted() &&
+                  child->get_memory().read_word(0x1002) ==
+                      parent.get_memory().read_word(0x1002) &&
+                  child->get_memory().private_page_count() == 1,
+              "Fork: child continues independently, copying one page");
+
+  // Many CPUs on one image
+  Memory loader;
+  loader.load_program(program, 0x8000);
+  MemoryImage image = loader.capture();
+  bool shared_ok = true;
+  for (uint16_t n = 1; n <= 8; ++n) {
+    CPU cpu;
+    cpu.load_image(image, 0x8000);
+    cpu.get_memory().write_word(0x1000, n);
+    cpu.run();
+    shared_ok = shared_ok && cpu.is_halted() &&
+                cpu.get_memory().private_page_count() == 1;
+  }
+  test_assert(shared_ok && image.read_byte(0x1000) == 0,
+              "Fork: CPUs on a shared image only copy written pages");
+}
+
+void test_snapshots() {
+  std::vector<uint8_t> program = make_collatz_program();
+  CPU cpu;
+  cpu.load_program(program, 0x8000);
+  cpu.get_memory().write_word(0x1000, 27);
+  cpu.get_memory().write_byte(0xF011, 1); // start the timer
+  CPU::RunBudget budget;
+  budget.max_instructions = 200;
+  cpu.run_for(budget);
+
+  CPU::Snapshot snapshot = cpu.snapshot();
+  test_assert(cpu.get_memory().private_page_count() == 0,
+              "Snapshot: taking one copies no memory");
+  cpu.run();
+  test_assert(cpu.get_memory().private_page_count() == 1 &&
+                  snapshot.cycle_count == 200,
+              "Snapshot: only pages written since the snapshot are copied");
+  CPU finished;
+  finished.load_program(program, 0x8000);
+  finished.restore(cpu.snapshot());
+
+  CPU resumed;
+  resumed.set_engine(CPU::Engine::COMPILED);
+  resumed.restore(snapshot);
+  resumed.run();
+  test_assert(same_architectural_state(cpu, resumed) &&
+                  cpu.get_cycle_count() == resumed.get_cycle_count() &&
+                  cpu.get_memory().get_timer_counter() ==
+                      resumed.get_memory().get_timer_counter() &&
+                  resumed.get_memory().read_word(0x1002) ==
+                      cpu.get_memory().read_word(0x1002),
+              "Snapshot: restored CPU finishes like the original");
+  test_assert(same_architectural_state(cpu, finished),
+              "Snapshot: restore replaces the whole machine state");
+
+  const std::string path = "build/test_cpu_snapshot.bin";
+  CPU::Snapshot loaded;
+  bool file_ok = save_snapshot(snapshot, path) && load_snapshot(path, loaded);
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  test_assert(file_ok && file.tellg() < 1024,
+              "Snapshot: file holds only non-zero pages");
+
+  CPU from_file;
+  from_file.restore(loaded);
+  from_file.run();
+  test_assert(same_architectural_state(cpu, from_file) &&
+                  cpu.get_cycle_count() == from_file.get_cycle_count() &&
+                  from_file.get_memory().read_word(0x1002) ==
+                      cpu.get_memory().read_word(0x1002) &&
+                  loaded.memory.read_byte(0x1002) == 0,
+              "Snapshot: mapped file restores without touching the file");
+
+  // Header bytes 37 and 40: faulted flag and fault code
+  std::ifstream saved(path, std::ios::binary);
+  const std::string image((std::istreambuf_iterator<char>(saved)),
+                          std::istreambuf_iterator<char>());
+  saved.close();
+  auto load_patched = [&](char faulted, char code) {
+    std::string patched = image;
+    patched[37] = faulted;
+    patched[40] = code;
+    std::ofstream out(path, std::ios::binary);
+    out << patched;
+    out.close();
+    return load_snapshot(path, loaded);
+  };
+  test_assert(load_patched(1, 3) && !load_patched(1, 4) &&
+                  !load_patched(0, 1) && load_patched(0, 0),
+              "Snapshot: fault codes are validated");
+
+  std::ofstream corrupt(path, std::ios::binary);
+  corrupt << "not a snapshot";
+  corrupt.close();
+  test_assert(!load_snapshot(path, loaded) &&
+                  !load_snapshot("build/missing.snapshot", loaded),
+              "Snapshot: invalid files are rejected");
+}
+
+void test_reset_for_reuse() {
+  // Self-modifying code: the patched instruction must be restored
+  const CPU::Engine engines[] = {CPU::Engine::INTERPRETER,
+                                 CPU::Engine::COMPILED};
+  bool smc_ok = true;
+  for (CPU::Engine engine : engines) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.load_program(make_self_modifying_program(), 0x8000);
+    cpu.run();
+    uint64_t cycles = cpu.get_cycle_count();
+    cpu.reset_for_reuse();
+    smc_ok = smc_ok && cpu.get_memory().read_word(0x8006) == 1 &&
+             cpu.get_memory().private_page_count() == 0 &&
+             cpu.get_registers().get_pc() == 0x8000 && !cpu.is_halted();
+    cpu.run();
+    smc_ok = smc_ok && cpu.get_registers().get_gpr(0) == 101 &&
+             cpu.get_cycle_count() == cycles;
+  }
+  test_assert(smc_ok, "Reuse: rewritten code is restored");
+
+  // Data and timer state from the previous job are gone
+  std::vector<uint8_t> program = make_collatz_program();
+  CPU pooled;
+  pooled.load_program(program, 0x8000);
+  bool reuse_ok = true;
+  for (uint16_t n = 5; n < 12; ++n) {
+    pooled.reset_for_reuse();
+    reuse_ok = reuse_ok && pooled.get_memory().read_word(0x1002) == 0 &&
+               !pooled.get_memory().is_timer_running() &&
+               pooled.get_registers().get_pc() == 0x8000;
+    pooled.get_memory().write_word(0x1000, n);
+    pooled.get_memory().write_byte(0xF011, 1);
+    pooled.run();
+
+    CPU fresh;
+    fresh.load_program(program, 0x8000);
+    fresh.get_memory().write_word(0x1000, n);
+    fresh.get_memory().write_byte(0xF011, 1);
+    fresh.run();
+    reuse_ok = reuse_ok && same_architectural_state(pooled, fresh) &&
+               pooled.get_cycle_count() == fresh.get_cycle_count() &&
+               pooled.get_memory().get_timer_counter() ==
+                   fresh.get_memory().get_timer_counter() &&
+               pooled.get_memory().read_word(0x1002) ==
+                   fresh.get_memory().read_word(0x1002);
+  }
+  test_assert(reuse_ok, "Reuse: pooled CPU matches a fresh CPU per job");
+}
+
+// Start the timer, then loop: IN R0, #1; CMP R0, #'.'; JZ done;
+// LOAD R2, [0xF010]; ADD R1, R2; ADD R1, R0; JMP loop; done: HALT
+std::vector<uint8_t> make_timed_input_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 3, 0)); // 0x8000: MOV R3, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(4, 2, 3, 0)); // 0x8004: STORE R3, [0xF011]
+  add_word(program, 0xF011);
+  add_word(program, make_instruction(23, 1, 0, 0)); // 0x8008: IN R0, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(10, 1, 0, 0)); // 0x800C: CMP R0, #'.'
+  add_word(program, '.');
+  add_word(program, make_instruction(14, 2, 0, 0)); // 0x8010: JZ 0x8020
+  add_word(program, 0x8020);
+  add_word(program, make_instruction(3, 2, 2, 0)); // 0x8014: LOAD R2, [0xF010]
+  add_word(program, 0xF010);
+  add_word(program, make_instruction(5, 0, 1, 2)); // 0x8018: ADD R1, R2
+  add_word(program, make_instruction(5, 0, 1, 0)); // 0x801A: ADD R1, R0
+  add_word(program, make_instruction(13, 2, 0, 0)); // 0x801C: JMP 0x8008
+  add_word(program, 0x8008);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8020: HALT
+  return program;
+}
+
+void test_io_record_replay() {
+  std::vector<uint8_t> program = make_timed_input_program();
+  const std::string input = "soft.";
+
+  CPU recorded;
+  recorded.set_engine(CPU::Engine::COMPILED);
+  recorded.load_program(program, 0x8000);
+  size_t next = 0;
+  recorded.get_memory().set_input_callback(
+      [&]() -> uint8_t { return static_cast<uint8_t>(input[next++]); });
+  auto log = std::make_shared<IoLog>();
+  record_io(recorded, log);
+  recorded.run();
+
+  // One input read per byte and a two-byte timer read per non-'.' byte
+  const std::vector<IoLog::Event> &events = log->events();
+  bool shape_ok = recorded.is_halted() && events.size() == 5 + 4 * 2 &&
+                  events[0].source == IoLog::Source::INPUT &&
+                  events[0].value == 's' &&
+                  events[1].source == IoLog::Source::TIMER_LOW &&
+                  events[2].source == IoLog::Source::TIMER_HIGH &&
+                  events[1].cycle == events[0].cycle + 3 &&
+                  log->input_bytes() ==
+                      std::vector<uint8_t>(input.begin(), input.end());
+  test_assert(shape_ok, "I/O log: records input and timer reads with cycles");
+
+  std::string path = "build/test_cpu_io.log";
+  IoLog loaded;
+  bool file_ok = log->save(path) && loaded.load(path) &&
+                 loaded.events().size() == events.size();
+  for (size_t i = 0; file_ok && i < events.size(); ++i) {
+    file_ok = loaded.events()[i].cycle == events[i].cycle &&
+              loaded.events()[i].source == events[i].source &&
+              loaded.events()[i].value == events[i].value;
+  }
+  test_assert(file_ok, "I/O log: save/load round trip");
+
+  // Replay without an input source reproduces the run on every engine
+  const CPU::Engine engines[] = {CPU::Engine::INTERPRETER,
+                                 CPU::Engine::THREADED, CPU::Engine::BLOCK,
+                                 CPU::Engine::COMPILED};
+  bool replay_ok = true;
+  for (CPU::Engine engine : engines) {
+    CPU replayed;
+    replayed.set_engine(engine);
+    replayed.load_program(program, 0x8000);
+    auto status = replay_io(replayed, log);
+    replayed.run();
+    replay_ok = replay_ok && !status->diverged &&
+                status->position == events.size() &&
+                same_architectural_state(recorded, replayed) &&
+                replayed.get_cycle_count() == recorded.get_cycle_count();
+  }
+  test_assert(replay_ok, "I/O replay: every engine reproduces the run");
+
+  // A truncated log leaves the replay waiting for input
+  auto truncated = std::make_shared<IoLog>();
+  for (size_t i = 0; i < 6; ++i) {
+    truncated->add(events[i]);
+  }
+  CPU waiting;
+  waiting.load_program(program, 0x8000);
+  auto status = replay_io(waiting, truncated);
+  CPU::RunResult result = waiting.run();
+  test_assert(result.reason == CPU::StopReason::WAITING_IO &&
+                  status->position == 6 && !status->diverged,
+              "I/O replay: stops waiting where the log ends");
+
+  // A read at another cycle than logged is reported
+  auto shifted = std::make_shared<IoLog>();
+  for (IoLog::Event event : events) {
+    event.cycle += event.source == IoLog::Source::INPUT ? 0 : 1;
+    shifted->add(event);
+  }
+  CPU diverging;
+  diverging.load_program(program, 0x8000);
+  status = replay_io(diverging, shifted);
+  diverging.run();
+  test_assert(status->diverged && status->position == 1 &&
+                  status->divergence_cycle == events[1].cycle,
+              "I/O replay: detects divergence from the log");
+}
+
+// Fill 0x1000-0x10FF with multiples of 3, pushing and popping each one:
+// R0 = 0, R1 = 0x1000; loop: ADD R0, #3; STORE R0, [R1]; ADD R1, #2;
+// PUSH R0; POP R2; CMP R1, #0x1100; JNZ loop; HALT
+std::vector<uint8_t> make_fill_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // 0x8000: MOV R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(2, 1, 1, 0)); // 0x8004: MOV R1, #0x1000
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(5, 1, 0, 0)); // 0x8008: ADD R0, #3
+  add_word(program, 3);
+  add_word(program, make_instruction(4, 3, 0, 1)); // 0x800C: STORE R0, [R1]
+  add_word(program, make_instruction(5, 1, 1, 0)); // 0x800E: ADD R1, #2
+  add_word(program, 2);
+  add_word(program, make_instruction(21, 0, 0, 0)); // 0x8012: PUSH R0
+  add_word(program, make_instruction(22, 0, 2, 0)); // 0x8014: POP R2
+  add_word(program, make_instruction(10, 1, 1, 0)); // 0x8016: CMP R1, #0x1100
+  add_word(program, 0x1100);
+  add_word(program, make_instruction(15, 2, 0, 0)); // 0x801A: JNZ 0x8008
+  add_word(program, 0x8008);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x801E: HALT
+  return program;
+}
+
+bool same_memory(CPU &a, CPU &b) {
+  for (uint32_t address = 0; address < Memory::IO_START; ++address) {
+    if (a.get_memory().read_byte(static_cast<uint16_t>(address)) !=
+        b.get_memory().read_byte(static_cast<uint16_t>(address))) {
+      return false;
+    }
+  }
+  return a.get_memory().get_timer_counter() ==
+         b.get_memory().get_timer_counter();
+}
+
+void test_reverse_execution() {
+  std::vector<uint8_t> program = make_fill_program();
+  auto start = [&](CPU &cpu) {
+    cpu.load_program(program, 0x8000);
+    cpu.get_memory().write_byte(0xF011, 1);
+  };
+
+  CPU cpu;
+  auto history = std::make_shared<ExecutionHistory>(64);
+  cpu.set_history(history);
+  cpu.set_engine(CPU::Engine::COMPILED);
+  start(cpu);
+  cpu.run();
+  const uint64_t total = cpu.get_cycle_count();
+  test_assert(cpu.is_halted() && history->record_count() == total &&
+                  history->checkpoint_count() == total / 64 + 1,
+              "History: one undo record per instruction, periodic checkpoints");
+
+  // Compare against a fresh run stopped at each target cycle, walking
+  // back inside the newest segment and across checkpoints
+  const uint64_t targets[] = {total - 1, total - 5, total / 2, 130, 64, 63, 0};
+  bool back_ok = cpu.step_back() && cpu.get_cycle_count() == total - 1;
+  for (uint64_t target : targets) {
+    CPU reference;
+    start(reference);
+    CPU::RunBudget budget;
+    budget.max_instructions = target;
+    if (target > 0) {
+      reference.run_for(budget);
+    }
+    back_ok = back_ok && cpu.run_backwards_to(target) &&
+              cpu.get_cycle_count() == target &&
+              same_architectural_state(cpu, reference) &&
+              same_memory(cpu, reference);
+  }
+  test_assert(back_ok, "Reverse: earlier cycles match a fresh run");
+  test_assert(!cpu.run_backwards_to(1) && cpu.get_cycle_count() == 0,
+              "Reverse: cannot go past the present");
+
+  // Running forward again extends the history from the rewound point
+  CPU::RunBudget budget;
+  budget.max_instructions = 100;
+  cpu.run_for(budget);
+  cpu.run();
+  CPU fresh;
+  start(fresh);
+  fresh.run();
+  bool rerun_ok = same_architectural_state(cpu, fresh) &&
+                  same_memory(cpu, fresh) &&
+                  cpu.get_cycle_count() == total && cpu.step_back() &&
+                  !cpu.is_halted();
+  test_assert(rerun_ok, "Reverse: execution resumes from the rewound state");
+
+  // Only max_checkpoints segments are kept
+  CPU bounded;
+  auto short_history = std::make_shared<ExecutionHistory>(32, 2);
+  bounded.set_history(short_history);
+  start(bounded);
+  bounded.run();
+  test_assert(short_history->checkpoint_count() == 2 &&
+                  short_history->oldest_cycle() > 0 &&
+                  !bounded.run_backwards_to(0) &&
+                  bounded.run_backwards_to(short_history->oldest_cycle()),
+              "Reverse: history is bounded by max_checkpoints");
+
+  // Undoing a store into code restores the original instruction
+  CPU smc;
+  smc.set_history(std::make_shared<ExecutionHistory>(4));
+  smc.load_program(make_self_modifying_program(), 0x8000);
+  smc.run();
+  uint16_t first_result = smc.get_registers().get_gpr(0);
+  bool smc_ok = smc.run_backwards_to(0) &&
+                smc.get_memory().read_word(0x8006) == 1;
+  smc.run();
+  test_assert(smc_ok && smc.get_registers().get_gpr(0) == first_result,
+              "Reverse: self-modifying code is rewound");
+
+  // Anything that runs without the history breaks the chain
+  cpu.set_history(nullptr);
+  cpu.reset_for_reuse();
+  test_assert(!cpu.step_back(), "Reverse: no history, no step back");
+}
+
+std::vector<uint8_t> make_perf_counter_program() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(2, 1, 0, 0)); // 0x8000: MOV R0, #5
+  add_word(program, 5);                            // enable | reset
+  add_word(program, make_instruction(24, 1, 0, 0)); // 0x8004: OUT R0, #0x20
+  add_word(program, 0x20);
+  add_word(program, make_instruction(2, 1, 1, 0)); // 0x8008: MOV R1, #3
+  add_word(program, 3);
+  add_word(program, make_instruction(19, 2, 0, 0)); // 0x800C: CALL 0x8030
+  add_word(program, 0x8030);
+  add_word(program, make_instruction(6, 1, 1, 0)); // 0x8010: SUB R1, #1
+  add_word(program, 1);
+  add_word(program, make_instruction(15, 2, 0, 0)); // 0x8014: JNZ 0x800C
+  add_word(program, 0x800C);
+  add_word(program, make_instruction(2, 1, 0, 0)); // 0x8018: MOV R0, #3
+  add_word(program, 3);                            // enable | latch
+  add_word(program, make_instruction(24, 1, 0, 0)); // 0x801C: OUT R0, #0x20
+  add_word(program, 0x20);
+  add_word(program, make_instruction(2, 1, 0, 0)); // 0x8020: MOV R0, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(24, 1, 0, 0)); // 0x8024: OUT R0, #0x20
+  add_word(program, 0x20);
+  add_word(program, make_instruction(3, 2, 2, 0)); // 0x8028: LOAD R2, [0xF028]
+  add_word(program, 0xF028);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x802C: HALT
+  add_word(program, make_instruction(0, 0, 0, 0)); // 0x802E: NOP
+  add_word(program, make_instruction(4, 2, 1, 0)); // 0x8030: STORE R1, [0x1000]
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(3, 2, 3, 0)); // 0x8034: LOAD R3, [0x1000]
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(20, 0, 0, 0)); // 0x8038: RET
+  return program;
+}
+
+void test_perf_counters() {
+  std::vector<uint8_t> program = make_perf_counter_program();
+  // Latched by the second OUT: MOV, 3 x (CALL STORE LOAD RET SUB JNZ), MOV
+  const uint32_t expected[Memory::PERF_COUNTER_COUNT] = {20, 20, 8, 6, 6, 0};
+
+  const CPU::Engine engines[] = {CPU::Engine::INTERPRETER,
+                                 CPU::Engine::THREADED, CPU::Engine::BLOCK,
+                                 CPU::Engine::COMPILED};
+  bool same = true;
+  for (CPU::Engine engine : engines) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.load_program(program, 0x8000);
+    cpu.run();
+    const Memory::PerfCounters &counters = cpu.get_memory().perf_counters();
+    same = same && cpu.is_halted() && !counters.enabled &&
+           std::equal(expected, expected + Memory::PERF_COUNTER_COUNT,
+                      counters.latched) &&
+           counters.live[Memory::PERF_INSTRUCTIONS] == 23 &&
+           cpu.get_registers().get_gpr(2) == 20;
+  }
+  test_assert(same, "Perf counters: same counts on every engine");
+
+  // Stopped inside the second call: live values move, the latch does not
+  CPU cpu;
+  cpu.set_engine(CPU::Engine::COMPILED);
+  cpu.load_program(program, 0x8000);
+  CPU::RunBudget budget;
+  budget.max_instructions = 10;
+  cpu.run_for(budget);
+  const Memory::PerfCounters &counters = cpu.get_memory().perf_counters();
+  test_assert(counters.enabled && counters.live[Memory::PERF_CALL_DEPTH] == 1 &&
+                  counters.live[Memory::PERF_INSTRUCTIONS] == 8 &&
+                  counters.latched[Memory::PERF_INSTRUCTIONS] == 0 &&
+                  cpu.get_memory().read_byte(Memory::IO_PERF_CONTROL) ==
+                      Memory::PERF_ENABLE,
+              "Perf counters: live values count, latch holds its sample");
+
+  const std::string path = "build/test_cpu_perf.snapshot";
+  CPU::Snapshot loaded;
+  test_assert(save_snapshot(cpu.snapshot(), path) &&
+                  load_snapshot(path, loaded) &&
+                  loaded.perf_counters == counters,
+              "Perf counters: saved and loaded with snapshots");
+
+  auto history = std::make_shared<ExecutionHistory>(4);
+  CPU reverse;
+  reverse.set_history(history);
+  reverse.load_program(program, 0x8000);
+  reverse.run();
+  bool back_ok = reverse.run_backwards_to(10) &&
+                 reverse.get_memory().perf_counters() == counters;
+  back_ok = back_ok && reverse.run_backwards_to(1) &&
+            !reverse.get_memory().is_perf_counting();
+  test_assert(back_ok, "Perf counters: reverse execution restores them");
+}
+
+void test_timing_model() {
+  const std::string path = "build/test_cpu_timing.cfg";
+  std::ofstream config(path);
+  config << "# fill loop costs\n"
+         << "opcode STORE 4\n"
+         << "opcode JNZ 2  # taken or not\n"
+         << "mode IMM 1\n"
+         << "mode DIR 1\n"
+         << "memory 2\n";
+  config.close();
+  auto model = std::make_shared<TimingModel>();
+  test_assert(model->load(path) &&
+                  model->opcode_cost(CPU::Opcode::STORE) == 4 &&
+                  model->opcode_cost(CPU::Opcode::LOAD) == 1 &&
+                  model->memory_access_cost() == 2,
+              "Timing model: loads costs and keeps defaults");
+
+  // MOV #, MOV #, 128 x (ADD # STORE [R] ADD # PUSH POP CMP # JNZ), HALT:
+  // 2 + 2 + 128 x (2 + 6 + 2 + 3 + 3 + 2 + 3) + 1
+  const uint64_t expected = 2693;
+  std::vector<uint8_t> program = make_fill_program();
+  bool same = true;
+  for (CPU::Engine engine : {CPU::Engine::INTERPRETER, CPU::Engine::COMPILED}) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.set_timing_model(model);
+    cpu.load_program(program, 0x8000);
+    cpu.get_memory().write_byte(0xF011, 1);
+    cpu.run();
+    same = same && cpu.get_cycle_count() == 899 &&
+           cpu.get_statistics().cycles == expected &&
+           cpu.get_memory().get_timer_counter() == expected;
+  }
+  test_assert(same, "Timing model: timer and statistics report modelled cycles");
+
+  CPU untimed;
+  untimed.set_engine(CPU::Engine::BLOCK);
+  untimed.load_program(program, 0x8000);
+  untimed.run();
+  test_assert(untimed.get_statistics().cycles == untimed.get_cycle_count(),
+              "Timing model: one cycle per instruction without a model");
+
+  std::ofstream bad(path);
+  bad << "opcode FOO 3\n";
+  bad.close();
+  test_assert(!model->load(path) &&
+                  model->opcode_cost(CPU::Opcode::STORE) == 4 &&
+                  !model->load("build/missing.cfg"),
+              "Timing model: invalid files are rejected");
+}
+
+void test_pipeline_model() {
+  std::vector<uint8_t> program;
+  add_word(program, make_instruction(3, 2, 0, 0)); // 0x8000: LOAD R0, [0x1000]
+  add_word(program, 0x1000);
+  add_word(program, make_instruction(5, 0, 1, 0)); // 0x8004: ADD R1, R0
+  add_word(program, make_instruction(5, 0, 1, 1)); // 0x8006: ADD R1, R1
+  add_word(program, make_instruction(10, 1, 1, 0)); // 0x8008: CMP R1, #0
+  add_word(program, 0);
+  add_word(program, make_instruction(14, 2, 0, 0)); // 0x800C: JZ 0x8012
+  add_word(program, 0x8012);
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8010: HALT
+  add_word(program, make_instruction(1, 0, 0, 0)); // 0x8012: HALT
+
+  auto model = std::make_shared<PipelineModel>();
+  CPU cpu;
+  cpu.set_pipeline_model(model);
+  cpu.load_program(program, 0x8000);
+  cpu.run();
+  const PipelineModel::Statistics &stats = model->statistics();
+  test_assert(stats.instructions == 6 && stats.cycles == 13 &&
+                  stats.stall_cycles[PipelineModel::STALL_LOAD_USE] == 1 &&
+                  stats.stall_cycles[PipelineModel::STALL_DATA] == 0 &&
+                  stats.resource_stalls[PipelineModel::RES_R0] == 1,
+              "Pipeline: one load-use stall with forwarding");
+  test_assert(stats.forwards[PipelineModel::FORWARD_EX_MEM] == 3 &&
+                  stats.forwards[PipelineModel::FORWARD_MEM_WB] == 1 &&
+                  stats.flushes[PipelineModel::FLUSH_BRANCH] == 1 &&
+                  stats.flush_cycles[PipelineModel::FLUSH_BRANCH] == 2,
+              "Pipeline: forwarding paths and taken-branch flush");
+
+  PipelineModel::Config config;
+  config.forwarding = false;
+  auto unforwarded = std::make_shared<PipelineModel>(config);
+  CPU slow;
+  slow.set_pipeline_model(unforwarded);
+  slow.load_program(program, 0x8000);
+  slow.run();
+  const PipelineModel::Statistics &slow_stats = unforwarded->statistics();
+  test_assert(slow_stats.cycles == 20 &&
+                  slow_stats.stall_cycles[PipelineModel::STALL_LOAD_USE] == 2 &&
+                  slow_stats.stall_cycles[PipelineModel::STALL_DATA] == 6 &&
+                  slow_stats.resource_stalls[PipelineModel::RES_FLAGS] == 2 &&
+                  slow_stats.forwards[PipelineModel::FORWARD_EX_MEM] == 0,
+              "Pipeline: without forwarding results wait for write-back");
+}
+
+void test_branch_predictors() {
+  // Loop of three CALLs: the JNZ at 0x8014 goes back twice, then falls out
+  auto profile = std::make_shared<BranchProfile>();
+  for (const char *spec : {"static", "static-not-taken", "bimodal", "ras:1"}) {
+    profile->add_predictor(make_branch_predictor(spec));
+  }
+  CPU cpu;
+  cpu.set_branch_profile(profile);
+  cpu.load_program(make_perf_counter_program(), 0x8000);
+  cpu.run();
+
+  std::vector<BranchProfile::Site> sites = profile->sites();
+  test_assert(sites.size() == 3 && sites[0].pc == 0x800C &&
+                  sites[0].kind == BranchKind::CALL &&
+                  sites[1].pc == 0x8014 && sites[1].executions == 3 &&
+                  sites[1].taken == 2 && sites[2].kind == BranchKind::RETURN,
+              "Branches: one site per branch PC");
+  test_assert(sites[1].mispredictions[0] == 1 &&
+                  sites[1].mispredictions[1] == 2 &&
+                  sites[1].mispredictions[2] == 2 &&
+                  profile->predicted(3) == 3 &&
+                  profile->mispredicted(3) == 0 &&
+                  profile->predicted(0) == 3,
+              "Branches: predictors run side by side on one pass");
+  test_assert(!make_branch_predictor("bogus") &&
+                  !make_branch_predictor("gshare:0") &&
+                  make_branch_predictor("gshare:8")->name() == "gshare:8",
+              "Branches: predictor specs are validated");
+}
+
+void test_cache_model() {
+  // Two sets of two ways; 0x00, 0x20 and 0x40 share set 0
+  Cache::Config config;
+  config.size = 64;
+  config.ways = 2;
+  config.line_size = 16;
+  Cache lru(config);
+  config.replacement = Cache::Replacement::FIFO;
+  Cache fifo(config);
+  for (uint16_t address : {0x00, 0x20, 0x00, 0x40}) {
+    lru.access(address, address == 0x00);
+    fifo.access(address, false);
+  }
+  const Cache::Result kept = lru.access(0x00, false);
+  Cache::Result evicted = lru.access(0x60, false);
+  evicted = lru.access(0x20, false);
+  test_assert(kept.hit && !fifo.access(0x00, false).hit &&
+                  evicted.writeback && evicted.victim == 0x00 &&
+                  lru.statistics().writebacks == 1,
+              "Cache: LRU keeps the reused line, FIFO the older one");
+  test_assert(parse_cache_config("4096:4:32:fifo:wt", config) &&
+                  config.size == 4096 && config.ways == 4 &&
+                  config.replacement == Cache::Replacement::FIFO &&
+                  config.write_policy == Cache::WritePolicy::WRITE_THROUGH &&
+                  !parse_cache_config("1000:2:16", config) &&
+                  !parse_cache_config("64:8:16", config) &&
+                  !parse_cache_config("64:2:16:wb:wt", config) &&
+                  !parse_cache_config("1024:65536:65536", config),
+              "Cache: specs are validated");
+
+  // The program's loop: CALL, STORE and LOAD [0x1000], RET, SUB, JNZ
+  auto caches =
+      std::make_shared<CacheHierarchy>(Cache::Config(), Cache::Config());
+  CPU cpu;
+  cpu.set_cache_hierarchy(caches);
+  cpu.load_program(make_perf_counter_program(), 0x8000);
+  cpu.run();
+  const CacheHierarchy::RegionStatistics &program =
+      caches->region(CacheHierarchy::REGION_PROGRAM);
+  const CacheHierarchy::RegionStatistics &stack =
+      caches->region(CacheHierarchy::REGION_STACK);
+  test_assert(caches->l1i().statistics().reads == 50 &&
+                  caches->l1i().statistics().misses() == 4 &&
+                  caches->l1d().statistics().reads == 6 &&
+                  caches->l1d().statistics().writes == 6 &&
+                  caches->l1d().statistics().misses() == 2 &&
+                  caches->memory_reads() == 6 && caches->memory_writes() == 0,
+              "Cache: only the first touch of each line misses");
+  test_assert(program.accesses == 50 && program.l1_misses == 4 &&
+                  stack.accesses == 12 && stack.l1_misses == 2 &&
+                  caches->region(CacheHierarchy::REGION_IO).accesses == 4,
+              "Cache: accesses counted by region, I/O uncached");
+  std::vector<CacheHierarchy::Site> sites = caches->sites();
+  auto store = std::find_if(
+      sites.begin(), sites.end(),
+      [](const CacheHierarchy::Site &site) { return site.pc == 0x8030; });
+  test_assert(store != sites.end() && store->fetches == 6 &&
+                  store->fetch_misses == 1 && store->data_accesses == 3 &&
+                  store->data_misses == 1,
+              "Cache: hits and misses counted per PC");
+
+  // Write-through L1D without allocation, over a write-back L2
+  Cache::Config through;
+  through.size = 64;
+  through.ways = 1;
+  through.write_policy = Cache::WritePolicy::WRITE_THROUGH;
+  auto layered = std::make_shared<CacheHierarchy>(Cache::Config(), through,
+                                                  Cache::Config());
+  CPU layered_cpu;
+  layered_cpu.set_cache_hierarchy(layered);
+  layered_cpu.load_program(make_perf_counter_program(), 0x8000);
+  layered_cpu.run();
+  test_assert(layered->l1d().statistics().misses() == 4 &&
+                  layered->l2()->statistics().reads == 6 &&
+                  layered->l2()->statistics().writes == 6 &&
+                  layered->l2()->statistics().misses() == 6 &&
+                  layered->region(CacheHierarchy::REGION_STACK).l2_misses ==
+                      2 &&
+                  layered->memory_reads() == 6 &&
+                  layered->memory_writes() == 0,
+              "Cache: write-through stores pass to a write-back L2");
+}
+
+void test_composed_observers() {
+  // Models attached together see the same stream as each one alone
+  auto pipeline = std::make_shared<PipelineModel>();
+  auto branches = std::make_shared<BranchProfile>();
+  branches->add_predictor(make_branch_predictor("static"));
+  auto caches =
+      std::make_shared<CacheHierarchy>(Cache::Config(), Cache::Config());
+  CPU cpu;
+  cpu.set_pipeline_model(pipeline);
+  cpu.set_branch_profile(branches);
+  cpu.set_cache_hierarchy(caches);
+  cpu.load_program(make_perf_counter_program(), 0x8000);
+  cpu.run();
+
+  auto solo_pipeline = std::make_shared<PipelineModel>();
+  CPU solo;
+  solo.set_pipeline_model(solo_pipeline);
+  solo.load_program(make_perf_counter_program(), 0x8000);
+  solo.run();
+  test_assert(pipeline->statistics().instructions == 27 &&
+                  pipeline->statistics().cycles ==
+                      solo_pipeline->statistics().cycles &&
+                  branches->predicted(0) == 3 &&
+                  branches->mispredicted(0) == 1 &&
+                  caches->l1i().statistics().reads == 50 &&
+                  caches->l1d().statistics().misses() == 2,
+              "Observers: pipeline, predictors and caches in one run");
+
+  // A traced run can keep a history: both observe the stores
+  const std::string path = "build/test_cpu_observers.json";
+  auto history = std::make_shared<ExecutionHistory>();
+  CPU both;
+  {
+    auto tracer = std::make_shared<TraceRecorder>();
+    tracer->set_output_path(path);
+    both.set_trace_recorder(tracer);
+    both.set_history(history);
+    both.load_program(make_perf_counter_program(), 0x8000);
+    both.run();
+    both.set_trace_recorder(nullptr);
+  }
+  const uint16_t stored = both.get_memory().read_word(0x1000);
+  const bool rewound = both.run_backwards_to(0);
+  std::ifstream in(path);
+  std::string trace((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  test_assert(stored == 1 && rewound &&
+                  both.get_memory().read_word(0x1000) == 0 &&
+                  both.get_registers().get_pc() == 0x8000 &&
+                  trace.find("\"addr\"") != std::string::npos,
+              "Observers: trace recorder and history share the store hook");
+}
+
+void test_breakpoints() {
+  CPU cpu;
+  cpu.load_program(make_counting_loop(), 0x8000);
+  cpu.add_breakpoint(0x8008);
+
+  CPU::RunResult result = cpu.run();
+  test_assert(result.reason == CPU::StopReason::BREAKPOINT &&
+                  cpu.get_registers().get_pc() == 0x8008 &&
+                  cpu.get_registers().get_gpr(0) == 1,
+              "Breakpoint: stops before the instruction at the PC");
+
+  result = cpu.run();
+  test_assert(result.reason == CPU::StopReason::BREAKPOINT &&
+                  result.instructions == 2 &&
+                  cpu.get_registers().get_gpr(0) == 2,
+              "Breakpoint: resuming executes the breakpoint instruction");
+
+  cpu.clear_breakpoints();
+  CPU::RunBudget budget;
+  budget.max_instructions = 100;
+  result = cpu.run_until(
+      [](const CPU &c) { return c.get_registers().get_gpr(0) == 10; },
+      budget);
+  test_assert(result.reason == CPU::StopReason::BREAKPOINT &&
+                  cpu.get_registers().get_gpr(0) == 10,
+              "Breakpoint: run_until stops when the predicate holds");
+}
+
+void test_fault_and_io_wait() {
+  const CPU::Engine engines[] = {CPU::Engine::INTERPRETER,
+                                 CPU::Engine::THREADED, CPU::Engine::BLOCK,
+                                 CPU::Engine::COMPILED};
+
+  // NOP; STORE with an immediate destination
+  std::vector<uint8_t> faulting;
+  add_word(faulting, make_instruction(0, 0, 0, 0));
+  add_word(faulting, make_instruction(4, 1, 0, 0));
+  add_word(faulting, 0x1234);
+  bool all_faulted = true;
+  for (CPU::Engine engine : engines) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.load_program(faulting, 0x8000);
+    CPU::RunResult result = cpu.run();
+    const CPU::Fault &fault = cpu.get_fault();
+    all_faulted = all_faulted && result.reason == CPU::StopReason::FAULT &&
+                  result.instructions == 1 && cpu.has_faulted() &&
+                  cpu.is_halted() &&
+                  fault.code == CPU::FaultCode::INVALID_MODE &&
+                  fault.pc == 0x8002 &&
+                  fault.instruction_word == make_instruction(4, 1, 0, 0);
+  }
+  test_assert(all_faulted, "Fault: all engines report code, PC and word");
+
+  // IN R1, #1; HALT
+  std::vector<uint8_t> reader;
+  add_word(reader, make_instruction(23, 1, 1, 0));
+  add_word(reader, 1);
+  add_word(reader, make_instruction(1, 0, 0, 0));
+  bool all_waited = true;
+  bool all_resumed = true;
+  for (CPU::Engine engine : engines) {
+    CPU cpu;
+    cpu.set_engine(engine);
+    cpu.load_program(reader, 0x8000);
+    bool ready = false;
+    cpu.get_memory().set_input_ready_callback([&ready]() { return ready; });
+    cpu.get_memory().set_input_callback([]() { return uint8_t('x'); });
+
+    CPU::RunResult result = cpu.run();
+    all_waited = all_waited && result.reason == CPU::StopReason::WAITING_IO &&
+                 result.instructions == 0 && cpu.is_waiting_for_input() &&
+                 cpu.get_registers().get_pc() == 0x8000;
+
+    ready = true;
+    result = cpu.run();
+    all_resumed = all_resumed && result.reason == CPU::StopReason::HALTED &&
+                  cpu.get_registers().get_gpr(1) == 'x';
+  }
+  test_assert(all_waited, "I/O wait: IN without input stops with WAITING_IO");
+  test_assert(all_resumed, "I/O wait: run resumes once input is ready");
+}
+
+void test_traced_run() {
+  const std::string path = "build/test_cpu_trace.json";
+  CPU untraced;
+  untraced.load_program(make_multiply_program(), 0x8000);
+  untraced.run();
+
+  CPU traced;
+  {
+    auto tracer = std::make_shared<TraceRecorder>();
+    tracer->set_output_path(path);
+    traced.set_trace_recorder(tracer);
+    traced.load_program(make_multiply_program(), 0x8000);
+    traced.run();
+    traced.set_trace_recorder(nullptr);
+  }
+  test_assert(same_architectural_state(untraced, traced),
+              "Trace: traced run matches untraced run");
+
+  std::ifstream in(path);
+  std::string line;
+  uint64_t entries = 0;
+  bool has_mem_write = false;
+  while (std::getline(in, line)) {
+    if (line.find("\"cycle\"") != std::string::npos) {
+      ++entries;
+    }
+    if (line.find("\"addr\"") != std::string::npos) {
+      has_mem_write = true;
+    }
+  }
+  test_assert(entries == traced.get_cycle_count(),
+              "Trace: one entry per retired instruction");
+  test_assert(has_mem_write, "Trace: memory observer records stack writes");
+}
+
+CPU::FaultCode fault_for(uint16_t word) {
+  std::vector<uint8_t> program;
+  add_word(program, word);
+  add_word(program, 0x8000); // extra word for modes that take one
+  add_word(program, make_instruction(1, 0, 0, 0));
+  CPU cpu;
+  cpu.load_program(program, 0x8000);
+  cpu.step();
+  return cpu.get_fault().code;
+}
+
+void test_decode_validation() {
+  using FC = CPU::FaultCode;
+  test_assert(fault_for(make_instruction(25, 0, 0, 0)) == FC::INVALID_OPCODE,
+              "Validate: opcode above OUT");
+  test_assert(fault_for(make_instruction(2, 6, 0, 0)) == FC::INVALID_MODE,
+              "Validate: undefined addressing mode");
+  test_assert(fault_for(make_instruction(3, 0, 0, 1)) == FC::INVALID_MODE,
+              "Validate: LOAD needs an address mode");
+  // Checked at decode, even though the branch would not be taken
+  test_assert(fault_for(make_instruction(14, 1, 0, 0)) == FC::INVALID_MODE,
+              "Validate: untaken JZ with immediate mode");
+  test_assert(fault_for(make_instruction(2, 1, 4, 0)) == FC::INVALID_REGISTER,
+              "Validate: rd above R3");
+  test_assert(fault_for(make_instruction(5, 3, 0, 7)) == FC::INVALID_REGISTER,
+              "Validate: rs above R3 in register indirect mode");
+  test_assert(fault_for(make_instruction(2, 1, 0, 7)) == FC::NONE,
+              "Validate: unused rs field is ignored");
+  test_assert(fault_for(make_instruction(0, 7, 7, 7)) == FC::NONE,
+              "Validate: NOP ignores mode and registers");
+  test_assert(fault_for(make_instruction(13, 2, 6, 0)) == FC::NONE,
+              "Validate: JMP ignores rd");
+}
+
 int main() {
   std::cout << "=== CPU Instruction Tests ===" << std::endl << std::endl;
 
@@ -259,6 +2135,34 @@ int main() {
   test_push_pop();
   test_call_ret();
   test_load_store();
+  test_self_modifying_code();
+  test_alternate_engines();
+  test_block_engine_timer();
+  test_compiled_alu_flags();
+  test_run_budget();
+  test_macro_fusion();
+  test_native_code();
+  test_sequence_profile();
+  test_hotspot_profile();
+  test_call_graph_profile();
+  test_superinstructions();
+  test_fleet();
+  test_lockstep();
+  test_fork();
+  test_snapshots();
+  test_reset_for_reuse();
+  test_io_record_replay();
+  test_reverse_execution();
+  test_perf_counters();
+  test_timing_model();
+  test_pipeline_model();
+  test_branch_predictors();
+  test_cache_model();
+  test_composed_observers();
+  test_breakpoints();
+  test_fault_and_io_wait();
+  test_decode_validation();
+  test_traced_run();
 
   std::cout << std::endl << "=== All CPU Tests Passed! ===" << std::endl;
   return 0;
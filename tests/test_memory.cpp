@@ -96,6 +96,29 @@ void test_timer_functionality() {
   test_assert(counter == 0, "Timer: Counter resets when stopped");
 }
 
+void test_perf_counter_registers() {
+  Memory mem;
+  mem.perf_counters().live[Memory::PERF_MEMORY_WRITES] = 0x12345678;
+
+  // Counters read the latched sample, little-endian
+  test_assert(mem.read_byte(0xF034) == 0,
+              "Perf counters: Unlatched counters read zero");
+  mem.write_byte(Memory::IO_PERF_CONTROL,
+                 Memory::PERF_ENABLE | Memory::PERF_LATCH);
+  mem.perf_counters().live[Memory::PERF_MEMORY_WRITES] = 1;
+  test_assert(mem.read_word(0xF034) == 0x5678 &&
+                  mem.read_word(0xF036) == 0x1234 &&
+                  mem.read_byte(Memory::IO_PERF_CONTROL) ==
+                      Memory::PERF_ENABLE,
+              "Perf counters: Latch copies live values");
+
+  // Reset applies before latch
+  mem.write_byte(Memory::IO_PERF_CONTROL,
+                 Memory::PERF_RESET | Memory::PERF_LATCH);
+  test_assert(mem.read_word(0xF034) == 0 && !mem.is_perf_counting(),
+              "Perf counters: Reset clears before latching");
+}
+
 void test_output_callback() {
   Memory mem;
 
@@ -128,6 +151,110 @@ void test_memory_boundaries() {
   test_assert(mem.read_byte(0xFFFF) == 0xBB, "Boundary: Write at 0xFFFF");
 }
 
+void test_page_dispatch() {
+  Memory mem;
+
+  // Odd address inside a page
+  mem.write_word(0x1235, 0xBEEF);
+  test_assert(mem.read_word(0x1235) == 0xBEEF, "Pages: Unaligned word access");
+  test_assert(mem.read_byte(0x1235) == 0xEF && mem.read_byte(0x1236) == 0xBE,
+              "Pages: Unaligned word is little-endian");
+
+  // Word straddling two RAM pages
+  mem.write_word(0x12FF, 0xCAFE);
+  test_assert(mem.read_byte(0x12FF) == 0xFE && mem.read_byte(0x1300) == 0xCA,
+              "Pages: Word split across a page boundary");
+  test_assert(mem.read_word(0x12FF) == 0xCAFE,
+              "Pages: Word read across a page boundary");
+
+  // Word straddling program memory and the I/O page reaches the device
+  std::vector<uint8_t> output_buffer;
+  mem.set_output_callback(
+      [&output_buffer](uint8_t value) { output_buffer.push_back(value); });
+  mem.write_word(0xEFFF, 0x4100);
+  test_assert(mem.read_byte(0xEFFF) == 0x00 && output_buffer.size() == 1 &&
+                  output_buffer[0] == 'A',
+              "Pages: High byte of straddling word goes to the device");
+
+  // Words at the top of memory wrap to address 0
+  mem.write_word(0xFFFF, 0x1122);
+  test_assert(mem.read_byte(0xFFFF) == 0x22 && mem.read_byte(0x0000) == 0x11,
+              "Pages: Word at 0xFFFF wraps to 0x0000");
+}
+
+void test_trace_callback() {
+  Memory mem;
+  mem.write_word(0x2000, 0x1234);
+
+  std::vector<uint16_t> addresses;
+  mem.set_trace_callback([&addresses](uint16_t address, uint8_t, uint8_t) {
+    addresses.push_back(address);
+  });
+  mem.write_word(0x2000, 0x5678);
+  test_assert(addresses.size() == 2 && addresses[0] == 0x2000 &&
+                  addresses[1] == 0x2001,
+              "Trace: Word write reports both bytes");
+  test_assert(mem.read_word(0x2000) == 0x5678, "Trace: Traced write stored");
+
+  mem.set_trace_callback(nullptr);
+  mem.write_word(0x2000, 0x9ABC);
+  test_assert(addresses.size() == 2 && mem.read_word(0x2000) == 0x9ABC,
+              "Trace: Clearing the callback restores untraced writes");
+}
+
+void test_copy_on_write() {
+  Memory fresh;
+  test_assert(fresh.private_page_count() == 0 && fresh.read_word(0x4000) == 0,
+              "CoW: New memory maps only the shared zero page");
+
+  Memory parent;
+  parent.load_program({0x01, 0x02, 0x03}, 0x8000);
+  parent.write_word(0x1000, 0x1234);
+  test_assert(parent.private_page_count() == 2,
+              "CoW: Only written pages are allocated");
+
+  MemoryImage image = parent.capture();
+  Memory child;
+  child.map(image);
+  test_assert(child.read_word(0x1000) == 0x1234 &&
+                  child.read_byte(0x8001) == 0x02 &&
+                  child.private_page_count() == 0,
+              "CoW: Mapped image shares the pages");
+
+  child.write_word(0x1000, 0xBEEF);
+  parent.write_word(0x1002, 0x5678);
+  test_assert(child.read_word(0x1000) == 0xBEEF &&
+                  parent.read_word(0x1000) == 0x1234 &&
+                  child.read_word(0x1002) == 0 &&
+                  image.read_byte(0x1002) == 0 &&
+                  child.private_page_count() == 1 &&
+                  parent.private_page_count() == 1,
+              "CoW: First write copies the page on either side");
+
+  // Traced writes copy too
+  std::vector<uint8_t> old_values;
+  child.set_trace_callback(
+      [&old_values](uint16_t, uint8_t old, uint8_t) {
+        old_values.push_back(old);
+      });
+  child.write_byte(0x8000, 0x7F);
+  test_assert(old_values.size() == 1 && old_values[0] == 0x01 &&
+                  parent.read_byte(0x8000) == 0x01,
+              "CoW: Traced write reports the shared value");
+
+  std::vector<uint8_t> output;
+  parent.set_output_callback(
+      [&output](uint8_t value) { output.push_back(value); });
+  parent.write_byte(0xF011, 1);
+  parent.tick(5);
+  Memory forked;
+  forked.fork_from(parent);
+  forked.write_byte(0xF000, 'x');
+  test_assert(forked.read_word(0xF010) == 5 && output.size() == 1 &&
+                  forked.read_word(0x1002) == 0x5678,
+              "CoW: fork_from copies timer state and callbacks");
+}
+
 int main() {
   std::cout << "=== Memory Unit Tests ===" << std::endl << std::endl;
 
@@ -136,8 +263,12 @@ int main() {
   test_program_loading();
   // test_io_addresses(); // Removed
   test_timer_functionality();
+  test_perf_counter_registers();
   test_output_callback();
   test_memory_boundaries();
+  test_page_dispatch();
+  test_trace_callback();
+  test_copy_on_write();
 
   std::cout << std::endl << "=== All Memory Tests Passed! ===" << std::endl;
   return 0;